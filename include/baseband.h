@@ -25,6 +25,12 @@
 /// @param len: number of samples to process
 void envelope_detect(const uint8_t *iq_buf, uint16_t *y_buf, uint32_t len);
 
+/// Envelope estimation (absolute squared) of 16 bit samples, scaled like envelope_detect()
+/// @param *iq_buf: input samples (I/Q samples in interleaved int16)
+/// @param *y_buf: output
+/// @param len: number of samples to process
+void envelope_detect_cs16(const int16_t *iq_buf, uint16_t *y_buf, uint32_t len);
+
 #define FILTER_ORDER 1
 
 /// Filter state buffer
@@ -57,6 +63,15 @@ void baseband_low_pass_filter(const uint16_t *x_buf, int16_t *y_buf, uint32_t le
 /// @param DemodFM_State: State to store between chunk processing
 void baseband_demod_FM(const uint8_t *x_buf, int16_t *y_buf, unsigned num_samples, DemodFM_State *state);
 
+/// FM demodulator for 16 bit samples
+///
+/// Function is stateful, do not mix with baseband_demod_FM() on the same state
+/// @param *x_buf: input samples (I/Q samples in interleaved int16)
+/// @param *y_buf: output from FM demodulator
+/// @param len: number of samples to process
+/// @param DemodFM_State: State to store between chunk processing
+void baseband_demod_FM_cs16(const int16_t *x_buf, int16_t *y_buf, unsigned num_samples, DemodFM_State *state);
+
 /// Initialize tables and constants
 /// Should be called once at startup
 void baseband_init(void);
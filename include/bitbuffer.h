@@ -32,6 +32,7 @@ typedef struct {
 
 
 /// Clear the content of the bitbuffer
+/// The bitbuffer needs to be zeroed initially, only the used rows are cleared
 void bitbuffer_clear(bitbuffer_t *bits);
 
 /// Add a single bit at the end of the bitbuffer (MSB first)
@@ -82,6 +83,25 @@ unsigned bitbuffer_differential_manchester_decode(bitbuffer_t *inbuf, unsigned r
 int compare_rows(bitbuffer_t *bits, unsigned row_a, unsigned row_b);
 unsigned count_repeats(bitbuffer_t *bits, unsigned row);
 
+/// Groups of identical rows in a bitbuffer, see bitbuffer_index_rows()
+typedef struct {
+	uint16_t	num_groups;	// Number of distinct rows
+	uint8_t	most_repeated;	// Group with the most rows, the first one on a tie
+	uint8_t	group_of_row[BITBUF_ROWS];	// Group index of each row
+	uint8_t	first_row[BITBUF_ROWS];	// First row of each group, groups are in row order
+	uint8_t	repeats[BITBUF_ROWS];	// Number of rows in each group
+} bitbuffer_row_index_t;
+
+/// Group identical rows (same length and bytes) using a fingerprint of each row.
+/// Takes O(rows), the index is only valid until the bitbuffer is changed.
+void bitbuffer_index_rows(const bitbuffer_t *bits, bitbuffer_row_index_t *index);
+
+/// Find the first row with min_bits to max_bits bits that is repeated
+/// min_repeats to max_repeats times, a max of 0 means no limit.
+/// Return the row index or -1.
+int bitbuffer_index_find_row(const bitbuffer_t *bits, const bitbuffer_row_index_t *index,
+			     unsigned min_repeats, unsigned max_repeats, unsigned min_bits, unsigned max_bits);
+
 /// Find a repeated row that has a minimum count of bits.
 /// Return the row index or -1.
 int bitbuffer_find_repeated_row(bitbuffer_t *bits, unsigned min_repeats, unsigned min_bits);
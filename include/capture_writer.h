@@ -0,0 +1,54 @@
+/**
+ * Threaded sample capture writer
+ *
+ * The reader fills large aligned buffers from a fixed pool while a
+ * writer thread drains full buffers to the output file. A slow storage
+ * device then only costs buffer occupancy instead of stalling the reader.
+ * When the pool is exhausted the reader keeps going and the samples of
+ * that read are counted as dropped.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_CAPTURE_WRITER_H_
+#define INCLUDE_CAPTURE_WRITER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define CAPTURE_WRITE_SIZE      (1024 * 1024)   // Preferred size of a single write
+#define CAPTURE_BUFFER_ALIGN    4096            // Buffer and write alignment for direct I/O
+#define DEFAULT_CAPTURE_BUFFERS 8
+
+typedef struct capture_writer capture_writer_t;
+
+/// Create a capture writer and start the writer thread
+///
+/// @param fd: output file descriptor
+/// @param block_size: size of a single read in bytes
+/// @param num_buffers: number of write buffers in the pool
+/// @param direct: try to bypass the page cache (O_DIRECT), needs block_size aligned to CAPTURE_BUFFER_ALIGN
+/// @return the writer or NULL on error
+capture_writer_t *capture_writer_create(int fd, size_t block_size, unsigned num_buffers, int direct);
+
+/// Space for the next read of block_size bytes
+///
+/// Never blocks, returns a scratch buffer if the pool is exhausted.
+uint8_t *capture_writer_buffer(capture_writer_t *writer);
+
+/// Commit len bytes read into the buffer returned by capture_writer_buffer()
+void capture_writer_commit(capture_writer_t *writer, size_t len);
+
+/// Return 1 if the writer thread failed to write
+int capture_writer_failed(capture_writer_t *writer);
+
+/// Flush all pending buffers, stop the writer thread and release the writer
+///
+/// @return 0 on success, -1 if any write failed
+int capture_writer_close(capture_writer_t *writer, FILE *stats_file);
+
+#endif /* INCLUDE_CAPTURE_WRITER_H_ */
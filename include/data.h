@@ -22,6 +22,9 @@
 #define INCLUDE_DATA_H_
 
 #include <stdio.h>
+#include <stdint.h>
+
+#include "mqtt_client.h"
 
 #if defined(_MSC_VER) && !defined(__clang__)
   /*
@@ -150,8 +153,171 @@ struct data_output *data_output_json_create(FILE *file);
 
 struct data_output *data_output_kv_create(FILE *file);
 
+/** Construct data output for CBOR (RFC 8949), for consumers that would parse JSON again
+
+    The output is a CBOR sequence (RFC 8742) of arrays, each item is self-delimiting:
+    - [0, id, [key, ...]] defines the key list id, written before its first use
+      (up to 256 ids, after that the ids are defined again from 0)
+    - [1, id, value, ...] is a record with the values for the keys of id
+    Values are integers, floats (the shortest exact size), text, arrays and, for
+    nested objects, maps. The first item carries the self-describe tag 55799.
+    Read it back with data_cbor_read().
+*/
+struct data_output *data_output_cbor_create(FILE *file);
+
+typedef struct data_cbor_reader data_cbor_reader_t;
+
+data_cbor_reader_t *data_cbor_reader_create(void);
+
+/** Decode the next item of a data_output_cbor_create() stream
+
+    @param buf the stream, starting at an item
+    @param data set to the record decoded (to be freed by the caller), NULL for key list
+                definitions; fields have no pretty keys and no formats
+
+    @return the bytes used, 0 if buf ends inside the item, -1 if the item is malformed
+*/
+int data_cbor_read(data_cbor_reader_t *reader, const uint8_t *buf, size_t len, data_t **data);
+
+void data_cbor_reader_free(data_cbor_reader_t *reader);
+
 struct data_output *data_output_syslog_create(const char *host, const char *port);
 
+/** Batch the messages of a syslog output
+
+    Messages are queued and sent together (with sendmmsg where available) when the
+    oldest has waited latency_ms or the batch is full. Other outputs are not changed.
+
+    @param output the syslog output
+    @param latency_ms the most a message is held back, 0 to send each message right away
+
+    @return 0 on success, -1 if output is not a syslog output or batching failed to start
+*/
+int data_output_syslog_set_latency(struct data_output *output, unsigned latency_ms);
+
+/** Totals of a syslog output: messages sent and the send syscalls used for them
+
+    @return 0 on success, -1 if output is not a syslog output
+*/
+int data_output_syslog_counters(struct data_output *output, unsigned long *messages, unsigned long *sends);
+
+/** Construct data output publishing each record as JSON to an MQTT broker
+
+    @param opts the broker connection, see mqtt_client.h
+    @param topic the topic template: "[key]" is replaced by the value of field key and
+                 "[/key]" by a slash and the value, both are left out if the record has
+                 no such field, e.g. "rtl_433[/model][/id]"
+
+    @return The output or NULL on error.
+*/
+struct data_output *data_output_mqtt_create(mqtt_client_opts_t const *opts, const char *topic);
+
+/** Totals of an MQTT output, see mqtt_client_counters_t
+
+    @return 0 on success, -1 if output is not an MQTT output
+*/
+int data_output_mqtt_counters(struct data_output *output, mqtt_client_counters_t *counters);
+
+#define INFLUX_DEFAULT_FLUSH_SIZE     8192    // bytes per HTTP POST
+#define INFLUX_DEFAULT_UDP_FLUSH_SIZE 1400    // bytes per datagram, fits an Ethernet frame
+#define INFLUX_DEFAULT_FLUSH_MS       1000
+
+typedef struct {
+    char const *host;
+    char const *port;
+    char const *path;           // HTTP request target, e.g. "/write?db=rtl_433", NULL to send UDP datagrams
+    char const *token;          // HTTP "Authorization: Token", NULL for none
+    char const *measurement;    // NULL for "rtl_433"
+    size_t flush_size;          // send when this many bytes are queued (the most per datagram), 0 for the default
+    unsigned flush_ms;          // the longest a line is held back, 0 to send as soon as possible
+} influx_opts_t;
+
+/** Construct data output writing InfluxDB line protocol
+
+    Each record is one point: model and id are tags, numbers and strings
+    are fields (nested objects with the parent key as prefix), the timestamp
+    is in ns. Lines are queued and sent by a flush thread, many per UDP
+    datagram or HTTP POST.
+
+    @return The output or NULL on error.
+*/
+struct data_output *data_output_influx_create(influx_opts_t const *opts);
+
+/** Timestamp of the next record printed to an InfluxDB output, e.g. its capture time
+
+    @param time_ns ns since the epoch, 0 for the time it is printed
+
+    @return 0 on success, -1 if output is not an InfluxDB output
+*/
+int data_output_influx_set_time(struct data_output *output, uint64_t time_ns);
+
+/** Totals of an InfluxDB output: lines written, sends (datagrams or POSTs) and lines dropped
+
+    @return 0 on success, -1 if output is not an InfluxDB output
+*/
+int data_output_influx_counters(struct data_output *output, unsigned long *lines, unsigned long *sends, unsigned long *dropped);
+
+/** Construct data output writing each record as JSON to a shared memory ring
+
+    Local readers map the ring and read the records without syscalls,
+    see shm_ring.h for the reader functions and the layout.
+
+    @param name the shared memory name, e.g. "/rtl_433" for /dev/shm/rtl_433
+    @param size bytes of records kept, rounded up to a power of two
+
+    @return The output or NULL on error.
+*/
+struct data_output *data_output_shm_create(const char *name, size_t size);
+
+/** Totals of a shared memory output: records written and records too large for the ring
+
+    @return 0 on success, -1 if output is not a shared memory output
+*/
+int data_output_shm_counters(struct data_output *output, unsigned long *records, unsigned long *dropped);
+
+/** Construct data output keeping the most recent record of each model and id
+
+    Records without a model (e.g. stats) are not kept. When max_records
+    are kept the one updated longest ago is replaced.
+*/
+struct data_output *data_output_latest_create(unsigned max_records);
+
+/** The records kept by a latest records output as one JSON array
+
+    @param doc set to the document, valid until the next call or the output is freed
+    @param len set to the length of doc
+
+    @return 1 if the records changed since the previous call, 0 if not, -1 if output is not a latest records output
+*/
+int data_output_latest_render(struct data_output *output, char const **doc, size_t *len);
+
+/** Construct data output appending the numbers of each record to a columnar store
+
+    Each record with a model is a row of the series model[/channel][/id],
+    its integer, double and numeric string fields are the columns; other
+    strings and nested objects are not stored. See tsdb.h for the layout
+    and the query function, and rtl_433_tsdb to query from the shell.
+
+    @param dir the store directory, one segment file per UTC day
+
+    @return The output or NULL on error.
+*/
+struct data_output *data_output_tsdb_create(const char *dir);
+
+/** Timestamp of the next record printed to a time series output, e.g. its capture time
+
+    @param time_ns ns since the epoch, 0 for the time it is printed
+
+    @return 0 on success, -1 if output is not a time series output
+*/
+int data_output_tsdb_set_time(struct data_output *output, uint64_t time_ns);
+
+/** Totals of a time series output: rows written and rows dropped
+
+    @return 0 on success, -1 if output is not a time series output
+*/
+int data_output_tsdb_counters(struct data_output *output, unsigned long *rows, unsigned long *dropped);
+
 /** Prints a structured data object */
 void data_output_print(struct data_output *output, data_t *data);
 
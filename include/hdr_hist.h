@@ -0,0 +1,49 @@
+/**
+ * HDR-style histogram
+ *
+ * Log-linear buckets (32 sub-buckets per power of two) giving about 3%
+ * relative precision from 0 to 2^48 with a fixed memory size, suitable for
+ * recording latencies in nanoseconds on the hot path. Larger values are
+ * counted in the top bucket (see HDR_HIST_MAX_BITS); min, max and the sum
+ * keep the exact values.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_HDR_HIST_H_
+#define INCLUDE_HDR_HIST_H_
+
+#include <stdint.h>
+
+#define HDR_HIST_SUB_BITS   5
+#define HDR_HIST_SUB_COUNT  (1 << HDR_HIST_SUB_BITS)
+#define HDR_HIST_MAX_BITS   48      // Values above 2^48 (about 78 hours in ns) are clamped
+#define HDR_HIST_BUCKETS    ((HDR_HIST_MAX_BITS - HDR_HIST_SUB_BITS + 1) * HDR_HIST_SUB_COUNT)
+
+typedef struct {
+    uint32_t counts[HDR_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+} hdr_hist_t;
+
+/// Clear all recorded values
+void hdr_hist_reset(hdr_hist_t *hist);
+
+/// Record a single value
+void hdr_hist_record(hdr_hist_t *hist, uint64_t value);
+
+/// Add all values recorded in src to dst
+void hdr_hist_merge(hdr_hist_t *dst, hdr_hist_t const *src);
+
+/// Value at the given percentile (0-100), 0 if empty
+uint64_t hdr_hist_percentile(hdr_hist_t const *hist, double percentile);
+
+/// Mean of all recorded values, 0 if empty
+double hdr_hist_mean(hdr_hist_t const *hist);
+
+#endif /* INCLUDE_HDR_HIST_H_ */
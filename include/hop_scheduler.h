@@ -0,0 +1,119 @@
+/**
+ * Frequency hop scheduler
+ *
+ * Decides when to hop based on the number of samples received instead of
+ * wall clock time, keeps track of the samples to discard after a retune and
+ * collects per-frequency statistics.
+ *
+ * The async reader keeps running while retuning, so the blocks it has queued
+ * by then hold samples of the old frequency. After a retune the scheduler
+ * drops as many blocks as the reader has buffers, then the tuner settle time.
+ * While hopping the reader uses short blocks (see hop_scheduler_block_size()),
+ * so all of its buffers together hold only a few ms of samples.
+ *
+ * The scheduler itself is not thread safe, the caller needs to serialize
+ * access between the sample callback and the retune controller.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_HOP_SCHEDULER_H_
+#define INCLUDE_HOP_SCHEDULER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define DEFAULT_HOP_SETTLE_MS   5   // Tuner PLL settle time after a retune
+#define HOP_BLOCK_MS            2   // Length of the reader's blocks while hopping
+
+/// Per-frequency dwell setting and statistics
+typedef struct {
+    uint32_t frequency;
+    uint64_t dwell_samples;     // Nominal dwell time in samples
+    uint64_t samples_received;  // Samples received while tuned to this frequency
+    uint64_t samples_discarded; // Samples dropped after retuning to this frequency
+    unsigned dwells;            // Number of times this frequency was visited
+    unsigned extensions;        // Number of times a dwell was extended by events
+    unsigned events;            // Decoded events on this frequency
+} hop_channel_t;
+
+typedef struct {
+    hop_channel_t *channels;
+    unsigned num_channels;
+    unsigned current;           // Index of the channel currently tuned
+    unsigned next;              // Index of the channel a pending retune goes to
+    unsigned hop_events;        // Events per dwell needed to extend it (0 = never extend)
+    unsigned stale_blocks;      // Blocks to discard after a retune, the reader's buffers
+    uint32_t settle_samples;    // Samples to discard after the stale blocks
+    uint64_t dwell_left;        // Samples left in the current dwell
+    unsigned dwell_events;      // Events seen in the current dwell
+    unsigned stale_left;        // Stale blocks still to discard
+    uint32_t settle_left;       // Settle samples still to discard
+    enum {
+        HOP_IDLE        = 0,    // Receiving on the current channel
+        HOP_PENDING     = 1,    // Retune requested, not yet started by the controller
+        HOP_RETUNING    = 2,    // Controller is retuning
+        HOP_RETUNED     = 3     // Retune done, the queued blocks are stale
+    } state;
+} hop_scheduler_t;
+
+/// Setup the scheduler for a list of frequencies
+///
+/// @param frequencies: list of frequencies to hop through
+/// @param dwell_secs: list of dwell times in seconds, the last one repeats for remaining frequencies
+/// @param num_dwell_secs: number of dwell times given
+/// @param num_frequencies: number of frequencies
+/// @param samp_rate: sample rate in samples per second
+/// @param stale_blocks: blocks the reader may have queued when a retune completes, i.e. its number of buffers
+/// @param settle_ms: tuner settle time in milliseconds
+/// @param hop_events: events per dwell needed to extend the dwell (0 = never extend)
+void hop_scheduler_init(hop_scheduler_t *hop, uint32_t const *frequencies, int const *dwell_secs,
+        unsigned num_dwell_secs, unsigned num_frequencies, uint32_t samp_rate, unsigned stale_blocks,
+        unsigned settle_ms, unsigned hop_events);
+
+/// Block size for the async reader while hopping
+///
+/// HOP_BLOCK_MS of 8 bit I/Q samples, rounded up to a multiple of 512 bytes.
+/// The stale blocks discarded after a retune are at most this long each.
+///
+/// @param samp_rate: sample rate in samples per second
+/// @return the block size in bytes
+unsigned hop_scheduler_block_size(uint32_t samp_rate);
+
+/// Release the scheduler
+void hop_scheduler_free(hop_scheduler_t *hop);
+
+/// Frequency currently tuned (or the first one before hopping started)
+uint32_t hop_scheduler_frequency(hop_scheduler_t const *hop);
+
+/// Account for a new block of samples before processing
+///
+/// @param num_samples: number of samples in the block
+/// @return number of leading samples to discard from this block
+unsigned hop_scheduler_settle(hop_scheduler_t *hop, unsigned num_samples);
+
+/// Account for events after processing a block
+///
+/// @param num_samples: number of samples processed (after discarding)
+/// @param events: number of events decoded in the block
+/// @return 1 if a retune should be requested now, 0 otherwise
+int hop_scheduler_update(hop_scheduler_t *hop, unsigned num_samples, unsigned events);
+
+/// Return 1 if a retune is pending for the controller
+int hop_scheduler_pending(hop_scheduler_t const *hop);
+
+/// Start the pending retune
+///
+/// @return the frequency to tune to
+uint32_t hop_scheduler_retune(hop_scheduler_t *hop);
+
+/// Finish the retune started with hop_scheduler_retune()
+void hop_scheduler_retuned(hop_scheduler_t *hop);
+
+/// Print per-frequency statistics
+void hop_scheduler_print_stats(hop_scheduler_t const *hop, FILE *file);
+
+#endif /* INCLUDE_HOP_SCHEDULER_H_ */
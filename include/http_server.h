@@ -0,0 +1,46 @@
+/**
+ * Minimal HTTP/1.1 server for published documents
+ *
+ * A single thread runs a poll() event loop over all connections and serves
+ * GET and HEAD requests for a few paths. The documents are rendered by the
+ * caller and published as immutable snapshots: publishing hands a copy
+ * over through an atomic pointer exchange and the server thread takes it
+ * when it next answers a request. Neither side ever waits for the other,
+ * so serving requests never slows down the thread that publishes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_HTTP_SERVER_H_
+#define INCLUDE_HTTP_SERVER_H_
+
+#include <stddef.h>
+
+#define HTTP_MAX_PATHS          8
+#define HTTP_MAX_CONNECTIONS    64
+
+typedef struct http_server http_server_t;
+
+/// Listen on host and port and start the server thread
+///
+/// @param host: address to bind, e.g. "127.0.0.1", "::" or NULL for all
+/// @return the server or NULL on error
+http_server_t *http_server_start(char const *host, char const *port);
+
+/// Replace the document served for path, body is copied
+///
+/// Publish from one thread at a time. Paths are added on first use, at most HTTP_MAX_PATHS.
+///
+/// @return 0 on success, -1 on allocation failure or too many paths
+int http_server_publish(http_server_t *server, char const *path, char const *content_type, void const *body, size_t len);
+
+/// Requests answered so far
+unsigned long http_server_requests(http_server_t *server);
+
+/// Close all connections, stop the thread and free
+void http_server_free(http_server_t *server);
+
+#endif /* INCLUDE_HTTP_SERVER_H_ */
@@ -0,0 +1,115 @@
+/**
+ * Compressed I/Q sample file format (.iqz)
+ *
+ * Lossless block based container for 8 bit unsigned I/Q samples (cu8).
+ * Each block is coded on its own with the cheapest of: raw copy, Rice
+ * coded offset from 128, or Rice coded delta to the previous sample of
+ * the same channel. Blocks carry the tuned frequency, the file header
+ * carries the capture metadata and a block index at the end of the file
+ * allows seeking. Truncated files (e.g. after a power loss) stay readable
+ * up to the last complete block.
+ *
+ * File layout (all values little-endian):
+ *
+ *     header:  "IQZ1" u16 version, u16 header_len, u32 frequency, u32 sample_rate,
+ *              i32 gain (tenths of dB, 0 = auto), u32 block_size, u64 timestamp (us since epoch)
+ *     block:   "IQZB" u32 raw_len, u32 comp_len, u32 frequency, u8 method, u8[3] reserved, data
+ *     index:   u64 file offset of each block
+ *     trailer: u64 index offset, u32 number of blocks, "IQZI"
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_IQZ_H_
+#define INCLUDE_IQZ_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define IQZ_BLOCK_SIZE          (256 * 1024)    // Raw bytes per block
+#define IQZ_DEFAULT_THREADS     2               // Decoder threads when reading
+
+typedef struct {
+    uint32_t frequency;     // Center frequency in Hz when the capture started
+    uint32_t sample_rate;   // Sample rate in Hz
+    int32_t gain;           // Tuner gain in tenths of dB, 0 for auto
+    uint64_t timestamp;     // Capture start in microseconds since the epoch
+} iqz_meta_t;
+
+typedef struct iqz_writer iqz_writer_t;
+typedef struct iqz_reader iqz_reader_t;
+
+/// Return 1 if the file name has the .iqz extension
+int iqz_filename(char const *filename);
+
+/// Start writing a compressed file
+///
+/// @param file: output file, positioned at the start, stays open after iqz_writer_close()
+/// @param meta: capture metadata for the file header
+/// @return the writer or NULL on error
+iqz_writer_t *iqz_writer_open(FILE *file, iqz_meta_t const *meta);
+
+/// Set the frequency recorded for the following blocks
+void iqz_writer_set_frequency(iqz_writer_t *writer, uint32_t frequency);
+
+/// Append samples, full blocks are compressed and written
+///
+/// @return 0 on success, -1 on write error
+int iqz_write(iqz_writer_t *writer, uint8_t const *buf, size_t len);
+
+/// Write the last partial block and the index, release the writer
+///
+/// @param stats_file: print compression statistics to this file if not NULL
+/// @return 0 on success, -1 on write error
+int iqz_writer_close(iqz_writer_t *writer, FILE *stats_file);
+
+/// Start reading a compressed file
+///
+/// @param file: input file, positioned at the start
+/// @param num_threads: number of decoder threads, 0 to decode on the calling thread
+/// @return the reader or NULL if the file is not a valid iqz file
+iqz_reader_t *iqz_reader_open(FILE *file, unsigned num_threads);
+
+/// Capture metadata from the file header
+iqz_meta_t const *iqz_reader_meta(iqz_reader_t const *reader);
+
+/// Frequency recorded for the block last read from
+uint32_t iqz_reader_frequency(iqz_reader_t const *reader);
+
+/// Read decompressed samples
+///
+/// @return number of bytes read, less than len at the end of file or on error
+size_t iqz_read(iqz_reader_t *reader, uint8_t *buf, size_t len);
+
+/// Seek to a sample offset (one sample is an I/Q pair), needs a seekable file
+///
+/// @return 0 on success, -1 on error
+int iqz_seek(iqz_reader_t *reader, uint64_t sample);
+
+/// Return 1 if a corrupt block was found
+int iqz_reader_error(iqz_reader_t const *reader);
+
+/// Stop the decoder threads and release the reader, the file stays open
+void iqz_reader_close(iqz_reader_t *reader);
+
+/// Compress one block, exposed for benchmarks
+///
+/// @param dst: output buffer of at least len bytes
+/// @param method: method used, see IQZ_METHOD_*
+/// @return number of bytes written to dst
+size_t iqz_encode_block(uint8_t const *src, size_t len, uint8_t *dst, uint8_t *method);
+
+/// Decompress one block, exposed for benchmarks
+///
+/// @return 0 on success, -1 on corrupt data
+int iqz_decode_block(uint8_t const *src, size_t comp_len, uint8_t method, uint8_t *dst, size_t raw_len);
+
+#define IQZ_METHOD_RAW      0
+#define IQZ_METHOD_OFFSET   1   // Rice coded sample - 128
+#define IQZ_METHOD_DELTA    2   // Rice coded sample - previous sample of the same channel
+
+#endif /* INCLUDE_IQZ_H_ */
@@ -0,0 +1,64 @@
+/**
+ * Minimal MQTT 3.1.1 publisher
+ *
+ * Publishes from any thread without blocking: messages are queued in memory
+ * and written by an I/O thread that owns the broker connection. The thread
+ * connects (and reconnects with a backoff), keeps the connection alive with
+ * PINGREQ and writes all queued messages together. QoS 1 messages stay
+ * queued until the broker acknowledges them and are sent again (DUP) after
+ * a reconnect. While disconnected the queue holds at most a backlog of
+ * messages, the oldest are dropped first.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_MQTT_CLIENT_H_
+#define INCLUDE_MQTT_CLIENT_H_
+
+#include <stddef.h>
+
+#define MQTT_DEFAULT_PORT       "1883"
+#define MQTT_DEFAULT_KEEP_ALIVE 60      // seconds
+#define MQTT_DEFAULT_BACKLOG    1000    // messages
+
+typedef struct {
+    char const *host;
+    char const *port;
+    char const *client_id;  // NULL for "rtl_433-<pid>"
+    char const *user;       // NULL for none
+    char const *pass;       // NULL for none
+    unsigned keep_alive;    // seconds, 0 to disable pings
+    int qos;                // 0 or 1
+    int retain;
+    unsigned backlog;       // most messages held, at least 1
+} mqtt_client_opts_t;
+
+typedef struct {
+    unsigned long published;    // written (QoS 0) or acknowledged (QoS 1)
+    unsigned long dropped;      // lost to the backlog limit
+    unsigned long writes;       // write syscalls for publish packets
+    unsigned long connects;
+    unsigned queued;            // waiting to be written or acknowledged
+} mqtt_client_counters_t;
+
+typedef struct mqtt_client mqtt_client_t;
+
+/// Start the I/O thread, the connection is made in the background
+///
+/// @return the client or NULL on error
+mqtt_client_t *mqtt_client_create(mqtt_client_opts_t const *opts);
+
+/// Queue a message for publishing, topic and payload are copied
+///
+/// @return 0 on success, -1 on allocation failure
+int mqtt_client_publish(mqtt_client_t *client, char const *topic, void const *payload, size_t payload_len);
+
+void mqtt_client_counters(mqtt_client_t *client, mqtt_client_counters_t *counters);
+
+/// Send what is queued (trying to connect once more if needed, waiting up to a second for acknowledgements), disconnect and free
+void mqtt_client_free(mqtt_client_t *client);
+
+#endif /* INCLUDE_MQTT_CLIENT_H_ */
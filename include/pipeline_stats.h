@@ -0,0 +1,89 @@
+/**
+ * Pipeline statistics
+ *
+ * Latency histograms for each stage of the sample pipeline and for each
+ * output sink, plus throughput counters. A report covers the interval since
+ * the previous one and starts a new interval. All recording happens on the
+ * sample thread, there is no locking. The same values can be written in
+ * Prometheus text format for scraping.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_PIPELINE_STATS_H_
+#define INCLUDE_PIPELINE_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "hdr_hist.h"
+#include "data.h"
+
+#define PIPELINE_MAX_OUTPUTS 32
+
+typedef enum {
+    STAGE_BASEBAND      = 0,    // Envelope detection and low pass filter, per block
+    STAGE_FM            = 1,    // FM demodulation, per block
+    STAGE_PULSE_DETECT  = 2,    // Single pulse_detect_package() call
+    STAGE_DEMOD         = 3,    // Demodulator dispatch for one package, including callbacks
+    STAGE_CALLBACK      = 4,    // Single decoder callback, including output
+    PIPELINE_STAGES
+} pipeline_stage_t;
+
+/// Running totals, owned by the receiver
+typedef struct {
+    uint64_t blocks;
+    uint64_t samples;
+    uint64_t dropped_samples;   // Discarded while the tuner settles after a hop
+    unsigned ook_packages;
+    unsigned fsk_packages;
+} pipeline_counters_t;
+
+/// Current levels sampled at report time
+typedef struct {
+    int noise_level;            // OOK low level estimate of the pulse detector
+    unsigned grabber_queue;     // Signal snippets waiting to be saved
+} pipeline_levels_t;
+
+typedef struct {
+    unsigned interval;          // Report interval in seconds
+    uint64_t interval_start;    // Monotonic time in ns
+    pipeline_counters_t last;   // Totals at interval start
+    hdr_hist_t stage[PIPELINE_STAGES];
+    hdr_hist_t latency;         // Capture of a package to output of each record
+    hdr_hist_t output[PIPELINE_MAX_OUTPUTS];
+    unsigned num_outputs;
+    uint64_t past_count[PIPELINE_STAGES + 1];   // Totals of the intervals reported, the last is the latency
+    double past_sum[PIPELINE_STAGES + 1];
+} pipeline_stats_t;
+
+/// Create the statistics, the first interval starts now
+///
+/// @param interval: report interval in seconds
+/// @param num_outputs: number of output sinks to time, at most PIPELINE_MAX_OUTPUTS
+/// @return the statistics or NULL on error
+pipeline_stats_t *pipeline_stats_create(unsigned interval, unsigned num_outputs);
+
+/// Return 1 if the report interval has elapsed at monotonic time now
+int pipeline_stats_due(pipeline_stats_t const *stats, uint64_t now);
+
+/// Build a stats record for the interval ending at monotonic time now and start a new interval
+data_t *pipeline_stats_report(pipeline_stats_t *stats, uint64_t now, pipeline_counters_t const *counters, pipeline_levels_t const *levels);
+
+/// Start a new interval at monotonic time now without a report, e.g. when only metrics are scraped
+///
+/// The latency counts and sums of the interval ending are added to the totals.
+void pipeline_stats_rotate(pipeline_stats_t *stats, uint64_t now, pipeline_counters_t const *counters);
+
+/// Write the counters, levels and latencies in Prometheus text format
+///
+/// Counters and the latency counts and sums are totals since the start,
+/// the latency quantiles cover the current interval. Intervals are started
+/// by each report, or by pipeline_stats_rotate() when no reports are made.
+void pipeline_stats_write_prometheus(pipeline_stats_t const *stats, FILE *out, pipeline_counters_t const *counters, pipeline_levels_t const *levels);
+
+void pipeline_stats_free(pipeline_stats_t *stats);
+
+#endif /* INCLUDE_PIPELINE_STATS_H_ */
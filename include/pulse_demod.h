@@ -16,6 +16,12 @@
 #include <stdint.h>
 #include "pulse_detect.h"
 #include "rtl_433.h"
+#include "hdr_hist.h"
+
+/// Record the duration of each decoder callback in ns, NULL to stop
+///
+/// Only for the sample thread, the histogram is not locked.
+void pulse_demod_time_callbacks(hdr_hist_t *hist);
 
 
 /// Demodulate a Pulse Code Modulation signal
@@ -30,6 +30,10 @@ typedef struct {
 	int ook_high_estimate;		// Estimate for the OOK high level at end of package
 	int fsk_f1_est;				// Estimate for the F1 frequency for FSK
 	int fsk_f2_est;				// Estimate for the F2 frequency for FSK
+	uint64_t offset;			// Offset to first pulse in number of samples from start of stream
+	uint64_t end_offset;		// Offset to end of package in number of samples from start of stream
+	uint64_t capture_ns;		// Monotonic time of the first pulse in ns, set by the receiver
+	double capture_time;		// Wall clock time of the first pulse (or file position) in seconds, set by the receiver
 } pulse_data_t;
 
 
@@ -54,6 +58,9 @@ void pulse_data_print(const pulse_data_t *data);
 /// @return 2 if FSK package is detected (but all sample data is still not completely processed)
 int pulse_detect_package(const int16_t *envelope_data, const int16_t *fm_data, int len, int16_t level_limit, uint32_t samp_rate, pulse_data_t *pulses, pulse_data_t *fsk_pulses);
 
+/// Current estimate of the OOK low level (base noise level) in the envelope data
+int pulse_detect_noise_level(void);
+
 
 /// Analyze and print result
 void pulse_analyzer(pulse_data_t *data, uint32_t samp_rate);
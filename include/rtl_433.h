@@ -31,7 +31,14 @@
 #define DEFAULT_FREQUENCY       433920000
 #define DEFAULT_HOP_TIME        (60*10)
 #define DEFAULT_HOP_EVENTS      2
+#define DEFAULT_STATS_INTERVAL  60
+#define DEFAULT_SYSLOG_LATENCY_MS   10
+#define DEFAULT_DEDUP_MS        2000    // repeats of a transmission come within a few seconds
+#define DEFAULT_HTTP_PORT       "9433"
+#define HTTP_PUBLISH_MS         500     // how often the HTTP documents are rendered
+#define HTTP_LATEST_MAX         1024    // most model and id pairs in /latest
 #define DEFAULT_ASYNC_BUF_NUMBER    0 // Force use of default value (was : 32)
+#define HOP_ASYNC_BUF_NUMBER        4 // Fewer buffers when hopping, all of them (short blocks, see hop_scheduler.h) are discarded after a retune
 #define DEFAULT_BUF_LENGTH      (16 * 16384)
 
 /*
@@ -65,11 +72,21 @@
 extern int debug_output;
 extern float sample_file_pos;
 
+/// Per decoder counters, collected with -M profile
+struct protocol_stats {
+    unsigned demod_calls;   // packages demodulated
+    unsigned callbacks;     // bitbuffers passed to the decoder
+    unsigned events;        // callbacks that decoded something
+    unsigned rows;          // rows in the bitbuffers passed to the decoder
+    uint64_t demod_ns;      // time in the demodulator, including the decoder
+    uint64_t callback_ns;   // time in the decoder callback
+};
+
+/// Decoder parameters as used by the demodulators, kept small as the
+/// dispatch loop walks an array of these for every package
 struct protocol_state {
     int (*callback)(bitbuffer_t *bitbuffer);
-
-   // Bits state (for old sample based decoders)
-    bitbuffer_t bits;
+    struct protocol_stats *stats;   // NULL unless profiling
 
     unsigned int modulation;
 
@@ -0,0 +1,55 @@
+/**
+ * I/Q sample formats
+ *
+ * Input file formats and conversion to the internal sample formats:
+ * cu8 (uint8, used throughout the receiver) and cs16 (int16, for the
+ * native 16 bit baseband path). The conversion loops are kept free of
+ * branches and aliasing so the compiler can vectorize them.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_SAMPLE_FORMAT_H_
+#define INCLUDE_SAMPLE_FORMAT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    SAMPLE_CU8  = 0,    // Unsigned 8 bit, 128 is zero (RTL-SDR native)
+    SAMPLE_CS8  = 1,    // Signed 8 bit (e.g. HackRF)
+    SAMPLE_CS16 = 2,    // Signed 16 bit, native endianness
+    SAMPLE_CF32 = 3,    // 32 bit float, full scale is 1.0 (e.g. GNU Radio)
+} sample_format_t;
+
+/// Guess the sample format from the file name extension, defaults to cu8
+///
+/// Recognizes .cu8, .cs8, .cs16 and .cf32 (also .cfile and .complex16s/.complex16u as used by other tools)
+sample_format_t sample_format_from_filename(char const *filename);
+
+/// Short name of the format, e.g. "cs16"
+char const *sample_format_name(sample_format_t format);
+
+/// Size of a single I or Q value in bytes
+size_t sample_format_size(sample_format_t format);
+
+/// Convert interleaved I/Q values to cu8
+///
+/// @param format: format of the input
+/// @param in: input values
+/// @param out: output values
+/// @param num_values: number of values, twice the number of samples
+void sample_convert_cu8(sample_format_t format, void const *in, uint8_t *out, size_t num_values);
+
+/// Convert interleaved I/Q values to cs16
+///
+/// @param format: format of the input
+/// @param in: input values
+/// @param out: output values
+/// @param num_values: number of values, twice the number of samples
+void sample_convert_cs16(sample_format_t format, void const *in, int16_t *out, size_t num_values);
+
+#endif /* INCLUDE_SAMPLE_FORMAT_H_ */
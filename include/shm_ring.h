@@ -0,0 +1,113 @@
+/**
+ * Shared memory record ring, one writer and any number of local readers
+ *
+ * The writer appends records (e.g. one JSON object each) to a POSIX shared
+ * memory segment (/dev/shm on Linux) and never waits for readers. Each
+ * reader keeps its own position, so readers do not affect each other or
+ * the writer. Neither side makes a syscall to pass a record: the writer
+ * copies the record in and publishes the new head, a reader copies it out
+ * and checks afterwards that the writer has not reused the space meanwhile
+ * (like a seqlock). A reader that falls more than the ring size behind
+ * loses the oldest records and is told how many by the sequence numbers.
+ *
+ * The layout is fixed (see shm_ring_header_t and shm_ring_slot_t) so
+ * readers can be written in other languages too.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_SHM_RING_H_
+#define INCLUDE_SHM_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHM_RING_MAGIC          0x676e69723333346cULL  // "l433ring" in little endian
+#define SHM_RING_VERSION        1
+#define SHM_RING_DEFAULT_NAME   "/rtl_433"
+#define SHM_RING_DEFAULT_SIZE   (1024 * 1024)   // bytes of records kept
+#define SHM_RING_PAD            0xffffffffU     // slot len of the filler at the end of the ring
+
+/// Start of the segment, the ring data follows at data_offset
+///
+/// Positions are byte counts since the ring was created, the offset into
+/// the data is the position modulo data_size. Slots from tail to head are
+/// valid; the writer moves tail past the slots it is about to overwrite
+/// before it writes, and moves head past a new slot after it is written.
+typedef struct {
+    uint64_t magic;         // SHM_RING_MAGIC, set last when the segment is ready
+    uint32_t version;       // SHM_RING_VERSION
+    uint32_t data_offset;   // bytes from the start of the segment to the ring data
+    uint64_t data_size;     // bytes of ring data, a power of two
+    uint32_t closed;        // set when the writer is done, no more records follow
+    uint32_t writer_pid;
+    uint64_t reserved[4];   // the above fills one cache line
+    uint64_t head;          // position after the newest slot
+    uint64_t seq;           // seq of the next record, set before head
+    uint64_t reserved_head[6];
+    uint64_t tail;          // position of the oldest slot
+    uint64_t reserved_tail[7];
+} shm_ring_header_t;
+
+/// A record in the ring data, followed by len bytes and padded to a multiple of 16 bytes
+///
+/// A slot never wraps around the end of the data. If a record does not
+/// fit before the end, a filler slot (len SHM_RING_PAD) takes the rest.
+typedef struct {
+    uint32_t size;          // bytes of the slot with this header
+    uint32_t len;           // bytes of the record, SHM_RING_PAD for a filler
+    uint64_t seq;           // record sequence number, from 0
+} shm_ring_slot_t;
+
+typedef struct shm_ring shm_ring_t;
+
+/// Create the shared memory segment for writing, replacing one of the same name
+///
+/// @param name: segment name, e.g. "/rtl_433" for /dev/shm/rtl_433 (the '/' is added if missing)
+/// @param size: bytes of records kept, rounded up to a power of two (at least 4096)
+/// @return the ring or NULL on error
+shm_ring_t *shm_ring_create(char const *name, size_t size);
+
+/// Append a record, never blocks
+///
+/// @return 0 on success, -1 if the record is larger than half the ring (it is dropped)
+int shm_ring_write(shm_ring_t *ring, void const *data, size_t len);
+
+/// Totals of the writer: records written and records too large to write
+void shm_ring_counters(shm_ring_t *ring, unsigned long *records, unsigned long *dropped);
+
+/// Mark the ring closed and remove the segment name, open readers can read what is left
+void shm_ring_free(shm_ring_t *ring);
+
+typedef struct shm_ring_reader shm_ring_reader_t;
+
+typedef struct {
+    void const *data;       // valid until the next read
+    size_t len;
+    uint64_t seq;
+    uint64_t lost;          // records overwritten before they could be read since the previous record
+} shm_ring_record_t;
+
+enum {
+    SHM_RING_CLOSED  = -1,  // the writer is done and everything was read, reopen to follow a new writer
+    SHM_RING_CORRUPT = -2,  // the data is not a valid ring
+};
+
+/// Map a ring for reading
+///
+/// @param name: segment name as given to shm_ring_create()
+/// @param from_oldest: start with the oldest record kept instead of the next one written
+/// @return the reader or NULL on error (e.g. no writer yet)
+shm_ring_reader_t *shm_ring_reader_open(char const *name, int from_oldest);
+
+/// Copy out the next record, never blocks
+///
+/// @return 1 for a record, 0 if there is none yet, SHM_RING_CLOSED or SHM_RING_CORRUPT
+int shm_ring_read(shm_ring_reader_t *reader, shm_ring_record_t *record);
+
+void shm_ring_reader_close(shm_ring_reader_t *reader);
+
+#endif /* INCLUDE_SHM_RING_H_ */
@@ -0,0 +1,54 @@
+/**
+ * Signal grabber
+ *
+ * Keeps the most recent I/Q samples in a ring buffer and saves a snippet
+ * around each triggered signal, with a margin before and after, to a
+ * g###_<freq>M_<rate>k.cu8 file. Files are written by a background thread
+ * straight from the ring, the receiver only appends samples and queues
+ * triggers and never waits for file I/O.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_SIGNAL_GRABBER_H_
+#define INCLUDE_SIGNAL_GRABBER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define DEFAULT_GRAB_PRE_MS     50  // Margin saved before a signal
+#define DEFAULT_GRAB_POST_MS    50  // Margin saved after a signal
+#define SIGNAL_GRABBER_JOBS     64  // Snippets queued for the writer thread
+
+typedef struct signal_grabber signal_grabber_t;
+
+/// Create a signal grabber and start the writer thread
+///
+/// @param ring_size: size of the sample ring in bytes
+/// @param samp_rate: sample rate in samples per second
+/// @param pre_ms: margin to save before each signal
+/// @param post_ms: margin to save after each signal
+/// @param overwrite: overwrite existing files instead of skipping to the next number
+/// @return the grabber or NULL on error
+signal_grabber_t *signal_grabber_create(size_t ring_size, uint32_t samp_rate, unsigned pre_ms, unsigned post_ms, int overwrite);
+
+/// Append received I/Q samples (uint8, 2 channel) to the ring
+void signal_grabber_write(signal_grabber_t *grabber, uint8_t const *iq_buf, uint32_t len);
+
+/// Queue a snippet, overlapping snippets are merged
+///
+/// @param start: stream offset of the first sample of the signal
+/// @param end: stream offset after the last sample of the signal
+/// @param frequency: frequency to note in the file name
+void signal_grabber_trigger(signal_grabber_t *grabber, uint64_t start, uint64_t end, uint32_t frequency);
+
+/// Number of snippets waiting to be saved
+unsigned signal_grabber_pending(signal_grabber_t *grabber);
+
+/// Save all queued snippets, stop the writer thread and release the grabber
+void signal_grabber_free(signal_grabber_t *grabber, FILE *stats_file);
+
+#endif /* INCLUDE_SIGNAL_GRABBER_H_ */
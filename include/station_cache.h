@@ -0,0 +1,70 @@
+/**
+ * Per station state cache to thin out repeated records
+ *
+ * Keeps a hash of the values (ignoring the time fields) last passed on for
+ * each station, keyed by model, id, channel and message type.
+ * Each decoded record is checked against its station and passed on, or
+ * suppressed if it repeats what the outputs already got:
+ *
+ * - full: every record, except exact repeats within the dedup window
+ * - change: only records whose values differ from the last one passed on
+ * - heartbeat: as change, and unchanged stations again every heartbeat
+ *
+ * Records without a model (e.g. stats) are always passed on. The cache is
+ * not thread safe, it is meant for the thread that runs the outputs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_STATION_CACHE_H_
+#define INCLUDE_STATION_CACHE_H_
+
+#include "data.h"
+
+#define STATION_CACHE_MAX_STATIONS      256     // the station seen longest ago is dropped beyond this
+#define STATION_CACHE_HEARTBEAT_S       600
+
+typedef enum {
+    STATION_EMIT_FULL,
+    STATION_EMIT_CHANGE,
+    STATION_EMIT_HEARTBEAT,
+} station_emit_t;
+
+typedef struct {
+    unsigned long records;      // records with a model checked
+    unsigned long emitted;      // records passed on
+    unsigned long unchanged;    // suppressed as their station did not change
+    unsigned long duplicates;   // suppressed as repeated frames within the dedup window
+    unsigned stations;          // stations currently cached
+} station_cache_counters_t;
+
+typedef struct station_cache station_cache_t;
+
+/// Create a cache
+///
+/// @param mode: which records to pass on
+/// @param heartbeat: seconds after which an unchanged station is passed on again (heartbeat mode)
+/// @param dedup_window: seconds within which a repeated frame is suppressed, 0 = off
+/// @param max_stations: stations to keep, at least 1
+/// @return the cache or NULL on allocation failure
+station_cache_t *station_cache_create(station_emit_t mode, double heartbeat, double dedup_window, unsigned max_stations);
+
+/// Check a record against its station and update the station
+///
+/// @param now: capture time of the record in seconds, on any monotonic time base
+/// @return 1 if the record should be output, 0 if it is suppressed
+int station_cache_check(station_cache_t *cache, data_t const *data, double now);
+
+/// Hash of the fields that identify the station a record is from
+///
+/// @return 1 if the record has a model, 0 if it is not from a station
+int station_cache_key(data_t const *data, uint64_t *key);
+
+void station_cache_counters(station_cache_t const *cache, station_cache_counters_t *counters);
+
+void station_cache_free(station_cache_t *cache);
+
+#endif /* INCLUDE_STATION_CACHE_H_ */
@@ -0,0 +1,138 @@
+/**
+ * Append-only columnar store for decoded readings
+ *
+ * Readings are kept in a directory with one segment file per UTC day
+ * (e.g. 2026-10-19.tsd). A segment is a header followed by blocks; each
+ * block holds the rows of one series (e.g. "Fine Offset WH1080 Weather
+ * Station/90") with one schema (the names and types of its fields) as
+ * columns: the timestamps, then one typed column per field. Blocks start
+ * small and double in capacity up to TSDB_MAX_ROWS, so a station heard
+ * rarely does not waste space; a row going back in time starts a block of
+ * the same capacity, as the rows of a block are in time order. When a
+ * segment is full, further rows of that day are dropped and counted. The
+ * block headers carry the series and the time range of their rows and
+ * serve as the index: a query reads only the headers of the blocks outside
+ * its range and the columns it uses.
+ *
+ * The writer appends through a memory mapping, a new row is published by
+ * incrementing the row count of its block last, and a new block by moving
+ * the segment end, so queries can run while rtl_433 writes. The layout is
+ * fixed (see tsdb_segment_header_t and tsdb_block_header_t), in the byte
+ * order of the host.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_TSDB_H_
+#define INCLUDE_TSDB_H_
+
+#include <stdint.h>
+
+#define TSDB_SEGMENT_MAGIC      0x316473743333346cULL   // "l433tsd1" in little endian
+#define TSDB_BLOCK_MAGIC        0x316b6c62U             // "blk1" in little endian
+#define TSDB_VERSION            1
+#define TSDB_DEFAULT_DIR        "rtl_433_tsdb"    // relative to the working directory
+#define TSDB_MAX_FIELDS         32
+#define TSDB_MAX_NAME           64      // bytes of a series name, with the terminating zero
+#define TSDB_MAX_FIELD_NAME     31      // bytes of a field name, with the terminating zero
+#define TSDB_MIN_ROWS           64      // capacity of the first block of a series in a segment
+#define TSDB_MAX_ROWS           1024
+#define TSDB_SEGMENT_MAX        (64 * 1024 * 1024)      // bytes of a segment, rows beyond are dropped
+
+typedef enum {
+    TSDB_INT = 1,           // int32_t column
+    TSDB_DOUBLE = 2,        // double column
+} tsdb_type_t;
+
+/// Start of a segment file, blocks follow from offset sizeof(tsdb_segment_header_t)
+typedef struct {
+    uint64_t magic;         // TSDB_SEGMENT_MAGIC
+    uint32_t version;       // TSDB_VERSION
+    int32_t day;            // days since 1970-01-01 UTC
+    uint64_t end;           // bytes in use, blocks up to here are complete
+    uint64_t reserved[5];
+} tsdb_segment_header_t;
+
+typedef struct {
+    char name[TSDB_MAX_FIELD_NAME];
+    uint8_t type;           // tsdb_type_t
+} tsdb_field_desc_t;
+
+/// Start of a block, followed by the field descriptions and the columns
+///
+/// The timestamp column (int64_t, ms since the epoch) comes at offset
+/// columns_offset from the block start, then one column per field, each
+/// capacity values long and padded to a multiple of 8 bytes. The rows of
+/// a block are in time order.
+typedef struct {
+    uint32_t magic;         // TSDB_BLOCK_MAGIC
+    uint32_t size;          // bytes of the block with this header
+    uint32_t capacity;      // rows the columns have room for
+    uint32_t rows;          // rows written, set after the row is complete
+    uint16_t num_fields;
+    uint16_t columns_offset;
+    uint32_t reserved;
+    int64_t time_min;       // ms since the epoch of the first row
+    int64_t time_max;       // ms since the epoch of the last row, set before rows
+    uint64_t schema;        // hash of the series name and the field descriptions
+    char series[TSDB_MAX_NAME];
+} tsdb_block_header_t;
+
+/// A field value to append
+typedef struct {
+    char const *name;
+    tsdb_type_t type;
+    union {
+        int32_t i;
+        double d;
+    } value;
+} tsdb_field_t;
+
+typedef struct tsdb tsdb_t;
+
+/// Open a store for appending, the directory is created if missing
+///
+/// @return the store or NULL on error
+tsdb_t *tsdb_open(char const *dir);
+
+/// Append a row to a series
+///
+/// Fields beyond TSDB_MAX_FIELDS are not stored, names are truncated to fit.
+///
+/// @param time_ms: ms since the epoch
+/// @return 0 on success, -1 if the row was dropped (segment full or write error)
+int tsdb_append(tsdb_t *db, char const *series, int64_t time_ms, tsdb_field_t const *fields, unsigned num_fields);
+
+/// Totals of the writer: rows written and rows dropped
+void tsdb_counters(tsdb_t *db, unsigned long *rows, unsigned long *dropped);
+
+/// Truncate the current segment to its end and close
+void tsdb_close(tsdb_t *db);
+
+/// Rows of one block within the range of a query, pointing into the mapped segment
+typedef struct {
+    char const *series;
+    uint64_t schema;
+    unsigned num_fields;
+    tsdb_field_desc_t const *fields;
+    unsigned rows;
+    int64_t const *time;                    // the first row in range
+    void const *columns[TSDB_MAX_FIELDS];   // int32_t or double, at the first row in range
+} tsdb_rows_t;
+
+/// Called for each block with rows in range, return nonzero to stop
+///
+/// Blocks come by day and in the order they were written, so the rows of a
+/// series come in time order unless the input went back in time. The
+/// pointers are valid until the callback returns.
+typedef int (*tsdb_rows_cb)(tsdb_rows_t const *rows, void *ctx);
+
+/// Run a query over the rows with from_ms <= time < to_ms
+///
+/// @return 0 if all segments were read, 1 if the callback stopped the query, -1 on error
+int tsdb_query(char const *dir, int64_t from_ms, int64_t to_ms, tsdb_rows_cb cb, void *ctx);
+
+#endif /* INCLUDE_TSDB_H_ */
@@ -95,6 +95,16 @@ int byteParity(uint8_t inByte);
 /// @return buf pointer (for short hand use as operator)
 char* local_time_str(time_t time_secs, char *buf);
 
+/// Monotonic clock for measuring elapsed time
+///
+/// @return nanoseconds since an unspecified starting point
+uint64_t monotonic_ns(void);
+
+/// Wall clock with sub second resolution
+///
+/// @return seconds since the epoch
+double wall_time(void);
+
 /// Convert Celsius to Fahrenheit
 ///
 /// @param celsius: temperature in Celsius
@@ -0,0 +1,43 @@
+/**
+ * Derived weather metrics per station
+ *
+ * Follows the records of each weather station and derives fields that
+ * otherwise need the history of the station:
+ *
+ * - rain_rate_mm_h, rain_1h_mm, rain_24h_mm from the cumulative rain counter,
+ *   across counter wraparounds and resets
+ * - wind_avg_10m_kph, gust_max_10m_kph and wind_dir_10m_deg (the speed
+ *   weighted mean direction) over the last 10 minutes
+ * - dew_point_C from temperature and humidity, wind_chill_C in cold wind
+ *
+ * The history is kept in fixed buckets per window, so each record costs the
+ * same time and memory no matter how often a station reports. Records are
+ * read before unit conversion, i.e. in the units the decoders output.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef INCLUDE_WEATHER_METRICS_H_
+#define INCLUDE_WEATHER_METRICS_H_
+
+#include "data.h"
+
+#define WEATHER_METRICS_MAX_STATIONS    64  // the station seen longest ago is dropped beyond this
+
+typedef struct weather_metrics weather_metrics_t;
+
+/// Create the metrics of up to max_stations stations
+weather_metrics_t *weather_metrics_create(unsigned max_stations);
+
+/// Add a record to the history of its station
+///
+/// @param now: capture time of the record in seconds, on any monotonic time base
+/// @return the derived fields to append to the record, NULL if there are none
+data_t *weather_metrics_update(weather_metrics_t *metrics, data_t const *data, double now);
+
+void weather_metrics_free(weather_metrics_t *metrics);
+
+#endif /* INCLUDE_WEATHER_METRICS_H_ */
@@ -41,6 +41,19 @@ void envelope_detect(const uint8_t *iq_buf, uint16_t *y_buf, uint32_t len) {
     }
 }
 
+/** Envelope of 16 bit samples
+ *  (I^2 + Q^2) >> 16 matches the scale of the 8 bit table above
+ *  while keeping the resolution of small signals
+ */
+void envelope_detect_cs16(const int16_t *iq_buf, uint16_t *y_buf, uint32_t len) {
+    unsigned int i;
+    for (i = 0; i < len; i++) {
+        int32_t x = iq_buf[2 * i];
+        int32_t y = iq_buf[2 * i + 1];
+        y_buf[i] = (uint16_t)(((uint32_t)(x * x) + (uint32_t)(y * y)) >> 16);
+    }
+}
+
 
 /** Something that might look like a IIR lowpass filter
  *
@@ -153,6 +166,54 @@ void baseband_demod_FM(const uint8_t *x_buf, int16_t *y_buf, unsigned num_sample
 }
 
 
+/// Scale a phase difference vector to the int16_t range atan2_int16() expects
+static inline void fm_normalize(int32_t *pr, int32_t *pi) {
+    uint32_t m = (uint32_t)(abs(*pr) | abs(*pi));
+#ifdef __GNUC__
+    int shift = m > 16383 ? 18 - __builtin_clz(m) : 0;
+#else
+    int shift = 0;
+    while ((m >> shift) > 16383)
+        shift++;
+#endif
+    *pr >>= shift;
+    *pi >>= shift;
+}
+
+void baseband_demod_FM_cs16(const int16_t *x_buf, int16_t *y_buf, unsigned num_samples, DemodFM_State *state) {
+    int32_t ar, ai;  // New IQ sample: x[n], 14 bit
+    int32_t br, bi;  // Old IQ sample: x[n-1]
+    int32_t pr, pi;  // Phase difference vector
+    int16_t xlp, ylp, xlp_old, ylp_old;  // Low Pass filter variables
+
+    // Pre-feed old sample
+    ar = state->br; ai = state->bi;
+    xlp_old = state->xlp; ylp_old = state->ylp;
+
+    for (unsigned n = 0; n < num_samples; n++) {
+        // delay old sample
+        br = ar;
+        bi = ai;
+        // get new sample, drop two bits so the products fit an int32_t
+        ar = x_buf[2*n] / 4;
+        ai = x_buf[2*n+1] / 4;
+        // Calculate phase difference vector: x[n] * conj(x[n-1])
+        pr = ar*br+ai*bi;
+        pi = ai*br-ar*bi;
+        fm_normalize(&pr, &pi);
+        xlp = atan2_int16(pi, pr);
+        // Low pass filter
+        ylp = ((alp[1] * ylp_old >> 1) + (blp[0] * xlp >> 1) + (blp[1] * xlp_old >> 1)) >> (F_SCALE - 1);
+        ylp_old = ylp; xlp_old = xlp;
+        y_buf[n] = ylp;
+    }
+
+    // Store newest sample for next run
+    state->br = ar; state->bi = ai;
+    state->xlp = xlp_old; state->ylp = ylp_old;
+}
+
+
 void baseband_init(void) {
     calc_squares();
 }
@@ -16,10 +16,14 @@
 #include <string.h>
 
 
+// Only rows up to num_rows are ever written, so clearing those keeps the
+// whole buffer zeroed without touching all of it
 void bitbuffer_clear(bitbuffer_t *bits) {
+	unsigned rows = bits->num_rows < BITBUF_ROWS ? bits->num_rows + 1 : BITBUF_ROWS;
 	bits->num_rows = 0;
-	memset(bits->bits_per_row, 0, BITBUF_ROWS*2);
-	memset(bits->bb, 0, BITBUF_ROWS * BITBUF_COLS);
+	memset(bits->bits_per_row, 0, rows * sizeof(bits->bits_per_row[0]));
+	memset(bits->syncs_before_row, 0, rows * sizeof(bits->syncs_before_row[0]));
+	memset(bits->bb, 0, rows * BITBUF_COLS);
 }
 
 
@@ -46,6 +50,7 @@ void bitbuffer_add_row(bitbuffer_t *bits) {
 	}
 	else {
 		bits->bits_per_row[bits->num_rows-1] = 0;	// Clear last row to handle overflow somewhat gracefully
+		memset(bits->bb[bits->num_rows-1], 0, BITBUF_COLS);
 //		fprintf(stderr, "ERROR: bitbuffer:: Could not add more rows\n");	// Some decoders may add many rows...
 	}
 }
@@ -297,16 +302,73 @@ unsigned count_repeats(bitbuffer_t *bits, unsigned row) {
 	return cnt;
 }
 
-int bitbuffer_find_repeated_row(bitbuffer_t *bits, unsigned min_repeats, unsigned min_bits) {
-	for (int i = 0; i < bits->num_rows; ++i) {
-		if (bits->bits_per_row[i] >= min_bits &&
-			count_repeats(bits, i) >= min_repeats) {
-			return i;
+// FNV-1a over the row length and bytes
+static uint64_t row_fingerprint(const bitbuffer_t *bits, unsigned row) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	unsigned len = bits->bits_per_row[row];
+	hash = (hash ^ (len & 0xff)) * 0x100000001b3ULL;
+	hash = (hash ^ (len >> 8)) * 0x100000001b3ULL;
+	for (unsigned i = 0; i < (len + 7) / 8; ++i) {
+		hash = (hash ^ bits->bb[row][i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+#define ROW_INDEX_SLOTS 64 // power of two, more than twice BITBUF_ROWS
+
+void bitbuffer_index_rows(const bitbuffer_t *bits, bitbuffer_row_index_t *index) {
+	uint64_t slot_hash[ROW_INDEX_SLOTS];
+	int8_t slot_group[ROW_INDEX_SLOTS];
+	memset(slot_group, -1, sizeof(slot_group));
+
+	index->num_groups = 0;
+	index->most_repeated = 0;
+	unsigned num_rows = bits->num_rows < BITBUF_ROWS ? bits->num_rows : BITBUF_ROWS;
+	for (unsigned row = 0; row < num_rows; ++row) {
+		uint64_t hash = row_fingerprint(bits, row);
+		unsigned slot = hash & (ROW_INDEX_SLOTS - 1);
+		int group;
+		// linear probing, a fingerprint match is confirmed with the bytes
+		while ((group = slot_group[slot]) >= 0) {
+			if (slot_hash[slot] == hash
+					&& compare_rows((bitbuffer_t *)bits, index->first_row[group], row))
+				break;
+			slot = (slot + 1) & (ROW_INDEX_SLOTS - 1);
+		}
+		if (group < 0) {
+			group = index->num_groups++;
+			slot_hash[slot] = hash;
+			slot_group[slot] = group;
+			index->first_row[group] = row;
+			index->repeats[group] = 0;
+		}
+		index->group_of_row[row] = group;
+		index->repeats[group]++;
+		if (index->repeats[group] > index->repeats[index->most_repeated])
+			index->most_repeated = group;
+	}
+}
+
+int bitbuffer_index_find_row(const bitbuffer_t *bits, const bitbuffer_row_index_t *index,
+		unsigned min_repeats, unsigned max_repeats, unsigned min_bits, unsigned max_bits) {
+	for (unsigned group = 0; group < index->num_groups; ++group) {
+		unsigned row = index->first_row[group];
+		unsigned len = bits->bits_per_row[row];
+		unsigned repeats = index->repeats[group];
+		if (len >= min_bits && (!max_bits || len <= max_bits)
+				&& repeats >= min_repeats && (!max_repeats || repeats <= max_repeats)) {
+			return row;
 		}
 	}
 	return -1;
 }
 
+int bitbuffer_find_repeated_row(bitbuffer_t *bits, unsigned min_repeats, unsigned min_bits) {
+	bitbuffer_row_index_t index;
+	bitbuffer_index_rows(bits, &index);
+	return bitbuffer_index_find_row(bits, &index, min_repeats, 0, min_bits, 0);
+}
+
 
 // Test code
 // gcc -I include/ -std=gnu11 -D _TEST src/bitbuffer.c
@@ -355,6 +417,18 @@ int main(int argc, char **argv) {
 	bitbuffer_add_bit(&bits, 1);
 	bitbuffer_print(&bits);
 
+	fprintf(stderr, "TEST: bitbuffer:: Row index\n");
+	bitbuffer_clear(&bits);
+	bitbuffer_parse(&bits, "{12}abc {12}123 {12}abc {16}abcd {12}abc {12}123");
+	bitbuffer_row_index_t index;
+	bitbuffer_index_rows(&bits, &index);
+	fprintf(stderr, "%u groups, most repeated row %u (%u times)\n", index.num_groups,
+			index.first_row[index.most_repeated], index.repeats[index.most_repeated]);
+	fprintf(stderr, "repeated row %d, row with at most 2 repeats %d, row with 16 bits %d\n",
+			bitbuffer_find_repeated_row(&bits, 3, 0),
+			bitbuffer_index_find_row(&bits, &index, 2, 2, 0, 0),
+			bitbuffer_index_find_row(&bits, &index, 0, 0, 16, 16));
+
 	return 0;
 }
 #endif /* _TEST */
@@ -0,0 +1,271 @@
+/**
+ * Threaded sample capture writer
+ *
+ * The pool is used as a ring: buffers [write, write + used) are queued for
+ * the writer thread, the buffer at write + used is the one being filled.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _GNU_SOURCE // for O_DIRECT
+
+#include "capture_writer.h"
+#include "hdr_hist.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} capture_buffer_t;
+
+struct capture_writer {
+    int fd;
+    int direct;
+    size_t block_size;
+    size_t buffer_size;
+    unsigned num_buffers;
+    capture_buffer_t *buffers;
+    uint8_t *scratch;           // Read target while the pool is exhausted
+
+    // reader side
+    unsigned fill;              // Buffer being filled
+    int filling;                // 1 if the reader owns buffers[fill]
+    uint64_t bytes_dropped;
+    uint64_t overruns;
+
+    // shared, protected by mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned write;             // Next buffer for the writer thread
+    unsigned used;              // Buffers queued or being written
+    int stop;
+    int failed;
+    hdr_hist_t occupancy;       // Buffers in use when a buffer is queued
+
+    // writer side
+    pthread_t thread;
+    uint64_t bytes_written;
+    hdr_hist_t latency;         // Duration of a single write in ns
+};
+
+static int write_all(int fd, uint8_t const *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void set_direct(capture_writer_t *writer, int enable)
+{
+#ifdef O_DIRECT
+    int flags = fcntl(writer->fd, F_GETFL);
+    if (flags < 0)
+        return;
+    flags = enable ? flags | O_DIRECT : flags & ~O_DIRECT;
+    if (fcntl(writer->fd, F_SETFL, flags) < 0) {
+        if (enable)
+            fprintf(stderr, "Direct I/O not supported by the output file, using buffered writes\n");
+        writer->direct = 0;
+        return;
+    }
+    writer->direct = enable;
+#else
+    if (enable)
+        fprintf(stderr, "Direct I/O not available, using buffered writes\n");
+    writer->direct = 0;
+#endif
+}
+
+static void *capture_writer_thread(void *arg)
+{
+    capture_writer_t *writer = arg;
+
+    pthread_mutex_lock(&writer->mutex);
+    for (;;) {
+        while (!writer->used && !writer->stop)
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+        if (!writer->used)
+            break;
+        capture_buffer_t *buf = &writer->buffers[writer->write];
+        int failed = writer->failed;
+        pthread_mutex_unlock(&writer->mutex);
+
+        // Keep draining after a failure so the reader never stalls
+        if (!failed) {
+            // Direct I/O needs aligned lengths, a short tail goes through the page cache
+            if (writer->direct && buf->len % CAPTURE_BUFFER_ALIGN)
+                set_direct(writer, 0);
+            uint64_t start = monotonic_ns();
+            if (write_all(writer->fd, buf->data, buf->len) < 0) {
+                perror("capture writer");
+                failed = 1;
+            } else {
+                hdr_hist_record(&writer->latency, monotonic_ns() - start);
+                writer->bytes_written += buf->len;
+            }
+        }
+        buf->len = 0;
+
+        pthread_mutex_lock(&writer->mutex);
+        writer->failed |= failed;
+        writer->write = (writer->write + 1) % writer->num_buffers;
+        writer->used--;
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+capture_writer_t *capture_writer_create(int fd, size_t block_size, unsigned num_buffers, int direct)
+{
+    capture_writer_t *writer = calloc(1, sizeof(capture_writer_t));
+    if (!writer) {
+        fprintf(stderr, "capture_writer_create(): calloc() failed\n");
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->block_size = block_size;
+    // Collect several reads into one larger write
+    writer->buffer_size = block_size * max(CAPTURE_WRITE_SIZE / block_size, 1);
+    writer->num_buffers = max(num_buffers, 2);
+    writer->buffers = calloc(writer->num_buffers, sizeof(capture_buffer_t));
+    if (!writer->buffers)
+        goto fail;
+    for (unsigned i = 0; i < writer->num_buffers; ++i) {
+        if (posix_memalign((void **)&writer->buffers[i].data, CAPTURE_BUFFER_ALIGN, writer->buffer_size))
+            goto fail;
+    }
+    writer->scratch = malloc(block_size);
+    if (!writer->scratch)
+        goto fail;
+
+    if (direct) {
+        if (block_size % CAPTURE_BUFFER_ALIGN)
+            fprintf(stderr, "Direct I/O needs a block size multiple of %d, using buffered writes\n", CAPTURE_BUFFER_ALIGN);
+        else
+            set_direct(writer, 1);
+    }
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    if (pthread_create(&writer->thread, NULL, capture_writer_thread, writer)) {
+        fprintf(stderr, "capture_writer_create(): failed to start writer thread\n");
+        pthread_cond_destroy(&writer->cond);
+        pthread_mutex_destroy(&writer->mutex);
+        goto fail;
+    }
+    return writer;
+
+fail:
+    if (writer->buffers) {
+        for (unsigned i = 0; i < writer->num_buffers; ++i)
+            free(writer->buffers[i].data);
+    }
+    free(writer->buffers);
+    free(writer->scratch);
+    free(writer);
+    return NULL;
+}
+
+uint8_t *capture_writer_buffer(capture_writer_t *writer)
+{
+    if (!writer->filling) {
+        pthread_mutex_lock(&writer->mutex);
+        writer->filling = writer->used < writer->num_buffers;
+        if (writer->filling)
+            writer->fill = (writer->write + writer->used) % writer->num_buffers;
+        pthread_mutex_unlock(&writer->mutex);
+    }
+    if (!writer->filling)
+        return writer->scratch;
+
+    capture_buffer_t *buf = &writer->buffers[writer->fill];
+    return buf->data + buf->len;
+}
+
+static void submit_buffer(capture_writer_t *writer)
+{
+    pthread_mutex_lock(&writer->mutex);
+    writer->used++;
+    hdr_hist_record(&writer->occupancy, writer->used);
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+    writer->filling = 0;
+}
+
+void capture_writer_commit(capture_writer_t *writer, size_t len)
+{
+    if (!writer->filling) {
+        writer->bytes_dropped += len;
+        writer->overruns++;
+        return;
+    }
+
+    capture_buffer_t *buf = &writer->buffers[writer->fill];
+    buf->len += len;
+    if (buf->len + writer->block_size > writer->buffer_size)
+        submit_buffer(writer);
+}
+
+int capture_writer_failed(capture_writer_t *writer)
+{
+    pthread_mutex_lock(&writer->mutex);
+    int failed = writer->failed;
+    pthread_mutex_unlock(&writer->mutex);
+    return failed;
+}
+
+int capture_writer_close(capture_writer_t *writer, FILE *stats_file)
+{
+    if (writer->filling && writer->buffers[writer->fill].len)
+        submit_buffer(writer);
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->stop = 1;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+
+    int failed = writer->failed;
+
+    if (stats_file) {
+        hdr_hist_t const *lat = &writer->latency;
+        fprintf(stats_file, "Capture statistics:\n");
+        fprintf(stats_file, "\t%llu bytes written, %llu bytes dropped in %llu overruns\n",
+                (unsigned long long)writer->bytes_written, (unsigned long long)writer->bytes_dropped,
+                (unsigned long long)writer->overruns);
+        fprintf(stats_file, "\twrite latency (us): p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, max %.0f\n",
+                hdr_hist_percentile(lat, 50.0) / 1e3, hdr_hist_percentile(lat, 90.0) / 1e3,
+                hdr_hist_percentile(lat, 99.0) / 1e3, hdr_hist_percentile(lat, 99.9) / 1e3,
+                lat->max / 1e3);
+        fprintf(stats_file, "\tbuffers in use: mean %.1f, max %llu of %u (%zu bytes each)\n",
+                hdr_hist_mean(&writer->occupancy), (unsigned long long)writer->occupancy.max,
+                writer->num_buffers, writer->buffer_size);
+    }
+
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->mutex);
+    for (unsigned i = 0; i < writer->num_buffers; ++i)
+        free(writer->buffers[i].data);
+    free(writer->buffers);
+    free(writer->scratch);
+    free(writer);
+
+    return failed ? -1 : 0;
+}
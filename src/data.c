@@ -18,15 +18,24 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+// sendmmsg() is a GNU extension
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdarg.h>
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
 #include "limits.h"
 // gethostname() needs _XOPEN_SOURCE 500 on unistd.h
+#ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 500
+#endif
 
 #ifndef _MSC_VER
 #include <unistd.h>
@@ -35,10 +44,16 @@
 #ifndef _WIN32
 #include <netdb.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <strings.h>
+#include <pthread.h>
 #endif
 #include <time.h>
 
 #include "data.h"
+#include "shm_ring.h"
+#include "tsdb.h"
 
 typedef void* (*array_elementwise_import_fn)(void*);
 typedef void* (*array_element_release_fn)(void*);
@@ -280,11 +295,15 @@ void data_free(data_t *data)
     }
 }
 
+static void print_csv_data(data_output_t *output, data_t *data, char *format);
+
 void data_output_print(data_output_t *output, data_t *data)
 {
     output->print_data(output, data, NULL);
     if (output->file) {
-        fputc('\n', output->file);
+        // a CSV row ends in its line buffer and is written at once
+        if (output->print_data != print_csv_data)
+            fputc('\n', output->file);
         fflush(output->file);
     }
 }
@@ -487,46 +506,135 @@ struct data_output *data_output_kv_create(FILE *file)
     return output;
 }
 
+/* growable line buffer */
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+} lbuf_t;
+
+static bool lbuf_reserve(lbuf_t *line, size_t len)
+{
+    if (line->len + len <= line->size)
+        return true;
+    size_t size = line->size ? line->size : 256;
+    while (size < line->len + len)
+        size *= 2;
+    char *buf = realloc(line->buf, size);
+    if (!buf)
+        return false;
+    line->buf = buf;
+    line->size = size;
+    return true;
+}
+
+static void lbuf_append(lbuf_t *line, const char *str, size_t len)
+{
+    if (!lbuf_reserve(line, len))
+        return;
+    memcpy(line->buf + line->len, str, len);
+    line->len += len;
+}
+
+static void lbuf_printf(lbuf_t *line, const char *format, ...)
+{
+    va_list ap;
+    int len;
+
+    lbuf_reserve(line, 32);
+    va_start(ap, format);
+    len = vsnprintf(line->buf + line->len, line->size - line->len, format, ap);
+    va_end(ap);
+    if (len < 0)
+        return;
+    if ((size_t)len >= line->size - line->len) {
+        if (!lbuf_reserve(line, len + 1))
+            return;
+        va_start(ap, format);
+        vsnprintf(line->buf + line->len, line->size - line->len, format, ap);
+        va_end(ap);
+    }
+    line->len += len;
+}
+
 /* CSV printer; doesn't really support recursive data objects yet */
 
+typedef struct {
+    const char *key;
+    int column;
+} csv_column_t;
+
 typedef struct {
     struct data_output output;
     const char **fields;
+    int num_fields;
+    csv_column_t *index;    // open addressing hash of field name to column
+    unsigned index_mask;
+    data_t **row;           // value for each column of the current record
+    lbuf_t line;            // the current line, written at once
     int data_recursion;
     const char *separator;
+    size_t separator_len;
 } data_output_csv_t;
 
+static unsigned csv_hash(const char *key)
+{
+    // FNV-1a
+    unsigned hash = 2166136261u;
+    while (*key)
+        hash = (hash ^ (unsigned char)*key++) * 16777619u;
+    return hash;
+}
+
+static int csv_column(data_output_csv_t *csv, const char *key)
+{
+    unsigned i = csv_hash(key) & csv->index_mask;
+    while (csv->index[i].key) {
+        if (strcmp(csv->index[i].key, key) == 0)
+            return csv->index[i].column;
+        i = (i + 1) & csv->index_mask;
+    }
+    return -1;
+}
+
 static void print_csv_data(data_output_t *output, data_t *data, char *format)
 {
     data_output_csv_t *csv = (data_output_csv_t *)output;
-
-    const char **fields = csv->fields;
     int i;
 
     if (csv->data_recursion)
         return;
 
+    // one pass over the record to sort the values into columns, the first of a key wins
+    memset(csv->row, 0, csv->num_fields * sizeof(data_t *));
+    for (; data; data = data->next) {
+        int column = csv_column(csv, data->key);
+        if (column >= 0 && !csv->row[column])
+            csv->row[column] = data;
+    }
+
     ++csv->data_recursion;
-    for (i = 0; fields[i]; ++i) {
-        const char *key = fields[i];
-        data_t *found = NULL;
+    csv->line.len = 0;
+    for (i = 0; i < csv->num_fields; ++i) {
+        data_t *found = csv->row[i];
         if (i)
-            fprintf(output->file, "%s", csv->separator);
-        for (data_t *iter = data; !found && iter; iter = iter->next)
-            if (strcmp(iter->key, key) == 0)
-                found = iter;
-
+            lbuf_append(&csv->line, csv->separator, csv->separator_len);
         if (found)
             print_value(output, found->type, found->value, found->format);
     }
     --csv->data_recursion;
+    lbuf_append(&csv->line, "\n", 1);
+    fwrite(csv->line.buf, 1, csv->line.len, output->file);
 }
 
 static void print_csv_array(data_output_t *output, data_array_t *array, char *format)
 {
+    data_output_csv_t *csv = (data_output_csv_t *)output;
+
     for (int c = 0; c < array->num_values; ++c) {
         if (c)
-            fprintf(output->file, ";");
+            lbuf_append(&csv->line, ";", 1);
         print_array_value(output, array, format, c);
     }
 }
@@ -534,15 +642,32 @@ static void print_csv_array(data_output_t *output, data_array_t *array, char *fo
 static void print_csv_string(data_output_t *output, const char *str, char *format)
 {
     data_output_csv_t *csv = (data_output_csv_t *)output;
+    const char reject[2] = {csv->separator[0], '\0'};
 
+    // copy the runs between separator candidates, strcspn is vectorized in most libcs
     while (*str) {
-        if (strncmp(str, csv->separator, strlen(csv->separator)) == 0)
-            fputc('\\', output->file);
-        fputc(*str, output->file);
+        size_t span = strcspn(str, reject);
+        lbuf_append(&csv->line, str, span);
+        str += span;
+        if (!*str)
+            break;
+        if (strncmp(str, csv->separator, csv->separator_len) == 0)
+            lbuf_append(&csv->line, "\\", 1);
+        lbuf_append(&csv->line, str, 1);
         ++str;
     }
 }
 
+static void print_csv_double(data_output_t *output, double data, char *format)
+{
+    lbuf_printf(&((data_output_csv_t *)output)->line, "%.3f", data);
+}
+
+static void print_csv_int(data_output_t *output, int data, char *format)
+{
+    lbuf_printf(&((data_output_csv_t *)output)->line, "%d", data);
+}
+
 static int compare_strings(const void *a, const void *b)
 {
     return strcmp(*(char **)a, *(char **)b);
@@ -555,10 +680,12 @@ static void *data_output_csv_init(data_output_csv_t *csv, const char **fields, i
     const char **allowed = NULL;
     int *use_count = NULL;
     int num_unique_fields;
+    unsigned index_size;
     if (!csv)
         goto alloc_error;
 
     csv->separator = ",";
+    csv->separator_len = strlen(csv->separator);
 
     allowed = calloc(num_fields, sizeof(const char *));
     memcpy(allowed, fields, sizeof(const char *) * num_fields);
@@ -600,21 +727,42 @@ static void *data_output_csv_init(data_output_csv_t *csv, const char **fields, i
         }
     }
     csv->fields[csv_fields] = NULL;
+    csv->num_fields = csv_fields;
     free(allowed);
     free(use_count);
+    allowed = NULL;
+    use_count = NULL;
+
+    // Map the field names to columns once, at most half full
+    for (index_size = 16; index_size < 2 * (unsigned)csv_fields; index_size *= 2);
+    csv->index = calloc(index_size, sizeof(csv_column_t));
+    csv->row = calloc(csv_fields + 1, sizeof(data_t *));
+    if (!csv->index || !csv->row)
+        goto alloc_error;
+    csv->index_mask = index_size - 1;
+    for (i = 0; i < csv_fields; ++i) {
+        unsigned slot = csv_hash(csv->fields[i]) & csv->index_mask;
+        while (csv->index[slot].key)
+            slot = (slot + 1) & csv->index_mask;
+        csv->index[slot].key = csv->fields[i];
+        csv->index[slot].column = i;
+    }
 
     // Output the CSV header
     for (i = 0; csv->fields[i]; ++i) {
-        printf("%s%s", i > 0 ? csv->separator : "", csv->fields[i]);
+        fprintf(csv->output.file, "%s%s", i > 0 ? csv->separator : "", csv->fields[i]);
     }
-    printf("\n");
+    fprintf(csv->output.file, "\n");
     return csv;
 
 alloc_error:
     free(use_count);
     free(allowed);
-    if (csv)
+    if (csv) {
         free(csv->fields);
+        free(csv->index);
+        free(csv->row);
+    }
     free(csv);
     return NULL;
 }
@@ -624,6 +772,9 @@ static void data_output_csv_free(data_output_t *output)
     data_output_csv_t *csv = (data_output_csv_t *)output;
 
     free(csv->fields);
+    free(csv->index);
+    free(csv->row);
+    free(csv->line.buf);
     free(csv);
 }
 
@@ -638,19 +789,643 @@ struct data_output *data_output_csv_create(FILE *file, const char **fields, int
     csv->output.print_data   = print_csv_data;
     csv->output.print_array  = print_csv_array;
     csv->output.print_string = print_csv_string;
-    csv->output.print_double = print_json_double;
-    csv->output.print_int    = print_json_int;
+    csv->output.print_double = print_csv_double;
+    csv->output.print_int    = print_csv_int;
     csv->output.output_free  = data_output_csv_free;
     csv->output.file         = file;
-    data_output_csv_init(csv, fields, num_fields);
+    return data_output_csv_init(csv, fields, num_fields);
+}
+
+/* CBOR printer (RFC 8949), a CBOR sequence (RFC 8742) with a key dictionary */
+
+#define CBOR_MAX_SCHEMAS 256    // the dictionary starts over when full
+
+enum {
+    CBOR_UINT   = 0,
+    CBOR_NINT   = 1,
+    CBOR_BYTES  = 2,
+    CBOR_TEXT   = 3,
+    CBOR_ARRAY  = 4,
+    CBOR_MAP    = 5,
+    CBOR_TAG    = 6,
+    CBOR_SIMPLE = 7,
+};
+
+#define CBOR_SELF_DESCRIBE 55799
+#define CBOR_DEFINE 0
+#define CBOR_RECORD 1
+
+typedef struct {
+    char *keys;                 // each key '\0' terminated
+    size_t keys_len;
+    unsigned num_keys;
+    unsigned hash;
+} cbor_schema_t;
+
+typedef struct {
+    struct data_output output;
+    FILE *out;                  // not output.file, that would append a newline
+    lbuf_t buf;                 // the current record, written at once
+    int depth;
+    int started;
+    cbor_schema_t schemas[CBOR_MAX_SCHEMAS];
+    unsigned num_schemas;
+} data_output_cbor_t;
+
+static void cbor_head(lbuf_t *buf, unsigned major, uint64_t value)
+{
+    uint8_t head[9];
+    size_t len;
+    if (value < 24) {
+        head[0] = major << 5 | (uint8_t)value;
+        len = 1;
+    } else if (value <= 0xff) {
+        head[0] = major << 5 | 24;
+        len = 2;
+    } else if (value <= 0xffff) {
+        head[0] = major << 5 | 25;
+        len = 3;
+    } else if (value <= 0xffffffff) {
+        head[0] = major << 5 | 26;
+        len = 5;
+    } else {
+        head[0] = major << 5 | 27;
+        len = 9;
+    }
+    for (size_t i = len - 1; i > 0; --i, value >>= 8)
+        head[i] = (uint8_t)value;
+    lbuf_append(buf, (char *)head, len);
+}
+
+static void cbor_text(lbuf_t *buf, const char *str)
+{
+    size_t len = strlen(str);
+    cbor_head(buf, CBOR_TEXT, len);
+    lbuf_append(buf, str, len);
+}
+
+// The schema (key list) of a record, defined in the stream on first use
+static unsigned cbor_schema(data_output_cbor_t *cbor, data_t *data)
+{
+    unsigned hash = 2166136261u; // FNV-1a over the keys with their terminators
+    unsigned num_keys = 0;
+    size_t keys_len = 0;
+    for (data_t *d = data; d; d = d->next) {
+        for (const char *k = d->key; ; ++k) {
+            hash = (hash ^ (unsigned char)*k) * 16777619u;
+            if (!*k)
+                break;
+        }
+        keys_len += strlen(d->key) + 1;
+        num_keys++;
+    }
+
+    for (unsigned id = 0; id < cbor->num_schemas; ++id) {
+        cbor_schema_t *schema = &cbor->schemas[id];
+        if (schema->hash != hash || schema->num_keys != num_keys || schema->keys_len != keys_len)
+            continue;
+        char *k = schema->keys;
+        data_t *d = data;
+        for (; d && !strcmp(k, d->key); d = d->next)
+            k += strlen(k) + 1;
+        if (!d)
+            return id;
+    }
+
+    if (cbor->num_schemas == CBOR_MAX_SCHEMAS) {
+        for (unsigned id = 0; id < cbor->num_schemas; ++id)
+            free(cbor->schemas[id].keys);
+        cbor->num_schemas = 0;
+    }
+    cbor_schema_t *schema = &cbor->schemas[cbor->num_schemas];
+    schema->keys = malloc(keys_len);
+    if (!schema->keys)
+        return CBOR_MAX_SCHEMAS;
+    char *k = schema->keys;
+    for (data_t *d = data; d; d = d->next) {
+        size_t len = strlen(d->key) + 1;
+        memcpy(k, d->key, len);
+        k += len;
+    }
+    schema->keys_len = keys_len;
+    schema->num_keys = num_keys;
+    schema->hash = hash;
+
+    // [0, id, [keys...]]
+    cbor_head(&cbor->buf, CBOR_ARRAY, 3);
+    cbor_head(&cbor->buf, CBOR_UINT, CBOR_DEFINE);
+    cbor_head(&cbor->buf, CBOR_UINT, cbor->num_schemas);
+    cbor_head(&cbor->buf, CBOR_ARRAY, num_keys);
+    for (data_t *d = data; d; d = d->next)
+        cbor_text(&cbor->buf, d->key);
+    return cbor->num_schemas++;
+}
+
+static void print_cbor_data(data_output_t *output, data_t *data, char *format)
+{
+    data_output_cbor_t *cbor = (data_output_cbor_t *)output;
+
+    if (cbor->depth) {
+        // nested objects are plain maps
+        unsigned num_fields = 0;
+        for (data_t *d = data; d; d = d->next)
+            num_fields++;
+        cbor_head(&cbor->buf, CBOR_MAP, num_fields);
+        for (; data; data = data->next) {
+            cbor_text(&cbor->buf, data->key);
+            print_value(output, data->type, data->value, data->format);
+        }
+        return;
+    }
+
+    cbor->buf.len = 0;
+    if (!cbor->started) {
+        cbor_head(&cbor->buf, CBOR_TAG, CBOR_SELF_DESCRIBE); // tags the first item
+        cbor->started = 1;
+    }
+    unsigned id = cbor_schema(cbor, data);
+    if (id == CBOR_MAX_SCHEMAS)
+        return;
+
+    // [1, id, values...]
+    cbor_head(&cbor->buf, CBOR_ARRAY, 2 + cbor->schemas[id].num_keys);
+    cbor_head(&cbor->buf, CBOR_UINT, CBOR_RECORD);
+    cbor_head(&cbor->buf, CBOR_UINT, id);
+    ++cbor->depth;
+    for (; data; data = data->next)
+        print_value(output, data->type, data->value, data->format);
+    --cbor->depth;
+
+    fwrite(cbor->buf.buf, 1, cbor->buf.len, cbor->out);
+    fflush(cbor->out);
+}
+
+static void print_cbor_array(data_output_t *output, data_array_t *array, char *format)
+{
+    data_output_cbor_t *cbor = (data_output_cbor_t *)output;
+
+    cbor_head(&cbor->buf, CBOR_ARRAY, array->num_values);
+    for (int c = 0; c < array->num_values; ++c)
+        print_array_value(output, array, format, c);
+}
+
+static void print_cbor_string(data_output_t *output, const char *str, char *format)
+{
+    cbor_text(&((data_output_cbor_t *)output)->buf, str);
+}
+
+// The shortest float that holds the value exactly: half, single or double precision
+static void print_cbor_double(data_output_t *output, double data, char *format)
+{
+    lbuf_t *buf = &((data_output_cbor_t *)output)->buf;
+    uint8_t bytes[9];
+    size_t len;
+
+    float f = (float)data;
+    if ((double)f == data) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        uint32_t exp = bits >> 23 & 0xff;
+        uint32_t mant = bits & 0x7fffff;
+        if ((mant & 0x1fff) == 0 && ((exp >= 127 - 14 && exp <= 127 + 15) || exp == 0xff || (exp == 0 && mant == 0))) {
+            uint16_t half = (uint16_t)(bits >> 16 & 0x8000);
+            if (exp == 0xff)
+                half |= 0x7c00;
+            else if (exp)
+                half |= (uint16_t)((exp - 127 + 15) << 10 | mant >> 13);
+            bytes[0] = 0xf9;
+            bytes[1] = (uint8_t)(half >> 8);
+            bytes[2] = (uint8_t)half;
+            len = 3;
+        } else {
+            bytes[0] = 0xfa;
+            for (int i = 4; i > 0; --i, bits >>= 8)
+                bytes[i] = (uint8_t)bits;
+            len = 5;
+        }
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &data, sizeof(bits));
+        bytes[0] = 0xfb;
+        for (int i = 8; i > 0; --i, bits >>= 8)
+            bytes[i] = (uint8_t)bits;
+        len = 9;
+    }
+    lbuf_append(buf, (char *)bytes, len);
+}
+
+static void print_cbor_int(data_output_t *output, int data, char *format)
+{
+    lbuf_t *buf = &((data_output_cbor_t *)output)->buf;
+    if (data < 0)
+        cbor_head(buf, CBOR_NINT, (uint64_t)(-1 - (int64_t)data));
+    else
+        cbor_head(buf, CBOR_UINT, (uint64_t)data);
+}
+
+static void data_output_cbor_free(data_output_t *output)
+{
+    data_output_cbor_t *cbor = (data_output_cbor_t *)output;
+
+    if (!cbor)
+        return;
+
+    for (unsigned id = 0; id < cbor->num_schemas; ++id)
+        free(cbor->schemas[id].keys);
+    free(cbor->buf.buf);
+    free(cbor);
+}
+
+struct data_output *data_output_cbor_create(FILE *file)
+{
+    data_output_cbor_t *cbor = calloc(1, sizeof(data_output_cbor_t));
+    if (!cbor) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+
+    cbor->output.print_data   = print_cbor_data;
+    cbor->output.print_array  = print_cbor_array;
+    cbor->output.print_string = print_cbor_string;
+    cbor->output.print_double = print_cbor_double;
+    cbor->output.print_int    = print_cbor_int;
+    cbor->output.output_free  = data_output_cbor_free;
+    cbor->out = file;
+
+    return &cbor->output;
+}
+
+/* CBOR reader for the stream above */
+
+struct data_cbor_reader {
+    char **keys[CBOR_MAX_SCHEMAS];  // NULL terminated key lists by schema id
+    unsigned num_keys[CBOR_MAX_SCHEMAS];
+};
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    int error;                  // CBOR_INCOMPLETE or CBOR_MALFORMED
+    int depth;
+} cbor_parser_t;
 
-    return &csv->output;
+enum { CBOR_INCOMPLETE = 1, CBOR_MALFORMED = 2 };
+
+#define CBOR_MAX_DEPTH 16
+
+static int cbor_read_head(cbor_parser_t *ps, unsigned *major, uint64_t *value)
+{
+    if (ps->p >= ps->end) {
+        ps->error = CBOR_INCOMPLETE;
+        return -1;
+    }
+    uint8_t initial = *ps->p++;
+    *major = initial >> 5;
+    unsigned info = initial & 0x1f;
+    if (info < 24) {
+        *value = info;
+        return 0;
+    }
+    if (info > 27) {
+        ps->error = CBOR_MALFORMED; // indefinite lengths are not written
+        return -1;
+    }
+    size_t len = (size_t)1 << (info - 24);
+    if ((size_t)(ps->end - ps->p) < len) {
+        ps->error = CBOR_INCOMPLETE;
+        return -1;
+    }
+    *value = 0;
+    for (size_t i = 0; i < len; ++i)
+        *value = *value << 8 | *ps->p++;
+    return 0;
+}
+
+static unsigned cbor_peek_major(cbor_parser_t *ps)
+{
+    return ps->p < ps->end ? *ps->p >> 5 : CBOR_SIMPLE;
+}
+
+static double cbor_half(uint16_t half)
+{
+    int exp = half >> 10 & 0x1f;
+    int mant = half & 0x3ff;
+    double value;
+    if (exp == 0)
+        value = ldexp(mant, -24);
+    else if (exp == 31)
+        value = mant ? NAN : INFINITY;
+    else
+        value = ldexp(mant + 1024, exp - 25);
+    return half & 0x8000 ? -value : value;
+}
+
+static int cbor_read_int(cbor_parser_t *ps, int *value)
+{
+    unsigned major;
+    uint64_t v;
+    if (cbor_read_head(ps, &major, &v) < 0)
+        return -1;
+    if ((major != CBOR_UINT && major != CBOR_NINT) || v > INT_MAX) {
+        ps->error = CBOR_MALFORMED;
+        return -1;
+    }
+    *value = major == CBOR_UINT ? (int)v : -1 - (int)v;
+    return 0;
+}
+
+static int cbor_read_double(cbor_parser_t *ps, double *value)
+{
+    if (ps->p >= ps->end) {
+        ps->error = CBOR_INCOMPLETE;
+        return -1;
+    }
+    uint8_t initial = *ps->p;
+    unsigned major;
+    uint64_t bits;
+    if (cbor_read_head(ps, &major, &bits) < 0)
+        return -1;
+    if (initial == 0xf9) {
+        *value = cbor_half((uint16_t)bits);
+    } else if (initial == 0xfa) {
+        uint32_t b = (uint32_t)bits;
+        float f;
+        memcpy(&f, &b, sizeof(f));
+        *value = f;
+    } else if (initial == 0xfb) {
+        memcpy(value, &bits, sizeof(*value));
+    } else {
+        ps->error = CBOR_MALFORMED;
+        return -1;
+    }
+    return 0;
+}
+
+// Returns a copy of a text string
+static char *cbor_read_text(cbor_parser_t *ps)
+{
+    unsigned major;
+    uint64_t len;
+    if (cbor_read_head(ps, &major, &len) < 0)
+        return NULL;
+    if (major != CBOR_TEXT) {
+        ps->error = CBOR_MALFORMED;
+        return NULL;
+    }
+    if ((uint64_t)(ps->end - ps->p) < len) {
+        ps->error = CBOR_INCOMPLETE;
+        return NULL;
+    }
+    char *str = malloc(len + 1);
+    if (!str) {
+        ps->error = CBOR_MALFORMED;
+        return NULL;
+    }
+    memcpy(str, ps->p, len);
+    str[len] = '\0';
+    ps->p += len;
+    return str;
+}
+
+static data_t *cbor_read_map(cbor_parser_t *ps);
+static data_array_t *cbor_read_array(cbor_parser_t *ps);
+
+// One field with the next value
+static data_t *cbor_read_field(cbor_parser_t *ps, const char *key)
+{
+    switch (cbor_peek_major(ps)) {
+    case CBOR_UINT:
+    case CBOR_NINT: {
+        int value;
+        return cbor_read_int(ps, &value) < 0 ? NULL : data_make(key, "", DATA_INT, value, NULL);
+    }
+    case CBOR_TEXT: {
+        char *value = cbor_read_text(ps);
+        data_t *field = value ? data_make(key, "", DATA_STRING, value, NULL) : NULL;
+        free(value);
+        return field;
+    }
+    case CBOR_ARRAY: {
+        data_array_t *value = cbor_read_array(ps);
+        return value ? data_make(key, "", DATA_ARRAY, value, NULL) : NULL;
+    }
+    case CBOR_MAP: {
+        data_t *value = cbor_read_map(ps);
+        return value ? data_make(key, "", DATA_DATA, value, NULL) : NULL;
+    }
+    default: {
+        double value;
+        return cbor_read_double(ps, &value) < 0 ? NULL : data_make(key, "", DATA_DOUBLE, value, NULL);
+    }
+    }
+}
+
+static data_t *cbor_read_map(cbor_parser_t *ps)
+{
+    unsigned major;
+    uint64_t num_fields;
+    if (cbor_read_head(ps, &major, &num_fields) < 0)
+        return NULL;
+    if (major != CBOR_MAP || num_fields == 0 || ++ps->depth > CBOR_MAX_DEPTH) {
+        ps->error = CBOR_MALFORMED;
+        return NULL;
+    }
+    data_t *first = NULL;
+    data_t *tail = NULL;
+    for (uint64_t i = 0; i < num_fields; ++i) {
+        char *key = cbor_read_text(ps);
+        data_t *field = key ? cbor_read_field(ps, key) : NULL;
+        free(key);
+        if (!field) {
+            if (!ps->error)
+                ps->error = CBOR_MALFORMED;
+            data_free(first);
+            return NULL;
+        }
+        if (tail)
+            tail->next = field;
+        else
+            first = field;
+        tail = field;
+    }
+    --ps->depth;
+    return first;
+}
+
+// Arrays are of one type, taken from the first element; empty arrays read as DATA_INT
+static data_array_t *cbor_read_array(cbor_parser_t *ps)
+{
+    unsigned major;
+    uint64_t num_values;
+    if (cbor_read_head(ps, &major, &num_values) < 0)
+        return NULL;
+    if (major != CBOR_ARRAY || num_values > (uint64_t)(ps->end - ps->p) || ++ps->depth > CBOR_MAX_DEPTH) {
+        ps->error = major != CBOR_ARRAY || ps->depth > CBOR_MAX_DEPTH ? CBOR_MALFORMED : CBOR_INCOMPLETE;
+        return NULL;
+    }
+
+    data_type_t type;
+    switch (num_values ? cbor_peek_major(ps) : CBOR_UINT) {
+    case CBOR_UINT:
+    case CBOR_NINT:  type = DATA_INT; break;
+    case CBOR_TEXT:  type = DATA_STRING; break;
+    case CBOR_ARRAY: type = DATA_ARRAY; break;
+    case CBOR_MAP:   type = DATA_DATA; break;
+    default:         type = DATA_DOUBLE; break;
+    }
+    int element_size = dmt[type].array_element_size;
+    void *values = calloc(num_values ? num_values : 1, element_size);
+    if (!values) {
+        ps->error = CBOR_MALFORMED;
+        return NULL;
+    }
+
+    uint64_t n = 0;
+    for (; n < num_values; ++n) {
+        void *element = (char *)values + n * element_size;
+        int ok;
+        switch (type) {
+        case DATA_INT:    ok = cbor_read_int(ps, element) == 0; break;
+        case DATA_DOUBLE: ok = cbor_read_double(ps, element) == 0; break;
+        case DATA_STRING: ok = (*(char **)element = cbor_read_text(ps)) != NULL; break;
+        case DATA_ARRAY:  ok = (*(data_array_t **)element = cbor_read_array(ps)) != NULL; break;
+        default:          ok = (*(data_t **)element = cbor_read_map(ps)) != NULL; break;
+        }
+        if (!ok)
+            break;
+    }
+
+    data_array_t *array = NULL;
+    if (n == num_values) {
+        array = data_array((int)num_values, type, values); // copies strings, takes data and arrays
+        if (!array)
+            ps->error = CBOR_MALFORMED;
+    }
+    // data_array() copied the strings, on failure the elements read so far go too
+    for (uint64_t i = 0; i < n; ++i) {
+        void *element = (char *)values + i * element_size;
+        if (type == DATA_STRING)
+            free(*(char **)element);
+        else if (!array && type == DATA_ARRAY)
+            data_array_free(*(data_array_t **)element);
+        else if (!array && type == DATA_DATA)
+            data_free(*(data_t **)element);
+    }
+    free(values);
+    --ps->depth;
+    return array;
+}
+
+static void cbor_reader_define(data_cbor_reader_t *reader, unsigned id, char **keys, unsigned num_keys)
+{
+    if (reader->keys[id]) {
+        for (unsigned i = 0; i < reader->num_keys[id]; ++i)
+            free(reader->keys[id][i]);
+        free(reader->keys[id]);
+    }
+    reader->keys[id] = keys;
+    reader->num_keys[id] = num_keys;
+}
+
+data_cbor_reader_t *data_cbor_reader_create(void)
+{
+    data_cbor_reader_t *reader = calloc(1, sizeof(data_cbor_reader_t));
+    if (!reader)
+        fprintf(stderr, "calloc() failed");
+    return reader;
+}
+
+void data_cbor_reader_free(data_cbor_reader_t *reader)
+{
+    if (!reader)
+        return;
+    for (unsigned id = 0; id < CBOR_MAX_SCHEMAS; ++id)
+        cbor_reader_define(reader, id, NULL, 0);
+    free(reader);
+}
+
+int data_cbor_read(data_cbor_reader_t *reader, const uint8_t *buf, size_t len, data_t **data)
+{
+    cbor_parser_t ps = {buf, buf + len, 0, 0};
+    unsigned major;
+    uint64_t value, kind, id;
+
+    *data = NULL;
+    if (cbor_read_head(&ps, &major, &value) < 0)
+        goto fail;
+    if (major == CBOR_TAG && value == CBOR_SELF_DESCRIBE && cbor_read_head(&ps, &major, &value) < 0)
+        goto fail;
+    if (major != CBOR_ARRAY || value < 2) {
+        ps.error = CBOR_MALFORMED;
+        goto fail;
+    }
+    uint64_t num_items = value;
+    if (cbor_read_head(&ps, &major, &kind) < 0 || cbor_read_head(&ps, &major, &id) < 0)
+        goto fail;
+    if (id >= CBOR_MAX_SCHEMAS) {
+        ps.error = CBOR_MALFORMED;
+        goto fail;
+    }
+
+    if (kind == CBOR_DEFINE && num_items == 3) {
+        uint64_t num_keys;
+        if (cbor_read_head(&ps, &major, &num_keys) < 0)
+            goto fail;
+        if (major != CBOR_ARRAY || num_keys == 0 || num_keys > (uint64_t)(ps.end - ps.p)) {
+            ps.error = major != CBOR_ARRAY || num_keys == 0 ? CBOR_MALFORMED : CBOR_INCOMPLETE;
+            goto fail;
+        }
+        char **keys = calloc(num_keys, sizeof(char *));
+        if (!keys) {
+            ps.error = CBOR_MALFORMED;
+            goto fail;
+        }
+        for (uint64_t i = 0; i < num_keys; ++i) {
+            keys[i] = cbor_read_text(&ps);
+            if (!keys[i]) {
+                for (uint64_t j = 0; j < i; ++j)
+                    free(keys[j]);
+                free(keys);
+                goto fail;
+            }
+        }
+        cbor_reader_define(reader, (unsigned)id, keys, (unsigned)num_keys);
+        return (int)(ps.p - buf);
+    }
+
+    if (kind != CBOR_RECORD || !reader->keys[id] || num_items - 2 != reader->num_keys[id]) {
+        ps.error = CBOR_MALFORMED;
+        goto fail;
+    }
+    data_t *tail = NULL;
+    for (unsigned i = 0; i < reader->num_keys[id]; ++i) {
+        data_t *field = cbor_read_field(&ps, reader->keys[id][i]);
+        if (!field) {
+            if (!ps.error)
+                ps.error = CBOR_MALFORMED;
+            data_free(*data);
+            *data = NULL;
+            goto fail;
+        }
+        if (tail)
+            tail->next = field;
+        else
+            *data = field;
+        tail = field;
+    }
+    return (int)(ps.p - buf);
+
+fail:
+    return ps.error == CBOR_INCOMPLETE ? 0 : -1;
 }
 
 /* Datagram (UDP) client */
 
 #ifndef _WIN32
 
+#define SYSLOG_MSG_MAX 1024
+#define SYSLOG_BATCH_MAX 32
+
 typedef struct {
     struct sockaddr_storage addr;
     socklen_t addr_len;
@@ -718,6 +1493,41 @@ static void datagram_client_send(datagram_client_t *client, const char *message,
     }
 }
 
+/// Send one datagram per message, returns the number of syscalls used
+static unsigned datagram_client_send_batch(datagram_client_t *client, char (*messages)[SYSLOG_MSG_MAX], size_t *lens, unsigned count)
+{
+    unsigned sends = 0;
+#ifdef __linux__
+    struct mmsghdr msgs[SYSLOG_BATCH_MAX];
+    struct iovec iov[SYSLOG_BATCH_MAX];
+    memset(msgs, 0, sizeof(struct mmsghdr) * count);
+    for (unsigned i = 0; i < count; ++i) {
+        iov[i].iov_base = messages[i];
+        iov[i].iov_len = lens[i];
+        msgs[i].msg_hdr.msg_name = &client->addr;
+        msgs[i].msg_hdr.msg_namelen = client->addr_len;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    unsigned sent = 0;
+    while (sent < count) {
+        int r = sendmmsg(client->sock, msgs + sent, count - sent, 0);
+        ++sends;
+        if (r <= 0) {
+            perror("sendmmsg");
+            break; // drop the rest of the batch
+        }
+        sent += r;
+    }
+#else
+    for (unsigned i = 0; i < count; ++i) {
+        datagram_client_send(client, messages[i], lens[i]);
+        ++sends;
+    }
+#endif
+    return sends;
+}
+
 /* array buffer (string builder) */
 
 typedef struct {
@@ -785,11 +1595,93 @@ typedef struct {
     int pri;
     char hostname[_POSIX_HOST_NAME_MAX + 1];
     abuf_t msg;
+
+    /* Batching, messages wait at most latency_ms for a flush by the flush thread */
+    unsigned latency_ms;        // 0 = send each message right away
+    pthread_t flush_thread;
+    pthread_mutex_t lock;       // protects the queue, counters and closing
+    pthread_cond_t cond;
+    pthread_mutex_t send_lock;  // one flush at a time, owns the send buffer
+    int closing;
+    char (*queue)[SYSLOG_MSG_MAX];
+    char (*sending)[SYSLOG_MSG_MAX];
+    size_t queue_len[SYSLOG_BATCH_MAX];
+    size_t sending_len[SYSLOG_BATCH_MAX];
+    unsigned queued;
+    struct timespec deadline;   // flush of the oldest queued message is due, CLOCK_REALTIME
+    unsigned long messages;
+    unsigned long sends;
 } data_output_syslog_t;
 
-static void print_syslog_array(data_output_t *output, data_array_t *array, char *format)
+// Send all queued messages, called without the lock held
+static void syslog_flush(data_output_syslog_t *syslog)
 {
-    data_output_syslog_t *syslog = (data_output_syslog_t *)output;
+    pthread_mutex_lock(&syslog->send_lock);
+    pthread_mutex_lock(&syslog->lock);
+    unsigned count = syslog->queued;
+    char (*batch)[SYSLOG_MSG_MAX] = syslog->queue;
+    syslog->queue = syslog->sending;
+    syslog->sending = batch;
+    memcpy(syslog->sending_len, syslog->queue_len, sizeof(size_t) * count);
+    syslog->queued = 0;
+    pthread_mutex_unlock(&syslog->lock);
+
+    if (count) {
+        unsigned sends = datagram_client_send_batch(&syslog->client, batch, syslog->sending_len, count);
+        pthread_mutex_lock(&syslog->lock);
+        syslog->messages += count;
+        syslog->sends += sends;
+        pthread_mutex_unlock(&syslog->lock);
+    }
+    pthread_mutex_unlock(&syslog->send_lock);
+}
+
+static void *syslog_flush_thread(void *arg)
+{
+    data_output_syslog_t *syslog = arg;
+
+    pthread_mutex_lock(&syslog->lock);
+    while (!syslog->closing) {
+        if (!syslog->queued) {
+            pthread_cond_wait(&syslog->cond, &syslog->lock);
+            continue;
+        }
+        if (syslog->queued < SYSLOG_BATCH_MAX
+                && pthread_cond_timedwait(&syslog->cond, &syslog->lock, &syslog->deadline) == 0)
+            continue; // woken up early, check again
+        pthread_mutex_unlock(&syslog->lock);
+        syslog_flush(syslog);
+        pthread_mutex_lock(&syslog->lock);
+    }
+    pthread_mutex_unlock(&syslog->lock);
+    return NULL;
+}
+
+static void syslog_queue(data_output_syslog_t *syslog, const char *message, size_t len)
+{
+    int full;
+
+    pthread_mutex_lock(&syslog->lock);
+    if (syslog->queued == 0) {
+        clock_gettime(CLOCK_REALTIME, &syslog->deadline);
+        syslog->deadline.tv_nsec += (long)(syslog->latency_ms % 1000) * 1000000;
+        syslog->deadline.tv_sec += syslog->latency_ms / 1000 + syslog->deadline.tv_nsec / 1000000000;
+        syslog->deadline.tv_nsec %= 1000000000;
+        pthread_cond_signal(&syslog->cond);
+    }
+    memcpy(syslog->queue[syslog->queued], message, len);
+    syslog->queue_len[syslog->queued] = len;
+    full = ++syslog->queued == SYSLOG_BATCH_MAX;
+    pthread_mutex_unlock(&syslog->lock);
+
+    // a full batch goes out right away, the next message needs the room
+    if (full)
+        syslog_flush(syslog);
+}
+
+static void print_syslog_array(data_output_t *output, data_array_t *array, char *format)
+{
+    data_output_syslog_t *syslog = (data_output_syslog_t *)output;
 
     abuf_cat(&syslog->msg, "[");
     for (int c = 0; c < array->num_values; ++c) {
@@ -827,8 +1719,8 @@ static void print_syslog_data(data_output_t *output, data_t *data, char *format)
         return;
     }
 
-    char message[1024];
-    abuf_init(&syslog->msg, message, 1024);
+    char message[SYSLOG_MSG_MAX];
+    abuf_init(&syslog->msg, message, SYSLOG_MSG_MAX);
 
     time_t now;
     struct tm tm_info;
@@ -841,7 +1733,15 @@ static void print_syslog_data(data_output_t *output, data_t *data, char *format)
 
     print_syslog_object(output, data, format);
 
-    datagram_client_send(&syslog->client, message, strlen(message));
+    if (syslog->latency_ms) {
+        syslog_queue(syslog, message, strlen(message));
+    } else {
+        datagram_client_send(&syslog->client, message, strlen(message));
+        pthread_mutex_lock(&syslog->lock);
+        syslog->messages++;
+        syslog->sends++;
+        pthread_mutex_unlock(&syslog->lock);
+    }
 
     abuf_setnull(&syslog->msg);
 }
@@ -896,11 +1796,77 @@ static void data_output_syslog_free(data_output_t *output)
     if (!syslog)
         return;
 
+    if (syslog->latency_ms) {
+        pthread_mutex_lock(&syslog->lock);
+        syslog->closing = 1;
+        pthread_cond_signal(&syslog->cond);
+        pthread_mutex_unlock(&syslog->lock);
+        pthread_join(syslog->flush_thread, NULL);
+        syslog_flush(syslog);
+    }
+
     datagram_client_close(&syslog->client);
 
+    pthread_mutex_destroy(&syslog->lock);
+    pthread_mutex_destroy(&syslog->send_lock);
+    pthread_cond_destroy(&syslog->cond);
+    free(syslog->queue);
+    free(syslog->sending);
     free(syslog);
 }
 
+int data_output_syslog_set_latency(struct data_output *output, unsigned latency_ms)
+{
+    data_output_syslog_t *syslog = (data_output_syslog_t *)output;
+
+    if (!output || output->print_data != print_syslog_data)
+        return -1;
+    if (syslog->latency_ms) {
+        // already batching, only the window can change
+        if (latency_ms) {
+            pthread_mutex_lock(&syslog->lock);
+            syslog->latency_ms = latency_ms;
+            pthread_mutex_unlock(&syslog->lock);
+        }
+        return 0;
+    }
+    if (!latency_ms)
+        return 0;
+
+    syslog->queue = calloc(SYSLOG_BATCH_MAX, SYSLOG_MSG_MAX);
+    syslog->sending = calloc(SYSLOG_BATCH_MAX, SYSLOG_MSG_MAX);
+    if (!syslog->queue || !syslog->sending) {
+        fprintf(stderr, "calloc() failed");
+        goto fail;
+    }
+    syslog->latency_ms = latency_ms;
+    if (pthread_create(&syslog->flush_thread, NULL, syslog_flush_thread, syslog)) {
+        fprintf(stderr, "Failed to start the syslog flush thread\n");
+        syslog->latency_ms = 0;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    free(syslog->queue);
+    free(syslog->sending);
+    syslog->queue = syslog->sending = NULL;
+    return -1;
+}
+
+int data_output_syslog_counters(struct data_output *output, unsigned long *messages, unsigned long *sends)
+{
+    data_output_syslog_t *syslog = (data_output_syslog_t *)output;
+
+    if (!output || output->print_data != print_syslog_data)
+        return -1;
+    pthread_mutex_lock(&syslog->lock);
+    *messages = syslog->messages;
+    *sends = syslog->sends;
+    pthread_mutex_unlock(&syslog->lock);
+    return 0;
+}
+
 struct data_output *data_output_syslog_create(const char *host, const char *port)
 {
     data_output_syslog_t *syslog = calloc(1, sizeof(data_output_syslog_t));
@@ -919,11 +1885,1005 @@ struct data_output *data_output_syslog_create(const char *host, const char *port
     syslog->pri = 20 * 8 + 5;
     gethostname(syslog->hostname, _POSIX_HOST_NAME_MAX + 1);
     syslog->hostname[_POSIX_HOST_NAME_MAX] = '\0';
+    pthread_mutex_init(&syslog->lock, NULL);
+    pthread_mutex_init(&syslog->send_lock, NULL);
+    pthread_cond_init(&syslog->cond, NULL);
     datagram_client_open(&syslog->client, host, port);
 
     return &syslog->output;
 }
 
+/* Render a record with a JSON output writing to a memory stream, returns the length or -1.
+   The stream is flushed, its buffer pointer is current on return. */
+static long render_json(data_output_t *json, data_t *data)
+{
+    rewind(json->file);
+    json->print_data(json, data, NULL);
+    long len = ftell(json->file);
+    fflush(json->file);
+    return len;
+}
+
+/* MQTT publisher, one JSON message per record */
+
+typedef struct {
+    struct data_output output;
+    mqtt_client_t *client;
+    char *topic;                // template, see data_output_mqtt_create()
+    data_output_t *json;        // formats into the memory stream
+    char *json_buf;
+    size_t json_size;
+} data_output_mqtt_t;
+
+// Append a field value to a topic, characters with a meaning in topics and blanks become '_'
+static void mqtt_topic_value(abuf_t *topic, data_t const *field)
+{
+    char value[64];
+    if (field->type == DATA_STRING)
+        snprintf(value, sizeof(value), "%s", (char const *)field->value);
+    else if (field->type == DATA_INT)
+        snprintf(value, sizeof(value), "%d", *(int const *)field->value);
+    else if (field->type == DATA_DOUBLE)
+        snprintf(value, sizeof(value), "%g", *(double const *)field->value);
+    else
+        return;
+    for (char *p = value; *p; ++p) {
+        if (*p == '/' || *p == '+' || *p == '#' || *p == ' ' || *p == '\t')
+            *p = '_';
+    }
+    abuf_cat(topic, value);
+}
+
+// "[key]" is replaced by the value of field key, "[/key]" by "/" and the value; nothing if the field is missing
+static void mqtt_expand_topic(char const *template, data_t *data, char *topic, size_t size)
+{
+    abuf_t buf;
+    abuf_init(&buf, topic, size);
+    *topic = '\0';
+
+    while (*template) {
+        char const *end = *template == '[' ? strchr(template, ']') : NULL;
+        if (!end) {
+            char c[2] = {*template++, '\0'};
+            abuf_cat(&buf, c);
+            continue;
+        }
+        char const *key = template + 1;
+        int slash = *key == '/';
+        key += slash;
+        size_t key_len = end - key;
+        for (data_t *field = data; field; field = field->next) {
+            if (strlen(field->key) == key_len && strncmp(field->key, key, key_len) == 0) {
+                if (slash)
+                    abuf_cat(&buf, "/");
+                mqtt_topic_value(&buf, field);
+                break;
+            }
+        }
+        template = end + 1;
+    }
+}
+
+static void print_mqtt_data(data_output_t *output, data_t *data, char *format)
+{
+    data_output_mqtt_t *mqtt = (data_output_mqtt_t *)output;
+    char topic[256];
+
+    mqtt_expand_topic(mqtt->topic, data, topic, sizeof(topic));
+
+    long len = render_json(mqtt->json, data);
+    if (len > 0)
+        mqtt_client_publish(mqtt->client, topic, mqtt->json_buf, len);
+}
+
+static void data_output_mqtt_free(data_output_t *output)
+{
+    data_output_mqtt_t *mqtt = (data_output_mqtt_t *)output;
+
+    if (!mqtt)
+        return;
+
+    mqtt_client_free(mqtt->client);
+    if (mqtt->json) {
+        fclose(mqtt->json->file);
+        data_output_free(mqtt->json);
+    }
+    free(mqtt->json_buf);
+    free(mqtt->topic);
+    free(mqtt);
+}
+
+int data_output_mqtt_counters(struct data_output *output, mqtt_client_counters_t *counters)
+{
+    if (!output || output->print_data != print_mqtt_data)
+        return -1;
+    mqtt_client_counters(((data_output_mqtt_t *)output)->client, counters);
+    return 0;
+}
+
+struct data_output *data_output_mqtt_create(mqtt_client_opts_t const *opts, const char *topic)
+{
+    data_output_mqtt_t *mqtt = calloc(1, sizeof(data_output_mqtt_t));
+    if (!mqtt) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+
+    mqtt->output.print_data   = print_mqtt_data;
+    mqtt->output.print_array  = print_json_array;
+    mqtt->output.print_string = print_json_string;
+    mqtt->output.print_double = print_json_double;
+    mqtt->output.print_int    = print_json_int;
+    mqtt->output.output_free  = data_output_mqtt_free;
+
+    mqtt->topic = strdup(topic);
+    FILE *json_file = open_memstream(&mqtt->json_buf, &mqtt->json_size);
+    mqtt->json = json_file ? data_output_json_create(json_file) : NULL;
+    mqtt->client = mqtt_client_create(opts);
+    if (!mqtt->topic || !mqtt->json || !mqtt->client) {
+        if (json_file && !mqtt->json)
+            fclose(json_file);
+        data_output_mqtt_free(&mqtt->output);
+        return NULL;
+    }
+
+    return &mqtt->output;
+}
+
+/* InfluxDB line protocol, many lines per UDP datagram or HTTP POST */
+
+#define INFLUX_MAX_PENDING (1 << 20) // bytes queued while sending is slow, more records are dropped
+#define INFLUX_HTTP_TIMEOUT_S 5
+#define INFLUX_MAX_DATAGRAM 65000 // UDP payload is at most 65507 bytes
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef struct {
+    struct data_output output;
+    influx_opts_t opts;         // with copies of the strings
+    char *strings[5];
+    datagram_client_t udp;
+    int sock;                   // HTTP connection kept alive, -1 if closed
+    lbuf_t line;                // the record being formatted
+    uint64_t time_ns;           // timestamp of the next record, 0 = now
+
+    pthread_t flush_thread;
+    pthread_mutex_t lock;       // protects the queue, counters and closing
+    pthread_cond_t cond;
+    int closing;
+    lbuf_t queue;               // lines waiting for the flush thread
+    lbuf_t sending;             // owned by the flush thread
+    struct timespec deadline;   // flush of the oldest queued line is due, CLOCK_REALTIME
+    unsigned long lines;
+    unsigned long sends;
+    unsigned long dropped;
+    int failing;                // the last send failed, report only the first failure
+} data_output_influx_t;
+
+// Measurement names escape comma and space, tag keys, tag values and field keys also '=';
+// nothing can hold a newline, it becomes a space
+static void influx_escape(lbuf_t *line, const char *str, const char *special)
+{
+    while (*str) {
+        size_t span = strcspn(str, special);
+        size_t newline = strcspn(str, "\n");
+        if (newline < span) {
+            lbuf_append(line, str, newline);
+            lbuf_append(line, " ", 1);
+            str += newline + 1;
+            continue;
+        }
+        lbuf_append(line, str, span);
+        str += span;
+        if (!*str)
+            break;
+        lbuf_append(line, "\\", 1);
+        lbuf_append(line, str++, 1);
+    }
+}
+
+// snprintf() is most of the formatting time, integers and short decimals are done here
+static void influx_uint(lbuf_t *line, unsigned long long v)
+{
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    lbuf_append(line, p, buf + sizeof(buf) - p);
+}
+
+static void influx_int(lbuf_t *line, long long v)
+{
+    if (v < 0) {
+        lbuf_append(line, "-", 1);
+        influx_uint(line, 0ULL - (unsigned long long)v);
+    } else {
+        influx_uint(line, v);
+    }
+}
+
+static void influx_double(lbuf_t *line, double v)
+{
+    // most readings have at most 3 decimals, anything else gets the full precision
+    double milli = v * 1000.0;
+    double rounded = floor(milli + 0.5);
+    if (fabs(milli) < 1e15 && milli == rounded) {
+        long long m = (long long)rounded;
+        unsigned long long a = m < 0 ? 0ULL - (unsigned long long)m : (unsigned long long)m;
+        if (m < 0)
+            lbuf_append(line, "-", 1);
+        influx_uint(line, a / 1000);
+        unsigned frac = a % 1000;
+        if (frac) {
+            char digits[4] = {'.', '0' + frac / 100, '0' + frac / 10 % 10, '0' + frac % 10};
+            size_t len = 4;
+            while (digits[len - 1] == '0')
+                --len;
+            lbuf_append(line, digits, len);
+        }
+        return;
+    }
+    lbuf_printf(line, "%.10g", v);
+}
+
+static void influx_field_key(lbuf_t *line, const char *prefix, const char *key)
+{
+    if (prefix) {
+        influx_escape(line, prefix, ", =");
+        lbuf_append(line, "_", 1);
+    }
+    influx_escape(line, key, ", =");
+}
+
+// Append the fields of a record, nested objects with the parent key as prefix; returns the fields added
+static int influx_fields(data_output_influx_t *influx, data_t *data, const char *prefix, int count)
+{
+    lbuf_t *line = &influx->line;
+
+    for (; data; data = data->next) {
+        if (!prefix && (!strcmp(data->key, "time") || !strcmp(data->key, "model") || !strcmp(data->key, "id")))
+            continue; // the timestamp and tags
+        if (data->type == DATA_DATA) {
+            char key[128];
+            if (prefix)
+                snprintf(key, sizeof(key), "%s_%s", prefix, data->key);
+            else
+                snprintf(key, sizeof(key), "%s", data->key);
+            count = influx_fields(influx, data->value, key, count);
+            continue;
+        }
+        if (data->type == DATA_DOUBLE && !isfinite(*(double *)data->value))
+            continue;
+        if (data->type != DATA_INT && data->type != DATA_DOUBLE && data->type != DATA_STRING)
+            continue; // arrays have no line protocol type
+
+        lbuf_append(line, count++ ? "," : " ", 1);
+        influx_field_key(line, prefix, data->key);
+        lbuf_append(line, "=", 1);
+        if (data->type == DATA_INT) {
+            influx_int(line, *(int *)data->value);
+            lbuf_append(line, "i", 1);
+        } else if (data->type == DATA_DOUBLE) {
+            influx_double(line, *(double *)data->value);
+        } else {
+            lbuf_append(line, "\"", 1);
+            influx_escape(line, data->value, "\"\\");
+            lbuf_append(line, "\"", 1);
+        }
+    }
+    return count;
+}
+
+// Send lines (whole lines, each ending in '\n') over UDP, at most flush_size bytes per datagram
+static unsigned influx_send_udp(data_output_influx_t *influx, const char *buf, size_t len)
+{
+    unsigned sends = 0;
+    while (len) {
+        size_t size = 0;
+        while (size < len) {
+            const char *eol = memchr(buf + size, '\n', len - size);
+            size_t next = eol ? (size_t)(eol - buf) + 1 : len;
+            if (size && next > influx->opts.flush_size)
+                break; // a single long line still goes out on its own
+            size = next;
+        }
+        datagram_client_send(&influx->udp, buf, size);
+        sends++;
+        buf += size;
+        len -= size;
+    }
+    return sends;
+}
+
+static int influx_http_connect(data_output_influx_t *influx)
+{
+    struct addrinfo hints = {0}, *res, *res0;
+    struct timeval timeout = {INFLUX_HTTP_TIMEOUT_S, 0};
+    int sock = -1;
+
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    int error = getaddrinfo(influx->opts.host, influx->opts.port, &hints, &res0);
+    if (error) {
+        fprintf(stderr, "InfluxDB: %s\n", gai_strerror(error));
+        return -1;
+    }
+    for (res = res0; res; res = res->ai_next) {
+        sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (sock < 0)
+            continue;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(sock, res->ai_addr, res->ai_addrlen) == 0)
+            break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res0);
+    return sock;
+}
+
+static int influx_write_all(int sock, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t r = send(sock, buf, len, MSG_NOSIGNAL);
+        if (r <= 0)
+            return -1;
+        buf += r;
+        len -= r;
+    }
+    return 0;
+}
+
+// Read a response, returns the HTTP status or -1; clears keep_alive if the server closes the connection
+static int influx_http_response(int sock, int *keep_alive)
+{
+    char head[2048];
+    size_t len = 0;
+    char *end = NULL;
+
+    while (!end) {
+        if (len == sizeof(head) - 1)
+            return -1;
+        ssize_t r = recv(sock, head + len, sizeof(head) - 1 - len, 0);
+        if (r <= 0)
+            return -1;
+        len += r;
+        head[len] = '\0';
+        end = strstr(head, "\r\n\r\n");
+    }
+    int status;
+    if (sscanf(head, "HTTP/1.%*d %d", &status) != 1)
+        return -1;
+
+    // skip the body, it is an error message at most
+    size_t body_len = 0;
+    for (char *h = strstr(head, "\r\n"); h && h < end; h = strstr(h + 2, "\r\n")) {
+        if (!strncasecmp(h + 2, "Content-Length:", 15))
+            body_len = strtoul(h + 17, NULL, 10);
+        else if (!strncasecmp(h + 2, "Connection: close", 17))
+            *keep_alive = 0;
+    }
+    size_t got = len - (end + 4 - head);
+    if (status / 100 != 2 && got)
+        fprintf(stderr, "InfluxDB: %.*s\n", (int)(got < 200 ? got : 200), end + 4);
+    while (got < body_len) {
+        ssize_t r = recv(sock, head, body_len - got < sizeof(head) ? body_len - got : sizeof(head), 0);
+        if (r <= 0)
+            return -1;
+        got += r;
+    }
+    return status;
+}
+
+// POST the lines, retry once on a fresh connection if a kept alive one was closed meanwhile
+static int influx_send_http(data_output_influx_t *influx, const char *buf, size_t len)
+{
+    char head[1024];
+    int head_len = snprintf(head, sizeof(head),
+            "POST %s HTTP/1.1\r\n"
+            "Host: %s:%s\r\n"
+            "Content-Type: text/plain; charset=utf-8\r\n"
+            "Content-Length: %zu\r\n"
+            "%s%s%s"
+            "\r\n",
+            influx->opts.path, influx->opts.host, influx->opts.port, len,
+            influx->opts.token ? "Authorization: Token " : "",
+            influx->opts.token ? influx->opts.token : "",
+            influx->opts.token ? "\r\n" : "");
+    if (head_len < 0 || (size_t)head_len >= sizeof(head))
+        return -1;
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int reused = influx->sock >= 0;
+        if (!reused)
+            influx->sock = influx_http_connect(influx);
+        if (influx->sock < 0)
+            return -1;
+        int keep_alive = 1;
+        int status = -1;
+        if (influx_write_all(influx->sock, head, head_len) == 0
+                && influx_write_all(influx->sock, buf, len) == 0)
+            status = influx_http_response(influx->sock, &keep_alive);
+        if (status < 0 || !keep_alive) {
+            close(influx->sock);
+            influx->sock = -1;
+        }
+        if (status >= 0)
+            return status / 100 == 2 ? 0 : -1;
+        if (!reused)
+            break;
+    }
+    return -1;
+}
+
+// Send all queued lines, called by the flush thread without the lock held
+static void influx_flush(data_output_influx_t *influx)
+{
+    pthread_mutex_lock(&influx->lock);
+    lbuf_t batch = influx->queue;
+    influx->queue = influx->sending;
+    influx->queue.len = 0;
+    influx->sending = batch;
+    unsigned long lines = 0;
+    for (size_t i = 0; i < batch.len; ++i)
+        lines += batch.buf[i] == '\n';
+    pthread_mutex_unlock(&influx->lock);
+
+    if (!batch.len)
+        return;
+    unsigned sends;
+    int failed;
+    if (influx->opts.path) {
+        failed = influx_send_http(influx, batch.buf, batch.len) < 0;
+        sends = 1;
+    } else {
+        sends = influx_send_udp(influx, batch.buf, batch.len);
+        failed = 0;
+    }
+    if (failed && !influx->failing)
+        fprintf(stderr, "InfluxDB: failed to write to %s:%s, dropping lines until it works again\n", influx->opts.host, influx->opts.port);
+    influx->failing = failed;
+
+    pthread_mutex_lock(&influx->lock);
+    if (failed)
+        influx->dropped += lines;
+    else
+        influx->lines += lines;
+    influx->sends += sends;
+    pthread_mutex_unlock(&influx->lock);
+}
+
+static void *influx_flush_thread(void *arg)
+{
+    data_output_influx_t *influx = arg;
+
+    pthread_mutex_lock(&influx->lock);
+    for (;;) {
+        if (!influx->queue.len) {
+            if (influx->closing)
+                break;
+            pthread_cond_wait(&influx->cond, &influx->lock);
+            continue;
+        }
+        if (!influx->closing && influx->queue.len < influx->opts.flush_size && influx->opts.flush_ms
+                && pthread_cond_timedwait(&influx->cond, &influx->lock, &influx->deadline) == 0)
+            continue; // woken up early, check again
+        pthread_mutex_unlock(&influx->lock);
+        influx_flush(influx);
+        pthread_mutex_lock(&influx->lock);
+    }
+    pthread_mutex_unlock(&influx->lock);
+    return NULL;
+}
+
+static void print_influx_data(data_output_t *output, data_t *data, char *format)
+{
+    data_output_influx_t *influx = (data_output_influx_t *)output;
+    lbuf_t *line = &influx->line;
+    char const *model = NULL;
+    data_t *id = NULL;
+
+    for (data_t *d = data; d; d = d->next) {
+        if (!strcmp(d->key, "model") && d->type == DATA_STRING)
+            model = d->value;
+        else if (!strcmp(d->key, "id") && (d->type == DATA_INT || d->type == DATA_STRING))
+            id = d;
+    }
+
+    line->len = 0;
+    influx_escape(line, influx->opts.measurement, ", ");
+    if (model) {
+        lbuf_append(line, ",model=", 7);
+        influx_escape(line, model, ", =");
+    }
+    if (id && id->type == DATA_INT) {
+        lbuf_append(line, ",id=", 4);
+        influx_int(line, *(int *)id->value);
+    } else if (id) {
+        lbuf_append(line, ",id=", 4);
+        influx_escape(line, id->value, ", =");
+    }
+    if (!influx_fields(influx, data, NULL, 0))
+        return; // a point needs at least one field
+
+    uint64_t time_ns = influx->time_ns;
+    influx->time_ns = 0;
+    if (!time_ns) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    lbuf_append(line, " ", 1);
+    influx_uint(line, time_ns);
+    lbuf_append(line, "\n", 1);
+
+    pthread_mutex_lock(&influx->lock);
+    if (influx->queue.len + line->len > INFLUX_MAX_PENDING) {
+        influx->dropped++;
+    } else {
+        if (!influx->queue.len) {
+            clock_gettime(CLOCK_REALTIME, &influx->deadline);
+            influx->deadline.tv_nsec += (long)(influx->opts.flush_ms % 1000) * 1000000;
+            influx->deadline.tv_sec += influx->opts.flush_ms / 1000 + influx->deadline.tv_nsec / 1000000000;
+            influx->deadline.tv_nsec %= 1000000000;
+        }
+        lbuf_append(&influx->queue, line->buf, line->len);
+        // the first line starts the deadline, a full batch goes out right away
+        if (influx->queue.len == line->len || influx->queue.len >= influx->opts.flush_size)
+            pthread_cond_signal(&influx->cond);
+    }
+    pthread_mutex_unlock(&influx->lock);
+}
+
+static void data_output_influx_free(data_output_t *output)
+{
+    data_output_influx_t *influx = (data_output_influx_t *)output;
+
+    if (!influx)
+        return;
+
+    // the flush thread sends what is queued before it ends
+    pthread_mutex_lock(&influx->lock);
+    influx->closing = 1;
+    pthread_cond_signal(&influx->cond);
+    pthread_mutex_unlock(&influx->lock);
+    pthread_join(influx->flush_thread, NULL);
+
+    datagram_client_close(&influx->udp);
+    if (influx->sock >= 0)
+        close(influx->sock);
+    pthread_mutex_destroy(&influx->lock);
+    pthread_cond_destroy(&influx->cond);
+    free(influx->line.buf);
+    free(influx->queue.buf);
+    free(influx->sending.buf);
+    for (int i = 0; i < 5; ++i)
+        free(influx->strings[i]);
+    free(influx);
+}
+
+int data_output_influx_set_time(struct data_output *output, uint64_t time_ns)
+{
+    if (!output || output->print_data != print_influx_data)
+        return -1;
+    ((data_output_influx_t *)output)->time_ns = time_ns;
+    return 0;
+}
+
+int data_output_influx_counters(struct data_output *output, unsigned long *lines, unsigned long *sends, unsigned long *dropped)
+{
+    data_output_influx_t *influx = (data_output_influx_t *)output;
+
+    if (!output || output->print_data != print_influx_data)
+        return -1;
+    pthread_mutex_lock(&influx->lock);
+    *lines = influx->lines;
+    *sends = influx->sends;
+    *dropped = influx->dropped;
+    pthread_mutex_unlock(&influx->lock);
+    return 0;
+}
+
+struct data_output *data_output_influx_create(influx_opts_t const *opts)
+{
+    data_output_influx_t *influx = calloc(1, sizeof(data_output_influx_t));
+    if (!influx) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+
+    influx->output.print_data   = print_influx_data;
+    influx->output.output_free  = data_output_influx_free;
+    influx->opts = *opts;
+    if (!influx->opts.flush_size)
+        influx->opts.flush_size = opts->path ? INFLUX_DEFAULT_FLUSH_SIZE : INFLUX_DEFAULT_UDP_FLUSH_SIZE;
+    if (!opts->path && influx->opts.flush_size > INFLUX_MAX_DATAGRAM)
+        influx->opts.flush_size = INFLUX_MAX_DATAGRAM;
+    influx->sock = -1;
+    influx->udp.sock = -1;
+
+    char const **strs[5] = {&influx->opts.host, &influx->opts.port, &influx->opts.path, &influx->opts.token, &influx->opts.measurement};
+    for (int i = 0; i < 5; ++i) {
+        if (*strs[i] && !(*strs[i] = influx->strings[i] = strdup(*strs[i]))) {
+            fprintf(stderr, "strdup() failed");
+            goto fail;
+        }
+    }
+    if (!influx->opts.measurement)
+        influx->opts.measurement = "rtl_433";
+    if (!opts->path && datagram_client_open(&influx->udp, opts->host, opts->port) < 0)
+        goto fail;
+
+    pthread_mutex_init(&influx->lock, NULL);
+    pthread_cond_init(&influx->cond, NULL);
+    if (pthread_create(&influx->flush_thread, NULL, influx_flush_thread, influx)) {
+        fprintf(stderr, "Failed to start the InfluxDB flush thread\n");
+        pthread_mutex_destroy(&influx->lock);
+        pthread_cond_destroy(&influx->cond);
+        goto fail;
+    }
+    return &influx->output;
+
+fail:
+    datagram_client_close(&influx->udp);
+    for (int i = 0; i < 5; ++i)
+        free(influx->strings[i]);
+    free(influx);
+    return NULL;
+}
+
+/* Shared memory ring, one JSON record per slot for local readers, see shm_ring.h */
+
+typedef struct {
+    struct data_output output;
+    shm_ring_t *ring;
+    data_output_t *json;        // formats into the memory stream
+    char *json_buf;
+    size_t json_size;
+} data_output_shm_t;
+
+static void print_shm_data(data_output_t *output, data_t *data, char *format)
+{
+    data_output_shm_t *shm = (data_output_shm_t *)output;
+
+    long len = render_json(shm->json, data);
+    if (len > 0)
+        shm_ring_write(shm->ring, shm->json_buf, len);
+}
+
+static void data_output_shm_free(data_output_t *output)
+{
+    data_output_shm_t *shm = (data_output_shm_t *)output;
+
+    if (!shm)
+        return;
+
+    shm_ring_free(shm->ring);
+    if (shm->json) {
+        fclose(shm->json->file);
+        data_output_free(shm->json);
+    }
+    free(shm->json_buf);
+    free(shm);
+}
+
+int data_output_shm_counters(struct data_output *output, unsigned long *records, unsigned long *dropped)
+{
+    if (!output || output->print_data != print_shm_data)
+        return -1;
+    shm_ring_counters(((data_output_shm_t *)output)->ring, records, dropped);
+    return 0;
+}
+
+struct data_output *data_output_shm_create(const char *name, size_t size)
+{
+    data_output_shm_t *shm = calloc(1, sizeof(data_output_shm_t));
+    if (!shm) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+
+    shm->output.print_data   = print_shm_data;
+    shm->output.print_array  = print_json_array;
+    shm->output.print_string = print_json_string;
+    shm->output.print_double = print_json_double;
+    shm->output.print_int    = print_json_int;
+    shm->output.output_free  = data_output_shm_free;
+
+    FILE *json_file = open_memstream(&shm->json_buf, &shm->json_size);
+    shm->json = json_file ? data_output_json_create(json_file) : NULL;
+    shm->ring = shm_ring_create(name, size);
+    if (!shm->json || !shm->ring) {
+        if (json_file && !shm->json)
+            fclose(json_file);
+        data_output_shm_free(&shm->output);
+        return NULL;
+    }
+
+    return &shm->output;
+}
+
+/* Most recent record of each model and id, rendered as one JSON array on request */
+
+typedef struct {
+    unsigned hash;
+    char key[128];              // model, newline, id
+    char *json;
+    size_t json_len;
+    unsigned long updated;      // update count when last replaced, the oldest goes when full
+} latest_record_t;
+
+typedef struct {
+    struct data_output output;
+    data_output_t *json;        // formats into the memory stream
+    char *json_buf;
+    size_t json_size;
+    latest_record_t *records;
+    unsigned num_records;
+    unsigned max_records;
+    unsigned long updates;
+    unsigned long rendered;     // updates included in doc
+    lbuf_t doc;
+} data_output_latest_t;
+
+static void print_latest_data(data_output_t *output, data_t *data, char *format)
+{
+    data_output_latest_t *latest = (data_output_latest_t *)output;
+    data_t *model = NULL;
+    data_t *id = NULL;
+    char key[128];
+
+    for (data_t *d = data; d; d = d->next) {
+        if (!strcmp(d->key, "model"))
+            model = d;
+        else if (!strcmp(d->key, "id"))
+            id = d;
+    }
+    if (!model || model->type != DATA_STRING)
+        return; // not a sensor reading, e.g. a stats record
+    if (!id)
+        snprintf(key, sizeof(key), "%s\n", (char *)model->value);
+    else if (id->type == DATA_INT)
+        snprintf(key, sizeof(key), "%s\n%d", (char *)model->value, *(int *)id->value);
+    else if (id->type == DATA_STRING)
+        snprintf(key, sizeof(key), "%s\n%s", (char *)model->value, (char *)id->value);
+    else
+        snprintf(key, sizeof(key), "%s\n%g", (char *)model->value, *(double *)id->value);
+
+    unsigned hash = 2166136261u; // FNV-1a
+    for (char const *p = key; *p; ++p)
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+
+    latest_record_t *record = NULL;
+    latest_record_t *oldest = latest->records;
+    for (unsigned i = 0; i < latest->num_records && !record; ++i) {
+        latest_record_t *r = &latest->records[i];
+        if (r->hash == hash && !strcmp(r->key, key))
+            record = r;
+        else if (r->updated < oldest->updated)
+            oldest = r;
+    }
+    if (!record) {
+        record = latest->num_records < latest->max_records ? &latest->records[latest->num_records++] : oldest;
+        memcpy(record->key, key, sizeof(key));
+        record->hash = hash;
+        record->json_len = 0;
+    }
+
+    long len = render_json(latest->json, data);
+    char *json = len > 0 ? realloc(record->json, len) : NULL;
+    if (!json)
+        return;
+    memcpy(json, latest->json_buf, len);
+    record->json = json;
+    record->json_len = len;
+    record->updated = ++latest->updates;
+}
+
+int data_output_latest_render(struct data_output *output, char const **doc, size_t *len)
+{
+    if (!output || output->print_data != print_latest_data)
+        return -1;
+    data_output_latest_t *latest = (data_output_latest_t *)output;
+    int changed = latest->rendered != latest->updates || !latest->doc.buf;
+    if (changed) {
+        latest->doc.len = 0;
+        lbuf_append(&latest->doc, "[", 1);
+        for (unsigned i = 0; i < latest->num_records; ++i) {
+            latest_record_t *r = &latest->records[i];
+            if (!r->json_len)
+                continue;
+            lbuf_append(&latest->doc, latest->doc.len > 1 ? ",\n" : "\n", latest->doc.len > 1 ? 2 : 1);
+            lbuf_append(&latest->doc, r->json, r->json_len);
+        }
+        lbuf_append(&latest->doc, "\n]\n", 3);
+        latest->rendered = latest->updates;
+    }
+    *doc = latest->doc.buf;
+    *len = latest->doc.len;
+    return changed;
+}
+
+static void data_output_latest_free(data_output_t *output)
+{
+    data_output_latest_t *latest = (data_output_latest_t *)output;
+
+    if (!latest)
+        return;
+
+    if (latest->json) {
+        fclose(latest->json->file);
+        data_output_free(latest->json);
+    }
+    for (unsigned i = 0; latest->records && i < latest->num_records; ++i)
+        free(latest->records[i].json);
+    free(latest->records);
+    free(latest->json_buf);
+    free(latest->doc.buf);
+    free(latest);
+}
+
+struct data_output *data_output_latest_create(unsigned max_records)
+{
+    data_output_latest_t *latest = calloc(1, sizeof(data_output_latest_t));
+    if (!latest) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+
+    latest->output.print_data   = print_latest_data;
+    latest->output.print_array  = print_json_array;
+    latest->output.print_string = print_json_string;
+    latest->output.print_double = print_json_double;
+    latest->output.print_int    = print_json_int;
+    latest->output.output_free  = data_output_latest_free;
+
+    latest->max_records = max_records ? max_records : 1;
+    latest->records = calloc(latest->max_records, sizeof(latest_record_t));
+    FILE *json_file = open_memstream(&latest->json_buf, &latest->json_size);
+    latest->json = json_file ? data_output_json_create(json_file) : NULL;
+    if (!latest->records || !latest->json) {
+        if (json_file && !latest->json)
+            fclose(json_file);
+        data_output_latest_free(&latest->output);
+        return NULL;
+    }
+
+    return &latest->output;
+}
+
+/* Columnar store, the numbers of each record as a row of its model and id, see tsdb.h */
+
+typedef struct {
+    struct data_output output;
+    tsdb_t *db;
+    uint64_t time_ns;           // timestamp of the next record, 0 for the time it is printed
+} data_output_tsdb_t;
+
+static void series_append(char *series, size_t size, data_t const *d)
+{
+    size_t len = strlen(series);
+    if (d->type == DATA_INT)
+        snprintf(series + len, size - len, "/%d", *(int *)d->value);
+    else if (d->type == DATA_DOUBLE)
+        snprintf(series + len, size - len, "/%g", *(double *)d->value);
+    else if (d->type == DATA_STRING)
+        snprintf(series + len, size - len, "/%s", (char *)d->value);
+}
+
+static void print_tsdb_data(data_output_t *output, data_t *data, char *format)
+{
+    data_output_tsdb_t *tsdb = (data_output_tsdb_t *)output;
+    data_t *model = NULL;
+    data_t *channel = NULL;
+    data_t *id = NULL;
+    tsdb_field_t fields[TSDB_MAX_FIELDS];
+    unsigned num_fields = 0;
+
+    uint64_t time_ns = tsdb->time_ns;
+    tsdb->time_ns = 0;
+
+    for (data_t *d = data; d; d = d->next) {
+        if (!strcmp(d->key, "model"))
+            model = d;
+        else if (!strcmp(d->key, "channel"))
+            channel = d;
+        else if (!strcmp(d->key, "id"))
+            id = d;
+        else if (!strcmp(d->key, "time") || num_fields == TSDB_MAX_FIELDS)
+            continue;
+        else if (d->type == DATA_INT) {
+            fields[num_fields].name = d->key;
+            fields[num_fields].type = TSDB_INT;
+            fields[num_fields++].value.i = *(int *)d->value;
+        }
+        else if (d->type == DATA_DOUBLE) {
+            fields[num_fields].name = d->key;
+            fields[num_fields].type = TSDB_DOUBLE;
+            fields[num_fields++].value.d = *(double *)d->value;
+        }
+        else if (d->type == DATA_STRING) {
+            // numbers formatted as strings, e.g. a direction, other strings are not stored
+            char *end;
+            double value = strtod(d->value, &end);
+            if (end == (char *)d->value || *end)
+                continue;
+            fields[num_fields].name = d->key;
+            fields[num_fields].type = TSDB_DOUBLE;
+            fields[num_fields++].value.d = value;
+        }
+    }
+    if (!model || model->type != DATA_STRING || !num_fields)
+        return; // not a sensor reading, e.g. a stats record
+
+    char series[TSDB_MAX_NAME];
+    snprintf(series, sizeof(series), "%s", (char *)model->value);
+    if (channel)
+        series_append(series, sizeof(series), channel);
+    if (id)
+        series_append(series, sizeof(series), id);
+
+    if (!time_ns) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    tsdb_append(tsdb->db, series, (int64_t)(time_ns / 1000000), fields, num_fields);
+}
+
+int data_output_tsdb_set_time(struct data_output *output, uint64_t time_ns)
+{
+    if (!output || output->print_data != print_tsdb_data)
+        return -1;
+    ((data_output_tsdb_t *)output)->time_ns = time_ns;
+    return 0;
+}
+
+int data_output_tsdb_counters(struct data_output *output, unsigned long *rows, unsigned long *dropped)
+{
+    if (!output || output->print_data != print_tsdb_data)
+        return -1;
+    tsdb_counters(((data_output_tsdb_t *)output)->db, rows, dropped);
+    return 0;
+}
+
+static void data_output_tsdb_free(data_output_t *output)
+{
+    data_output_tsdb_t *tsdb = (data_output_tsdb_t *)output;
+
+    if (!tsdb)
+        return;
+
+    tsdb_close(tsdb->db);
+    free(tsdb);
+}
+
+struct data_output *data_output_tsdb_create(const char *dir)
+{
+    data_output_tsdb_t *tsdb = calloc(1, sizeof(data_output_tsdb_t));
+    if (!tsdb) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+
+    tsdb->output.print_data   = print_tsdb_data;
+    tsdb->output.output_free  = data_output_tsdb_free;
+
+    tsdb->db = tsdb_open(dir);
+    if (!tsdb->db) {
+        free(tsdb);
+        return NULL;
+    }
+
+    return &tsdb->output;
+}
+
 #else
 
 struct data_output *data_output_syslog_create(const char *host, const char *port)
@@ -932,4 +2892,79 @@ struct data_output *data_output_syslog_create(const char *host, const char *port
     exit(1);
 }
 
+int data_output_syslog_set_latency(struct data_output *output, unsigned latency_ms)
+{
+    return -1;
+}
+
+int data_output_syslog_counters(struct data_output *output, unsigned long *messages, unsigned long *sends)
+{
+    return -1;
+}
+
+struct data_output *data_output_mqtt_create(mqtt_client_opts_t const *opts, const char *topic)
+{
+    fprintf(stderr, "MQTT output not available.\n");
+    exit(1);
+}
+
+int data_output_mqtt_counters(struct data_output *output, mqtt_client_counters_t *counters)
+{
+    return -1;
+}
+
+struct data_output *data_output_influx_create(influx_opts_t const *opts)
+{
+    fprintf(stderr, "InfluxDB output not available.\n");
+    exit(1);
+}
+
+int data_output_influx_set_time(struct data_output *output, uint64_t time_ns)
+{
+    return -1;
+}
+
+int data_output_influx_counters(struct data_output *output, unsigned long *lines, unsigned long *sends, unsigned long *dropped)
+{
+    return -1;
+}
+
+struct data_output *data_output_shm_create(const char *name, size_t size)
+{
+    fprintf(stderr, "Shared memory output not available.\n");
+    exit(1);
+}
+
+int data_output_shm_counters(struct data_output *output, unsigned long *records, unsigned long *dropped)
+{
+    return -1;
+}
+
+struct data_output *data_output_latest_create(unsigned max_records)
+{
+    fprintf(stderr, "Latest records output not available.\n");
+    exit(1);
+}
+
+int data_output_latest_render(struct data_output *output, char const **doc, size_t *len)
+{
+    return -1;
+}
+
+struct data_output *data_output_tsdb_create(const char *dir)
+{
+    fprintf(stderr, "Time series output not available.\n");
+    exit(1);
+}
+
+int data_output_tsdb_set_time(struct data_output *output, uint64_t time_ns)
+{
+    return -1;
+}
+
+int data_output_tsdb_counters(struct data_output *output, unsigned long *rows, unsigned long *dropped)
+{
+    return -1;
+}
+
 #endif
@@ -44,6 +44,8 @@
  * wireless sensors group.
  * That's why it's NOT possible to get pressure data by wireless communication. If you need pressure data you should try
  * an Arduino/Raspberry solution wired with a BMP180/280 or BMP085 sensor.
+ * A BMP085 on /dev/i2c-1 is read for each weather message and reported as 'pressure' and 'int_temp'; without one
+ * these two fields are left out.
  *
  * Data are transmitted in a 48 seconds cycle (data packet, then wait 48 seconds, then data packet...).
  *
@@ -147,7 +149,7 @@ unsigned int temperature, pressure;
 
 
 // Open a connection to the bmp085
-// Returns a file id
+// Returns a file id or -1 if the sensor is not available
 int bmp085_i2c_Begin()
 {
 	int fd;
@@ -157,25 +159,24 @@ int bmp085_i2c_Begin()
 	
 	// Open port for reading and writing
 	if ((fd = open(fileName, O_RDWR)) < 0)
-		exit(1);
+		return -1;
 	
 	// Set the port options and set the address of the device
 	if (ioctl(fd, I2C_SLAVE, BMP085_I2C_ADDRESS) < 0) {					
 		close(fd);
-		exit(1);
+		return -1;
 	}
 
 	return fd;
 }
 
 // Read two words from the BMP085 and supply it as a 16 bit integer
+// Returns -1 on error
 __s32 bmp085_i2c_Read_Int(int fd, __u8 address)
 {
 	__s32 res = i2c_smbus_read_word_data(fd, address);
-	if (res < 0) {
-		close(fd);
-		exit(1);
-	}
+	if (res < 0)
+		return -1;
 
 	// Convert result to 16 bits and swap bytes
 	res = ((res<<8) & 0xFF00) | ((res>>8) & 0xFF);
@@ -184,72 +185,91 @@ __s32 bmp085_i2c_Read_Int(int fd, __u8 address)
 }
 
 //Write a byte to the BMP085
-void bmp085_i2c_Write_Byte(int fd, __u8 address, __u8 value)
+int bmp085_i2c_Write_Byte(int fd, __u8 address, __u8 value)
 {
-	if (i2c_smbus_write_byte_data(fd, address, value) < 0) {
-		close(fd);
-		exit(1);
-	}
+	return i2c_smbus_write_byte_data(fd, address, value) < 0 ? -1 : 0;
 }
 
 // Read a block of data BMP085
-void bmp085_i2c_Read_Block(int fd, __u8 address, __u8 length, __u8 *values)
+int bmp085_i2c_Read_Block(int fd, __u8 address, __u8 length, __u8 *values)
 {
-	if(i2c_smbus_read_i2c_block_data(fd, address,length,values)<0) {
-		close(fd);
-		exit(1);
-	}
+	return i2c_smbus_read_i2c_block_data(fd, address,length,values) < 0 ? -1 : 0;
 }
 
 
-void bmp085_Calibration()
+// Read the calibration table, returns -1 on error
+int bmp085_Calibration()
 {
+	__s32 cal[11];
+	int i;
 	int fd = bmp085_i2c_Begin();
-	ac1 = bmp085_i2c_Read_Int(fd,0xAA);
-	ac2 = bmp085_i2c_Read_Int(fd,0xAC);
-	ac3 = bmp085_i2c_Read_Int(fd,0xAE);
-	ac4 = bmp085_i2c_Read_Int(fd,0xB0);
-	ac5 = bmp085_i2c_Read_Int(fd,0xB2);
-	ac6 = bmp085_i2c_Read_Int(fd,0xB4);
-	b1 = bmp085_i2c_Read_Int(fd,0xB6);
-	b2 = bmp085_i2c_Read_Int(fd,0xB8);
-	mb = bmp085_i2c_Read_Int(fd,0xBA);
-	mc = bmp085_i2c_Read_Int(fd,0xBC);
-	md = bmp085_i2c_Read_Int(fd,0xBE);
+	if (fd < 0)
+		return -1;
+	for (i = 0; i < 11; i++) {
+		cal[i] = bmp085_i2c_Read_Int(fd, 0xAA + 2 * i);
+		if (cal[i] < 0) {
+			close(fd);
+			return -1;
+		}
+	}
 	close(fd);
-}
-
-// Read the uncompensated temperature value
-unsigned int bmp085_ReadUT()
+	ac1 = cal[0];
+	ac2 = cal[1];
+	ac3 = cal[2];
+	ac4 = cal[3];
+	ac5 = cal[4];
+	ac6 = cal[5];
+	b1 = cal[6];
+	b2 = cal[7];
+	mb = cal[8];
+	mc = cal[9];
+	md = cal[10];
+	return 0;
+}
+
+// Read the uncompensated temperature value, returns -1 on error
+int bmp085_ReadUT(unsigned int *ut)
 {
-	unsigned int ut = 0;
+	__s32 res;
 	int fd = bmp085_i2c_Begin();
+	if (fd < 0)
+		return -1;
 
 	// Write 0x2E into Register 0xF4
 	// This requests a temperature reading
-	bmp085_i2c_Write_Byte(fd,0xF4,0x2E);
+	if (bmp085_i2c_Write_Byte(fd,0xF4,0x2E) < 0) {
+		close(fd);
+		return -1;
+	}
 	
 	// Wait at least 4.5ms
 	usleep(5000);
 
 	// Read the two byte result from address 0xF6
-	ut = bmp085_i2c_Read_Int(fd,0xF6);
+	res = bmp085_i2c_Read_Int(fd,0xF6);
 
 	// Close the i2c file
 	close (fd);
 	
-	return ut;
+	if (res < 0)
+		return -1;
+	*ut = res;
+	return 0;
 }
 
-// Read the uncompensated pressure value
-unsigned int bmp085_ReadUP()
+// Read the uncompensated pressure value, returns -1 on error
+int bmp085_ReadUP(unsigned int *up)
 {
-	unsigned int up = 0;
 	int fd = bmp085_i2c_Begin();
+	if (fd < 0)
+		return -1;
 
 	// Write 0x34+(BMP085_OVERSAMPLING_SETTING<<6) into register 0xF4
 	// Request a pressure reading w/ oversampling setting
-	bmp085_i2c_Write_Byte(fd,0xF4,0x34 + (BMP085_OVERSAMPLING_SETTING<<6));
+	if (bmp085_i2c_Write_Byte(fd,0xF4,0x34 + (BMP085_OVERSAMPLING_SETTING<<6)) < 0) {
+		close(fd);
+		return -1;
+	}
 
 	// Wait for conversion, delay time dependent on oversampling setting
 	usleep((2 + (3<<BMP085_OVERSAMPLING_SETTING)) * 1000);
@@ -257,14 +277,17 @@ unsigned int bmp085_ReadUP()
 	// Read the three byte result from 0xF6
 	// 0xF6 = MSB, 0xF7 = LSB and 0xF8 = XLSB
 	__u8 values[3];
-	bmp085_i2c_Read_Block(fd, 0xF6, 3, values);
+	if (bmp085_i2c_Read_Block(fd, 0xF6, 3, values) < 0) {
+		close(fd);
+		return -1;
+	}
 
-	up = (((unsigned int) values[0] << 16) | ((unsigned int) values[1] << 8) | (unsigned int) values[2]) >> (8-BMP085_OVERSAMPLING_SETTING);
+	*up = (((unsigned int) values[0] << 16) | ((unsigned int) values[1] << 8) | (unsigned int) values[2]) >> (8-BMP085_OVERSAMPLING_SETTING);
 
 	// Close the i2c file
 	close (fd);
 	
-	return up;
+	return 0;
 }
 
 // Calculate pressure given uncalibrated pressure
@@ -320,28 +343,42 @@ unsigned int bmp085_GetTemperature(unsigned int ut)
 // --------- Get PRESSURE -------------------------------------------------------------------
 
 
-double read_int_temp()
+// The sensor is optional: without it (no i2c bus, no BMP085 on it) the
+// pressure and internal temperature are simply not reported. The first
+// failure is remembered so the bus is not probed again for every message.
+static int bmp085_state; // 0=unknown 1=calibrated -1=not available
+
+// Read relative pressure in hPa and internal temperature in C, returns -1 if not available
+static int read_bmp085(double *press, double *int_temp)
 {
-	bmp085_Calibration();
-	temperature = bmp085_GetTemperature(bmp085_ReadUT());
-	pressure = bmp085_GetPressure(bmp085_ReadUP());
-	
-	return ((double)temperature)/10;	
-}
+	unsigned int ut, up;
+
+	if (bmp085_state < 0)
+		return -1;
+	if (bmp085_state == 0) {
+		if (bmp085_Calibration() < 0) {
+			if (debug_output)
+				fprintf(stderr, "BMP085 not available, pressure and internal temperature are not reported\n");
+			bmp085_state = -1;
+			return -1;
+		}
+		bmp085_state = 1;
+	}
+	if (bmp085_ReadUT(&ut) < 0 || bmp085_ReadUP(&up) < 0)
+		return -1; // the sensor was there, skip just this reading
 
+	temperature = bmp085_GetTemperature(ut);
+	pressure = bmp085_GetPressure(up);
 
-double read_press()
-{
-	bmp085_Calibration();
-	temperature = bmp085_GetTemperature(bmp085_ReadUT());
-	pressure = bmp085_GetPressure(bmp085_ReadUP());
-	return ((((double)pressure)/100) / pow((1.0 - (station_altitude/100)/44330.0), 5.255));
-	//return ((((double)pressure)/100)/ pow(1.0 - station_altitude/44330.0, 5.255));
+	*int_temp = ((double)temperature)/10;
+	*press = ((((double)pressure)/100) / pow((1.0 - (station_altitude/100)/44330.0), 5.255));
+	//*press = ((((double)pressure)/100)/ pow(1.0 - station_altitude/44330.0, 5.255));
 	
 	//Relative pressure calculated from 'station_altitude' value. See https://en.wikipedia.org/wiki/Barometric_formula 
 	//See also: https://www.mkompf.com/weather/pibaro.html
 	//
 	//Remember to change 'station_altitude' value at the top of this file to reflect YOUR station altitude!
+	return 0;
 }
 
 
@@ -583,8 +620,8 @@ static int fineoffset_wh1080_callback(bitbuffer_t *bitbuffer) {
     const int humidity = get_humidity(br);
     const char* direction_str = get_wind_direction_str(br);
 	const char* direction_deg = get_wind_direction_deg(br);
-	const float pressure = read_press();
-    const float int_temp = read_int_temp();
+	double pressure = 0, int_temp = 0;
+	const int have_bmp085 = msg_type == 0 && read_bmp085(&pressure, &int_temp) == 0;
 
 
 	// Select which metric system for *wind avg speed* and *wind gust* :
@@ -687,15 +724,23 @@ if (msg_type == 0) {
 			"id",		"Station ID",	DATA_FORMAT,	"%d",		DATA_INT,	device_id,
 			"temperature_C","Temperature",	DATA_FORMAT,	"%.01f C",	DATA_DOUBLE,	temperature,
 			"humidity",	"Humidity",	DATA_FORMAT,	"%u %%",	DATA_INT,	humidity,
-			"pressure",	"Pressure",	DATA_FORMAT, "%.02f hPa",	DATA_DOUBLE, pressure,
 			"direction_str","Wind string",	DATA_STRING,					direction_str,
 			"direction_deg","Wind degrees",	DATA_STRING,					direction_deg,
 			"speed",	"Wind avg speed",DATA_FORMAT,	"%.02f",	DATA_DOUBLE,	speed,
 			"gust",		"Wind gust",	DATA_FORMAT,	"%.02f",	DATA_DOUBLE, 	gust,
 			"rain",		"Total rainfall",DATA_FORMAT,	"%3.1f",	DATA_DOUBLE, 	rain,
-			"int_temp",	"Internal temp.",DATA_FORMAT, "%.01f C",	DATA_DOUBLE, int_temp,
 			"battery",	"Battery",	DATA_STRING,					battery,
 		NULL);
+    if (data && have_bmp085) {
+        // console sensor readings go last, only when the BMP085 is wired up
+        data_t *tail = data;
+        while (tail->next)
+            tail = tail->next;
+        tail->next = data_make(
+			"pressure",	"Pressure",	DATA_FORMAT, "%.02f hPa",	DATA_DOUBLE, pressure,
+			"int_temp",	"Internal temp.",DATA_FORMAT, "%.01f C",	DATA_DOUBLE, int_temp,
+		NULL);
+    }
     data_acquired_handler(data);
     return 1;
 
@@ -14,6 +14,23 @@
 #include "pulse_demod.h"
 #include "optparse.h"
 
+/// A match or preamble pattern, precomputed for the search.
+/// Patterns that fit a 64 bit window with 7 bits to spare are compared as
+/// a masked word at each bit offset, longer ones use bitbuffer_search().
+struct flex_pattern {
+    unsigned len;
+    uint64_t bits;  // left aligned, inverted if the decoder inverts
+    uint64_t mask;
+    bitrow_t row;   // the pattern for bitbuffer_search(), also inverted
+};
+
+#define FLEX_WORD_PATTERN_BITS 57
+
+struct flex_params;
+typedef int (*flex_stage_t)(bitbuffer_t *bitbuffer, struct flex_params *params, int *match_count);
+
+#define FLEX_STAGES 5
+
 struct flex_params {
     char *name;
     unsigned min_rows;
@@ -28,62 +45,179 @@ struct flex_params {
     bitrow_t match_bits;
     unsigned preamble_len;
     bitrow_t preamble_bits;
+
+    // compiled matcher
+    unsigned num_stages;
+    flex_stage_t stages[FLEX_STAGES];   // cheapest and most selective first
+    struct flex_pattern match;
+    struct flex_pattern preamble;
+    unsigned preamble_pos[BITBUF_ROWS]; // preamble hits of the current package
+    char row_codes[BITBUF_ROWS][5 + BITBUF_COLS * 2 + 1]; // "{nnn}..\0"
 };
 
-static int flex_callback(bitbuffer_t *bitbuffer, struct flex_params *params)
+static void compile_pattern(struct flex_pattern *pattern, bitrow_t const bits, unsigned len, unsigned invert)
 {
-    int i;
-    int match_count = 0;
-    data_t *data;
-    data_t *row_data[BITBUF_ROWS];
-    char *row_codes[BITBUF_ROWS];
-    char row_bytes[BITBUF_COLS * 2 + 1];
-    char time_str[LOCAL_TIME_BUFLEN];
-    bitrow_t tmp;
+    pattern->len = len;
+    memcpy(pattern->row, bits, sizeof(bitrow_t));
+    if (invert) {
+        for (unsigned i = 0; i < (len + 7) / 8; ++i)
+            pattern->row[i] = ~pattern->row[i];
+    }
+    pattern->bits = 0;
+    pattern->mask = 0;
+    if (len <= FLEX_WORD_PATTERN_BITS) {
+        for (unsigned i = 0; i < 8; ++i)
+            pattern->bits = pattern->bits << 8 | pattern->row[i];
+        pattern->mask = len ? ~0ULL << (64 - len) : 0;
+        pattern->bits &= pattern->mask;
+    }
+}
 
-    // discard short / unwanted bitbuffers
-    if ((bitbuffer->num_rows < params->min_rows)
-            || (params->max_rows && bitbuffer->num_rows > params->max_rows))
-        return 0;
+/// Return the position of the pattern in the row or the row length if not found.
+static unsigned flex_search(bitbuffer_t *bitbuffer, unsigned row, struct flex_pattern *pattern)
+{
+    unsigned len = bitbuffer->bits_per_row[row];
+    if (pattern->len > FLEX_WORD_PATTERN_BITS)
+        return bitbuffer_search(bitbuffer, row, 0, pattern->row, pattern->len);
+    if (len < pattern->len)
+        return len;
+
+    uint8_t const *b = bitbuffer->bb[row];
+    unsigned last = len - pattern->len; // last possible start
+    uint64_t word = 0;
+    for (unsigned i = 0; i < 8; ++i)
+        word = word << 8 | b[i];
+    for (unsigned pos = 0; pos <= last; pos += 8) {
+        for (unsigned shift = 0; shift < 8 && pos + shift <= last; ++shift) {
+            if (((word << shift) & pattern->mask) == pattern->bits)
+                return pos + shift;
+        }
+        unsigned next = pos / 8 + 8;
+        word = word << 8 | (next < BITBUF_COLS ? b[next] : 0);
+    }
+    return len;
+}
 
-    for (i = 0; i < bitbuffer->num_rows; i++) {
+static int stage_rows(bitbuffer_t *bitbuffer, struct flex_params *params, int *match_count)
+{
+    (void)match_count;
+    return bitbuffer->num_rows >= params->min_rows
+            && (!params->max_rows || bitbuffer->num_rows <= params->max_rows);
+}
+
+static int stage_bits(bitbuffer_t *bitbuffer, struct flex_params *params, int *match_count)
+{
+    int count = 0;
+    for (int i = 0; i < bitbuffer->num_rows; i++) {
         if ((bitbuffer->bits_per_row[i] >= params->min_bits)
                 && (!params->max_bits || bitbuffer->bits_per_row[i] <= params->max_bits))
-            match_count++;
+            count++;
     }
-    if (!match_count)
-        return 0;
+    *match_count = count;
+    return count > 0;
+}
 
-    // discard unless min_repeats, min_bits
-    // TODO: check max_repeats, max_bits
-    int r = bitbuffer_find_repeated_row(bitbuffer, params->min_repeats, params->min_bits);
+static int stage_repeats(bitbuffer_t *bitbuffer, struct flex_params *params, int *match_count)
+{
+    bitbuffer_row_index_t index;
+    bitbuffer_index_rows(bitbuffer, &index);
+    int r = bitbuffer_index_find_row(bitbuffer, &index,
+            params->min_repeats, params->max_repeats, params->min_bits, params->max_bits);
     if (r < 0)
         return 0;
-    // TODO: set match_count to count of repeated rows
+    if (!params->match_len && !params->preamble_len)
+        *match_count = index.repeats[index.group_of_row[r]];
+    return 1;
+}
 
-    if (params->invert) {
-        bitbuffer_invert(bitbuffer);
+static int stage_match(bitbuffer_t *bitbuffer, struct flex_params *params, int *match_count)
+{
+    int count = 0;
+    for (int i = 0; i < bitbuffer->num_rows; i++) {
+        if (flex_search(bitbuffer, i, &params->match) < bitbuffer->bits_per_row[i])
+            count++;
     }
+    if (!params->preamble_len)
+        *match_count = count;
+    return count > 0;
+}
 
-    // discard unless match
-    if (params->match_len) {
-        match_count = 0;
-        for (i = 0; i < bitbuffer->num_rows; i++) {
-            if (bitbuffer_search(bitbuffer, i, 0, params->match_bits, params->match_len) < bitbuffer->bits_per_row[i]) {
-                match_count++;
-            }
-        }
-        if (!match_count)
+static int stage_preamble(bitbuffer_t *bitbuffer, struct flex_params *params, int *match_count)
+{
+    int count = 0;
+    for (int i = 0; i < bitbuffer->num_rows; i++) {
+        params->preamble_pos[i] = flex_search(bitbuffer, i, &params->preamble);
+        if (params->preamble_pos[i] < bitbuffer->bits_per_row[i])
+            count++;
+    }
+    *match_count = count;
+    return count > 0;
+}
+
+/// Turn the parsed spec into a list of checks.
+/// All checks have to pass, so they are ordered for early-out: the row count
+/// and row lengths are cheap and usually reject most packages, a match or
+/// preamble of at least a byte rejects noise before the repeats index is built.
+/// Inverting is folded into the patterns, the bits are only inverted for output.
+static void flex_compile(struct flex_params *params)
+{
+    int repeats = params->min_repeats || params->max_repeats;
+    int selective = params->match_len + params->preamble_len >= 8;
+
+    params->num_stages = 0;
+    if (params->min_rows || params->max_rows)
+        params->stages[params->num_stages++] = stage_rows;
+    params->stages[params->num_stages++] = stage_bits;
+    if (repeats && !selective)
+        params->stages[params->num_stages++] = stage_repeats;
+    if (params->match_len)
+        params->stages[params->num_stages++] = stage_match;
+    if (params->preamble_len)
+        params->stages[params->num_stages++] = stage_preamble;
+    if (repeats && selective)
+        params->stages[params->num_stages++] = stage_repeats;
+
+    compile_pattern(&params->match, params->match_bits, params->match_len, params->invert);
+    compile_pattern(&params->preamble, params->preamble_bits, params->preamble_len, params->invert);
+}
+
+static char const hex_digits[] = "0123456789abcdef";
+
+/// Run the compiled stages only, the bitbuffer is not changed. Returns 1 on a match.
+/// Also a hook for the tests to time the matcher without the output.
+int flex_match(struct flex_params *params, bitbuffer_t *bitbuffer, int *match_count)
+{
+    *match_count = 0;
+    // discard short / unwanted bitbuffers
+    for (unsigned s = 0; s < params->num_stages; ++s) {
+        if (!params->stages[s](bitbuffer, params, match_count))
             return 0;
     }
+    return 1;
+}
+
+static int flex_callback(bitbuffer_t *bitbuffer, struct flex_params *params)
+{
+    int i;
+    int match_count;
+    data_t *data;
+    data_t *row_data[BITBUF_ROWS];
+    char *row_codes[BITBUF_ROWS];
+    char time_str[LOCAL_TIME_BUFLEN];
+    bitrow_t tmp;
 
-    // discard unless match, this should be an AND condition
+    if (!flex_match(params, bitbuffer, &match_count))
+        return 0;
+
+    if (params->invert) {
+        bitbuffer_invert(bitbuffer);
+    }
+
+    // align at the preamble
     if (params->preamble_len) {
-        match_count = 0;
         for (i = 0; i < bitbuffer->num_rows; i++) {
-            unsigned pos = bitbuffer_search(bitbuffer, i, 0, params->preamble_bits, params->preamble_len);
+            unsigned pos = params->preamble_pos[i];
             if (pos < bitbuffer->bits_per_row[i]) {
-                match_count++;
                 pos += params->preamble_len;
                 unsigned len = bitbuffer->bits_per_row[i] - pos;
                 bitbuffer_extract_bytes(bitbuffer, i, pos, tmp, len);
@@ -91,8 +225,6 @@ static int flex_callback(bitbuffer_t *bitbuffer, struct flex_params *params)
                 bitbuffer->bits_per_row[i] = len;
             }
         }
-        if (!match_count)
-            return 0;
     }
 
     if (debug_output >= 1) {
@@ -113,21 +245,24 @@ static int flex_callback(bitbuffer_t *bitbuffer, struct flex_params *params)
     }
 
     for (i = 0; i < bitbuffer->num_rows; i++) {
-        row_bytes[0] = '\0';
-        // print byte-wide
-        for (int col = 0; col < (bitbuffer->bits_per_row[i] + 7) / 8; ++col) {
-            sprintf(&row_bytes[2 * col], "%02x", bitbuffer->bb[i][col]);
+        unsigned bits = bitbuffer->bits_per_row[i];
+        // a simpler representation for csv output, the row data is a suffix of it
+        char *code = params->row_codes[i];
+        int prefix = sprintf(code, "{%u}", bits);
+        char *row_bytes = code + prefix;
+        // print byte-wide, remove last nibble if needed
+        unsigned nibbles = (bits + 3) / 4;
+        for (unsigned n = 0; n < nibbles; ++n) {
+            uint8_t byte = bitbuffer->bb[i][n / 2];
+            row_bytes[n] = hex_digits[n & 1 ? byte & 0xf : byte >> 4];
         }
-        // remove last nibble if needed
-        row_bytes[2 * (bitbuffer->bits_per_row[i] + 3) / 8] = '\0';
+        row_bytes[nibbles] = '\0';
 
         row_data[i] = data_make(
-                "len", "", DATA_INT, bitbuffer->bits_per_row[i],
+                "len", "", DATA_INT, bits,
                 "data", "", DATA_STRING, row_bytes,
                 NULL);
-        // a simpler representation for csv output
-        row_codes[i] = malloc(5 + BITBUF_COLS * 2 + 1); // "{nnn}..\0"
-        sprintf(row_codes[i], "{%d}%s", bitbuffer->bits_per_row[i], row_bytes);
+        row_codes[i] = code;
     }
     data = data_make(
             "time", "", DATA_STRING, time_str,
@@ -138,9 +273,6 @@ static int flex_callback(bitbuffer_t *bitbuffer, struct flex_params *params)
             "codes", "", DATA_ARRAY, data_array(bitbuffer->num_rows, DATA_STRING, row_codes),
             NULL);
     data_acquired_handler(data);
-    for (i = 0; i < bitbuffer->num_rows; i++) {
-        free(row_codes[i]);
-    }
 
     return 0;
 }
@@ -159,7 +291,6 @@ static void usage()
 {
     fprintf(stderr,
             "Use -X <spec> to add a general purpose decoder. For usage use -X help\n");
-    exit(1);
 }
 
 static void help()
@@ -209,60 +340,84 @@ static void help()
     exit(0);
 }
 
-#define FLEX_SLOTS 8
+// A reload of the config file needs room for the old and the new decoders at the same time
+#define FLEX_SLOTS 128
 static struct flex_params *params_slot[FLEX_SLOTS];
-static int cb_slot0(bitbuffer_t *bitbuffer) { return flex_callback(bitbuffer, params_slot[0]); }
-static int cb_slot1(bitbuffer_t *bitbuffer) { return flex_callback(bitbuffer, params_slot[1]); }
-static int cb_slot2(bitbuffer_t *bitbuffer) { return flex_callback(bitbuffer, params_slot[2]); }
-static int cb_slot3(bitbuffer_t *bitbuffer) { return flex_callback(bitbuffer, params_slot[3]); }
-static int cb_slot4(bitbuffer_t *bitbuffer) { return flex_callback(bitbuffer, params_slot[4]); }
-static int cb_slot5(bitbuffer_t *bitbuffer) { return flex_callback(bitbuffer, params_slot[5]); }
-static int cb_slot6(bitbuffer_t *bitbuffer) { return flex_callback(bitbuffer, params_slot[6]); }
-static int cb_slot7(bitbuffer_t *bitbuffer) { return flex_callback(bitbuffer, params_slot[7]); }
-static unsigned next_slot = 0;
-int (*callback_slot[])(bitbuffer_t *bitbuffer) = {cb_slot0, cb_slot1, cb_slot2, cb_slot3, cb_slot4, cb_slot5, cb_slot6, cb_slot7};
+#define FLEX_SLOT(g, n) static int cb_slot##g##n(bitbuffer_t *bitbuffer) { return flex_callback(bitbuffer, params_slot[g * 8 + n]); }
+#define FLEX_SLOT8(g) FLEX_SLOT(g, 0) FLEX_SLOT(g, 1) FLEX_SLOT(g, 2) FLEX_SLOT(g, 3) \
+        FLEX_SLOT(g, 4) FLEX_SLOT(g, 5) FLEX_SLOT(g, 6) FLEX_SLOT(g, 7)
+FLEX_SLOT8(0) FLEX_SLOT8(1) FLEX_SLOT8(2) FLEX_SLOT8(3) FLEX_SLOT8(4) FLEX_SLOT8(5) FLEX_SLOT8(6) FLEX_SLOT8(7)
+FLEX_SLOT8(8) FLEX_SLOT8(9) FLEX_SLOT8(10) FLEX_SLOT8(11) FLEX_SLOT8(12) FLEX_SLOT8(13) FLEX_SLOT8(14) FLEX_SLOT8(15)
+#undef FLEX_SLOT8
+#undef FLEX_SLOT
+#define CB_SLOT8(g) cb_slot##g##0, cb_slot##g##1, cb_slot##g##2, cb_slot##g##3, \
+        cb_slot##g##4, cb_slot##g##5, cb_slot##g##6, cb_slot##g##7
+static int (*callback_slot[FLEX_SLOTS])(bitbuffer_t *bitbuffer) = {
+        CB_SLOT8(0), CB_SLOT8(1), CB_SLOT8(2), CB_SLOT8(3), CB_SLOT8(4), CB_SLOT8(5), CB_SLOT8(6), CB_SLOT8(7),
+        CB_SLOT8(8), CB_SLOT8(9), CB_SLOT8(10), CB_SLOT8(11), CB_SLOT8(12), CB_SLOT8(13), CB_SLOT8(14), CB_SLOT8(15)};
+#undef CB_SLOT8
 
 static unsigned parse_bits(const char *code, bitrow_t bitrow)
 {
     bitbuffer_t bits = {0};
-    bitbuffer_parse(&bits, code);
+    if (code)
+        bitbuffer_parse(&bits, code);
     if (bits.num_rows != 1) {
         fprintf(stderr, "Bad flex spec, \"match\" needs exactly one bit row (%d found)!\n", bits.num_rows);
-        usage();
+        return 0;
     }
     memcpy(bitrow, bits.bb[0], sizeof(bitrow_t));
     return bits.bits_per_row[0];
 }
 
+r_device *flex_parse_device(char *spec);
+
+// An empty spec, "?" or a prefix of "help"
+static int is_help(char const *spec)
+{
+    return !spec || !*spec || *spec == '?' || !strncasecmp(spec, "help", strlen(spec));
+}
+
+/* For -X, prints the help and exits if asked for it */
 r_device *flex_create_device(char *spec)
 {
-    if (next_slot >= FLEX_SLOTS) {
-        fprintf(stderr, "Maximum number of flex decoders reached!\n");
-        exit(1);
+    if (is_help(spec)) {
+        help();
     }
+    return flex_parse_device(spec);
+}
 
-    if (!spec || !*spec || *spec == '?' || !strncasecmp(spec, "help", strlen(spec))) {
-        help();
+/* For config files, never exits: a help request is an error, returns NULL on error */
+r_device *flex_parse_device(char *spec)
+{
+    unsigned slot;
+    if (is_help(spec)) {
+        fprintf(stderr, "Bad flex spec, \"%s\" is not a decoder!\n", spec ? spec : "");
+        return NULL;
+    }
+    for (slot = 0; slot < FLEX_SLOTS && params_slot[slot]; ++slot);
+    if (slot >= FLEX_SLOTS) {
+        fprintf(stderr, "Maximum number of flex decoders reached!\n");
+        return NULL;
     }
 
     struct flex_params *params = (struct flex_params *)calloc(1, sizeof(struct flex_params));
-    params_slot[next_slot] = params;
     r_device *dev = (r_device *)calloc(1, sizeof(r_device));
-    char *c, *o;
+    char *c, *o, *saveptr;
 
     spec = strdup(spec);
-    c = strtok(spec, ":");
+    c = strtok_r(spec, ":", &saveptr);
     if (c == NULL) {
         fprintf(stderr, "Bad flex spec, missing name!\n");
-        usage();
+        goto fail;
     }
     params->name = strdup(c);
     snprintf(dev->name, sizeof(dev->name), "General purpose decoder '%s'", c);
 
-    c = strtok(NULL, ":");
+    c = strtok_r(NULL, ":", &saveptr);
     if (c == NULL) {
         fprintf(stderr, "Bad flex spec, missing modulation!\n");
-        usage();
+        goto fail;
     }
     // TODO: add demod_arg where needed
     if (!strcasecmp(c, "OOK_MC_ZEROBIT"))
@@ -289,45 +444,45 @@ r_device *flex_create_device(char *spec)
         dev->modulation = FSK_PULSE_MANCHESTER_ZEROBIT;
     else {
         fprintf(stderr, "Bad flex spec, unknown modulation!\n");
-        usage();
+        goto fail;
     }
 
-    c = strtok(NULL, ":");
+    c = strtok_r(NULL, ":", &saveptr);
     if (c == NULL) {
         fprintf(stderr, "Bad flex spec, missing short limit!\n");
-        usage();
+        goto fail;
     }
     dev->short_limit = atoi(c);
 
-    c = strtok(NULL, ":");
+    c = strtok_r(NULL, ":", &saveptr);
     if (c == NULL) {
         fprintf(stderr, "Bad flex spec, missing long limit!\n");
-        usage();
+        goto fail;
     }
     dev->long_limit = atoi(c);
 
-    c = strtok(NULL, ":");
+    c = strtok_r(NULL, ":", &saveptr);
     if (c == NULL) {
         fprintf(stderr, "Bad flex spec, missing reset limit!\n");
-        usage();
+        goto fail;
     }
     dev->reset_limit = atoi(c);
 
     if (dev->modulation == OOK_PULSE_PWM_PRECISE) {
-        c = strtok(NULL, ":");
+        c = strtok_r(NULL, ":", &saveptr);
         if (c == NULL) {
             fprintf(stderr, "Bad flex spec, missing gap limit!\n");
-            usage();
+            goto fail;
         }
         dev->gap_limit = atoi(c);
 
-        o = strtok(NULL, ":");
+        o = strtok_r(NULL, ":", &saveptr);
         if (o != NULL) {
             c = o;
             dev->tolerance = atoi(c);
         }
 
-        o = strtok(NULL, ":");
+        o = strtok_r(NULL, ":", &saveptr);
         if (o != NULL) {
             c = o;
             dev->sync_width = atoi(c);
@@ -337,15 +492,14 @@ r_device *flex_create_device(char *spec)
     if (dev->modulation == OOK_PULSE_DMC
             || dev->modulation == OOK_PULSE_PIWM_RAW
             || dev->modulation == OOK_PULSE_PIWM_DC) {
-        c = strtok(NULL, ":");
+        c = strtok_r(NULL, ":", &saveptr);
         if (c == NULL) {
             fprintf(stderr, "Bad flex spec, missing tolerance limit!\n");
-            usage();
+            goto fail;
         }
         dev->tolerance = atoi(c);
     }
 
-    dev->json_callback = callback_slot[next_slot];
     dev->fields = output_fields;
 
     getkwargs(&c, NULL, NULL); // skip the initial fixed part
@@ -378,18 +532,24 @@ r_device *flex_create_device(char *spec)
         else if (!strcasecmp(key, "invert"))
             params->invert = val ? atoi(val) : 1;
 
-        else if (!strcasecmp(key, "match"))
+        else if (!strcasecmp(key, "match")) {
             params->match_len = parse_bits(val, params->match_bits);
+            if (!params->match_len)
+                goto fail;
+        }
 
-        else if (!strcasecmp(key, "preamble"))
+        else if (!strcasecmp(key, "preamble")) {
             params->preamble_len = parse_bits(val, params->preamble_bits);
+            if (!params->preamble_len)
+                goto fail;
+        }
 
         else if (!strcasecmp(key, "countonly"))
             params->count_only = val ? atoi(val) : 1;
 
         else {
             fprintf(stderr, "Bad flex spec, unknown keyword (%s)!\n", key);
-            usage();
+            goto fail;
         }
     }
 
@@ -399,15 +559,49 @@ r_device *flex_create_device(char *spec)
     if (params->min_bits > 0 && params->min_repeats < 1)
         params->min_repeats = 1;
 
+    flex_compile(params);
+
     if (debug_output >= 1) {
         fprintf(stderr, "Adding flex decoder \"%s\"\n", params->name);
         fprintf(stderr, "\tmodulation=%u, short_limit=%.0f, long_limit=%.0f, reset_limit=%.0f, demod_arg=%u\n",
                 dev->modulation, dev->short_limit, dev->long_limit, dev->reset_limit, (unsigned)dev->demod_arg);
-        fprintf(stderr, "\tmin_rows=%u, min_bits=%u, min_repeats=%u, invert=%u, match_len=%u, preamble_len=%u\n",
-                params->min_rows, params->min_bits, params->min_repeats, params->invert, params->match_len, params->preamble_len);
+        fprintf(stderr, "\tmin_rows=%u, max_rows=%u, min_bits=%u, max_bits=%u, min_repeats=%u, max_repeats=%u, invert=%u, match_len=%u, preamble_len=%u\n",
+                params->min_rows, params->max_rows, params->min_bits, params->max_bits, params->min_repeats, params->max_repeats,
+                params->invert, params->match_len, params->preamble_len);
     }
 
     free(spec);
-    next_slot++;
+    params_slot[slot] = params;
+    dev->json_callback = callback_slot[slot];
     return dev;
+
+fail:
+    usage();
+    free(params->name);
+    free(params);
+    free(dev);
+    free(spec);
+    return NULL;
+}
+
+/// The compiled matcher of a flex decoder for flex_match(), NULL if dev is not one
+struct flex_params *flex_device_params(r_device const *dev)
+{
+    for (unsigned slot = 0; slot < FLEX_SLOTS; ++slot) {
+        if (callback_slot[slot] == dev->json_callback)
+            return params_slot[slot];
+    }
+    return NULL;
+}
+
+void flex_free_device(r_device *dev)
+{
+    for (unsigned slot = 0; slot < FLEX_SLOTS; ++slot) {
+        if (callback_slot[slot] == dev->json_callback && params_slot[slot]) {
+            free(params_slot[slot]->name);
+            free(params_slot[slot]);
+            params_slot[slot] = NULL;
+        }
+    }
+    free(dev);
 }
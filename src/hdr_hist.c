@@ -0,0 +1,111 @@
+/**
+ * HDR-style histogram
+ *
+ * Log-linear buckets (32 sub-buckets per power of two), see hdr_hist.h
+ * for the range and precision.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "hdr_hist.h"
+#include <string.h>
+
+static unsigned msb64(uint64_t value)
+{
+    unsigned msb = 0;
+    while (value >>= 1)
+        msb++;
+    return msb;
+}
+
+// Group 0 holds the values below 2^SUB_BITS exactly, group g >= 1
+// covers [2^(g+SUB_BITS-1), 2^(g+SUB_BITS)) in SUB_COUNT steps.
+static unsigned bucket_index(uint64_t value)
+{
+    if (value < HDR_HIST_SUB_COUNT)
+        return (unsigned)value;
+
+    unsigned msb = msb64(value);
+    if (msb >= HDR_HIST_MAX_BITS)
+        return HDR_HIST_BUCKETS - 1;
+
+    unsigned group = msb - HDR_HIST_SUB_BITS + 1;
+    unsigned sub = (unsigned)(value >> (msb - HDR_HIST_SUB_BITS)) - HDR_HIST_SUB_COUNT;
+    return group * HDR_HIST_SUB_COUNT + sub;
+}
+
+static uint64_t bucket_value(unsigned index)
+{
+    unsigned group = index / HDR_HIST_SUB_COUNT;
+    unsigned sub = index % HDR_HIST_SUB_COUNT;
+    if (group == 0)
+        return sub;
+    return (uint64_t)(HDR_HIST_SUB_COUNT + sub) << (group - 1);
+}
+
+void hdr_hist_reset(hdr_hist_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+void hdr_hist_record(hdr_hist_t *hist, uint64_t value)
+{
+    hist->counts[bucket_index(value)]++;
+    if (!hist->total || value < hist->min)
+        hist->min = value;
+    if (value > hist->max)
+        hist->max = value;
+    hist->total++;
+    hist->sum += value;
+}
+
+void hdr_hist_merge(hdr_hist_t *dst, hdr_hist_t const *src)
+{
+    if (!src->total)
+        return;
+    for (unsigned i = 0; i < HDR_HIST_BUCKETS; ++i)
+        dst->counts[i] += src->counts[i];
+    if (!dst->total || src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->total += src->total;
+    dst->sum += src->sum;
+}
+
+uint64_t hdr_hist_percentile(hdr_hist_t const *hist, double percentile)
+{
+    if (!hist->total)
+        return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * hist->total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank >= hist->total)
+        return hist->max;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HDR_HIST_BUCKETS; ++i) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_value(i);
+            // report the bucket midpoint, but stay within the recorded range
+            if (i + 1 < HDR_HIST_BUCKETS)
+                value += (bucket_value(i + 1) - value) / 2;
+            if (value < hist->min)
+                value = hist->min;
+            if (value > hist->max)
+                value = hist->max;
+            return value;
+        }
+    }
+    return hist->max;
+}
+
+double hdr_hist_mean(hdr_hist_t const *hist)
+{
+    return hist->total ? hist->sum / hist->total : 0.0;
+}
@@ -0,0 +1,146 @@
+/**
+ * Frequency hop scheduler
+ *
+ * Decides when to hop based on the number of samples received instead of
+ * wall clock time, keeps track of the samples to discard after a retune and
+ * collects per-frequency statistics.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "hop_scheduler.h"
+#include "util.h"
+#include <stdlib.h>
+
+void hop_scheduler_init(hop_scheduler_t *hop, uint32_t const *frequencies, int const *dwell_secs,
+        unsigned num_dwell_secs, unsigned num_frequencies, uint32_t samp_rate, unsigned stale_blocks,
+        unsigned settle_ms, unsigned hop_events)
+{
+    *hop = (hop_scheduler_t){0};
+
+    hop->channels = calloc(num_frequencies, sizeof(hop_channel_t));
+    if (!hop->channels) {
+        fprintf(stderr, "hop_scheduler_init(): calloc() failed\n");
+        exit(1);
+    }
+    hop->num_channels = num_frequencies;
+    for (unsigned i = 0; i < num_frequencies; ++i) {
+        // the last dwell time given applies to all remaining frequencies
+        int secs = num_dwell_secs ? dwell_secs[min(i, num_dwell_secs - 1)] : 0;
+        hop->channels[i].frequency = frequencies[i];
+        hop->channels[i].dwell_samples = (uint64_t)max(secs, 1) * samp_rate;
+    }
+
+    hop->hop_events = hop_events;
+    hop->stale_blocks = max(stale_blocks, 1);
+    hop->settle_samples = (uint64_t)samp_rate * settle_ms / 1000;
+    hop->dwell_left = hop->channels[0].dwell_samples;
+    hop->channels[0].dwells = 1;
+}
+
+unsigned hop_scheduler_block_size(uint32_t samp_rate)
+{
+    uint64_t bytes = (uint64_t)samp_rate * 2 * HOP_BLOCK_MS / 1000;
+    return (unsigned)max((bytes + 511) / 512, 1) * 512;
+}
+
+void hop_scheduler_free(hop_scheduler_t *hop)
+{
+    free(hop->channels);
+    hop->channels = NULL;
+    hop->num_channels = 0;
+}
+
+uint32_t hop_scheduler_frequency(hop_scheduler_t const *hop)
+{
+    return hop->channels[hop->current].frequency;
+}
+
+unsigned hop_scheduler_settle(hop_scheduler_t *hop, unsigned num_samples)
+{
+    hop_channel_t *ch = &hop->channels[hop->current];
+    unsigned discard = 0;
+
+    ch->samples_received += num_samples;
+
+    if (hop->state == HOP_RETUNED) {
+        // The reader kept filling its buffers while retuning, this and the queued blocks are stale
+        hop->state = HOP_IDLE;
+        hop->stale_left = hop->stale_blocks - 1;
+        hop->settle_left = hop->settle_samples;
+        discard = num_samples;
+    } else if (hop->stale_left) {
+        hop->stale_left--;
+        discard = num_samples;
+    } else if (hop->settle_left) {
+        // Discard what is left of the tuner settle time
+        discard = min(hop->settle_left, num_samples);
+        hop->settle_left -= discard;
+    }
+
+    ch->samples_discarded += discard;
+    return discard;
+}
+
+int hop_scheduler_update(hop_scheduler_t *hop, unsigned num_samples, unsigned events)
+{
+    hop_channel_t *ch = &hop->channels[hop->current];
+
+    ch->events += events;
+    hop->dwell_events += events;
+
+    if (hop->num_channels < 2 || hop->state != HOP_IDLE)
+        return 0;
+
+    if (hop->dwell_left > num_samples) {
+        hop->dwell_left -= num_samples;
+        return 0;
+    }
+
+    // Stay while packets keep arriving
+    if (hop->hop_events && hop->dwell_events >= hop->hop_events) {
+        hop->dwell_left = ch->dwell_samples;
+        hop->dwell_events = 0;
+        ch->extensions++;
+        return 0;
+    }
+
+    hop->next = (hop->current + 1) % hop->num_channels;
+    hop->state = HOP_PENDING;
+    return 1;
+}
+
+int hop_scheduler_pending(hop_scheduler_t const *hop)
+{
+    return hop->state == HOP_PENDING;
+}
+
+uint32_t hop_scheduler_retune(hop_scheduler_t *hop)
+{
+    hop->state = HOP_RETUNING;
+    return hop->channels[hop->next].frequency;
+}
+
+void hop_scheduler_retuned(hop_scheduler_t *hop)
+{
+    hop->current = hop->next;
+    hop->state = HOP_RETUNED;
+    hop->dwell_left = hop->channels[hop->current].dwell_samples;
+    hop->dwell_events = 0;
+    hop->channels[hop->current].dwells++;
+}
+
+void hop_scheduler_print_stats(hop_scheduler_t const *hop, FILE *file)
+{
+    fprintf(file, "Frequency hopping statistics:\n");
+    for (unsigned i = 0; i < hop->num_channels; ++i) {
+        hop_channel_t const *ch = &hop->channels[i];
+        double loss = ch->samples_received ? 100.0 * ch->samples_discarded / ch->samples_received : 0.0;
+        fprintf(file, "\t%s: %u dwells (%u extended), %u events, %llu samples, %llu discarded (%.3f%%)\n",
+                nice_freq(ch->frequency), ch->dwells, ch->extensions, ch->events,
+                (unsigned long long)ch->samples_received, (unsigned long long)ch->samples_discarded, loss);
+    }
+}
@@ -0,0 +1,489 @@
+/**
+ * Minimal HTTP/1.1 server for published documents
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "http_server.h"
+
+// Not available on Windows, -M http reports an error there
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define HTTP_MAX_REQUEST    4096    // bytes of request line and headers
+#define HTTP_IDLE_TIMEOUT_S 30
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE is set instead
+#endif
+
+/// A published document, never changed once published
+typedef struct {
+    char const *path;
+    char const *content_type;
+    size_t len;
+    char data[];                // body, then path and content type
+} http_doc_t;
+
+typedef struct {
+    int sock;                   // -1 if unused
+    int close_after;            // close once the response is written
+    time_t last_active;
+    size_t in_len;
+    char in[HTTP_MAX_REQUEST + 1];
+    char *out;
+    size_t out_len;
+    size_t out_pos;
+    size_t out_size;
+} http_conn_t;
+
+struct http_server {
+    pthread_t thread;
+    int listen_sock;
+    int wake[2];                // self pipe to stop the server thread
+    int closing;
+    unsigned long requests;
+    http_doc_t *pending[HTTP_MAX_PATHS];    // published and not yet taken, exchanged atomically
+
+    /* publishing thread only */
+    char *paths[HTTP_MAX_PATHS];
+    int num_paths;
+
+    /* server thread only */
+    http_doc_t *docs[HTTP_MAX_PATHS];
+    http_conn_t conns[HTTP_MAX_CONNECTIONS];
+};
+
+static void close_conn(http_conn_t *conn)
+{
+    close(conn->sock);
+    conn->sock = -1;
+    conn->in_len = 0;
+    conn->out_len = conn->out_pos = 0;
+}
+
+static int out_reserve(http_conn_t *conn, size_t len)
+{
+    if (conn->out_len + len <= conn->out_size)
+        return 0;
+    size_t size = conn->out_size ? conn->out_size : 4096;
+    while (size < conn->out_len + len)
+        size *= 2;
+    char *out = realloc(conn->out, size);
+    if (!out)
+        return -1;
+    conn->out = out;
+    conn->out_size = size;
+    return 0;
+}
+
+static void respond(http_conn_t *conn, char const *status, char const *content_type, void const *body, size_t len, int head_only)
+{
+    char header[512];
+    int header_len = snprintf(header, sizeof(header),
+            "HTTP/1.1 %s\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %zu\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: %s\r\n"
+            "\r\n",
+            status, content_type, len, conn->close_after ? "close" : "keep-alive");
+    if (head_only)
+        len = 0;
+    if (out_reserve(conn, header_len + len) < 0) {
+        conn->close_after = 1;
+        return;
+    }
+    memcpy(conn->out + conn->out_len, header, header_len);
+    memcpy(conn->out + conn->out_len + header_len, body, len);
+    conn->out_len += header_len + len;
+}
+
+// Take the documents published since the last request
+static void take_docs(http_server_t *server)
+{
+    for (int i = 0; i < HTTP_MAX_PATHS; ++i) {
+        http_doc_t *doc = __atomic_exchange_n(&server->pending[i], NULL, __ATOMIC_ACQ_REL);
+        if (doc) {
+            free(server->docs[i]);
+            server->docs[i] = doc;
+        }
+    }
+}
+
+// The value of header name (without the colon) in lower case, empty if missing
+static void header_value(char const *headers, char const *name, char *value, size_t size)
+{
+    size_t name_len = strlen(name);
+    *value = '\0';
+    for (char const *line = strstr(headers, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, name, name_len) || line[2 + name_len] != ':')
+            continue;
+        char const *p = line + 3 + name_len;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        size_t n = 0;
+        while (*p && *p != '\r' && n < size - 1)
+            value[n++] = (char)tolower((unsigned char)*p++);
+        value[n] = '\0';
+        return;
+    }
+}
+
+static void handle_request(http_server_t *server, http_conn_t *conn, char *request)
+{
+    char method[8], target[256], version[16], connection[32];
+    if (sscanf(request, "%7s %255s %15s", method, target, version) != 3 || strncmp(version, "HTTP/1.", 7)) {
+        conn->close_after = 1;
+        respond(conn, "400 Bad Request", "text/plain", "Bad request\n", 12, 0);
+        return;
+    }
+    __atomic_add_fetch(&server->requests, 1, __ATOMIC_RELAXED);
+
+    header_value(request, "Connection", connection, sizeof(connection));
+    if (strcmp(version, "HTTP/1.0") == 0)
+        conn->close_after = !strstr(connection, "keep-alive");
+    else
+        conn->close_after = strstr(connection, "close") != NULL;
+
+    int head_only = strcmp(method, "HEAD") == 0;
+    if (!head_only && strcmp(method, "GET")) {
+        conn->close_after = 1;
+        respond(conn, "405 Method Not Allowed", "text/plain", "Method not allowed\n", 19, 0);
+        return;
+    }
+
+    char *query = strchr(target, '?');
+    if (query)
+        *query = '\0';
+    take_docs(server);
+    for (int i = 0; i < HTTP_MAX_PATHS; ++i) {
+        http_doc_t const *doc = server->docs[i];
+        if (doc && strcmp(doc->path, target) == 0) {
+            respond(conn, "200 OK", doc->content_type, doc->data, doc->len, head_only);
+            return;
+        }
+    }
+    if (strcmp(target, "/") == 0) {
+        // an index of the documents
+        char index[HTTP_MAX_PATHS * 260] = "";
+        for (int i = 0; i < HTTP_MAX_PATHS; ++i) {
+            if (server->docs[i]) {
+                strncat(index, server->docs[i]->path, 256);
+                strcat(index, "\n");
+            }
+        }
+        respond(conn, "200 OK", "text/plain", index, strlen(index), head_only);
+        return;
+    }
+    respond(conn, "404 Not Found", "text/plain", "Not found\n", 10, head_only);
+}
+
+// Answer the first complete request received, returns 1 if there was one
+static int handle_input(http_server_t *server, http_conn_t *conn)
+{
+    conn->in[conn->in_len] = '\0';
+    char *end = strstr(conn->in, "\r\n\r\n");
+    if (!end) {
+        if (conn->in_len < HTTP_MAX_REQUEST)
+            return 0;
+        conn->close_after = 1;
+        respond(conn, "431 Request Header Fields Too Large", "text/plain", "Request too large\n", 18, 0);
+        return 1;
+    }
+    end[2] = '\0'; // keep the last header line end for header_value()
+    handle_request(server, conn, conn->in);
+    size_t used = end + 4 - conn->in;
+    conn->in_len -= used;
+    memmove(conn->in, conn->in + used, conn->in_len);
+    return 1;
+}
+
+// Write what is pending, returns -1 if the connection is done
+static int handle_output(http_conn_t *conn)
+{
+    while (conn->out_pos < conn->out_len) {
+        ssize_t n = send(conn->sock, conn->out + conn->out_pos, conn->out_len - conn->out_pos, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n <= 0)
+            return -1;
+        conn->out_pos += n;
+    }
+    return conn->close_after ? -1 : 0;
+}
+
+// Write the pending response, then answer pipelined requests one at a time
+static void serve_conn(http_server_t *server, http_conn_t *conn)
+{
+    for (;;) {
+        if (handle_output(conn) < 0) {
+            close_conn(conn);
+            return;
+        }
+        if (conn->out_pos < conn->out_len)
+            return; // the rest when the socket is writable
+        conn->out_len = conn->out_pos = 0;
+        if (!handle_input(server, conn))
+            return;
+    }
+}
+
+static void accept_conns(http_server_t *server)
+{
+    for (;;) {
+        int sock = accept(server->listen_sock, NULL, NULL);
+        if (sock < 0)
+            return;
+        http_conn_t *conn = NULL;
+        for (int i = 0; i < HTTP_MAX_CONNECTIONS && !conn; ++i) {
+            if (server->conns[i].sock < 0)
+                conn = &server->conns[i];
+        }
+        if (!conn) {
+            close(sock); // too many, the client may try again
+            continue;
+        }
+        int one = 1;
+        fcntl(sock, F_SETFL, O_NONBLOCK);
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        conn->sock = sock;
+        conn->close_after = 0;
+        conn->last_active = time(NULL);
+    }
+}
+
+static void *http_server_thread(void *arg)
+{
+    http_server_t *server = arg;
+    struct pollfd pfds[HTTP_MAX_CONNECTIONS + 2];
+    http_conn_t *polled[HTTP_MAX_CONNECTIONS];
+
+    while (!__atomic_load_n(&server->closing, __ATOMIC_ACQUIRE)) {
+        pfds[0].fd = server->wake[0];
+        pfds[0].events = POLLIN;
+        pfds[1].fd = server->listen_sock;
+        pfds[1].events = POLLIN;
+        int n = 2;
+        for (int i = 0; i < HTTP_MAX_CONNECTIONS; ++i) {
+            http_conn_t *conn = &server->conns[i];
+            if (conn->sock < 0)
+                continue;
+            pfds[n].fd = conn->sock;
+            pfds[n].events = conn->out_pos < conn->out_len ? POLLOUT : POLLIN;
+            polled[n - 2] = conn;
+            n++;
+        }
+        if (poll(pfds, n, 1000) < 0 && errno != EINTR)
+            break;
+
+        time_t now = time(NULL);
+        for (int i = 2; i < n; ++i) {
+            http_conn_t *conn = polled[i - 2];
+            short revents = pfds[i].revents;
+            if (!revents) {
+                if (now - conn->last_active > HTTP_IDLE_TIMEOUT_S)
+                    close_conn(conn);
+                continue;
+            }
+            conn->last_active = now;
+            if (revents & POLLIN) {
+                ssize_t r = recv(conn->sock, conn->in + conn->in_len, HTTP_MAX_REQUEST - conn->in_len, 0);
+                if (r <= 0 && !(r < 0 && (errno == EAGAIN || errno == EINTR))) {
+                    close_conn(conn);
+                    continue;
+                }
+                if (r > 0)
+                    conn->in_len += r;
+            } else if (revents & (POLLERR | POLLHUP | POLLNVAL) && !(revents & POLLOUT)) {
+                close_conn(conn);
+                continue;
+            }
+            serve_conn(server, conn);
+        }
+        if (pfds[1].revents & POLLIN)
+            accept_conns(server);
+        if (pfds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(server->wake[0], drain, sizeof(drain)) > 0);
+        }
+    }
+    return NULL;
+}
+
+static int listen_socket(char const *host, char const *port)
+{
+    struct addrinfo hints = {0}, *res, *ai;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "HTTP: %s:%s: %s\n", host ? host : "*", port, gai_strerror(err));
+        return -1;
+    }
+    int sock = -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0)
+            continue;
+        int one = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(sock, ai->ai_addr, ai->ai_addrlen) == 0 && listen(sock, 16) == 0)
+            break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock < 0) {
+        fprintf(stderr, "HTTP: can't listen on %s:%s: %s\n", host ? host : "*", port, strerror(errno));
+        return -1;
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    return sock;
+}
+
+http_server_t *http_server_start(char const *host, char const *port)
+{
+    http_server_t *server = calloc(1, sizeof(http_server_t));
+    if (!server) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; ++i)
+        server->conns[i].sock = -1;
+    server->wake[0] = server->wake[1] = -1;
+
+    server->listen_sock = listen_socket(host, port);
+    if (server->listen_sock < 0)
+        goto fail;
+    if (pipe(server->wake) < 0) {
+        server->wake[0] = server->wake[1] = -1;
+        goto fail;
+    }
+    fcntl(server->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(server->wake[1], F_SETFL, O_NONBLOCK);
+    if (pthread_create(&server->thread, NULL, http_server_thread, server)) {
+        fprintf(stderr, "HTTP: failed to start the server thread\n");
+        goto fail;
+    }
+    return server;
+
+fail:
+    if (server->listen_sock >= 0)
+        close(server->listen_sock);
+    if (server->wake[0] >= 0) {
+        close(server->wake[0]);
+        close(server->wake[1]);
+    }
+    free(server);
+    return NULL;
+}
+
+int http_server_publish(http_server_t *server, char const *path, char const *content_type, void const *body, size_t len)
+{
+    int i;
+    for (i = 0; i < server->num_paths && strcmp(server->paths[i], path); ++i);
+    if (i == server->num_paths) {
+        if (i == HTTP_MAX_PATHS || !(server->paths[i] = strdup(path)))
+            return -1;
+        server->num_paths++;
+    }
+
+    size_t path_size = strlen(path) + 1;
+    size_t type_size = strlen(content_type) + 1;
+    http_doc_t *doc = malloc(sizeof(http_doc_t) + len + path_size + type_size);
+    if (!doc)
+        return -1;
+    memcpy(doc->data, body, len);
+    memcpy(doc->data + len, path, path_size);
+    memcpy(doc->data + len + path_size, content_type, type_size);
+    doc->path = doc->data + len;
+    doc->content_type = doc->data + len + path_size;
+    doc->len = len;
+
+    // the one replaced was never taken by the server thread, nothing else refers to it
+    free(__atomic_exchange_n(&server->pending[i], doc, __ATOMIC_ACQ_REL));
+    return 0;
+}
+
+unsigned long http_server_requests(http_server_t *server)
+{
+    return __atomic_load_n(&server->requests, __ATOMIC_RELAXED);
+}
+
+void http_server_free(http_server_t *server)
+{
+    if (!server)
+        return;
+
+    __atomic_store_n(&server->closing, 1, __ATOMIC_RELEASE);
+    if (write(server->wake[1], "", 1) < 0 && errno != EAGAIN)
+        perror("write");
+    pthread_join(server->thread, NULL);
+
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; ++i) {
+        if (server->conns[i].sock >= 0)
+            close(server->conns[i].sock);
+        free(server->conns[i].out);
+    }
+    for (int i = 0; i < HTTP_MAX_PATHS; ++i) {
+        free(server->pending[i]);
+        free(server->docs[i]);
+        free(server->paths[i]);
+    }
+    close(server->listen_sock);
+    close(server->wake[0]);
+    close(server->wake[1]);
+    free(server);
+}
+
+#else
+
+#include <stdio.h>
+
+http_server_t *http_server_start(char const *host, char const *port)
+{
+    fprintf(stderr, "HTTP server not supported on this platform\n");
+    return NULL;
+}
+
+int http_server_publish(http_server_t *server, char const *path, char const *content_type, void const *body, size_t len)
+{
+    return -1;
+}
+
+unsigned long http_server_requests(http_server_t *server)
+{
+    return 0;
+}
+
+void http_server_free(http_server_t *server)
+{
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,722 @@
+/**
+ * Compressed I/Q sample file format (.iqz)
+ *
+ * Samples are split into chunks of IQZ_CHUNK values, each chunk gets its
+ * own Rice parameter k. Residuals are mapped to unsigned values with a
+ * zigzag code, the quotient is coded in unary (LSB first), quotients of
+ * RICE_ESCAPE or more escape to the plain 8 bit value.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "iqz.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#define IQZ_VERSION         1
+#define IQZ_HEADER_LEN      32
+#define IQZ_BLOCK_HDR_LEN   20
+#define IQZ_TRAILER_LEN     16
+#define IQZ_CHUNK           256     // Values per Rice parameter
+#define RICE_ESCAPE         15      // Unary quotient length that escapes to 8 bit
+#define RICE_MAX_K          7
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v & 0xffff);
+    put_u16(p + 2, v >> 16);
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+    put_u32(p, v & 0xffffffff);
+    put_u32(p + 4, v >> 32);
+}
+
+static uint16_t get_u16(uint8_t const *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(uint8_t const *p)
+{
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static uint64_t get_u64(uint8_t const *p)
+{
+    return get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+/* Rice coding */
+
+static inline uint8_t zigzag(uint8_t residual)
+{
+    return (uint8_t)(residual << 1) ^ (residual & 0x80 ? 0xff : 0);
+}
+
+static inline uint8_t unzigzag(uint8_t u)
+{
+    return (uint8_t)((u >> 1) ^ -(u & 1));
+}
+
+static unsigned rice_k(uint8_t const *u, unsigned n)
+{
+    unsigned sum = 0;
+    for (unsigned i = 0; i < n; ++i)
+        sum += u[i];
+    unsigned k = 0;
+    while (k < RICE_MAX_K && (n << (k + 1)) <= sum)
+        k++;
+    return k;
+}
+
+typedef struct {
+    uint8_t *dst;
+    size_t pos;
+    size_t len;
+    uint64_t acc;
+    unsigned bits;
+} bit_writer_t;
+
+static inline int bw_put(bit_writer_t *bw, uint32_t value, unsigned bits)
+{
+    bw->acc |= (uint64_t)value << bw->bits;
+    bw->bits += bits;
+    while (bw->bits >= 8) {
+        if (bw->pos >= bw->len)
+            return -1;
+        bw->dst[bw->pos++] = bw->acc & 0xff;
+        bw->acc >>= 8;
+        bw->bits -= 8;
+    }
+    return 0;
+}
+
+static size_t rice_encode(uint8_t const *src, size_t len, uint8_t *dst, size_t dst_len, int delta)
+{
+    bit_writer_t bw = {dst, 0, dst_len, 0, 0};
+    uint8_t prev[2] = {128, 128};
+    uint8_t u[IQZ_CHUNK];
+
+    for (size_t start = 0; start < len; start += IQZ_CHUNK) {
+        unsigned n = (unsigned)(len - start < IQZ_CHUNK ? len - start : IQZ_CHUNK);
+        for (unsigned i = 0; i < n; ++i) {
+            uint8_t v = src[start + i];
+            uint8_t *p = &prev[i & 1]; // chunks are even sized, i & 1 selects I or Q
+            u[i] = zigzag(v - *p);
+            if (delta)
+                *p = v;
+        }
+
+        unsigned k = rice_k(u, n);
+        if (bw_put(&bw, k, 3) < 0)
+            return 0;
+        for (unsigned i = 0; i < n; ++i) {
+            unsigned q = u[i] >> k;
+            int r;
+            if (q < RICE_ESCAPE)
+                r = bw_put(&bw, ((1u << q) - 1) | (u[i] & ((1u << k) - 1)) << (q + 1), q + 1 + k);
+            else
+                r = bw_put(&bw, ((1u << RICE_ESCAPE) - 1) | (uint32_t)u[i] << RICE_ESCAPE, RICE_ESCAPE + 8);
+            if (r < 0)
+                return 0;
+        }
+    }
+    if (bw.bits && bw_put(&bw, 0, 8 - bw.bits) < 0)
+        return 0;
+    return bw.pos;
+}
+
+static int rice_decode(uint8_t const *src, size_t len, uint8_t *dst, size_t dst_len, int delta)
+{
+    uint8_t prev[2] = {128, 128};
+    uint64_t acc = 0;
+    unsigned bits = 0;
+    size_t pos = 0;
+
+    for (size_t start = 0; start < dst_len; start += IQZ_CHUNK) {
+        unsigned n = (unsigned)(dst_len - start < IQZ_CHUNK ? dst_len - start : IQZ_CHUNK);
+        unsigned k = 0;
+        for (unsigned i = 0; i <= n; ++i) {
+            // a value takes at most 23 bits, the chunk header 3 bits
+            while (bits <= 56 && pos < len) {
+                acc |= (uint64_t)src[pos++] << bits;
+                bits += 8;
+            }
+            if (i == 0) {
+                if (bits < 3)
+                    return -1;
+                k = acc & 7;
+                acc >>= 3;
+                bits -= 3;
+                if (n == 0)
+                    break;
+            }
+            if (i == n)
+                break;
+
+            unsigned ones = ~acc & ((1u << RICE_ESCAPE) - 1);
+            unsigned q = 0;
+            uint8_t u;
+            if (!ones) {
+                if (bits < RICE_ESCAPE + 8)
+                    return -1;
+                u = (acc >> RICE_ESCAPE) & 0xff;
+                acc >>= RICE_ESCAPE + 8;
+                bits -= RICE_ESCAPE + 8;
+            } else {
+#ifdef __GNUC__
+                q = __builtin_ctz(ones);
+#else
+                while (!(ones & (1u << q)))
+                    q++;
+#endif
+                if (bits < q + 1 + k)
+                    return -1;
+                u = (uint8_t)(q << k | ((acc >> (q + 1)) & ((1u << k) - 1)));
+                acc >>= q + 1 + k;
+                bits -= q + 1 + k;
+            }
+
+            uint8_t *p = &prev[i & 1];
+            uint8_t v = *p + unzigzag(u);
+            dst[start + i] = v;
+            if (delta)
+                *p = v;
+        }
+    }
+    return 0;
+}
+
+size_t iqz_encode_block(uint8_t const *src, size_t len, uint8_t *dst, uint8_t *method)
+{
+    // Pick the predictor with the smaller residuals, noise compresses
+    // better as offset and narrow band signals better as delta.
+    uint64_t sum_offset = 0, sum_delta = 0;
+    uint8_t prev[2] = {128, 128};
+    for (size_t i = 0; i < len; ++i) {
+        sum_offset += zigzag(src[i] - 128);
+        sum_delta += zigzag(src[i] - prev[i & 1]);
+        prev[i & 1] = src[i];
+    }
+    int delta = sum_delta < sum_offset;
+
+    size_t comp_len = rice_encode(src, len, dst, len, delta);
+    if (comp_len && comp_len < len) {
+        *method = delta ? IQZ_METHOD_DELTA : IQZ_METHOD_OFFSET;
+        return comp_len;
+    }
+    memcpy(dst, src, len);
+    *method = IQZ_METHOD_RAW;
+    return len;
+}
+
+int iqz_decode_block(uint8_t const *src, size_t comp_len, uint8_t method, uint8_t *dst, size_t raw_len)
+{
+    switch (method) {
+    case IQZ_METHOD_RAW:
+        if (comp_len != raw_len)
+            return -1;
+        memcpy(dst, src, raw_len);
+        return 0;
+    case IQZ_METHOD_OFFSET:
+        return rice_decode(src, comp_len, dst, raw_len, 0);
+    case IQZ_METHOD_DELTA:
+        return rice_decode(src, comp_len, dst, raw_len, 1);
+    default:
+        return -1;
+    }
+}
+
+int iqz_filename(char const *filename)
+{
+    size_t len = strlen(filename);
+    return len > 4 && !strcmp(filename + len - 4, ".iqz");
+}
+
+/* Writer */
+
+struct iqz_writer {
+    FILE *file;
+    uint32_t frequency;
+    uint8_t *block;
+    size_t fill;
+    uint8_t *comp;
+    uint64_t offset;            // File offset of the next block
+    uint64_t *index;
+    unsigned num_blocks;
+    unsigned index_size;
+    int failed;
+    uint64_t raw_bytes;
+    uint64_t comp_bytes;
+    unsigned methods[3];        // Blocks per method
+};
+
+static int write_block(iqz_writer_t *writer)
+{
+    uint8_t hdr[IQZ_BLOCK_HDR_LEN] = {'I', 'Q', 'Z', 'B'};
+    uint8_t method;
+    size_t comp_len = iqz_encode_block(writer->block, writer->fill, writer->comp, &method);
+
+    put_u32(hdr + 4, (uint32_t)writer->fill);
+    put_u32(hdr + 8, (uint32_t)comp_len);
+    put_u32(hdr + 12, writer->frequency);
+    hdr[16] = method;
+
+    if (writer->num_blocks == writer->index_size) {
+        unsigned size = writer->index_size ? writer->index_size * 2 : 64;
+        uint64_t *index = realloc(writer->index, size * sizeof(uint64_t));
+        if (!index)
+            return -1;
+        writer->index = index;
+        writer->index_size = size;
+    }
+    if (fwrite(hdr, 1, sizeof(hdr), writer->file) != sizeof(hdr)
+            || fwrite(writer->comp, 1, comp_len, writer->file) != comp_len)
+        return -1;
+
+    writer->index[writer->num_blocks++] = writer->offset;
+    writer->offset += sizeof(hdr) + comp_len;
+    writer->raw_bytes += writer->fill;
+    writer->comp_bytes += sizeof(hdr) + comp_len;
+    writer->methods[method]++;
+    writer->fill = 0;
+    return 0;
+}
+
+iqz_writer_t *iqz_writer_open(FILE *file, iqz_meta_t const *meta)
+{
+    iqz_writer_t *writer = calloc(1, sizeof(iqz_writer_t));
+    if (!writer)
+        return NULL;
+    writer->block = malloc(IQZ_BLOCK_SIZE);
+    writer->comp = malloc(IQZ_BLOCK_SIZE);
+    if (!writer->block || !writer->comp) {
+        free(writer->block);
+        free(writer->comp);
+        free(writer);
+        return NULL;
+    }
+    writer->file = file;
+    writer->frequency = meta->frequency;
+
+    uint8_t hdr[IQZ_HEADER_LEN] = {'I', 'Q', 'Z', '1'};
+    put_u16(hdr + 4, IQZ_VERSION);
+    put_u16(hdr + 6, IQZ_HEADER_LEN);
+    put_u32(hdr + 8, meta->frequency);
+    put_u32(hdr + 12, meta->sample_rate);
+    put_u32(hdr + 16, (uint32_t)meta->gain);
+    put_u32(hdr + 20, IQZ_BLOCK_SIZE);
+    put_u64(hdr + 24, meta->timestamp);
+    if (fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr))
+        writer->failed = 1;
+    writer->offset = sizeof(hdr);
+    return writer;
+}
+
+void iqz_writer_set_frequency(iqz_writer_t *writer, uint32_t frequency)
+{
+    writer->frequency = frequency;
+}
+
+int iqz_write(iqz_writer_t *writer, uint8_t const *buf, size_t len)
+{
+    while (len && !writer->failed) {
+        size_t n = IQZ_BLOCK_SIZE - writer->fill;
+        if (n > len)
+            n = len;
+        memcpy(writer->block + writer->fill, buf, n);
+        writer->fill += n;
+        buf += n;
+        len -= n;
+        if (writer->fill == IQZ_BLOCK_SIZE && write_block(writer) < 0)
+            writer->failed = 1;
+    }
+    return writer->failed ? -1 : 0;
+}
+
+int iqz_writer_close(iqz_writer_t *writer, FILE *stats_file)
+{
+    if (!writer->failed && writer->fill && write_block(writer) < 0)
+        writer->failed = 1;
+
+    if (!writer->failed) {
+        uint8_t entry[8];
+        for (unsigned i = 0; i < writer->num_blocks && !writer->failed; ++i) {
+            put_u64(entry, writer->index[i]);
+            writer->failed = fwrite(entry, 1, sizeof(entry), writer->file) != sizeof(entry);
+        }
+        uint8_t trailer[IQZ_TRAILER_LEN];
+        put_u64(trailer, writer->offset);
+        put_u32(trailer + 8, writer->num_blocks);
+        memcpy(trailer + 12, "IQZI", 4);
+        if (fwrite(trailer, 1, sizeof(trailer), writer->file) != sizeof(trailer) || fflush(writer->file))
+            writer->failed = 1;
+    }
+
+    if (stats_file && writer->raw_bytes) {
+        fprintf(stats_file, "Compressed %llu bytes to %llu bytes (%.1f%%) in %u blocks (%u raw, %u offset, %u delta)\n",
+                (unsigned long long)writer->raw_bytes, (unsigned long long)writer->comp_bytes,
+                100.0 * writer->comp_bytes / writer->raw_bytes, writer->num_blocks,
+                writer->methods[IQZ_METHOD_RAW], writer->methods[IQZ_METHOD_OFFSET], writer->methods[IQZ_METHOD_DELTA]);
+    }
+
+    int failed = writer->failed;
+    free(writer->index);
+    free(writer->block);
+    free(writer->comp);
+    free(writer);
+    return failed ? -1 : 0;
+}
+
+/* Reader */
+
+enum {
+    SLOT_EMPTY,     // Owned by the reader
+    SLOT_LOADED,    // Compressed data waiting for a decoder
+    SLOT_DECODED,   // Raw data ready
+};
+
+typedef struct {
+    int state;
+    int error;
+    uint8_t method;
+    uint32_t raw_len;
+    uint32_t comp_len;
+    uint32_t frequency;
+    uint8_t *comp;
+    uint8_t *raw;
+} iqz_slot_t;
+
+struct iqz_reader {
+    FILE *file;
+    iqz_meta_t meta;
+    uint32_t block_size;
+    uint64_t *index;            // NULL if the file has no (valid) index
+    unsigned num_blocks;
+    int eof;
+    int error;
+    uint32_t frequency;
+
+    iqz_slot_t *slots;
+    unsigned num_slots;
+    unsigned head;              // Next slot to consume
+    unsigned tail;              // Next slot to load
+    size_t pos;                 // Read position in the head slot
+
+    unsigned num_threads;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    unsigned next_decode;       // Next slot for the decoder threads
+    int stop;
+};
+
+static void decode_slot(iqz_slot_t *slot)
+{
+    slot->error = iqz_decode_block(slot->comp, slot->comp_len, slot->method, slot->raw, slot->raw_len) < 0;
+}
+
+static void *iqz_decoder_thread(void *arg)
+{
+    iqz_reader_t *reader = arg;
+
+    pthread_mutex_lock(&reader->mutex);
+    for (;;) {
+        while (!reader->stop && reader->next_decode == reader->tail)
+            pthread_cond_wait(&reader->work_cond, &reader->mutex);
+        if (reader->stop)
+            break;
+        iqz_slot_t *slot = &reader->slots[reader->next_decode % reader->num_slots];
+        reader->next_decode++;
+        pthread_mutex_unlock(&reader->mutex);
+
+        decode_slot(slot);
+
+        pthread_mutex_lock(&reader->mutex);
+        slot->state = SLOT_DECODED;
+        pthread_cond_broadcast(&reader->done_cond);
+    }
+    pthread_mutex_unlock(&reader->mutex);
+    return NULL;
+}
+
+// Read the next block header and data into a slot, returns -1 at the end of the blocks
+static int load_slot(iqz_reader_t *reader, iqz_slot_t *slot)
+{
+    uint8_t hdr[IQZ_BLOCK_HDR_LEN];
+    if (fread(hdr, 1, sizeof(hdr), reader->file) != sizeof(hdr) || memcmp(hdr, "IQZB", 4))
+        return -1; // end of blocks, index or truncated file
+    slot->raw_len = get_u32(hdr + 4);
+    slot->comp_len = get_u32(hdr + 8);
+    slot->frequency = get_u32(hdr + 12);
+    slot->method = hdr[16];
+    if (slot->raw_len > reader->block_size || slot->comp_len > reader->block_size) {
+        reader->error = 1;
+        return -1;
+    }
+    if (fread(slot->comp, 1, slot->comp_len, reader->file) != slot->comp_len)
+        return -1; // truncated block
+    return 0;
+}
+
+static void fill_slots(iqz_reader_t *reader)
+{
+    while (!reader->eof && reader->tail - reader->head < reader->num_slots) {
+        iqz_slot_t *slot = &reader->slots[reader->tail % reader->num_slots];
+        if (load_slot(reader, slot) < 0) {
+            reader->eof = 1;
+            break;
+        }
+        if (!reader->num_threads) {
+            decode_slot(slot);
+            slot->state = SLOT_DECODED;
+            reader->tail++;
+            continue;
+        }
+        pthread_mutex_lock(&reader->mutex);
+        slot->state = SLOT_LOADED;
+        reader->tail++;
+        pthread_cond_signal(&reader->work_cond);
+        pthread_mutex_unlock(&reader->mutex);
+    }
+}
+
+// Wait for all decoders to finish and drop the decoded blocks
+static void drain_slots(iqz_reader_t *reader)
+{
+    pthread_mutex_lock(&reader->mutex);
+    for (; reader->head != reader->tail; reader->head++) {
+        iqz_slot_t *slot = &reader->slots[reader->head % reader->num_slots];
+        while (slot->state != SLOT_DECODED)
+            pthread_cond_wait(&reader->done_cond, &reader->mutex);
+        slot->state = SLOT_EMPTY;
+    }
+    reader->head = reader->tail = reader->next_decode = 0;
+    reader->pos = 0;
+    pthread_mutex_unlock(&reader->mutex);
+}
+
+static int read_index(iqz_reader_t *reader)
+{
+    uint8_t trailer[IQZ_TRAILER_LEN];
+    off_t end;
+    if (fseeko(reader->file, 0, SEEK_END) || (end = ftello(reader->file)) < IQZ_HEADER_LEN + IQZ_TRAILER_LEN
+            || fseeko(reader->file, end - IQZ_TRAILER_LEN, SEEK_SET)
+            || fread(trailer, 1, sizeof(trailer), reader->file) != sizeof(trailer)
+            || memcmp(trailer + 12, "IQZI", 4))
+        return -1;
+
+    uint64_t index_offset = get_u64(trailer);
+    uint32_t num_blocks = get_u32(trailer + 8);
+    if (index_offset + (uint64_t)num_blocks * 8 + IQZ_TRAILER_LEN != (uint64_t)end
+            || fseeko(reader->file, (off_t)index_offset, SEEK_SET))
+        return -1;
+
+    reader->index = malloc((num_blocks ? num_blocks : 1) * sizeof(uint64_t));
+    if (!reader->index)
+        return -1;
+    for (unsigned i = 0; i < num_blocks; ++i) {
+        uint8_t entry[8];
+        if (fread(entry, 1, sizeof(entry), reader->file) != sizeof(entry)) {
+            free(reader->index);
+            reader->index = NULL;
+            return -1;
+        }
+        reader->index[i] = get_u64(entry);
+    }
+    reader->num_blocks = num_blocks;
+    return 0;
+}
+
+iqz_reader_t *iqz_reader_open(FILE *file, unsigned num_threads)
+{
+    uint8_t hdr[IQZ_HEADER_LEN];
+    if (fread(hdr, 1, sizeof(hdr), file) != sizeof(hdr) || memcmp(hdr, "IQZ1", 4)
+            || get_u16(hdr + 4) != IQZ_VERSION || get_u16(hdr + 6) < IQZ_HEADER_LEN)
+        return NULL;
+
+    iqz_reader_t *reader = calloc(1, sizeof(iqz_reader_t));
+    if (!reader)
+        return NULL;
+    reader->file = file;
+    reader->meta.frequency = get_u32(hdr + 8);
+    reader->meta.sample_rate = get_u32(hdr + 12);
+    reader->meta.gain = (int32_t)get_u32(hdr + 16);
+    reader->block_size = get_u32(hdr + 20);
+    reader->meta.timestamp = get_u64(hdr + 24);
+    reader->frequency = reader->meta.frequency;
+
+    uint16_t header_len = get_u16(hdr + 6);
+    if (reader->block_size == 0 || reader->block_size > 64 * IQZ_BLOCK_SIZE)
+        goto fail;
+
+    // The index is optional, a truncated file is read sequentially
+    off_t start = ftello(file);
+    if (start >= 0) {
+        read_index(reader);
+        if (fseeko(file, start + header_len - IQZ_HEADER_LEN, SEEK_SET))
+            goto fail;
+    } else if (header_len > IQZ_HEADER_LEN) {
+        goto fail;
+    }
+
+    reader->num_threads = num_threads;
+    reader->num_slots = num_threads ? 2 * num_threads : 1;
+    reader->slots = calloc(reader->num_slots, sizeof(iqz_slot_t));
+    if (!reader->slots)
+        goto fail;
+    for (unsigned i = 0; i < reader->num_slots; ++i) {
+        reader->slots[i].comp = malloc(reader->block_size);
+        reader->slots[i].raw = malloc(reader->block_size);
+        if (!reader->slots[i].comp || !reader->slots[i].raw)
+            goto fail;
+    }
+
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->work_cond, NULL);
+    pthread_cond_init(&reader->done_cond, NULL);
+    if (num_threads) {
+        reader->threads = calloc(num_threads, sizeof(pthread_t));
+        if (!reader->threads) {
+            reader->num_threads = 0;
+            iqz_reader_close(reader);
+            return NULL;
+        }
+        for (unsigned i = 0; i < num_threads; ++i) {
+            if (pthread_create(&reader->threads[i], NULL, iqz_decoder_thread, reader)) {
+                reader->num_threads = i;
+                iqz_reader_close(reader);
+                return NULL;
+            }
+        }
+    }
+    return reader;
+
+fail:
+    if (reader->slots) {
+        for (unsigned i = 0; i < reader->num_slots; ++i) {
+            free(reader->slots[i].comp);
+            free(reader->slots[i].raw);
+        }
+    }
+    free(reader->slots);
+    free(reader->index);
+    free(reader);
+    return NULL;
+}
+
+iqz_meta_t const *iqz_reader_meta(iqz_reader_t const *reader)
+{
+    return &reader->meta;
+}
+
+uint32_t iqz_reader_frequency(iqz_reader_t const *reader)
+{
+    return reader->frequency;
+}
+
+size_t iqz_read(iqz_reader_t *reader, uint8_t *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len && !reader->error) {
+        fill_slots(reader);
+        if (reader->head == reader->tail)
+            break; // end of file
+
+        iqz_slot_t *slot = &reader->slots[reader->head % reader->num_slots];
+        if (reader->num_threads) {
+            pthread_mutex_lock(&reader->mutex);
+            while (slot->state != SLOT_DECODED)
+                pthread_cond_wait(&reader->done_cond, &reader->mutex);
+            pthread_mutex_unlock(&reader->mutex);
+        }
+        if (slot->error) {
+            reader->error = 1;
+            break;
+        }
+
+        size_t n = slot->raw_len - reader->pos;
+        if (n > len - done)
+            n = len - done;
+        memcpy(buf + done, slot->raw + reader->pos, n);
+        done += n;
+        reader->pos += n;
+        reader->frequency = slot->frequency;
+
+        if (reader->pos == slot->raw_len) {
+            // Decoders never touch decoded slots, no lock needed
+            slot->state = SLOT_EMPTY;
+            reader->head++;
+            reader->pos = 0;
+        }
+    }
+    return done;
+}
+
+int iqz_seek(iqz_reader_t *reader, uint64_t sample)
+{
+    uint64_t offset = sample * 2;
+    uint64_t block = offset / reader->block_size;
+
+    if (!reader->index || block >= reader->num_blocks)
+        return -1;
+
+    drain_slots(reader);
+    reader->eof = 0;
+    if (fseeko(reader->file, (off_t)reader->index[block], SEEK_SET))
+        return -1;
+
+    // Skip into the block, all blocks but the last one are full
+    uint8_t skip[4096];
+    offset -= block * reader->block_size;
+    while (offset) {
+        size_t n = offset < sizeof(skip) ? (size_t)offset : sizeof(skip);
+        if (iqz_read(reader, skip, n) != n)
+            return -1;
+        offset -= n;
+    }
+    return 0;
+}
+
+int iqz_reader_error(iqz_reader_t const *reader)
+{
+    return reader->error;
+}
+
+void iqz_reader_close(iqz_reader_t *reader)
+{
+    if (reader->num_threads)
+        drain_slots(reader);
+    pthread_mutex_lock(&reader->mutex);
+    reader->stop = 1;
+    pthread_cond_broadcast(&reader->work_cond);
+    pthread_mutex_unlock(&reader->mutex);
+    for (unsigned i = 0; i < reader->num_threads; ++i)
+        pthread_join(reader->threads[i], NULL);
+
+    pthread_cond_destroy(&reader->done_cond);
+    pthread_cond_destroy(&reader->work_cond);
+    pthread_mutex_destroy(&reader->mutex);
+    for (unsigned i = 0; i < reader->num_slots; ++i) {
+        free(reader->slots[i].comp);
+        free(reader->slots[i].raw);
+    }
+    free(reader->slots);
+    free(reader->threads);
+    free(reader->index);
+    free(reader);
+}
@@ -0,0 +1,620 @@
+/**
+ * Minimal MQTT 3.1.1 publisher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "mqtt_client.h"
+
+// Not available on Windows, data_output_mqtt_create() is a stub there
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MQTT_CONNECT_TIMEOUT_MS 5000
+#define MQTT_MAX_BACKOFF_S      30
+#define MQTT_CLOSE_WAIT_MS      1000
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE is set instead
+#endif
+
+enum {
+    MQTT_CONNECT    = 1,
+    MQTT_CONNACK    = 2,
+    MQTT_PUBLISH    = 3,
+    MQTT_PUBACK     = 4,
+    MQTT_PINGREQ    = 12,
+    MQTT_PINGRESP   = 13,
+    MQTT_DISCONNECT = 14,
+};
+
+typedef struct mqtt_msg {
+    struct mqtt_msg *next;
+    uint16_t packet_id;     // QoS 1, assigned when first written
+    int written;            // on the current connection
+    int dup;                // written on an earlier connection
+    size_t topic_len;
+    size_t payload_len;
+    char data[];            // topic, then payload
+} mqtt_msg_t;
+
+struct mqtt_client {
+    mqtt_client_opts_t opts;    // strings are owned copies
+    char *strings[5];
+    pthread_t thread;
+    pthread_mutex_t lock;       // protects the queue, counters and closing
+    int wake[2];                // self pipe to wake the I/O thread
+    int closing;
+    mqtt_msg_t *head;
+    mqtt_msg_t *tail;
+    mqtt_client_counters_t counters;
+
+    /* I/O thread only */
+    int sock;
+    uint16_t next_id;
+    uint64_t last_write;        // monotonic ns
+    uint64_t ping_sent;         // 0 = no ping outstanding
+    uint8_t *tx;
+    size_t tx_size;
+    uint8_t rx[4096];
+    size_t rx_len;
+};
+
+// the data library links without util.c, so no monotonic_ns() here
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t put_remaining_length(uint8_t *p, size_t len)
+{
+    size_t n = 0;
+    do {
+        uint8_t b = len % 128;
+        len /= 128;
+        p[n++] = len ? b | 0x80 : b;
+    } while (len);
+    return n;
+}
+
+static size_t put_string(uint8_t *p, char const *str, size_t len)
+{
+    p[0] = (uint8_t)(len >> 8);
+    p[1] = (uint8_t)len;
+    memcpy(p + 2, str, len);
+    return len + 2;
+}
+
+static int write_all(int sock, uint8_t const *buf, size_t len)
+{
+    while (len) {
+        ssize_t r = send(sock, buf, len, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        buf += r;
+        len -= r;
+    }
+    return 0;
+}
+
+// Wait for the wake pipe, returns 1 if woken
+static int wait_wake(mqtt_client_t *client, int timeout_ms)
+{
+    struct pollfd pfd = {.fd = client->wake[0], .events = POLLIN};
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return 0;
+    char drain[64];
+    while (read(client->wake[0], drain, sizeof(drain)) > 0);
+    return 1;
+}
+
+static int is_closing(mqtt_client_t *client)
+{
+    pthread_mutex_lock(&client->lock);
+    int closing = client->closing;
+    pthread_mutex_unlock(&client->lock);
+    return closing;
+}
+
+static int open_socket(char const *host, char const *port)
+{
+    struct addrinfo hints, *res, *ai;
+    int sock = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res))
+        return -1;
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0)
+            continue;
+        // connect with a timeout, then switch back to blocking
+        int flags = fcntl(sock, F_GETFL);
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+        int err = 0;
+        if (connect(sock, ai->ai_addr, ai->ai_addrlen) < 0) {
+            struct pollfd pfd = {.fd = sock, .events = POLLOUT};
+            socklen_t err_len = sizeof(err);
+            if (errno != EINPROGRESS || poll(&pfd, 1, MQTT_CONNECT_TIMEOUT_MS) != 1
+                    || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0)
+                err = -1;
+        }
+        if (!err) {
+            fcntl(sock, F_SETFL, flags);
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock < 0)
+        return -1;
+
+    struct timeval timeout = {.tv_sec = MQTT_CONNECT_TIMEOUT_MS / 1000};
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // writes are batched already
+#ifdef SO_NOSIGPIPE
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    return sock;
+}
+
+static int connect_broker(mqtt_client_t *client)
+{
+    mqtt_client_opts_t const *opts = &client->opts;
+    uint8_t packet[1024];
+    uint8_t body[1024];
+    size_t id_len = strlen(opts->client_id);
+    size_t user_len = opts->user ? strlen(opts->user) : 0;
+    size_t pass_len = opts->pass ? strlen(opts->pass) : 0;
+    size_t n = 0;
+
+    if (id_len + user_len + pass_len + 16 > sizeof(body))
+        return -1;
+
+    int sock = open_socket(opts->host, opts->port);
+    if (sock < 0)
+        return -1;
+
+    // variable header: protocol name, level 4 (3.1.1), flags, keep alive
+    n += put_string(body + n, "MQTT", 4);
+    body[n++] = 4;
+    body[n++] = 0x02 | (opts->user ? 0x80 : 0) | (opts->pass ? 0x40 : 0); // clean session
+    body[n++] = (uint8_t)(opts->keep_alive >> 8);
+    body[n++] = (uint8_t)opts->keep_alive;
+    n += put_string(body + n, opts->client_id, id_len);
+    if (opts->user)
+        n += put_string(body + n, opts->user, user_len);
+    if (opts->pass)
+        n += put_string(body + n, opts->pass, pass_len);
+
+    size_t len = 0;
+    packet[len++] = MQTT_CONNECT << 4;
+    len += put_remaining_length(packet + len, n);
+    memcpy(packet + len, body, n);
+    len += n;
+
+    uint8_t connack[4];
+    size_t got = 0;
+    if (write_all(sock, packet, len) == 0) {
+        while (got < sizeof(connack)) {
+            ssize_t r = recv(sock, connack + got, sizeof(connack) - got, 0);
+            if (r <= 0)
+                break;
+            got += r;
+        }
+    }
+    if (got < sizeof(connack) || connack[0] != MQTT_CONNACK << 4 || connack[3] != 0) {
+        if (got == sizeof(connack) && connack[3])
+            fprintf(stderr, "MQTT: %s:%s refused the connection (code %d)\n", opts->host, opts->port, connack[3]);
+        close(sock);
+        return -1;
+    }
+
+    client->sock = sock;
+    client->rx_len = 0;
+    client->ping_sent = 0;
+    client->last_write = now_ns();
+
+    // everything not acknowledged goes out again
+    pthread_mutex_lock(&client->lock);
+    for (mqtt_msg_t *msg = client->head; msg; msg = msg->next) {
+        if (msg->written)
+            msg->dup = 1;
+        msg->written = 0;
+    }
+    client->counters.connects++;
+    pthread_mutex_unlock(&client->lock);
+    return 0;
+}
+
+static void disconnect_broker(mqtt_client_t *client, char const *reason)
+{
+    if (client->sock < 0)
+        return;
+    if (reason)
+        fprintf(stderr, "MQTT: %s:%s %s, reconnecting\n", client->opts.host, client->opts.port, reason);
+    close(client->sock);
+    client->sock = -1;
+}
+
+static void unlink_msg(mqtt_client_t *client, mqtt_msg_t *prev, mqtt_msg_t *msg)
+{
+    if (prev)
+        prev->next = msg->next;
+    else
+        client->head = msg->next;
+    if (client->tail == msg)
+        client->tail = prev;
+    client->counters.queued--;
+    free(msg);
+}
+
+// Write all messages not yet written on this connection, batched into few writes
+static int flush_queue(mqtt_client_t *client)
+{
+    int qos = client->opts.qos;
+    for (;;) {
+        size_t len = 0;
+        unsigned qos0_written = 0;
+
+        pthread_mutex_lock(&client->lock);
+        mqtt_msg_t *prev = NULL;
+        mqtt_msg_t *msg = client->head;
+        while (msg) {
+            if (msg->written) {
+                prev = msg;
+                msg = msg->next;
+                continue;
+            }
+            size_t remaining = 2 + msg->topic_len + (qos ? 2 : 0) + msg->payload_len;
+            size_t size = 5 + remaining;
+            if (len + size > client->tx_size) {
+                if (len)
+                    break; // write this batch first
+                uint8_t *tx = realloc(client->tx, size);
+                if (!tx)
+                    break;
+                client->tx = tx;
+                client->tx_size = size;
+            }
+            uint8_t *p = client->tx + len;
+            size_t n = 0;
+            p[n++] = (uint8_t)(MQTT_PUBLISH << 4 | (msg->dup ? 0x08 : 0) | qos << 1 | (client->opts.retain ? 1 : 0));
+            n += put_remaining_length(p + n, remaining);
+            n += put_string(p + n, msg->data, msg->topic_len);
+            if (qos) {
+                if (!msg->packet_id) {
+                    if (!++client->next_id)
+                        ++client->next_id;
+                    msg->packet_id = client->next_id;
+                }
+                p[n++] = (uint8_t)(msg->packet_id >> 8);
+                p[n++] = (uint8_t)msg->packet_id;
+            }
+            memcpy(p + n, msg->data + msg->topic_len, msg->payload_len);
+            len += n + msg->payload_len;
+
+            mqtt_msg_t *next = msg->next;
+            if (qos) {
+                msg->written = 1;
+                prev = msg;
+            } else {
+                unlink_msg(client, prev, msg); // at most once
+                qos0_written++;
+            }
+            msg = next;
+        }
+        pthread_mutex_unlock(&client->lock);
+
+        if (!len)
+            return 0;
+        int r = write_all(client->sock, client->tx, len);
+        client->last_write = now_ns();
+
+        pthread_mutex_lock(&client->lock);
+        client->counters.writes++;
+        if (!r)
+            client->counters.published += qos0_written;
+        pthread_mutex_unlock(&client->lock);
+        if (r < 0)
+            return -1;
+    }
+}
+
+static void handle_packet(mqtt_client_t *client, uint8_t type, uint8_t const *body, size_t len)
+{
+    if (type == MQTT_PUBACK && len >= 2) {
+        uint16_t id = (uint16_t)(body[0] << 8 | body[1]);
+        pthread_mutex_lock(&client->lock);
+        mqtt_msg_t *prev = NULL;
+        for (mqtt_msg_t *msg = client->head; msg; prev = msg, msg = msg->next) {
+            if (msg->written && msg->packet_id == id) {
+                unlink_msg(client, prev, msg);
+                client->counters.published++;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&client->lock);
+    } else if (type == MQTT_PINGRESP) {
+        client->ping_sent = 0;
+    }
+    // nothing is subscribed, anything else is ignored
+}
+
+static int read_packets(mqtt_client_t *client)
+{
+    ssize_t r = recv(client->sock, client->rx + client->rx_len, sizeof(client->rx) - client->rx_len, 0);
+    if (r <= 0)
+        return -1;
+    client->rx_len += r;
+
+    for (;;) {
+        size_t remaining = 0;
+        size_t n = 1;
+        int shift = 0;
+        do {
+            if (n >= client->rx_len)
+                return 0; // incomplete header
+            remaining |= (size_t)(client->rx[n] & 0x7f) << shift;
+            shift += 7;
+        } while (client->rx[n++] & 0x80 && n < 5);
+        if (n + remaining > sizeof(client->rx))
+            return -1; // too large for anything we expect
+        if (n + remaining > client->rx_len)
+            return 0;
+        handle_packet(client, client->rx[0] >> 4, client->rx + n, remaining);
+        client->rx_len -= n + remaining;
+        memmove(client->rx, client->rx + n + remaining, client->rx_len);
+    }
+}
+
+static int send_control(mqtt_client_t *client, uint8_t type)
+{
+    uint8_t packet[2] = {(uint8_t)(type << 4), 0};
+    client->last_write = now_ns();
+    return write_all(client->sock, packet, sizeof(packet));
+}
+
+static int has_unacked(mqtt_client_t *client)
+{
+    pthread_mutex_lock(&client->lock);
+    int unacked = client->head != NULL;
+    pthread_mutex_unlock(&client->lock);
+    return unacked;
+}
+
+// Last chance to deliver the queue before closing
+static void close_broker(mqtt_client_t *client)
+{
+    if (client->sock < 0 && has_unacked(client))
+        connect_broker(client);
+    if (client->sock < 0)
+        return;
+
+    uint64_t end = now_ns() + (uint64_t)MQTT_CLOSE_WAIT_MS * 1000000;
+    if (flush_queue(client) == 0) {
+        while (has_unacked(client)) {
+            uint64_t now = now_ns();
+            struct pollfd pfd = {.fd = client->sock, .events = POLLIN};
+            if (now >= end || poll(&pfd, 1, (int)((end - now) / 1000000) + 1) <= 0 || read_packets(client) < 0)
+                break;
+        }
+        send_control(client, MQTT_DISCONNECT);
+    }
+    close(client->sock);
+    client->sock = -1;
+}
+
+static void *mqtt_io_thread(void *arg)
+{
+    mqtt_client_t *client = arg;
+    unsigned backoff = 1;
+    int connected_before = 0;
+    uint64_t keep_alive = (uint64_t)client->opts.keep_alive * 1000000000;
+
+    while (!is_closing(client)) {
+        if (client->sock < 0) {
+            if (connect_broker(client) < 0) {
+                if (backoff == 1)
+                    fprintf(stderr, "MQTT: failed to connect to %s:%s, retrying\n", client->opts.host, client->opts.port);
+                // new messages wake us up too, only closing ends the wait early
+                uint64_t until = now_ns() + (uint64_t)backoff * 1000000000;
+                for (uint64_t now = now_ns(); now < until && !is_closing(client); now = now_ns())
+                    wait_wake(client, (int)((until - now) / 1000000) + 1);
+                backoff = backoff * 2 < MQTT_MAX_BACKOFF_S ? backoff * 2 : MQTT_MAX_BACKOFF_S;
+                continue;
+            }
+            if (backoff > 1 || connected_before)
+                fprintf(stderr, "MQTT: connected to %s:%s\n", client->opts.host, client->opts.port);
+            backoff = 1;
+            connected_before = 1;
+        }
+
+        if (flush_queue(client) < 0) {
+            disconnect_broker(client, "write failed");
+            continue;
+        }
+
+        int timeout_ms = -1;
+        if (keep_alive) {
+            uint64_t now = now_ns();
+            if (client->ping_sent && now - client->ping_sent > keep_alive) {
+                disconnect_broker(client, "did not answer a ping");
+                continue;
+            }
+            if (!client->ping_sent && now - client->last_write >= keep_alive) {
+                if (send_control(client, MQTT_PINGREQ) < 0) {
+                    disconnect_broker(client, "write failed");
+                    continue;
+                }
+                client->ping_sent = now;
+            }
+            uint64_t due = client->ping_sent ? client->ping_sent + keep_alive : client->last_write + keep_alive;
+            timeout_ms = due > now ? (int)((due - now) / 1000000) + 1 : 0;
+        }
+
+        struct pollfd fds[2] = {
+            {.fd = client->sock, .events = POLLIN},
+            {.fd = client->wake[0], .events = POLLIN},
+        };
+        if (poll(fds, 2, timeout_ms) < 0 && errno != EINTR)
+            break;
+        if (fds[1].revents)
+            wait_wake(client, 0);
+        if (fds[0].revents && read_packets(client) < 0)
+            disconnect_broker(client, "closed the connection");
+    }
+
+    close_broker(client);
+    return NULL;
+}
+
+mqtt_client_t *mqtt_client_create(mqtt_client_opts_t const *opts)
+{
+    char default_id[32];
+    mqtt_client_t *client = calloc(1, sizeof(mqtt_client_t));
+    if (!client) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+
+    client->opts = *opts;
+    if (!opts->client_id) {
+        snprintf(default_id, sizeof(default_id), "rtl_433-%d", (int)getpid());
+        client->opts.client_id = default_id;
+    }
+    // own copies of the strings
+    char const **strs[5] = {&client->opts.host, &client->opts.port, &client->opts.client_id, &client->opts.user, &client->opts.pass};
+    for (int i = 0; i < 5; ++i) {
+        if (*strs[i]) {
+            client->strings[i] = strdup(*strs[i]);
+            if (!client->strings[i])
+                goto fail;
+            *strs[i] = client->strings[i];
+        }
+    }
+    if (client->opts.backlog < 1)
+        client->opts.backlog = 1;
+    client->opts.qos = client->opts.qos ? 1 : 0;
+    client->sock = -1;
+
+    if (pipe(client->wake) < 0) {
+        client->wake[0] = client->wake[1] = -1;
+        goto fail;
+    }
+    fcntl(client->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(client->wake[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&client->lock, NULL);
+    if (pthread_create(&client->thread, NULL, mqtt_io_thread, client)) {
+        pthread_mutex_destroy(&client->lock);
+        goto fail;
+    }
+    return client;
+
+fail:
+    fprintf(stderr, "MQTT: failed to start the client\n");
+    if (client->wake[0] >= 0) {
+        close(client->wake[0]);
+        close(client->wake[1]);
+    }
+    for (int i = 0; i < 5; ++i)
+        free(client->strings[i]);
+    free(client);
+    return NULL;
+}
+
+int mqtt_client_publish(mqtt_client_t *client, char const *topic, void const *payload, size_t payload_len)
+{
+    size_t topic_len = strlen(topic);
+    if (topic_len > 65535)
+        return -1;
+    mqtt_msg_t *msg = malloc(sizeof(mqtt_msg_t) + topic_len + payload_len);
+    if (!msg)
+        return -1;
+    msg->next = NULL;
+    msg->packet_id = 0;
+    msg->written = 0;
+    msg->dup = 0;
+    msg->topic_len = topic_len;
+    msg->payload_len = payload_len;
+    memcpy(msg->data, topic, topic_len);
+    memcpy(msg->data + topic_len, payload, payload_len);
+
+    pthread_mutex_lock(&client->lock);
+    while (client->counters.queued >= client->opts.backlog) {
+        unlink_msg(client, NULL, client->head); // drop the oldest
+        client->counters.dropped++;
+    }
+    if (client->tail)
+        client->tail->next = msg;
+    else
+        client->head = msg;
+    client->tail = msg;
+    client->counters.queued++;
+    pthread_mutex_unlock(&client->lock);
+
+    // a full pipe already has a wake up pending
+    if (write(client->wake[1], "", 1) < 0 && errno != EAGAIN)
+        return -1;
+    return 0;
+}
+
+void mqtt_client_counters(mqtt_client_t *client, mqtt_client_counters_t *counters)
+{
+    pthread_mutex_lock(&client->lock);
+    *counters = client->counters;
+    pthread_mutex_unlock(&client->lock);
+}
+
+void mqtt_client_free(mqtt_client_t *client)
+{
+    if (!client)
+        return;
+
+    pthread_mutex_lock(&client->lock);
+    client->closing = 1;
+    pthread_mutex_unlock(&client->lock);
+    if (write(client->wake[1], "", 1) < 0 && errno != EAGAIN)
+        perror("write");
+    pthread_join(client->thread, NULL);
+
+    while (client->head)
+        unlink_msg(client, NULL, client->head);
+    close(client->wake[0]);
+    close(client->wake[1]);
+    pthread_mutex_destroy(&client->lock);
+    for (int i = 0; i < 5; ++i)
+        free(client->strings[i]);
+    free(client->tx);
+    free(client);
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,163 @@
+/**
+ * Pipeline statistics
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "pipeline_stats.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+pipeline_stats_t *pipeline_stats_create(unsigned interval, unsigned num_outputs)
+{
+    pipeline_stats_t *stats = calloc(1, sizeof(pipeline_stats_t));
+    if (!stats)
+        return NULL;
+    stats->interval = interval ? interval : 1;
+    stats->num_outputs = num_outputs < PIPELINE_MAX_OUTPUTS ? num_outputs : PIPELINE_MAX_OUTPUTS;
+    stats->interval_start = monotonic_ns();
+    return stats;
+}
+
+int pipeline_stats_due(pipeline_stats_t const *stats, uint64_t now)
+{
+    return now - stats->interval_start >= (uint64_t)stats->interval * 1000000000;
+}
+
+// Latency summary in us
+static data_t *latency_data(hdr_hist_t const *hist)
+{
+    if (!hist->total)
+        return data_make("count", "", DATA_FORMAT, "%.0f", DATA_DOUBLE, 0.0, NULL);
+    return data_make(
+            "count",    "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)hist->total,
+            "mean_us",  "", DATA_FORMAT, "%.1f", DATA_DOUBLE, hdr_hist_mean(hist) / 1e3,
+            "p50_us",   "", DATA_FORMAT, "%.1f", DATA_DOUBLE, hdr_hist_percentile(hist, 50.0) / 1e3,
+            "p99_us",   "", DATA_FORMAT, "%.1f", DATA_DOUBLE, hdr_hist_percentile(hist, 99.0) / 1e3,
+            "max_us",   "", DATA_FORMAT, "%.1f", DATA_DOUBLE, hist->max / 1e3,
+            NULL);
+}
+
+data_t *pipeline_stats_report(pipeline_stats_t *stats, uint64_t now, pipeline_counters_t const *counters, pipeline_levels_t const *levels)
+{
+    char time_str[LOCAL_TIME_BUFLEN];
+    double secs = (now - stats->interval_start) / 1e9;
+    if (secs <= 0.0)
+        secs = 1e-9;
+
+    data_t *stages = data_make(
+            "baseband",         "", DATA_DATA, latency_data(&stats->stage[STAGE_BASEBAND]),
+            "fm_demod",         "", DATA_DATA, latency_data(&stats->stage[STAGE_FM]),
+            "pulse_detect",     "", DATA_DATA, latency_data(&stats->stage[STAGE_PULSE_DETECT]),
+            "demod",            "", DATA_DATA, latency_data(&stats->stage[STAGE_DEMOD]),
+            "callback",         "", DATA_DATA, latency_data(&stats->stage[STAGE_CALLBACK]),
+            NULL);
+
+    pipeline_counters_t const *last = &stats->last;
+    data_t *data = data_make(
+            "time",             "", DATA_STRING, local_time_str(0, time_str),
+            "type",             "", DATA_STRING, "stats",
+            "interval",         "", DATA_FORMAT, "%.3f s", DATA_DOUBLE, secs,
+            "blocks_per_s",     "", DATA_FORMAT, "%.1f", DATA_DOUBLE, (counters->blocks - last->blocks) / secs,
+            "samples_per_s",    "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (counters->samples - last->samples) / secs,
+            "dropped_samples",  "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)(counters->dropped_samples - last->dropped_samples),
+            "ook_packages",     "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)(counters->ook_packages - last->ook_packages),
+            "fsk_packages",     "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)(counters->fsk_packages - last->fsk_packages),
+            "noise_level",      "", DATA_INT, levels->noise_level,
+            "grabber_queue",    "", DATA_INT, (int)levels->grabber_queue,
+            "latency",          "", DATA_DATA, latency_data(&stats->latency),
+            "stages",           "", DATA_DATA, stages,
+            NULL);
+
+    if (data && stats->num_outputs) {
+        // one latency summary per sink, in the order given with -F
+        data_t *outputs[PIPELINE_MAX_OUTPUTS];
+        for (unsigned i = 0; i < stats->num_outputs; ++i)
+            outputs[i] = latency_data(&stats->output[i]);
+        data_t *tail = data;
+        while (tail->next)
+            tail = tail->next;
+        tail->next = data_make("outputs", "", DATA_ARRAY, data_array(stats->num_outputs, DATA_DATA, outputs), NULL);
+    }
+
+    pipeline_stats_rotate(stats, now, counters);
+    return data;
+}
+
+void pipeline_stats_rotate(pipeline_stats_t *stats, uint64_t now, pipeline_counters_t const *counters)
+{
+    stats->last = *counters;
+    stats->interval_start = now;
+    for (unsigned i = 0; i < PIPELINE_STAGES; ++i) {
+        stats->past_count[i] += stats->stage[i].total;
+        stats->past_sum[i] += stats->stage[i].sum;
+        hdr_hist_reset(&stats->stage[i]);
+    }
+    stats->past_count[PIPELINE_STAGES] += stats->latency.total;
+    stats->past_sum[PIPELINE_STAGES] += stats->latency.sum;
+    hdr_hist_reset(&stats->latency);
+    for (unsigned i = 0; i < stats->num_outputs; ++i)
+        hdr_hist_reset(&stats->output[i]);
+}
+
+static void prometheus_counter(FILE *out, char const *name, char const *help, char const *labels, double value)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s%s %.17g\n", name, help, name, name, labels, value);
+}
+
+static void prometheus_gauge(FILE *out, char const *name, char const *help, double value)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n", name, help, name, name, value);
+}
+
+// One summary in seconds, label is "" or e.g. "stage=\"demod\","
+static void prometheus_summary(FILE *out, char const *name, char const *label, hdr_hist_t const *hist, uint64_t past_count, double past_sum)
+{
+    static double const quantiles[] = {0.5, 0.9, 0.99};
+    for (unsigned i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+        fprintf(out, "%s{%squantile=\"%g\"} ", name, label, quantiles[i]);
+        if (hist->total)
+            fprintf(out, "%.9g\n", hdr_hist_percentile(hist, quantiles[i] * 100.0) / 1e9);
+        else
+            fprintf(out, "NaN\n");
+    }
+    // the same labels without the trailing comma, or none
+    char labels[64] = "";
+    size_t label_len = strlen(label);
+    if (label_len)
+        snprintf(labels, sizeof(labels), "{%.*s}", (int)label_len - 1, label);
+    fprintf(out, "%s_sum%s %.9g\n", name, labels, (past_sum + hist->sum) / 1e9);
+    fprintf(out, "%s_count%s %llu\n", name, labels, (unsigned long long)(past_count + hist->total));
+}
+
+void pipeline_stats_write_prometheus(pipeline_stats_t const *stats, FILE *out, pipeline_counters_t const *counters, pipeline_levels_t const *levels)
+{
+    static char const *const stage_names[PIPELINE_STAGES] = {"baseband", "fm_demod", "pulse_detect", "demod", "callback"};
+
+    prometheus_counter(out, "rtl_433_blocks_total", "Sample blocks processed.", "", counters->blocks);
+    prometheus_counter(out, "rtl_433_samples_total", "Samples processed.", "", counters->samples);
+    prometheus_counter(out, "rtl_433_dropped_samples_total", "Samples discarded while the tuner settles after a hop.", "", counters->dropped_samples);
+    fprintf(out, "# HELP rtl_433_packages_total Pulse packages detected.\n# TYPE rtl_433_packages_total counter\n");
+    fprintf(out, "rtl_433_packages_total{modulation=\"ook\"} %u\n", counters->ook_packages);
+    fprintf(out, "rtl_433_packages_total{modulation=\"fsk\"} %u\n", counters->fsk_packages);
+    prometheus_gauge(out, "rtl_433_noise_level", "OOK low level estimate of the pulse detector.", levels->noise_level);
+    prometheus_gauge(out, "rtl_433_grabber_queue", "Signal snippets waiting to be saved.", levels->grabber_queue);
+
+    fprintf(out, "# HELP rtl_433_stage_seconds Time in each pipeline stage.\n# TYPE rtl_433_stage_seconds summary\n");
+    for (unsigned i = 0; i < PIPELINE_STAGES; ++i) {
+        char label[64];
+        snprintf(label, sizeof(label), "stage=\"%s\",", stage_names[i]);
+        prometheus_summary(out, "rtl_433_stage_seconds", label, &stats->stage[i], stats->past_count[i], stats->past_sum[i]);
+    }
+    fprintf(out, "# HELP rtl_433_latency_seconds Capture of a package to output of each record.\n# TYPE rtl_433_latency_seconds summary\n");
+    prometheus_summary(out, "rtl_433_latency_seconds", "", &stats->latency, stats->past_count[PIPELINE_STAGES], stats->past_sum[PIPELINE_STAGES]);
+}
+
+void pipeline_stats_free(pipeline_stats_t *stats)
+{
+    free(stats);
+}
@@ -18,11 +18,49 @@
 #include <math.h>
 #include <limits.h>
 
+/* Demodulation only runs on the sample thread, so all demodulators share one
+ * bitbuffer. It is zeroed once and bitbuffer_clear() only clears the rows
+ * that were used, a demodulator that finds nothing costs no clearing at all */
+static bitbuffer_t demod_bits;
+
+static bitbuffer_t *demod_bitbuffer(void)
+{
+	bitbuffer_clear(&demod_bits);
+	return &demod_bits;
+}
+
+static hdr_hist_t *callback_latency;
+
+void pulse_demod_time_callbacks(hdr_hist_t *hist)
+{
+	callback_latency = hist;
+}
+
+static int run_callback(struct protocol_state *device, bitbuffer_t *bits)
+{
+	struct protocol_stats *stats = device->stats;
+	if (!stats && !callback_latency)
+		return device->callback(bits);
+
+	uint64_t start = monotonic_ns();
+	int events = device->callback(bits);
+	uint64_t elapsed = monotonic_ns() - start;
+	if (callback_latency)
+		hdr_hist_record(callback_latency, elapsed);
+	if (stats) {
+		stats->callback_ns += elapsed;
+		stats->callbacks++;
+		stats->rows += bits->num_rows;
+		if (events > 0)
+			stats->events++;
+	}
+	return events;
+}
 
 int pulse_demod_pcm(const pulse_data_t *pulses, struct protocol_state *device)
 {
 	int events = 0;
-	bitbuffer_t bits = {0};
+	bitbuffer_t *bits = demod_bitbuffer();
 	const int MAX_ZEROS = device->reset_limit / device->long_limit;
 	const int TOLERANCE = device->long_limit / 4;		// Tolerance is ±25% of a bit period
 
@@ -34,13 +72,13 @@ int pulse_demod_pcm(const pulse_data_t *pulses, struct protocol_state *device)
 
 		// Add run of ones (1 for RZ, many for NRZ)
 		for (int i=0; i < highs; ++i) {
-			bitbuffer_add_bit(&bits, 1);
+			bitbuffer_add_bit(bits, 1);
 		}
 		// Add run of zeros
 		periods -= highs;					// Remove 1s from whole period
 		periods = min(periods, MAX_ZEROS); 	// Don't overflow at end of message
 		for (int i=0; i < periods; ++i) {
-			bitbuffer_add_bit(&bits, 0);
+			bitbuffer_add_bit(bits, 0);
 		}
 
 		// Validate data
@@ -53,23 +91,23 @@ int pulse_demod_pcm(const pulse_data_t *pulses, struct protocol_state *device)
 					n,pulses->pulse[n],pulses->gap[n],
 					pulses->pulse[n] + pulses->gap[n]);
 			}
-			bitbuffer_clear(&bits);
+			bitbuffer_clear(bits);
 		}
 
 		// End of Message?
 		if (((n == pulses->num_pulses-1) 	// No more pulses? (FSK)
 		 || (pulses->gap[n] > device->reset_limit))	// Long silence (OOK)
-		 && (bits.bits_per_row[0] > 0)		// Only if data has been accumulated
+		 && (bits->bits_per_row[0] > 0)		// Only if data has been accumulated
 		) {
 			if (device->callback) {
-				events += device->callback(&bits);
+				events += run_callback(device, bits);
 			}
 			// Debug printout
 			if(!device->callback || (debug_output && events > 0)) {
 				fprintf(stderr, "pulse_demod_pcm(): %s \n", device->name);
-				bitbuffer_print(&bits);
+				bitbuffer_print(bits);
 			}
-			bitbuffer_clear(&bits);
+			bitbuffer_clear(bits);
 		}
 	} // for
 	return events;
@@ -78,29 +116,29 @@ int pulse_demod_pcm(const pulse_data_t *pulses, struct protocol_state *device)
 
 int pulse_demod_ppm(const pulse_data_t *pulses, struct protocol_state *device) {
 	int events = 0;
-	bitbuffer_t bits = {0};
+	bitbuffer_t *bits = demod_bitbuffer();
 
 	for(unsigned n = 0; n < pulses->num_pulses; ++n) {
 		// Short gap
 		if(pulses->gap[n] < device->short_limit) {
-			bitbuffer_add_bit(&bits, 0);
+			bitbuffer_add_bit(bits, 0);
 		// Long gap
 		} else if(pulses->gap[n] < device->long_limit) {
-			bitbuffer_add_bit(&bits, 1);
+			bitbuffer_add_bit(bits, 1);
 		// Check for new packet in multipacket
 		} else if(pulses->gap[n] < device->reset_limit) {
-			bitbuffer_add_row(&bits);
+			bitbuffer_add_row(bits);
 		// End of Message?
 		} else {
 			if (device->callback) {
-				events += device->callback(&bits);
+				events += run_callback(device, bits);
 			}
 			// Debug printout
 			if(!device->callback || (debug_output && events > 0)) {
 				fprintf(stderr, "pulse_demod_ppm(): %s \n", device->name);
-				bitbuffer_print(&bits);
+				bitbuffer_print(bits);
 			}
-			bitbuffer_clear(&bits);
+			bitbuffer_clear(bits);
 		}
 	} // for pulses
 	return events;
@@ -110,7 +148,7 @@ int pulse_demod_ppm(const pulse_data_t *pulses, struct protocol_state *device) {
 int pulse_demod_pwm(const pulse_data_t *pulses, struct protocol_state *device) {
 	int events = 0;
 	int start_bit_detected = 0;
-	bitbuffer_t bits = {0};
+	bitbuffer_t *bits = demod_bitbuffer();
 	int start_bit = device->demod_arg;
 
 	for(unsigned n = 0; n < pulses->num_pulses; ++n) {
@@ -120,27 +158,27 @@ int pulse_demod_pwm(const pulse_data_t *pulses, struct protocol_state *device) {
 		} else {
 			// Detect pulse width
 			if(pulses->pulse[n] <= device->short_limit) {
-				bitbuffer_add_bit(&bits, 1);
+				bitbuffer_add_bit(bits, 1);
 			} else {
-				bitbuffer_add_bit(&bits, 0);
+				bitbuffer_add_bit(bits, 0);
 			}
 		}
 		// End of Message?
                 if (n == pulses->num_pulses - 1                           // No more pulses (FSK)
 		    || pulses->gap[n] > device->reset_limit) {  // Long silence (OOK)
 			if (device->callback) {
-				events += device->callback(&bits);
+				events += run_callback(device, bits);
 			}
 			// Debug printout
 			if(!device->callback || (debug_output && events > 0)) {
 				fprintf(stderr, "pulse_demod_pwm(): %s\n", device->name);
-				bitbuffer_print(&bits);
+				bitbuffer_print(bits);
 			}
-			bitbuffer_clear(&bits);
+			bitbuffer_clear(bits);
 			start_bit_detected = 0;
 		// Check for new packet in multipacket
 		} else if(pulses->gap[n] > device->long_limit) {
-			bitbuffer_add_row(&bits);
+			bitbuffer_add_row(bits);
 			start_bit_detected = 0;
 		}
 	}
@@ -152,7 +190,7 @@ int pulse_demod_pwm_precise(const pulse_data_t *pulses, struct protocol_state *d
 {
 	int events = 0;
 	int start_bit_detected = 0;
-	bitbuffer_t bits = {0};
+	bitbuffer_t *bits = demod_bitbuffer();
 	int start_bit = device->demod_arg;
 
 	// lower and upper bounds (non inclusive)
@@ -212,13 +250,13 @@ int pulse_demod_pwm_precise(const pulse_data_t *pulses, struct protocol_state *d
 			start_bit_detected = 1;
 		} else if (pulses->pulse[n] > one_l && pulses->pulse[n] < one_u) {
 			// 'Short' 1 pulse
-			bitbuffer_add_bit(&bits, 1);
+			bitbuffer_add_bit(bits, 1);
 		} else if (pulses->pulse[n] > zero_l && pulses->pulse[n] < zero_u) {
 			// 'Long' 0 pulse
-			bitbuffer_add_bit(&bits, 0);
+			bitbuffer_add_bit(bits, 0);
 		} else if (pulses->pulse[n] > sync_l && pulses->pulse[n] < sync_u) {
 			// Sync pulse
-			bitbuffer_add_sync(&bits);
+			bitbuffer_add_sync(bits);
 		} else if (pulses->pulse[n] < one_l) {
 			// Ignore spurious short pulses
 		} else {
@@ -229,21 +267,21 @@ int pulse_demod_pwm_precise(const pulse_data_t *pulses, struct protocol_state *d
 		// End of Message?
 		if (((n == pulses->num_pulses - 1) // No more pulses? (FSK)
 				|| (pulses->gap[n] > device->reset_limit)) // Long silence (OOK)
-				&& (bits.num_rows > 0)) { // Only if data has been accumulated
+				&& (bits->num_rows > 0)) { // Only if data has been accumulated
 			if (device->callback) {
-				events += device->callback(&bits);
+				events += run_callback(device, bits);
 			}
 			// Debug printout
 			if (!device->callback || (debug_output && events > 0)) {
 				fprintf(stderr, "pulse_demod_pwm_precise(): %s \n", device->name);
-				bitbuffer_print(&bits);
+				bitbuffer_print(bits);
 			}
-			bitbuffer_clear(&bits);
+			bitbuffer_clear(bits);
 			start_bit_detected = 0;
 		} else if (device->gap_limit > 0 && pulses->gap[n] > device->gap_limit
-				&& bits.num_rows > 0 && bits.bits_per_row[bits.num_rows - 1] > 0) {
+				&& bits->num_rows > 0 && bits->bits_per_row[bits->num_rows - 1] > 0) {
 			// New packet in multipacket
-			bitbuffer_add_row(&bits);
+			bitbuffer_add_row(bits);
 			start_bit_detected = 0;
 		}
 	}
@@ -254,17 +292,17 @@ int pulse_demod_pwm_precise(const pulse_data_t *pulses, struct protocol_state *d
 int pulse_demod_manchester_zerobit(const pulse_data_t *pulses, struct protocol_state *device) {
 	int events = 0;
 	int time_since_last = 0;
-	bitbuffer_t bits = {0};
+	bitbuffer_t *bits = demod_bitbuffer();
 
 	// First rising edge is always counted as a zero (Seems to be hardcoded policy for the Oregon Scientific sensors...)
-	bitbuffer_add_bit(&bits, 0);
+	bitbuffer_add_bit(bits, 0);
 
 	for(unsigned n = 0; n < pulses->num_pulses; ++n) {
 		// Falling edge is on end of pulse
 		if(pulses->pulse[n] + time_since_last > (device->short_limit * 1.5)) {
 			// Last bit was recorded more than short_limit*1.5 samples ago
 			// so this pulse start must be a data edge (falling data edge means bit = 1)
-			bitbuffer_add_bit(&bits, 1);
+			bitbuffer_add_bit(bits, 1);
 			time_since_last = 0;
 		} else {
 			time_since_last += pulses->pulse[n];
@@ -274,21 +312,21 @@ int pulse_demod_manchester_zerobit(const pulse_data_t *pulses, struct protocol_s
 		if(pulses->gap[n] > device->reset_limit) {
 			int newevents = 0;
 			if (device->callback) {
-				events += device->callback(&bits);
+				events += run_callback(device, bits);
 			}
 			// Debug printout
 			if(!device->callback || (debug_output && events > 0)) {
 				fprintf(stderr, "pulse_demod_manchester_zerobit(): %s \n", device->name);
-				bitbuffer_print(&bits);
+				bitbuffer_print(bits);
 			}
-			bitbuffer_clear(&bits);
-			bitbuffer_add_bit(&bits, 0);		// Prepare for new message with hardcoded 0
+			bitbuffer_clear(bits);
+			bitbuffer_add_bit(bits, 0);		// Prepare for new message with hardcoded 0
 			time_since_last = 0;
 		// Rising edge is on end of gap
 		} else if(pulses->gap[n] + time_since_last > (device->short_limit * 1.5)) {
 			// Last bit was recorded more than short_limit*1.5 samples ago
 			// so this pulse end is a data edge (rising data edge means bit = 0)
-			bitbuffer_add_bit(&bits, 0);
+			bitbuffer_add_bit(bits, 0);
 			time_since_last = 0;
 		} else {
 			time_since_last += pulses->gap[n];
@@ -301,7 +339,7 @@ int pulse_demod_dmc(const pulse_data_t *pulses, struct protocol_state *device) {
    int symbol[PD_MAX_PULSES * 2];
    unsigned int n;
 
-   bitbuffer_t bits = {0};
+   bitbuffer_t *bits = demod_bitbuffer();
    int events = 0;
 
    for(n = 0; n < pulses->num_pulses; n++) {
@@ -312,13 +350,13 @@ int pulse_demod_dmc(const pulse_data_t *pulses, struct protocol_state *device) {
    for(n = 0; n < pulses->num_pulses * 2; ++n) {
       if ( fabsf(symbol[n] - device->short_limit) < device->tolerance) {
          // Short - 1
-         bitbuffer_add_bit(&bits, 1);
+         bitbuffer_add_bit(bits, 1);
          if ( fabsf(symbol[++n] - device->short_limit) > device->tolerance) {
             if (symbol[n] >= device->reset_limit - device->tolerance ) {
                // Don't expect another short gap at end of message
                n--;
-			} else if (bits.num_rows > 0 && bits.bits_per_row[bits.num_rows - 1] > 0) {
-				bitbuffer_add_row(&bits);
+			} else if (bits->num_rows > 0 && bits->bits_per_row[bits->num_rows - 1] > 0) {
+				bitbuffer_add_row(bits);
 /*
                fprintf(stderr, "Detected error during pulse_demod_dmc(): %s\n",
                        device->name);
@@ -327,18 +365,18 @@ int pulse_demod_dmc(const pulse_data_t *pulses, struct protocol_state *device) {
          }
       } else if ( fabsf(symbol[n] - device->long_limit) < device->tolerance) {
          // Long - 0
-         bitbuffer_add_bit(&bits, 0);
+         bitbuffer_add_bit(bits, 0);
       } else if (symbol[n] >= device->reset_limit - device->tolerance
-			&& bits.num_rows > 0) { // Only if data has been accumulated
+			&& bits->num_rows > 0) { // Only if data has been accumulated
          //END message ?
          if (device->callback) {
-            events += device->callback(&bits);
+            events += run_callback(device, bits);
          }
          if(!device->callback || (debug_output && events > 0)) {
             fprintf(stderr, "pulse_demod_dmc(): %s \n", device->name);
-            bitbuffer_print(&bits);
+            bitbuffer_print(bits);
          }
-         bitbuffer_clear(&bits);
+         bitbuffer_clear(bits);
       }
    }
 
@@ -350,7 +388,7 @@ int pulse_demod_piwm_raw(const pulse_data_t *pulses, struct protocol_state *devi
 	unsigned int n;
 	int w;
 
-	bitbuffer_t bits = {0};
+	bitbuffer_t *bits = demod_bitbuffer();
 	int events = 0;
 
 	for (n = 0; n < pulses->num_pulses; n++) {
@@ -361,14 +399,14 @@ int pulse_demod_piwm_raw(const pulse_data_t *pulses, struct protocol_state *devi
 	for (n = 0; n < pulses->num_pulses * 2; ++n) {
 		w = symbol[n] / device->short_limit + 0.5;
 	  	if (symbol[n] > device->long_limit) {
-			bitbuffer_add_row(&bits);
+			bitbuffer_add_row(bits);
 		} else if (fabsf(symbol[n] - w * device->short_limit) < device->tolerance) {
 			// Add w symbols
 			for (; w > 0; --w)
-				bitbuffer_add_bit(&bits, 1-n%2);
+				bitbuffer_add_bit(bits, 1-n%2);
 		} else if (symbol[n] < device->reset_limit
-				&& bits.num_rows > 0 && bits.bits_per_row[bits.num_rows - 1] > 0) {
-			bitbuffer_add_row(&bits);
+				&& bits->num_rows > 0 && bits->bits_per_row[bits->num_rows - 1] > 0) {
+			bitbuffer_add_row(bits);
 /*
 			fprintf(stderr, "Detected error during pulse_demod_piwm_raw(): %s\n",
 					device->name);
@@ -377,16 +415,16 @@ int pulse_demod_piwm_raw(const pulse_data_t *pulses, struct protocol_state *devi
 
 		if (((n == pulses->num_pulses * 2 - 1) // No more pulses? (FSK)
 				|| (symbol[n] > device->reset_limit)) // Long silence (OOK)
-				&& (bits.num_rows > 0)) { // Only if data has been accumulated
+				&& (bits->num_rows > 0)) { // Only if data has been accumulated
 			//END message ?
 			if (device->callback) {
-				events += device->callback(&bits);
+				events += run_callback(device, bits);
 			}
 			if(!device->callback || (debug_output && events > 0)) {
 				fprintf(stderr, "pulse_demod_piwm_raw(): %s \n", device->name);
-				bitbuffer_print(&bits);
+				bitbuffer_print(bits);
 			}
-			bitbuffer_clear(&bits);
+			bitbuffer_clear(bits);
 		}
         }
 
@@ -397,7 +435,7 @@ int pulse_demod_piwm_dc(const pulse_data_t *pulses, struct protocol_state *devic
 	int symbol[PD_MAX_PULSES * 2];
 	unsigned int n;
 
-	bitbuffer_t bits = {0};
+	bitbuffer_t *bits = demod_bitbuffer();
 	int events = 0;
 
 	for (n = 0; n < pulses->num_pulses; n++) {
@@ -408,13 +446,13 @@ int pulse_demod_piwm_dc(const pulse_data_t *pulses, struct protocol_state *devic
 	for (n = 0; n < pulses->num_pulses * 2; ++n) {
 		if (fabsf(symbol[n] - device->short_limit) < device->tolerance) {
 			// Short - 1
-			bitbuffer_add_bit(&bits, 1);
+			bitbuffer_add_bit(bits, 1);
 	  	} else if (fabsf(symbol[n] - device->long_limit) < device->tolerance) {
 			// Long - 0
-	        bitbuffer_add_bit(&bits, 0);
+	        bitbuffer_add_bit(bits, 0);
 		} else if (symbol[n] < device->reset_limit
-				&& bits.num_rows > 0 && bits.bits_per_row[bits.num_rows - 1] > 0) {
-			bitbuffer_add_row(&bits);
+				&& bits->num_rows > 0 && bits->bits_per_row[bits->num_rows - 1] > 0) {
+			bitbuffer_add_row(bits);
 /*
 			fprintf(stderr, "Detected error during pulse_demod_piwm_dc(): %s\n",
 					device->name);
@@ -423,16 +461,16 @@ int pulse_demod_piwm_dc(const pulse_data_t *pulses, struct protocol_state *devic
 
 		if (((n == pulses->num_pulses * 2 - 1) // No more pulses? (FSK)
 				|| (symbol[n] > device->reset_limit)) // Long silence (OOK)
-				&& (bits.num_rows > 0)) { // Only if data has been accumulated
+				&& (bits->num_rows > 0)) { // Only if data has been accumulated
 			//END message ?
 			if (device->callback) {
-				events += device->callback(&bits);
+				events += run_callback(device, bits);
 			}
 			if(!device->callback || (debug_output && events > 0)) {
 				fprintf(stderr, "pulse_demod_piwm_dc(): %s \n", device->name);
-				bitbuffer_print(&bits);
+				bitbuffer_print(bits);
 			}
-			bitbuffer_clear(&bits);
+			bitbuffer_clear(bits);
 		}
 	}
 
@@ -457,7 +495,7 @@ int pulse_demod_osv1(const pulse_data_t *pulses, struct protocol_state *device)
 	int preamble = 0;
 	int events = 0;
 	int manbit = 0;
-	bitbuffer_t bits = {0};
+	bitbuffer_t *bits = demod_bitbuffer();
 
 	/* preamble */
 	for(n = 0; n < pulses->num_pulses; ++n) {
@@ -484,28 +522,28 @@ int pulse_demod_osv1(const pulse_data_t *pulses, struct protocol_state *device)
 	/* sync gap could be part of data when the first bit is 0 */
 	if(pulses->gap[n] > pulses->pulse[n]) {
 		manbit ^= 1;
-		if(manbit) bitbuffer_add_bit(&bits, 0);
+		if(manbit) bitbuffer_add_bit(bits, 0);
 	}
 
 	/* remaining data bits */
 	for(n++; n < pulses->num_pulses; ++n) {
 		manbit ^= 1;
-		if(manbit) bitbuffer_add_bit(&bits, 1);
+		if(manbit) bitbuffer_add_bit(bits, 1);
 		if(pulses->pulse[n] > 615) {
 			manbit ^= 1;
-			if(manbit) bitbuffer_add_bit(&bits, 1);
+			if(manbit) bitbuffer_add_bit(bits, 1);
 		}
 		if (n == pulses->num_pulses - 1 || pulses->gap[n] > device->reset_limit) {
-			if((bits.bits_per_row[bits.num_rows-1] == 32) && device->callback) {
-				events += device->callback(&bits);
+			if((bits->bits_per_row[bits->num_rows-1] == 32) && device->callback) {
+				events += run_callback(device, bits);
 			}
 			return(events);
 		}
 		manbit ^= 1;
-		if(manbit) bitbuffer_add_bit(&bits, 0);
+		if(manbit) bitbuffer_add_bit(bits, 0);
 		if(pulses->gap[n] > 450) {
 			manbit ^= 1;
-			if(manbit) bitbuffer_add_bit(&bits, 0);
+			if(manbit) bitbuffer_add_bit(bits, 0);
 		}
 	}
 	return events;
@@ -515,17 +553,17 @@ int pulse_demod_osv1(const pulse_data_t *pulses, struct protocol_state *device)
 int pulse_demod_string(const char *code, struct protocol_state *device)
 {
 	int events = 0;
-	bitbuffer_t bits = {0};
+	bitbuffer_t *bits = demod_bitbuffer();
 
-	bitbuffer_parse(&bits, code);
+	bitbuffer_parse(bits, code);
 
 	if (device->callback) {
-		events += device->callback(&bits);
+		events += run_callback(device, bits);
 	}
 	// Debug printout
 	if(!device->callback || (debug_output && events > 0)) {
 		fprintf(stderr, "pulse_demod_pcm(): %s \n", device->name);
-		bitbuffer_print(&bits);
+		bitbuffer_print(bits);
 	}
 
 	return events;
@@ -196,6 +196,7 @@ typedef struct {
 	int max_pulse;			// Size of biggest pulse detected
 
 	int data_counter;		// Counter for how much of data chunk is processed
+	uint64_t stream_offset;	// Number of samples in all previous data chunks
 	int lead_in_counter;	// Counter for allowing initial noise estimate to settle
 
 	int ook_low_estimate;		// Estimate for the OOK low level (base noise level) in the envelope data
@@ -206,6 +207,10 @@ typedef struct {
 } pulse_state_t;
 static pulse_state_t pulse_state;
 
+int pulse_detect_noise_level(void) {
+	return pulse_state.ook_low_estimate;
+}
+
 
 /// Demodulate On/Off Keying (OOK) and Frequency Shift Keying (FSK) from an envelope signal
 int pulse_detect_package(const int16_t *envelope_data, const int16_t *fm_data, int len, int16_t level_limit, uint32_t samp_rate, pulse_data_t *pulses, pulse_data_t *fsk_pulses) {
@@ -230,6 +235,8 @@ int pulse_detect_package(const int16_t *envelope_data, const int16_t *fm_data, i
 					// Initialize all data
 					pulse_data_clear(pulses);
 					pulse_data_clear(fsk_pulses);
+					pulses->offset = s->stream_offset + s->data_counter;
+					fsk_pulses->offset = pulses->offset;
 					s->pulse_length = 0;
 					s->max_pulse = 0;
 					s->FSK_state = (pulse_FSK_state_t){0};
@@ -292,6 +299,7 @@ int pulse_detect_package(const int16_t *envelope_data, const int16_t *fm_data, i
 						fsk_pulses->fsk_f2_est = s->FSK_state.fm_f2_est;
 						fsk_pulses->ook_low_estimate = s->ook_low_estimate;
 						fsk_pulses->ook_high_estimate = s->ook_high_estimate;
+						fsk_pulses->end_offset = s->stream_offset + s->data_counter;
 						s->ook_state = PD_OOK_STATE_IDLE;	// Ensure everything is reset
 						return 2;	// FSK package detected!!!
 					}
@@ -314,6 +322,7 @@ int pulse_detect_package(const int16_t *envelope_data, const int16_t *fm_data, i
 						// Store estimates
 						pulses->ook_low_estimate = s->ook_low_estimate;
 						pulses->ook_high_estimate = s->ook_high_estimate;
+						pulses->end_offset = s->stream_offset + s->data_counter;
 						return 1;	// End Of Package!!
 					}
 
@@ -332,6 +341,7 @@ int pulse_detect_package(const int16_t *envelope_data, const int16_t *fm_data, i
 					// Store estimates
 					pulses->ook_low_estimate = s->ook_low_estimate;
 					pulses->ook_high_estimate = s->ook_high_estimate;
+					pulses->end_offset = s->stream_offset + s->data_counter;
 					return 1;	// End Of Package!!
 				}
 				break;
@@ -343,6 +353,7 @@ int pulse_detect_package(const int16_t *envelope_data, const int16_t *fm_data, i
 	} // while
 
 	s->data_counter = 0;
+	s->stream_offset += len;
 	return 0;	// Out of data
 }
 
@@ -21,6 +21,7 @@
  */
 
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "rtl-sdr.h"
 #include "rtl_433.h"
@@ -30,6 +31,17 @@
 #include "data.h"
 #include "util.h"
 #include "optparse.h"
+#include "hop_scheduler.h"
+#include "capture_writer.h"
+#include "iqz.h"
+#include "signal_grabber.h"
+#include "sample_format.h"
+#include "pipeline_stats.h"
+#include "shm_ring.h"
+#include "tsdb.h"
+#include "http_server.h"
+#include "station_cache.h"
+#include "weather_metrics.h"
 
 #define MAX_DATA_OUTPUTS 32
 
@@ -37,7 +49,6 @@ static int do_exit = 0;
 static int do_exit_async = 0, frequencies = 0;
 uint32_t frequency[MAX_PROTOCOLS];
 uint32_t center_frequency = 0;
-time_t rawtime_old;
 int duration = 0;
 time_t stop_time;
 int flag;
@@ -65,6 +76,7 @@ uint16_t num_r_devices = 0;
 
 struct dm_state {
     FILE *out_file;
+    iqz_writer_t *out_iqz;
     int32_t level_limit;
     int16_t am_buf[MAXIMAL_BUF_LENGTH];  // AM demodulated signal (for OOK decoding)
     union {
@@ -78,23 +90,75 @@ struct dm_state {
     int analyze;
     int analyze_pulses;
     int debug_mode;
-    int hop_time;
+
+    /* Frequency hopping */
+    int hop_time[MAX_PROTOCOLS];
+    int hop_times;
+    unsigned hop_events;
+    unsigned hop_settle_ms;
+    hop_scheduler_t hop;
+
+    /* Sync mode capture */
+    unsigned capture_buffers;
+    int capture_direct;
+
+    /* Input file */
+    double in_offset;
+    unsigned read_threads;
+    int native_cs16;
+    int16_t *iq16_buf;      // Native cs16 samples of the current block, NULL for cu8 processing
 
     /* Signal grabber variables */
     int signal_grabber;
-    int8_t* sg_buf;
-    int sg_index;
-    int sg_len;
+    signal_grabber_t *grabber;
+    unsigned grab_pre_ms;
+    unsigned grab_post_ms;
 
+    /* Outputs */
+    unsigned syslog_latency_ms;
+    station_emit_t emit_mode;
+    double heartbeat;       // seconds
+    double dedup_window;    // seconds, 0 = off
+    int derived_weather;
 
     /* Protocol states */
-    uint16_t r_dev_num;
-    struct protocol_state *r_devs[MAX_PROTOCOLS];
+    struct protocol_table *protocols;
+
+    /* Decoder profiling and pipeline statistics */
+    FILE *profile_file;     // NULL unless profiling
+    int decoder_stats;      // collect per decoder counters, for the profile or the HTTP metrics
+    unsigned stats_interval;    // 0 = no periodic stats
+    char *http_host;        // NULL unless serving metrics
+    char *http_port;
+    pipeline_counters_t counters;
+
+    /* Arrival of the current block, maps stream offsets to time */
+    uint64_t block_end;     // stream offset after the last sample
+    uint64_t block_ns;      // monotonic time
+    double block_time;      // wall clock, or file position when reading a file
+
+    /* Decoders from the config file, replaced as a whole on reload */
+    char *config_file;
+    struct protocol_table *cfg_table;       // in use by the sample callback
+    struct protocol_table *cfg_pending;     // loaded, picked up before the next package, protected by reload_mutex
+    struct protocol_table *cfg_retired;     // no longer in use, freed by the reload thread, protected by reload_mutex
 
     pulse_data_t    pulse_data;
     pulse_data_t    fsk_pulse_data;
 };
 
+/* A set of decoders, grown as needed. The protocol states are kept in one
+ * array so the dispatch loop walks contiguous memory. A table from the
+ * config file is swapped as a whole, see reload_controller() */
+struct protocol_table {
+    unsigned num;
+    unsigned size;          // allocated entries
+    int fsk;                // some decoder needs FM demodulation
+    r_device **devices;
+    struct protocol_state *protocols;
+    struct protocol_stats *stats;   // NULL unless profiling
+};
+
 void usage(r_device *devices) {
     int i;
     char disabledc;
@@ -114,17 +178,32 @@ void usage(r_device *devices) {
             "\t[-g <gain>] (default: 0 for auto)\n"
             "\t[-f <frequency>] [-f...] Receive frequency(s) (default: %i Hz)\n"
             "\t[-H <seconds>] Hop interval for polling of multiple frequencies (default: %i seconds)\n"
+            "\t\t Specify -H once per -f to set a dwell time for each frequency\n"
             "\t[-p <ppm_error] Correct rtl-sdr tuner frequency offset error (default: 0)\n"
             "\t[-s <sample rate>] Set sample rate (default: %i Hz)\n"
             "\t[-S] Force sync output (default: async)\n"
+            "\t[-Y hop_events=<n>] Extend a hop dwell while at least <n> events are decoded per dwell (default: %i, 0 = off)\n"
+            "\t[-Y hop_settle=<ms>] Discard samples for <ms> after the blocks queued while retuning (default: %i)\n"
+            "\t[-Y capture_buffers=<n>] Number of write buffers for sync mode capture (default: %i)\n"
+            "\t[-Y capture_direct] Bypass the page cache when writing sync mode captures\n"
+            "\t[-Y read_offset=<seconds>] Start reading the input file at an offset\n"
+            "\t[-Y read_threads=<n>] Number of decompression threads for .iqz input files (default: %i)\n"
+            "\t[-Y native_cs16] Demodulate cs16 and cf32 input files with 16 bit precision instead of converting to cu8\n"
+            "\t[-Y grab_pre=<ms>] Margin saved before each signal with -t (default: %i)\n"
+            "\t[-Y grab_post=<ms>] Margin saved after each signal with -t (default: %i)\n"
             "\t= Demodulator options =\n"
             "\t[-R <device>] Enable only the specified device decoding protocol (can be used multiple times)\n"
             "\t[-G] Enable all device protocols, included those disabled by default\n"
             "\t[-X <spec> | help] Add a general purpose decoder (-R 0 to disable all other decoders)\n"
+            "\t[-c <filename>] Add the general purpose decoders from a config file (e.g. decoders.cfg), one <spec> per line\n"
+            "\t\t Send SIGHUP to reload the file without stopping the receiver\n"
             "\t[-l <level>] Change detection level used to determine pulses [0-16384] (0 = auto) (default: %i)\n"
             "\t[-z <value>] Override short value in data decoder\n"
             "\t[-x <value>] Override long value in data decoder\n"
-            "\t[-n <value>] Specify number of samples to take (each sample is 2 bytes: 1 each of I & Q)\n"
+            "\t[-n <value>] Specify number of samples to take (each sample is 2 bytes: 1 each of I & Q)\n",
+            DEFAULT_FREQUENCY, DEFAULT_HOP_TIME, DEFAULT_SAMPLE_RATE, DEFAULT_HOP_EVENTS, DEFAULT_HOP_SETTLE_MS, DEFAULT_CAPTURE_BUFFERS, IQZ_DEFAULT_THREADS, DEFAULT_GRAB_PRE_MS, DEFAULT_GRAB_POST_MS, DEFAULT_LEVEL_LIMIT);
+
+    fprintf(stderr,
             "\t= Analyze/Debug options =\n"
             "\t[-a] Analyze mode. Print a textual description of the signal. Disables decoding\n"
             "\t[-A] Pulse Analyzer. Enable pulse analysis and decode attempt\n"
@@ -133,8 +212,16 @@ void usage(r_device *devices) {
             "\t[-q] Quiet mode, suppress non-data messages\n"
             "\t[-W] Overwrite mode, disable checks to prevent files from being overwritten\n"
             "\t[-y <code>] Verify decoding of demodulated test data (e.g. \"{25}fb2dd58\") with enabled devices\n"
+            "\t[-M profile[=<filename>]] Collect per decoder counters and timings, print them as JSON on SIGUSR1 and at exit (default: stderr)\n"
+            "\t[-M stats[=<seconds>]] Report pipeline stage latencies and throughput through the outputs every <seconds> and at exit (default: %i)\n"
+            "\t[-M http[=[<host>:]<port>]] Serve /metrics (Prometheus) and /latest (the newest record of each model and id)\n"
+            "\t\t (default: 127.0.0.1:%s, use e.g. 0.0.0.0:%s for all interfaces)\n"
+            "\t[-M latency] Add the capture time of the first pulse and the capture to output latency to each record\n",
+            DEFAULT_STATS_INTERVAL, DEFAULT_HTTP_PORT, DEFAULT_HTTP_PORT);
+
+    fprintf(stderr,
             "\t= File I/O options =\n"
-            "\t[-t] Test signal auto save. Use it together with analyze mode (-a -t). Creates one file per signal\n"
+            "\t[-t] Test signal auto save. Creates one file per detected signal (select with -I), also with analyze mode (-a -t)\n"
             "\t\t Note: Saves raw I/Q samples (uint8 pcm, 2 channel). Preferred mode for generating test files\n"
             "\t[-r <filename>] Read data from input file instead of a receiver\n"
             "\t[-m <mode>] Data file mode for input / output file (default: 0)\n"
@@ -143,15 +230,36 @@ void usage(r_device *devices) {
             "\t\t 2 = FM demodulated samples (int16) (experimental)\n"
             "\t\t 3 = Raw I/Q samples (cf32, 2 channel)\n"
             "\t\t Note: If output file is specified, input will always be I/Q\n"
-            "\t[-F] kv|json|csv|syslog Produce decoded output in given format. Not yet supported by all drivers.\n"
+            "\t\t Input files named *.cs8, *.cs16 or *.cf32 are read as I/Q samples of that format\n"
+            "\t\t Files named *.iqz are read and written as compressed I/Q samples (uint8, 2 channel)\n"
+            "\t[-F] kv|json|csv|cbor|syslog|mqtt|influx|shm|tsdb Produce decoded output in given format. Not yet supported by all drivers.\n"
             "\t\t append output to file with :<filename> (e.g. -F csv:log.csv), defaults to stdout.\n"
             "\t\t specify host/port for syslog with e.g. -F syslog:127.0.0.1:1514\n"
+            "\t\t cbor is a binary stream of records with a key dictionary, see data_output_cbor_create() in data.h\n"
+            "\t[-F] mqtt://[user:pass@]host[:port][/topic][,qos=1][,retain=1][,keepalive=<s>][,backlog=<n>][,client_id=<id>]\n"
+            "\t\t Publish JSON records to an MQTT broker (default: localhost:1883, topic rtl_433[/model][/id])\n"
+            "\t\t [key] in the topic is replaced by the field value, [/key] by /value, both are left out if the field is missing\n"
+            "\t[-F] influx://host[:port][/path][,token=<token>] | influx+udp://host[:port]  [,flush_size=<bytes>][,flush_ms=<ms>][,measurement=<name>]\n"
+            "\t\t InfluxDB line protocol over HTTP (default: localhost:8086/write?db=rtl_433) or UDP (default: port 8089)\n"
+            "\t\t many lines per POST or datagram, sent at flush_size bytes (default: 8192, UDP 1400) or after flush_ms (default: 1000)\n"
+            "\t[-F] shm[:<name>][,size=<bytes>] Write JSON records to a shared memory ring for local readers\n"
+            "\t\t (default: /rtl_433, i.e. /dev/shm/rtl_433, keeping %i bytes of records), see shm_ring.h\n"
+            "\t[-F] tsdb[:<dir>] Append the numeric fields to a columnar store with a file per day (default: %s)\n"
+            "\t\t query it with rtl_433_tsdb, see tsdb.h\n"
+            "\t[-Y syslog_latency=<ms>] Batch syslog datagrams, holding each back at most <ms> (default with no value: %i, 0 = off)\n"
+            "\t[-Y emit=full|change|heartbeat] Output every record (default), only records of a station (model, id, channel) whose values changed,\n"
+            "\t\t or also unchanged stations once per heartbeat\n"
+            "\t[-Y heartbeat=<seconds>] Output unchanged stations again after <seconds>, implies emit=heartbeat (default: %i)\n"
+            "\t[-Y dedup=<ms>] Drop a repeat of the record last output for a station within <ms> (default with no value: %i, 0 = off)\n"
+            "\t[-Y derived_weather] Add rain rate and totals, 10 minute wind average, gust and direction, dew point and wind chill\n"
+            "\t\t to the records of weather stations\n"
             "\t[-C] native|si|customary Convert units in decoded output.\n"
             "\t[-T] specify number of seconds to run\n"
             "\t[-U] Print timestamps in UTC (this may also be accomplished by invocation with TZ environment variable set).\n"
             "\t[-E] Stop after outputting successful event(s)\n"
             "\t[<filename>] Save data stream to output file (a '-' dumps samples to stdout)\n\n",
-            DEFAULT_FREQUENCY, DEFAULT_HOP_TIME, DEFAULT_SAMPLE_RATE, DEFAULT_LEVEL_LIMIT);
+            SHM_RING_DEFAULT_SIZE, TSDB_DEFAULT_DIR, DEFAULT_SYSLOG_LATENCY_MS,
+            STATION_CACHE_HEARTBEAT_S, DEFAULT_DEDUP_MS);
 
     fprintf(stderr, "Supported device protocols:\n");
     for (i = 0; i < num_r_devices; i++) {
@@ -189,8 +297,31 @@ static void sighandler(int signum) {
 #endif
 
 
-static void register_protocol(struct dm_state *demod, r_device *t_dev) {
-    struct protocol_state *p = calloc(1, sizeof (struct protocol_state));
+static void protocol_table_add(struct protocol_table *table, r_device *t_dev) {
+    if (table->num == table->size) {
+        table->size = table->size ? table->size * 2 : 32;
+        table->devices = realloc(table->devices, table->size * sizeof(r_device *));
+        table->protocols = realloc(table->protocols, table->size * sizeof(struct protocol_state));
+        if (!table->devices || !table->protocols) {
+            fprintf(stderr, "Failed to allocate protocol table\n");
+            exit(1);
+        }
+        if (table->stats) {
+            table->stats = realloc(table->stats, table->size * sizeof(struct protocol_stats));
+            if (!table->stats) {
+                fprintf(stderr, "Failed to allocate protocol stats\n");
+                exit(1);
+            }
+            for (unsigned i = 0; i < table->num; i++)
+                table->protocols[i].stats = &table->stats[i];
+        }
+    }
+    struct protocol_state *p = &table->protocols[table->num];
+    memset(p, 0, sizeof(struct protocol_state));
+    if (table->stats) {
+        memset(&table->stats[table->num], 0, sizeof(struct protocol_stats));
+        p->stats = &table->stats[table->num];
+    }
     p->short_limit = (float) t_dev->short_limit / ((float) 1000000 / (float) samp_rate);
     p->long_limit = (float) t_dev->long_limit / ((float) 1000000 / (float) samp_rate);
     p->reset_limit = (float) t_dev->reset_limit / ((float) 1000000 / (float) samp_rate);
@@ -201,19 +332,38 @@ static void register_protocol(struct dm_state *demod, r_device *t_dev) {
     p->callback = t_dev->json_callback;
     p->name = t_dev->name;
     p->demod_arg = t_dev->demod_arg;
-    bitbuffer_clear(&p->bits);
 
-    demod->r_devs[demod->r_dev_num] = p;
-    demod->r_dev_num++;
+    table->devices[table->num] = t_dev;
+    table->num++;
+    if (t_dev->modulation >= FSK_DEMOD_MIN_VAL)
+        table->fsk = 1;
+}
 
-    if (!quiet_mode) {
-    fprintf(stderr, "Registering protocol [%d] \"%s\"\n", demod->r_dev_num, t_dev->name);
+/* Start collecting per decoder counters */
+static void protocol_table_enable_stats(struct protocol_table *table) {
+    table->stats = calloc(table->size ? table->size : 1, sizeof(struct protocol_stats));
+    if (!table->stats) {
+        fprintf(stderr, "Failed to allocate protocol stats\n");
+        exit(1);
     }
+    for (unsigned i = 0; i < table->num; i++)
+        table->protocols[i].stats = &table->stats[i];
+}
+
+static void protocol_table_free(struct protocol_table *table) {
+    if (!table)
+        return;
+    free(table->devices);
+    free(table->protocols);
+    free(table->stats);
+    free(table);
+}
+
+static void register_protocol(struct dm_state *demod, r_device *t_dev) {
+    protocol_table_add(demod->protocols, t_dev);
 
-    if (demod->r_dev_num > MAX_PROTOCOLS) {
-        fprintf(stderr, "\n\nMax number of protocols reached %d\n", MAX_PROTOCOLS);
-    fprintf(stderr, "Increase MAX_PROTOCOLS and recompile\n");
-    exit(-1);
+    if (!quiet_mode) {
+    fprintf(stderr, "Registering protocol [%d] \"%s\"\n", demod->protocols->num, t_dev->name);
     }
 }
 
@@ -233,10 +383,90 @@ static unsigned int signal_pulse_counter = 0;
 
 static void *output_handler[MAX_DATA_OUTPUTS];
 static int last_output_handler = 0;
+static pipeline_stats_t *pipeline_stats;   // NULL unless periodic stats or HTTP metrics are enabled
+static http_server_t *http_server;          // NULL unless serving metrics
+static struct data_output *latest_output;   // most recent records for /latest, also in output_handler
+static uint64_t http_rendered;              // monotonic ns, sample thread only
+static pthread_mutex_t http_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t http_cond = PTHREAD_COND_INITIALIZER;
+static char *http_metrics;                  // /metrics as last rendered, without the HTTP counters; with http_mutex
+static size_t http_metrics_len;
+static uint64_t http_published;             // monotonic ns, with http_mutex
+static int http_refresh_stop;               // with http_mutex
+static pthread_t http_refresh_thread;
+static int latency_fields = 0;  // Option -M latency
+static pulse_data_t const *current_package; // package being decoded, NULL otherwise
+static station_cache_t *station_cache;      // NULL if all records are output
+static weather_metrics_t *weather_metrics;  // NULL unless derived weather fields are added
+
+static uint64_t stage_start(void) {
+    return pipeline_stats ? monotonic_ns() : 0;
+}
+
+static void stage_end(pipeline_stage_t stage, uint64_t start) {
+    if (pipeline_stats)
+        hdr_hist_record(&pipeline_stats->stage[stage], monotonic_ns() - start);
+}
+
+static pthread_mutex_t hop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hop_cond = PTHREAD_COND_INITIALIZER;
+static int hop_stop = 0;
+
+/* Capture time of the first sample as "YYYY-MM-DD HH:MM:SS.ssssss" (or "@<pos>s" for files) */
+static char *capture_time_str(double capture_time, char *buf, size_t size) {
+    if (sample_file_pos != -1.0) {
+        snprintf(buf, size, "@%fs", capture_time);
+        return buf;
+    }
+    time_t secs = (time_t)capture_time;
+    int usecs = (int)((capture_time - secs) * 1e6);
+    char date[LOCAL_TIME_BUFLEN];
+    snprintf(buf, size, "%s.%06d", local_time_str(secs, date), usecs);
+    return buf;
+}
+
+/* Record the capture to emit latency of the package a record was decoded from */
+static void track_latency(data_t *data) {
+    if (!current_package || (!pipeline_stats && !latency_fields))
+        return;
+    uint64_t latency = monotonic_ns() - current_package->capture_ns;
+    if (pipeline_stats)
+        hdr_hist_record(&pipeline_stats->latency, latency);
+    if (latency_fields && data) {
+        char time_str[LOCAL_TIME_BUFLEN + 8];
+        data_t *tail = data;
+        while (tail->next)
+            tail = tail->next;
+        tail->next = data_make(
+                "capture_time", "", DATA_STRING, capture_time_str(current_package->capture_time, time_str, sizeof(time_str)),
+                "latency_us",   "", DATA_FORMAT, "%.0f", DATA_DOUBLE, latency / 1e3,
+                NULL);
+    }
+}
 
 /* handles incoming structured data by dumping it */
 void data_acquired_handler(data_t *data)
 {
+    // capture time of the package, i.e. sample time for files, so replays give the same results
+    double now = current_package ? current_package->capture_time : monotonic_ns() / 1e9;
+
+    // every record goes into the history, even those not output
+    data_t *derived = weather_metrics ? weather_metrics_update(weather_metrics, data, now) : NULL;
+
+    if (station_cache && !station_cache_check(station_cache, data, now)) {
+        data_free(derived);
+        data_free(data);
+        return;
+    }
+    if (derived) {
+        data_t *tail = data;
+        while (tail->next)
+            tail = tail->next;
+        tail->next = derived;
+    }
+
+    track_latency(data);
+
     if (conversion_mode == CONVERT_SI) {
         for (data_t *d = data; d; d = d->next) {
             // Convert double type fields ending in _F to _C
@@ -260,6 +490,16 @@ void data_acquired_handler(data_t *data)
                 free(d->format);
                 d->format = new_format_label;
             }
+            // Convert double type fields ending in _in_h to _mm_h
+            else if ((d->type == DATA_DOUBLE) && str_endswith(d->key, "_in_h")) {
+                *(double*)d->value = inch2mm(*(double*)d->value);
+                char *new_label = str_replace(d->key, "_in_h", "_mm_h");
+                free(d->key);
+                d->key = new_label;
+                char *new_format_label = str_replace(d->format, "in/h", "mm/h");
+                free(d->format);
+                d->format = new_format_label;
+            }
             // Convert double type fields ending in _mph to _kph
             else if ((d->type == DATA_DOUBLE) && str_endswith(d->key, "_inch")) {
                 *(double*)d->value = inch2mm(*(double*)d->value);
@@ -315,6 +555,16 @@ void data_acquired_handler(data_t *data)
                 free(d->format);
                 d->format = new_format_label;
             }
+            // Convert double type fields ending in _mm_h to _in_h
+            else if ((d->type == DATA_DOUBLE) && str_endswith(d->key, "_mm_h")) {
+                *(double*)d->value = mm2inch(*(double*)d->value);
+                char *new_label = str_replace(d->key, "_mm_h", "_in_h");
+                free(d->key);
+                d->key = new_label;
+                char *new_format_label = str_replace(d->format, "mm/h", "in/h");
+                free(d->format);
+                d->format = new_format_label;
+            }
             // Convert double type fields ending in _mm to _inch
             else if ((d->type == DATA_DOUBLE) && str_endswith(d->key, "_mm")) {
                 *(double*)d->value = mm2inch(*(double*)d->value);
@@ -348,6 +598,131 @@ void data_acquired_handler(data_t *data)
         }
     }
 
+    // InfluxDB points and stored rows carry the capture time, files have no wall clock time
+    uint64_t capture_ns = 0;
+    if (current_package && sample_file_pos == -1.0)
+        capture_ns = (uint64_t)(current_package->capture_time * 1e9);
+
+    for (int i = 0; i < last_output_handler; ++i) {
+        uint64_t start = stage_start();
+        data_output_influx_set_time(output_handler[i], capture_ns);
+        data_output_tsdb_set_time(output_handler[i], capture_ns);
+        data_output_print(output_handler[i], data);
+        if (pipeline_stats && i < (int)pipeline_stats->num_outputs)
+            hdr_hist_record(&pipeline_stats->output[i], monotonic_ns() - start);
+    }
+    data_free(data);
+}
+
+#define STATS_COUNTERS_MAX 5
+
+// A section of the stats record: totals reported as their change in the interval, and optionally a level
+typedef struct {
+    char const *name;
+    char const *keys[STATS_COUNTERS_MAX + 1];   // NULL terminated
+    char const *level;                          // NULL, or the key of the value after the totals, reported as is
+    int (*read)(struct data_output *output, unsigned long *values); // NULL if not read from the outputs
+    unsigned long last[STATS_COUNTERS_MAX];
+} counter_stats_t;
+
+/* Append a section with the change of each total since the last report, the totals are not truncated */
+static void add_counter_stats(data_t *data, counter_stats_t *stats, unsigned long const *values)
+{
+    data_t *section = NULL, **tail = &section;
+    unsigned i;
+    for (i = 0; stats->keys[i]; ++i) {
+        *tail = data_make(stats->keys[i], "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)(values[i] - stats->last[i]), NULL);
+        stats->last[i] = values[i];
+        if (*tail)
+            tail = &(*tail)->next;
+    }
+    if (stats->level)
+        *tail = data_make(stats->level, "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)values[i], NULL);
+
+    while (data->next)
+        data = data->next;
+    data->next = data_make(stats->name, "", DATA_DATA, section, NULL);
+}
+
+/* Append a section with the totals of all outputs the section reads, if there are any */
+static void add_output_stats(data_t *data, counter_stats_t *stats)
+{
+    unsigned long sum[STATS_COUNTERS_MAX + 1] = {0};
+    int found = 0;
+    for (int i = 0; i < last_output_handler; ++i) {
+        unsigned long values[STATS_COUNTERS_MAX + 1] = {0};
+        if (stats->read(output_handler[i], values) == 0) {
+            for (unsigned k = 0; k <= STATS_COUNTERS_MAX; ++k)
+                sum[k] += values[k];
+            found = 1;
+        }
+    }
+    if (found)
+        add_counter_stats(data, stats, sum);
+}
+
+static int read_syslog_counters(struct data_output *output, unsigned long *values)
+{
+    return data_output_syslog_counters(output, &values[0], &values[1]);
+}
+
+static int read_mqtt_counters(struct data_output *output, unsigned long *values)
+{
+    mqtt_client_counters_t c;
+    if (data_output_mqtt_counters(output, &c) != 0)
+        return -1;
+    values[0] = c.published;
+    values[1] = c.dropped;
+    values[2] = c.writes;
+    values[3] = c.connects;
+    values[4] = c.queued;
+    return 0;
+}
+
+static int read_influx_counters(struct data_output *output, unsigned long *values)
+{
+    return data_output_influx_counters(output, &values[0], &values[1], &values[2]);
+}
+
+static int read_shm_counters(struct data_output *output, unsigned long *values)
+{
+    return data_output_shm_counters(output, &values[0], &values[1]);
+}
+
+static int read_tsdb_counters(struct data_output *output, unsigned long *values)
+{
+    return data_output_tsdb_counters(output, &values[0], &values[1]);
+}
+
+// Records checked and suppressed by the station cache
+static counter_stats_t station_stats = {"stations", {"records", "emitted", "unchanged", "duplicates"}, "cached", NULL, {0}};
+
+// Summed over all outputs of a kind, in the order of the stats record
+static counter_stats_t output_stats[] = {
+        {"syslog", {"messages", "sends"}, NULL, read_syslog_counters, {0}},
+        {"mqtt", {"published", "dropped", "writes", "connects"}, "queued", read_mqtt_counters, {0}},
+        {"influx", {"lines", "sends", "dropped"}, NULL, read_influx_counters, {0}},
+        {"shm", {"records", "dropped"}, NULL, read_shm_counters, {0}},
+        {"tsdb", {"rows", "dropped"}, NULL, read_tsdb_counters, {0}},
+};
+
+/* Emit a stats record for the interval ending now through all outputs */
+static void emit_pipeline_stats(struct dm_state *demod) {
+    if (!pipeline_stats || !demod->stats_interval)
+        return;
+    pipeline_levels_t levels = {
+        .noise_level = pulse_detect_noise_level(),
+        .grabber_queue = demod->grabber ? signal_grabber_pending(demod->grabber) : 0,
+    };
+    data_t *data = pipeline_stats_report(pipeline_stats, monotonic_ns(), &demod->counters, &levels);
+    if (data && station_cache) {
+        station_cache_counters_t c;
+        station_cache_counters(station_cache, &c);
+        unsigned long values[] = {c.records, c.emitted, c.unchanged, c.duplicates, c.stations};
+        add_counter_stats(data, &station_stats, values);
+    }
+    for (unsigned i = 0; data && i < sizeof(output_stats) / sizeof(*output_stats); ++i)
+        add_output_stats(data, &output_stats[i]);
     for (int i = 0; i < last_output_handler; ++i) {
         data_output_print(output_handler[i], data);
     }
@@ -359,7 +734,7 @@ static void classify_signal() {
     unsigned int delta, count_min, count_max, min_new, max_new, p_limit;
     unsigned int a[3], b[2], a_cnt[3], a_new[3], b_new[2];
     unsigned int signal_distance_data[4000] = {0};
-    struct protocol_state p = {0};
+    bitbuffer_t bits = {0};
     unsigned int signal_type;
 
     if (!signal_pulse_data[0][0])
@@ -524,45 +899,45 @@ static void classify_signal() {
     fprintf(stderr, "\nShort distance: %d, long distance: %d, packet distance: %d\n", a[0], a[1], a[2]);
     fprintf(stderr, "\np_limit: %d\n", p_limit);
 
-    bitbuffer_clear(&p.bits);
+    bitbuffer_clear(&bits);
     if (signal_type == 1) {
         for (i = 0; i < 1000; i++) {
             if (signal_distance_data[i] > 0) {
                 if (signal_distance_data[i] < (a[0] + a[1]) / 2) {
                     //                     fprintf(stderr, "0 [%d] %d < %d\n",i, signal_distance_data[i], (a[0]+a[1])/2);
-                    bitbuffer_add_bit(&p.bits, 0);
+                    bitbuffer_add_bit(&bits, 0);
                 } else if ((signal_distance_data[i] > (a[0] + a[1]) / 2) && (signal_distance_data[i] < (a[1] + a[2]) / 2)) {
                     //                     fprintf(stderr, "0 [%d] %d > %d\n",i, signal_distance_data[i], (a[0]+a[1])/2);
-                    bitbuffer_add_bit(&p.bits, 1);
+                    bitbuffer_add_bit(&bits, 1);
                 } else if (signal_distance_data[i] > (a[1] + a[2]) / 2) {
                     //                     fprintf(stderr, "0 [%d] %d > %d\n",i, signal_distance_data[i], (a[1]+a[2])/2);
-                    bitbuffer_add_row(&p.bits);
+                    bitbuffer_add_row(&bits);
                 }
 
             }
 
         }
-        bitbuffer_print(&p.bits);
+        bitbuffer_print(&bits);
     }
     if (signal_type == 2) {
         for (i = 0; i < 1000; i++) {
             if (signal_pulse_data[i][2] > 0) {
                 if (signal_pulse_data[i][2] < p_limit) {
                     //                     fprintf(stderr, "0 [%d] %d < %d\n",i, signal_pulse_data[i][2], p_limit);
-                    bitbuffer_add_bit(&p.bits, 0);
+                    bitbuffer_add_bit(&bits, 0);
                 } else {
                     //                     fprintf(stderr, "1 [%d] %d > %d\n",i, signal_pulse_data[i][2], p_limit);
-                    bitbuffer_add_bit(&p.bits, 1);
+                    bitbuffer_add_bit(&bits, 1);
                 }
                 if ((signal_distance_data[i] >= (a[1] + a[2]) / 2)) {
                     //                     fprintf(stderr, "\\n [%d] %d > %d\n",i, signal_distance_data[i], (a[1]+a[2])/2);
-                    bitbuffer_add_row(&p.bits);
+                    bitbuffer_add_row(&bits);
                 }
 
 
             }
         }
-        bitbuffer_print(&p.bits);
+        bitbuffer_print(&bits);
     }
 
     for (i = 0; i < 1000; i++) {
@@ -574,6 +949,15 @@ static void classify_signal() {
 
 }
 
+/* frequency the current samples were received on */
+static uint32_t current_frequency(struct dm_state *demod) {
+    if (demod->hop.num_channels > 1)
+        return hop_scheduler_frequency(&demod->hop);
+    if (center_frequency)
+        return center_frequency; // e.g. as recorded in a replayed .iqz file
+    return frequency[0];
+}
+
 static void pwm_analyze(struct dm_state *demod, int16_t *buf, uint32_t len) {
     unsigned int i;
     int32_t threshold = (demod->level_limit ? demod->level_limit : 8000);  // Does not support auto level. Use old default instead.
@@ -621,56 +1005,8 @@ static void pwm_analyze(struct dm_state *demod, int16_t *buf, uint32_t len) {
                 classify_signal();
 
                 signal_pulse_counter = 0;
-                if (demod->sg_buf) {
-                    int start_pos, signal_bszie, wlen, wrest = 0, sg_idx, idx;
-                    char sgf_name[256] = {0};
-                    FILE *sgfp;
-
-            while (1) {
-            sprintf(sgf_name, "g%03d_%gM_%gk.cu8", demod->signal_grabber, frequency[0]/1000000.0, samp_rate/1000.0);
-            demod->signal_grabber++;
-            if (access(sgf_name, F_OK) == -1 || overwrite_mode) {
-                break;
-            }
-            }
-
-                    signal_bszie = 2 * (signal_end - (signal_start - 10000));
-                    signal_bszie = (131072 - (signal_bszie % 131072)) + signal_bszie;
-                    sg_idx = demod->sg_index - demod->sg_len;
-                    if (sg_idx < 0)
-                        sg_idx = SIGNAL_GRABBER_BUFFER - demod->sg_len;
-                    idx = (i - 40000)*2;
-                    start_pos = sg_idx + idx - signal_bszie;
-                    fprintf(stderr, "signal_bszie = %d  -      sg_index = %d\n", signal_bszie, demod->sg_index);
-                    fprintf(stderr, "start_pos    = %d  -   buffer_size = %d\n", start_pos, SIGNAL_GRABBER_BUFFER);
-                    if (signal_bszie > SIGNAL_GRABBER_BUFFER)
-                        fprintf(stderr, "Signal bigger then buffer, signal = %d > buffer %d !!\n", signal_bszie, SIGNAL_GRABBER_BUFFER);
-
-                    if (start_pos < 0) {
-                        start_pos = SIGNAL_GRABBER_BUFFER + start_pos;
-                        fprintf(stderr, "restart_pos = %d\n", start_pos);
-                    }
-
-                    fprintf(stderr, "*** Saving signal to file %s\n", sgf_name);
-                    sgfp = fopen(sgf_name, "wb");
-                    if (!sgfp) {
-                        fprintf(stderr, "Failed to open %s\n", sgf_name);
-                    }
-                    wlen = signal_bszie;
-                    if (start_pos + signal_bszie > SIGNAL_GRABBER_BUFFER) {
-                        wlen = SIGNAL_GRABBER_BUFFER - start_pos;
-                        wrest = signal_bszie - wlen;
-                    }
-                    fprintf(stderr, "*** Writing data from %d, len %d\n", start_pos, wlen);
-                    fwrite(&demod->sg_buf[start_pos], 1, wlen, sgfp);
-
-                    if (wrest) {
-                        fprintf(stderr, "*** Writing data from %d, len %d\n", 0, wrest);
-                        fwrite(&demod->sg_buf[0], 1, wrest, sgfp);
-                    }
-
-                    fclose(sgfp);
-                }
+                if (demod->grabber)
+                    signal_grabber_trigger(demod->grabber, signal_start, signal_end, current_frequency(demod));
                 signal_start = 0;
             }
         }
@@ -685,13 +1021,372 @@ err:
 }
 
 
+typedef int (*pulse_demod_t)(const pulse_data_t *pulses, struct protocol_state *device);
+
+static pulse_demod_t ook_demodulator(unsigned modulation) {
+    switch (modulation) {
+        case OOK_PULSE_PCM_RZ:
+            return pulse_demod_pcm;
+        case OOK_PULSE_PPM_RAW:
+            return pulse_demod_ppm;
+        case OOK_PULSE_PWM_PRECISE:
+            return pulse_demod_pwm_precise;
+        case OOK_PULSE_PWM_RAW:
+            return pulse_demod_pwm;
+        case OOK_PULSE_MANCHESTER_ZEROBIT:
+            return pulse_demod_manchester_zerobit;
+        case OOK_PULSE_PIWM_RAW:
+            return pulse_demod_piwm_raw;
+        case OOK_PULSE_PIWM_DC:
+            return pulse_demod_piwm_dc;
+        case OOK_PULSE_DMC:
+            return pulse_demod_dmc;
+        case OOK_PULSE_PWM_OSV1:
+            return pulse_demod_osv1;
+        // FSK decoders
+        case FSK_PULSE_PCM:
+        case FSK_PULSE_PWM_RAW:
+            return NULL;
+        case FSK_PULSE_MANCHESTER_ZEROBIT:
+            return pulse_demod_manchester_zerobit;
+        default:
+            fprintf(stderr, "Unknown modulation %d in protocol!\n", modulation);
+            return NULL;
+    }
+}
+
+static pulse_demod_t fsk_demodulator(unsigned modulation) {
+    switch (modulation) {
+        // OOK decoders
+        case OOK_PULSE_PCM_RZ:
+        case OOK_PULSE_PPM_RAW:
+        case OOK_PULSE_PWM_PRECISE:
+        case OOK_PULSE_PWM_RAW:
+        case OOK_PULSE_MANCHESTER_ZEROBIT:
+        case OOK_PULSE_DMC:
+        case OOK_PULSE_PWM_OSV1:
+            return NULL;
+        case FSK_PULSE_PCM:
+            return pulse_demod_pcm;
+        case FSK_PULSE_PWM_RAW:
+            return pulse_demod_pwm;
+        case FSK_PULSE_MANCHESTER_ZEROBIT:
+            return pulse_demod_manchester_zerobit;
+        default:
+            fprintf(stderr, "Unknown modulation %d in protocol!\n", modulation);
+            return NULL;
+    }
+}
+
+static int run_demod(pulse_demod_t demod, pulse_data_t *pulses, struct protocol_state *p) {
+    if (!demod)
+        return 0;
+    if (!p->stats)
+        return demod(pulses, p);
+
+    uint64_t start = monotonic_ns();
+    int events = demod(pulses, p);
+    p->stats->demod_ns += monotonic_ns() - start;
+    p->stats->demod_calls++;
+    return events;
+}
+
+static int demod_ook_package(pulse_data_t *pulses, struct protocol_state *p) {
+    return run_demod(ook_demodulator(p->modulation), pulses, p);
+}
+
+static int demod_fsk_package(pulse_data_t *pulses, struct protocol_state *p) {
+    return run_demod(fsk_demodulator(p->modulation), pulses, p);
+}
+
+static volatile sig_atomic_t profile_requested = 0;
+
+#ifndef _WIN32
+static void sigusr1_callback(int signum) {
+    profile_requested = 1;
+}
+#endif
+
+static void add_protocol_stats(data_t **decoders, unsigned *num, struct protocol_table *table) {
+    for (unsigned i = 0; table && table->stats && i < table->num; i++) {
+        struct protocol_stats *st = &table->stats[i];
+        // demod time includes the callbacks, report it exclusive
+        uint64_t demod_ns = st->demod_ns > st->callback_ns ? st->demod_ns - st->callback_ns : 0;
+        decoders[(*num)++] = data_make(
+                "name",         "", DATA_STRING, table->protocols[i].name,
+                "demod_calls",  "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)st->demod_calls,
+                "demod_ms",     "", DATA_DOUBLE, demod_ns / 1e6,
+                "callbacks",    "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)st->callbacks,
+                "callback_ms",  "", DATA_DOUBLE, st->callback_ns / 1e6,
+                "rows",         "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)st->rows,
+                "events",       "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)st->events,
+                "rejected",     "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)(st->callbacks - st->events),
+                NULL);
+    }
+}
+
+/* Print the decoder profile as one JSON line */
+static void print_protocol_stats(struct dm_state *demod, struct protocol_table *cfg) {
+    char time_str[LOCAL_TIME_BUFLEN];
+    unsigned num = 0;
+
+    if (!demod->profile_file)
+        return;
+    unsigned size = demod->protocols->num + (cfg ? cfg->num : 0);
+    if (!size)
+        return;
+    data_t **decoders = calloc(size, sizeof(data_t *));
+    if (!decoders)
+        return;
+    add_protocol_stats(decoders, &num, demod->protocols);
+    add_protocol_stats(decoders, &num, cfg);
+    if (!num) {
+        free(decoders);
+        return;
+    }
+
+    data_t *data = data_make(
+            "time",         "", DATA_STRING, local_time_str(0, time_str),
+            "ook_packages", "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)demod->counters.ook_packages,
+            "fsk_packages", "", DATA_FORMAT, "%.0f", DATA_DOUBLE, (double)demod->counters.fsk_packages,
+            "decoders",     "", DATA_ARRAY, data_array(num, DATA_DATA, decoders),
+            NULL);
+    struct data_output *output = data_output_json_create(demod->profile_file);
+    data_output_print(output, data);
+    data_output_free(output);
+    data_free(data);
+    free(decoders);
+    fflush(demod->profile_file);
+}
+
+// Prometheus label values escape backslash, double quote and newline
+static void write_label_value(FILE *out, char const *str) {
+    for (; *str; ++str) {
+        if (*str == '\\' || *str == '"')
+            fprintf(out, "\\%c", *str);
+        else if (*str == '\n')
+            fputs("\\n", out);
+        else
+            fputc(*str, out);
+    }
+}
+
+enum decoder_metric { DECODER_DEMOD_CALLS, DECODER_CALLBACKS, DECODER_EVENTS, DECODER_SECONDS, DECODER_METRICS };
+
+static char const *const decoder_metric_names[DECODER_METRICS] = {"demod_calls", "callbacks", "events", "seconds"};
+static char const *const decoder_metric_help[DECODER_METRICS] = {
+        "Demodulator runs of each decoder.",
+        "Decoder callbacks with demodulated rows.",
+        "Records output by each decoder.",
+        "Time spent in each decoder, including callbacks.",
+};
+
+static void write_decoder_family(FILE *out, enum decoder_metric metric, struct protocol_table *table) {
+    for (unsigned i = 0; table && table->stats && i < table->num; i++) {
+        struct protocol_stats *st = &table->stats[i];
+        if (!st->demod_calls)
+            continue;
+        fprintf(out, "rtl_433_decoder_%s_total{decoder=\"", decoder_metric_names[metric]);
+        write_label_value(out, table->protocols[i].name);
+        if (metric == DECODER_SECONDS)
+            fprintf(out, "\"} %.6f\n", st->demod_ns / 1e9);
+        else
+            fprintf(out, "\"} %lu\n", (unsigned long)(metric == DECODER_DEMOD_CALLS ? st->demod_calls
+                    : metric == DECODER_CALLBACKS ? st->callbacks : st->events));
+    }
+}
+
+// Records dropped by outputs that queue or batch, summed per kind of output
+static void write_output_drops(FILE *out) {
+    unsigned long mqtt = 0, influx = 0, shm = 0, tsdb = 0;
+    int found = 0;
+    for (int i = 0; i < last_output_handler; ++i) {
+        mqtt_client_counters_t c;
+        unsigned long a, b, d;
+        if (data_output_mqtt_counters(output_handler[i], &c) == 0)
+            mqtt += c.dropped, found |= 1;
+        else if (data_output_influx_counters(output_handler[i], &a, &b, &d) == 0)
+            influx += d, found |= 2;
+        else if (data_output_shm_counters(output_handler[i], &a, &d) == 0)
+            shm += d, found |= 4;
+        else if (data_output_tsdb_counters(output_handler[i], &a, &d) == 0)
+            tsdb += d, found |= 8;
+    }
+    if (!found)
+        return;
+    fprintf(out, "# HELP rtl_433_output_dropped_total Records dropped by the outputs.\n"
+            "# TYPE rtl_433_output_dropped_total counter\n");
+    if (found & 1)
+        fprintf(out, "rtl_433_output_dropped_total{output=\"mqtt\"} %lu\n", mqtt);
+    if (found & 2)
+        fprintf(out, "rtl_433_output_dropped_total{output=\"influx\"} %lu\n", influx);
+    if (found & 4)
+        fprintf(out, "rtl_433_output_dropped_total{output=\"shm\"} %lu\n", shm);
+    if (found & 8)
+        fprintf(out, "rtl_433_output_dropped_total{output=\"tsdb\"} %lu\n", tsdb);
+}
+
+/* Publish /metrics as last rendered with the current HTTP counters, with http_mutex held */
+static void publish_metrics(void) {
+    char *buf = NULL;
+    size_t len = 0;
+
+    FILE *out = open_memstream(&buf, &len);
+    if (!out)
+        return;
+    if (http_metrics)
+        fwrite(http_metrics, 1, http_metrics_len, out);
+    fprintf(out, "# HELP rtl_433_http_requests_total HTTP requests answered.\n"
+            "# TYPE rtl_433_http_requests_total counter\n"
+            "rtl_433_http_requests_total %lu\n", http_server_requests(http_server));
+    fclose(out);
+    if (buf)
+        http_server_publish(http_server, "/metrics", "text/plain; version=0.0.4", buf, len);
+    free(buf);
+    http_published = monotonic_ns();
+}
+
+/* Render /metrics and /latest and hand them to the HTTP server, at most every HTTP_PUBLISH_MS unless forced */
+static void publish_http(struct dm_state *demod, struct protocol_table *cfg, int force) {
+    char *buf = NULL;
+    size_t len = 0;
+
+    uint64_t now = monotonic_ns();
+    if (!http_server || (!force && now - http_rendered < (uint64_t)HTTP_PUBLISH_MS * 1000000))
+        return;
+    http_rendered = now;
+
+    FILE *out = open_memstream(&buf, &len);
+    if (!out)
+        return;
+    pipeline_levels_t levels = {
+        .noise_level = pulse_detect_noise_level(),
+        .grabber_queue = demod->grabber ? signal_grabber_pending(demod->grabber) : 0,
+    };
+    if (pipeline_stats)
+        pipeline_stats_write_prometheus(pipeline_stats, out, &demod->counters, &levels);
+    for (int m = 0; m < DECODER_METRICS; ++m) {
+        fprintf(out, "# HELP rtl_433_decoder_%s_total %s\n"
+                "# TYPE rtl_433_decoder_%s_total counter\n",
+                decoder_metric_names[m], decoder_metric_help[m], decoder_metric_names[m]);
+        write_decoder_family(out, m, demod->protocols);
+        write_decoder_family(out, m, cfg);
+    }
+    write_output_drops(out);
+    if (station_cache) {
+        station_cache_counters_t c;
+        station_cache_counters(station_cache, &c);
+        fprintf(out, "# HELP rtl_433_station_records_total Records checked by the station cache, by outcome.\n"
+                "# TYPE rtl_433_station_records_total counter\n"
+                "rtl_433_station_records_total{result=\"emitted\"} %lu\n"
+                "rtl_433_station_records_total{result=\"unchanged\"} %lu\n"
+                "rtl_433_station_records_total{result=\"duplicate\"} %lu\n"
+                "# HELP rtl_433_stations Stations in the station cache.\n"
+                "# TYPE rtl_433_stations gauge\n"
+                "rtl_433_stations %u\n",
+                c.emitted, c.unchanged, c.duplicates, c.stations);
+    }
+    fclose(out);
+
+    pthread_mutex_lock(&http_mutex);
+    free(http_metrics);
+    http_metrics = buf;
+    http_metrics_len = len;
+    publish_metrics();
+    char const *doc;
+    size_t doc_len;
+    if (data_output_latest_render(latest_output, &doc, &doc_len) == 1)
+        http_server_publish(http_server, "/latest", "application/json", doc, doc_len);
+    pthread_mutex_unlock(&http_mutex);
+}
+
+/* Republish /metrics while the sample thread does not, e.g. when the input stalls,
+ * so the document and the HTTP counters in it stay current */
+static void *http_refresh(void *arg) {
+    pthread_mutex_lock(&http_mutex);
+    while (!http_refresh_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)HTTP_PUBLISH_MS * 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&http_cond, &http_mutex, &deadline);
+        if (!http_refresh_stop && monotonic_ns() - http_published >= (uint64_t)HTTP_PUBLISH_MS * 1000000)
+            publish_metrics();
+    }
+    pthread_mutex_unlock(&http_mutex);
+    return NULL;
+}
+
+/* Stop the refresh thread, then the server */
+static void stop_http(void) {
+    if (!http_server)
+        return;
+    pthread_mutex_lock(&http_mutex);
+    http_refresh_stop = 1;
+    pthread_cond_signal(&http_cond);
+    pthread_mutex_unlock(&http_mutex);
+    pthread_join(http_refresh_thread, NULL);
+    http_server_free(http_server);
+    http_server = NULL;
+    free(http_metrics);
+    http_metrics = NULL;
+}
+
+
+static pthread_mutex_t reload_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reload_cond = PTHREAD_COND_INITIALIZER;
+
+/* Called between packages: switch to a newly loaded decoder table, the old
+ * one is no longer referenced once this returns and is left for reclaim */
+static struct protocol_table *current_protocol_table(struct dm_state *demod) {
+    if (!demod->config_file)
+        return NULL;
+    pthread_mutex_lock(&reload_mutex);
+    if (demod->cfg_pending && !demod->cfg_retired) {
+        demod->cfg_retired = demod->cfg_table;
+        demod->cfg_table = demod->cfg_pending;
+        demod->cfg_pending = NULL;
+        if (demod->cfg_table->fsk)
+            demod->enable_FM_demod = 1;
+        pthread_cond_signal(&reload_cond);
+    }
+    pthread_mutex_unlock(&reload_mutex);
+    return demod->cfg_table;
+}
+
+/* Map the stream offset of the current block end to its arrival time */
+static void stamp_block(struct dm_state *demod, uint64_t arrival_ns) {
+    demod->block_end = demod->counters.samples;
+    demod->block_ns = arrival_ns;
+    if (sample_file_pos != -1.0)
+        demod->block_time = demod->in_offset + (double)demod->block_end / samp_rate;
+    else
+        demod->block_time = wall_time();
+}
+
+/* Capture time of a package from its stream offset, the samples before the
+ * block end were received (block_end - offset) / samp_rate earlier. A file is
+ * not read in real time, there the block counts as captured when it was read */
+static void stamp_package(struct dm_state *demod, pulse_data_t *pulses) {
+    uint64_t behind = demod->block_end > pulses->offset ? demod->block_end - pulses->offset : 0;
+    uint64_t behind_ns = sample_file_pos == -1.0 ? behind * 1000000000 / samp_rate : 0;
+    pulses->capture_ns = demod->block_ns > behind_ns ? demod->block_ns - behind_ns : 0;
+    pulses->capture_time = demod->block_time - (double)behind / samp_rate;
+}
+
 static void rtlsdr_callback(unsigned char *iq_buf, uint32_t len, void *ctx) {
     struct dm_state *demod = ctx;
     int i;
+    int p_events = 0;  // Sensor events successfully detected per package
     char time_str[LOCAL_TIME_BUFLEN];
 
     if (do_exit || do_exit_async)
         return;
+    uint64_t arrival_ns = monotonic_ns();
+
+    // packages are demodulated within a single call, switch decoders here
+    struct protocol_table *cfg = current_protocol_table(demod);
 
     if ((bytes_to_read > 0) && (bytes_to_read <= len)) {
         len = bytes_to_read;
@@ -703,22 +1398,49 @@ static void rtlsdr_callback(unsigned char *iq_buf, uint32_t len, void *ctx) {
     alarm(3); // require callback to run every 3 second, abort otherwise
 #endif
 
-    if (demod->signal_grabber) {
-        //fprintf(stderr, "[%d] sg_index - len %d\n", demod->sg_index, len );
-        memcpy(&demod->sg_buf[demod->sg_index], iq_buf, len);
-        demod->sg_len = len;
-        demod->sg_index += len;
-        if (demod->sg_index + len > SIGNAL_GRABBER_BUFFER)
-            demod->sg_index = 0;
+    if (demod->hop.num_channels > 1) {
+        pthread_mutex_lock(&hop_mutex);
+        unsigned discard = hop_scheduler_settle(&demod->hop, len / 2);
+        pthread_mutex_unlock(&hop_mutex);
+        if (discard * 2 >= len) {
+            demod->counters.dropped_samples += len / 2;
+            if (bytes_to_read > 0)
+                bytes_to_read -= len;
+            return;
+        }
+        demod->counters.dropped_samples += discard;
+        iq_buf += discard * 2;
+        if (demod->iq16_buf)
+            demod->iq16_buf += discard * 2;
+        len -= discard * 2;
+        if (bytes_to_read > 0)
+            bytes_to_read -= discard * 2;
     }
 
+    demod->counters.blocks++;
+    demod->counters.samples += len / 2;
+    stamp_block(demod, arrival_ns);
+
+    if (demod->grabber)
+        signal_grabber_write(demod->grabber, iq_buf, len);
+
     // AM demodulation
-    envelope_detect(iq_buf, demod->buf.temp, len/2);
+    uint64_t start = stage_start();
+    if (demod->iq16_buf)
+        envelope_detect_cs16(demod->iq16_buf, demod->buf.temp, len/2);
+    else
+        envelope_detect(iq_buf, demod->buf.temp, len/2);
     baseband_low_pass_filter(demod->buf.temp, demod->am_buf, len/2, &demod->lowpass_filter_state);
+    stage_end(STAGE_BASEBAND, start);
 
     // FM demodulation
     if (demod->enable_FM_demod) {
-        baseband_demod_FM(iq_buf, demod->buf.fm, len/2, &demod->demod_FM_state);
+        start = stage_start();
+        if (demod->iq16_buf)
+            baseband_demod_FM_cs16(demod->iq16_buf, demod->buf.fm, len/2, &demod->demod_FM_state);
+        else
+            baseband_demod_FM(iq_buf, demod->buf.fm, len/2, &demod->demod_FM_state);
+        stage_end(STAGE_FM, start);
     }
 
     // Handle special input formats
@@ -735,85 +1457,48 @@ static void rtlsdr_callback(unsigned char *iq_buf, uint32_t len, void *ctx) {
     } else {
         // Detect a package and loop through demodulators with pulse data
         int package_type = 1;  // Just to get us started
-        int p_events = 0;  // Sensor events successfully detected per package
         while(package_type) {
+            start = stage_start();
             package_type = pulse_detect_package(demod->am_buf, demod->buf.fm, len/2, demod->level_limit, samp_rate, &demod->pulse_data, &demod->fsk_pulse_data);
+            stage_end(STAGE_PULSE_DETECT, start);
             if (package_type == 1) {
                 if(demod->analyze_pulses) fprintf(stderr, "Detected OOK package\t@ %s\n", local_time_str(0, time_str));
-                for (i = 0; i < demod->r_dev_num; i++) {
-                    switch (demod->r_devs[i]->modulation) {
-                        case OOK_PULSE_PCM_RZ:
-                            p_events += pulse_demod_pcm(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        case OOK_PULSE_PPM_RAW:
-                            p_events += pulse_demod_ppm(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        case OOK_PULSE_PWM_PRECISE:
-                            p_events += pulse_demod_pwm_precise(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        case OOK_PULSE_PWM_RAW:
-                            p_events += pulse_demod_pwm(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        case OOK_PULSE_MANCHESTER_ZEROBIT:
-                            p_events += pulse_demod_manchester_zerobit(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        case OOK_PULSE_PIWM_RAW:
-                            p_events += pulse_demod_piwm_raw(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        case OOK_PULSE_PIWM_DC:
-                            p_events += pulse_demod_piwm_dc(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        case OOK_PULSE_DMC:
-                            p_events += pulse_demod_dmc(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        case OOK_PULSE_PWM_OSV1:
-                            p_events += pulse_demod_osv1(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        // FSK decoders
-                        case FSK_PULSE_PCM:
-                        case FSK_PULSE_PWM_RAW:
-                            break;
-                        case FSK_PULSE_MANCHESTER_ZEROBIT:
-                            p_events += pulse_demod_manchester_zerobit(&demod->pulse_data, demod->r_devs[i]);
-                            break;
-                        default:
-                            fprintf(stderr, "Unknown modulation %d in protocol!\n", demod->r_devs[i]->modulation);
-                    }
-                } // for demodulators
+                demod->counters.ook_packages++;
+                stamp_package(demod, &demod->pulse_data);
+                current_package = &demod->pulse_data;
+                start = stage_start();
+                for (i = 0; i < (int)demod->protocols->num; i++)
+                    p_events += demod_ook_package(&demod->pulse_data, &demod->protocols->protocols[i]);
+                for (i = 0; cfg && i < (int)cfg->num; i++)
+                    p_events += demod_ook_package(&demod->pulse_data, &cfg->protocols[i]);
+                stage_end(STAGE_DEMOD, start);
+                current_package = NULL;
                 if(debug_output > 1) pulse_data_print(&demod->pulse_data);
                 if(demod->analyze_pulses && (include_only == 0 || (include_only == 1 && p_events == 0) || (include_only == 2 && p_events > 0)) ) {
                     pulse_analyzer(&demod->pulse_data, samp_rate);
                 }
+                if(demod->grabber && (include_only == 0 || (include_only == 1 && p_events == 0) || (include_only == 2 && p_events > 0)) ) {
+                    signal_grabber_trigger(demod->grabber, demod->pulse_data.offset, demod->pulse_data.end_offset, current_frequency(demod));
+                }
             } else if (package_type == 2) {
                 if(demod->analyze_pulses) fprintf(stderr, "Detected FSK package\t@ %s\n", local_time_str(0, time_str));
-                for (i = 0; i < demod->r_dev_num; i++) {
-                    switch (demod->r_devs[i]->modulation) {
-                        // OOK decoders
-                        case OOK_PULSE_PCM_RZ:
-                        case OOK_PULSE_PPM_RAW:
-                        case OOK_PULSE_PWM_PRECISE:
-                        case OOK_PULSE_PWM_RAW:
-                        case OOK_PULSE_MANCHESTER_ZEROBIT:
-                        case OOK_PULSE_DMC:
-                        case OOK_PULSE_PWM_OSV1:
-                            break;
-                        case FSK_PULSE_PCM:
-                            p_events += pulse_demod_pcm(&demod->fsk_pulse_data, demod->r_devs[i]);
-                            break;
-                        case FSK_PULSE_PWM_RAW:
-                            p_events += pulse_demod_pwm(&demod->fsk_pulse_data, demod->r_devs[i]);
-                            break;
-                        case FSK_PULSE_MANCHESTER_ZEROBIT:
-                            p_events += pulse_demod_manchester_zerobit(&demod->fsk_pulse_data, demod->r_devs[i]);
-                            break;
-                        default:
-                            fprintf(stderr, "Unknown modulation %d in protocol!\n", demod->r_devs[i]->modulation);
-                    }
-                } // for demodulators
+                demod->counters.fsk_packages++;
+                stamp_package(demod, &demod->fsk_pulse_data);
+                current_package = &demod->fsk_pulse_data;
+                start = stage_start();
+                for (i = 0; i < (int)demod->protocols->num; i++)
+                    p_events += demod_fsk_package(&demod->fsk_pulse_data, &demod->protocols->protocols[i]);
+                for (i = 0; cfg && i < (int)cfg->num; i++)
+                    p_events += demod_fsk_package(&demod->fsk_pulse_data, &cfg->protocols[i]);
+                stage_end(STAGE_DEMOD, start);
+                current_package = NULL;
                 if(debug_output > 1) pulse_data_print(&demod->fsk_pulse_data);
                 if(demod->analyze_pulses && (include_only == 0 || (include_only == 1 && p_events == 0) || (include_only == 2 && p_events > 0)) ) {
                     pulse_analyzer(&demod->fsk_pulse_data, samp_rate);
                 }
+                if(demod->grabber && (include_only == 0 || (include_only == 1 && p_events == 0) || (include_only == 2 && p_events > 0)) ) {
+                    signal_grabber_trigger(demod->grabber, demod->fsk_pulse_data.offset, demod->fsk_pulse_data.end_offset, current_frequency(demod));
+                }
             } // if (package_type == ...
         } // while(package_type)...
 
@@ -830,7 +1515,14 @@ static void rtlsdr_callback(unsigned char *iq_buf, uint32_t len, void *ctx) {
         } else if (demod->debug_mode == 2) {  // FM data
             out_buf = (uint8_t*)demod->buf.fm;
         }
-        if (fwrite(out_buf, 1, len, demod->out_file) != len) {
+        if (demod->out_iqz) {
+            if (demod->hop.num_channels > 1)
+                iqz_writer_set_frequency(demod->out_iqz, hop_scheduler_frequency(&demod->hop));
+            if (iqz_write(demod->out_iqz, out_buf, len) < 0) {
+                fprintf(stderr, "Short write, samples lost, exiting!\n");
+                rtlsdr_cancel_async(dev);
+            }
+        } else if (fwrite(out_buf, 1, len, demod->out_file) != len) {
             fprintf(stderr, "Short write, samples lost, exiting!\n");
             rtlsdr_cancel_async(dev);
         }
@@ -839,16 +1531,30 @@ static void rtlsdr_callback(unsigned char *iq_buf, uint32_t len, void *ctx) {
     if (bytes_to_read > 0)
         bytes_to_read -= len;
 
+    if (profile_requested) {
+        profile_requested = 0;
+        print_protocol_stats(demod, cfg);
+    }
+
+    if (pipeline_stats && pipeline_stats_due(pipeline_stats, monotonic_ns())) {
+        if (demod->stats_interval)
+            emit_pipeline_stats(demod);
+        else // only for the HTTP metrics, their quantiles still cover an interval
+            pipeline_stats_rotate(pipeline_stats, monotonic_ns(), &demod->counters);
+    }
+
+    if (http_server)
+        publish_http(demod, cfg, 0);
+
+    if (demod->hop.num_channels > 1) {
+        pthread_mutex_lock(&hop_mutex);
+        if (hop_scheduler_update(&demod->hop, len / 2, p_events))
+            pthread_cond_signal(&hop_cond);
+        pthread_mutex_unlock(&hop_mutex);
+    }
+
     time_t rawtime;
     time(&rawtime);
-	if (frequencies > 1 && difftime(rawtime, rawtime_old) > demod->hop_time) {
-	  rawtime_old = rawtime;
-	  do_exit_async = 1;
-#ifndef _WIN32
-	  alarm(0); // cancel the watchdog timer
-#endif
-	  rtlsdr_cancel_async(dev);
-	}
     if (duration > 0 && rawtime >= stop_time) {
         do_exit_async = do_exit = 1;
 #ifndef _WIN32
@@ -967,6 +1673,11 @@ void add_csv_output(char *param, r_device *devices, int num_devices, r_device *
     free(output_fields);
 }
 
+void add_cbor_output(char *param)
+{
+    output_handler[last_output_handler++] = data_output_cbor_create(fopen_output(param));
+}
+
 void add_kv_output(char *param)
 {
     output_handler[last_output_handler++] = data_output_kv_create(fopen_output(param));
@@ -982,7 +1693,401 @@ void add_syslog_output(char *param)
     output_handler[last_output_handler++] = data_output_syslog_create(host, port);
 }
 
+// e.g. "mqtt://localhost", "mqtt://user:pass@[::1]:1883/sensors/[model][/id],qos=1,retain=1"
+void add_mqtt_output(char *param)
+{
+    mqtt_client_opts_t opts = {
+            .host       = "localhost",
+            .port       = MQTT_DEFAULT_PORT,
+            .keep_alive = MQTT_DEFAULT_KEEP_ALIVE,
+            .backlog    = MQTT_DEFAULT_BACKLOG,
+    };
+    char *topic = "rtl_433[/model][/id]";
+    char *key, *val;
+
+    if (strncmp(param, "mqtt://", 7) == 0)
+        param += 7;
+    else if (strncmp(param, "mqtt:", 5) == 0)
+        param += 5;
+    else
+        param += 4;
+
+    char *kwargs = strchr(param, ',');
+    if (kwargs)
+        *kwargs++ = '\0';
+    char *path = strchr(param, '/');
+    if (path) {
+        *path++ = '\0';
+        if (*path)
+            topic = path;
+    }
+    char *at = strrchr(param, '@');
+    if (at) {
+        *at = '\0';
+        opts.user = param;
+        char *colon = strchr(param, ':');
+        if (colon) {
+            *colon = '\0';
+            opts.pass = colon + 1;
+        }
+        param = at + 1;
+    }
+    hostport_param(param, (char **)&opts.host, (char **)&opts.port);
+
+    while (getkwargs(&kwargs, &key, &val)) {
+        if (!strcasecmp(key, "qos")) {
+            opts.qos = val ? atoi(val) : 1;
+            if (opts.qos < 0 || opts.qos > 1) {
+                fprintf(stderr, "-F mqtt: qos must be 0 or 1\n");
+                exit(1);
+            }
+        } else if (!strcasecmp(key, "retain")) {
+            opts.retain = val ? atoi(val) : 1;
+        } else if (!strcasecmp(key, "keepalive")) {
+            opts.keep_alive = val ? atoi(val) : MQTT_DEFAULT_KEEP_ALIVE;
+        } else if (!strcasecmp(key, "backlog")) {
+            int backlog = val ? atoi(val) : MQTT_DEFAULT_BACKLOG;
+            opts.backlog = backlog > 0 ? backlog : 1;
+        } else if (!strcasecmp(key, "client_id")) {
+            opts.client_id = val;
+        } else {
+            fprintf(stderr, "Unknown MQTT option \"%s\"\n", key);
+            exit(1);
+        }
+    }
+    fprintf(stderr, "Publishing MQTT to %s port %s, topic %s\n", opts.host, opts.port, topic);
+
+    struct data_output *output = data_output_mqtt_create(&opts, topic);
+    if (!output) {
+        fprintf(stderr, "rtl_433: failed to create MQTT output\n");
+        exit(1);
+    }
+    output_handler[last_output_handler++] = output;
+}
+
+// e.g. "influx://localhost:8086/write?db=rtl_433", "influx+udp://localhost:8089,flush_ms=100"
+void add_influx_output(char *param)
+{
+    influx_opts_t opts = {
+            .host       = "localhost",
+            .flush_ms   = INFLUX_DEFAULT_FLUSH_MS,
+    };
+    char path_buf[1024];
+    char *key, *val;
+    int udp = strncmp(param, "influx+udp", 10) == 0;
+
+    param = strchr(param, ':');
+    param = param ? param + 1 : "";
+    if (strncmp(param, "//", 2) == 0)
+        param += 2;
+    char *kwargs = strchr(param, ',');
+    if (kwargs)
+        *kwargs++ = '\0';
+    char *path = strchr(param, '/');
+    if (path) {
+        if (udp) {
+            fprintf(stderr, "-F influx+udp: the database is set by the UDP listener, not a path\n");
+            exit(1);
+        }
+        snprintf(path_buf, sizeof(path_buf), "%s", path); // the host ends where the path starts
+        opts.path = path_buf;
+        *path = '\0';
+    }
+    hostport_param(param, (char **)&opts.host, (char **)&opts.port);
+    if (!opts.port)
+        opts.port = udp ? "8089" : "8086";
+    if (!udp && !opts.path)
+        opts.path = "/write?db=rtl_433";
+
+    while (getkwargs(&kwargs, &key, &val)) {
+        if (!strcasecmp(key, "flush_size")) {
+            opts.flush_size = val ? atoi(val) : 0;
+        } else if (!strcasecmp(key, "flush_ms")) {
+            opts.flush_ms = val ? atoi(val) : INFLUX_DEFAULT_FLUSH_MS;
+        } else if (!strcasecmp(key, "token")) {
+            opts.token = val;
+        } else if (!strcasecmp(key, "measurement")) {
+            opts.measurement = val;
+        } else {
+            fprintf(stderr, "Unknown InfluxDB option \"%s\"\n", key);
+            exit(1);
+        }
+    }
+    if (udp)
+        fprintf(stderr, "InfluxDB line protocol UDP datagrams to %s port %s\n", opts.host, opts.port);
+    else
+        fprintf(stderr, "InfluxDB line protocol HTTP POST to %s port %s %s\n", opts.host, opts.port, opts.path);
+
+    struct data_output *output = data_output_influx_create(&opts);
+    if (!output) {
+        fprintf(stderr, "rtl_433: failed to create InfluxDB output\n");
+        exit(1);
+    }
+    output_handler[last_output_handler++] = output;
+}
+
+// e.g. "shm", "shm:/rtl_433,size=4194304"
+void add_shm_output(char *param)
+{
+    char *name = SHM_RING_DEFAULT_NAME;
+    size_t size = SHM_RING_DEFAULT_SIZE;
+    char *key, *val;
+
+    char *kwargs = strchr(param, ',');
+    if (kwargs)
+        *kwargs++ = '\0';
+    param = arg_param(param);
+    if (param && *param)
+        name = param;
+
+    while (getkwargs(&kwargs, &key, &val)) {
+        if (!strcasecmp(key, "size")) {
+            size = val ? strtoul(val, NULL, 0) : SHM_RING_DEFAULT_SIZE;
+        } else {
+            fprintf(stderr, "Unknown shared memory option \"%s\"\n", key);
+            exit(1);
+        }
+    }
+    fprintf(stderr, "JSON records to shared memory %s\n", name);
+
+    struct data_output *output = data_output_shm_create(name, size);
+    if (!output) {
+        fprintf(stderr, "rtl_433: failed to create shared memory output\n");
+        exit(1);
+    }
+    output_handler[last_output_handler++] = output;
+}
+
+// e.g. "tsdb", "tsdb:/var/lib/rtl_433"
+void add_tsdb_output(char *param)
+{
+    char *dir = TSDB_DEFAULT_DIR;
+
+    param = arg_param(param);
+    if (param && *param)
+        dir = param;
+    fprintf(stderr, "Time series to %s\n", dir);
+
+    struct data_output *output = data_output_tsdb_create(dir);
+    if (!output) {
+        fprintf(stderr, "rtl_433: failed to create time series output\n");
+        exit(1);
+    }
+    output_handler[last_output_handler++] = output;
+}
+
+void parse_tuning_opts(struct dm_state *demod, char *opts)
+{
+    char *key, *val;
+    while (getkwargs(&opts, &key, &val)) {
+        if (!strcasecmp(key, "hop_events"))
+            demod->hop_events = val ? atoi(val) : DEFAULT_HOP_EVENTS;
+        else if (!strcasecmp(key, "hop_settle"))
+            demod->hop_settle_ms = val ? atoi(val) : DEFAULT_HOP_SETTLE_MS;
+        else if (!strcasecmp(key, "capture_buffers"))
+            demod->capture_buffers = val ? atoi(val) : DEFAULT_CAPTURE_BUFFERS;
+        else if (!strcasecmp(key, "capture_direct"))
+            demod->capture_direct = val ? atoi(val) : 1;
+        else if (!strcasecmp(key, "read_offset"))
+            demod->in_offset = val ? atof(val) : 0.0;
+        else if (!strcasecmp(key, "read_threads"))
+            demod->read_threads = val ? atoi(val) : IQZ_DEFAULT_THREADS;
+        else if (!strcasecmp(key, "native_cs16"))
+            demod->native_cs16 = val ? atoi(val) : 1;
+        else if (!strcasecmp(key, "grab_pre"))
+            demod->grab_pre_ms = val ? atoi(val) : DEFAULT_GRAB_PRE_MS;
+        else if (!strcasecmp(key, "grab_post"))
+            demod->grab_post_ms = val ? atoi(val) : DEFAULT_GRAB_POST_MS;
+        else if (!strcasecmp(key, "syslog_latency")) {
+            char *end = NULL;
+            long ms = val ? strtol(val, &end, 10) : DEFAULT_SYSLOG_LATENCY_MS;
+            if ((end && (end == val || *end)) || ms < 0 || ms > 60000) {
+                fprintf(stderr, "-Y syslog_latency: latency must be 0 to 60000 ms\n");
+                exit(1);
+            }
+            demod->syslog_latency_ms = (unsigned)ms;
+        }
+        else if (!strcasecmp(key, "emit")) {
+            if (!val || !strcasecmp(val, "full"))
+                demod->emit_mode = STATION_EMIT_FULL;
+            else if (!strcasecmp(val, "change"))
+                demod->emit_mode = STATION_EMIT_CHANGE;
+            else if (!strcasecmp(val, "heartbeat"))
+                demod->emit_mode = STATION_EMIT_HEARTBEAT;
+            else {
+                fprintf(stderr, "Invalid emit mode %s, use full, change or heartbeat\n", val);
+                exit(1);
+            }
+        }
+        else if (!strcasecmp(key, "heartbeat")) {
+            demod->emit_mode = STATION_EMIT_HEARTBEAT;
+            demod->heartbeat = val ? atof(val) : STATION_CACHE_HEARTBEAT_S;
+            if (demod->heartbeat <= 0) {
+                fprintf(stderr, "-Y heartbeat: interval must be a positive number of seconds\n");
+                exit(1);
+            }
+        }
+        else if (!strcasecmp(key, "dedup"))
+            demod->dedup_window = (val ? atoi(val) : DEFAULT_DEDUP_MS) / 1000.0;
+        else if (!strcasecmp(key, "derived_weather"))
+            demod->derived_weather = val ? atoi(val) : 1;
+        else {
+            fprintf(stderr, "Invalid tuning option %s\n", key);
+            exit(1);
+        }
+    }
+}
+
+/* retunes on request of the sample callback while the async reader keeps running */
+static void *hop_controller(void *arg)
+{
+    struct dm_state *demod = arg;
+    uint32_t freq;
+    int r;
+
+    pthread_mutex_lock(&hop_mutex);
+    while (!hop_stop) {
+        if (!hop_scheduler_pending(&demod->hop)) {
+            pthread_cond_wait(&hop_cond, &hop_mutex);
+            continue;
+        }
+        freq = hop_scheduler_retune(&demod->hop);
+        pthread_mutex_unlock(&hop_mutex);
+
+        r = rtlsdr_set_center_freq(dev, freq);
+        if (r < 0)
+            fprintf(stderr, "WARNING: Failed to set center freq.\n");
+        else if (!quiet_mode)
+            fprintf(stderr, "Tuned to %u Hz.\n", rtlsdr_get_center_freq(dev));
+
+        pthread_mutex_lock(&hop_mutex);
+        center_frequency = freq;
+        hop_scheduler_retuned(&demod->hop);
+    }
+    pthread_mutex_unlock(&hop_mutex);
+    return NULL;
+}
+
 r_device *flex_create_device(char *spec); // maybe put this in some header file?
+r_device *flex_parse_device(char *spec);
+void flex_free_device(r_device *dev);
+
+static void free_config_table(struct protocol_table *table)
+{
+    if (!table)
+        return;
+    for (unsigned i = 0; i < table->num; i++)
+        flex_free_device(table->devices[i]);
+    protocol_table_free(table);
+}
+
+/* reads one general purpose decoder spec per line, returns NULL if any spec is bad */
+static struct protocol_table *load_protocol_table(char const *path, int profile)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open config file %s\n", path);
+        return NULL;
+    }
+    struct protocol_table *table = calloc(1, sizeof(struct protocol_table));
+    char line[1024];
+    unsigned line_num = 0;
+    while (table && fgets(line, sizeof(line), file)) {
+        line_num++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *spec = line + strspn(line, " \t");
+        if (!*spec || *spec == '#')
+            continue;
+        r_device *flex_device = flex_parse_device(spec);
+        if (!flex_device) {
+            fprintf(stderr, "%s:%u: failed to add decoder\n", path, line_num);
+            free_config_table(table);
+            table = NULL;
+            break;
+        }
+        protocol_table_add(table, flex_device);
+    }
+    fclose(file);
+    if (table && profile)
+        protocol_table_enable_stats(table);
+    return table;
+}
+
+void parse_metrics_opts(struct dm_state *demod, char *opts)
+{
+    char *key, *val;
+    while (getkwargs(&opts, &key, &val)) {
+        if (!strcasecmp(key, "profile")) {
+            demod->profile_file = val && *val ? fopen_output(val) : stderr;
+        } else if (!strcasecmp(key, "stats")) {
+            int interval = val ? atoi_time(val, "-M stats: ") : DEFAULT_STATS_INTERVAL;
+            if (interval < 1) {
+                fprintf(stderr, "-M stats: interval must be a positive number of seconds\n");
+                exit(1);
+            }
+            demod->stats_interval = interval;
+        } else if (!strcasecmp(key, "http")) {
+            demod->http_host = "127.0.0.1";
+            demod->http_port = DEFAULT_HTTP_PORT;
+            if (val && strchr(val, ':'))
+                hostport_param(val, &demod->http_host, &demod->http_port);
+            else if (val && *val)
+                demod->http_port = val;
+        } else if (!strcasecmp(key, "latency")) {
+            latency_fields = 1;
+        } else {
+            fprintf(stderr, "Unknown metrics option \"%s\"\n", key);
+            exit(1);
+        }
+    }
+}
+
+#ifndef _WIN32
+static int reload_stop = 0;
+
+/* reloads the config file on SIGHUP (blocked in all other threads), the sample
+ * callback picks up the new table between packages, the table it retired is
+ * freed here as soon as it is swapped, so only a reload holds two tables */
+static void *reload_controller(void *arg)
+{
+    struct dm_state *demod = arg;
+    sigset_t set;
+    int sig, stop;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    do {
+        sigwait(&set, &sig);
+
+        pthread_mutex_lock(&reload_mutex);
+        stop = reload_stop;
+        pthread_mutex_unlock(&reload_mutex);
+        if (stop)
+            break;
+
+        struct protocol_table *table = load_protocol_table(demod->config_file, demod->decoder_stats);
+        if (!table) {
+            fprintf(stderr, "Reloading %s failed, keeping the current decoders\n", demod->config_file);
+            continue;
+        }
+        pthread_mutex_lock(&reload_mutex);
+        demod->cfg_pending = table;
+        while (demod->cfg_pending && !reload_stop)
+            pthread_cond_wait(&reload_cond, &reload_mutex);
+        stop = reload_stop;
+        struct protocol_table *unused = demod->cfg_pending; // not picked up before stopping
+        demod->cfg_pending = NULL;
+        struct protocol_table *retired = demod->cfg_retired;
+        demod->cfg_retired = NULL;
+        pthread_mutex_unlock(&reload_mutex);
+        free_config_table(unused);
+        free_config_table(retired);
+        if (!quiet_mode && !unused)
+            fprintf(stderr, "Reloaded %u decoders from %s\n", table->num, demod->config_file);
+    } while (!stop);
+    return NULL;
+}
+#endif
 
 int main(int argc, char **argv) {
 #ifndef _WIN32
@@ -1001,7 +2106,6 @@ int main(int argc, char **argv) {
     int ppm_error = 0;
     struct dm_state* demod;
     int dev_index = 0;
-    int frequency_current = 0;
     uint32_t out_block_size = DEFAULT_BUF_LENGTH;
     uint16_t device_count;
     char vendor[256], product[256], serial[256];
@@ -1012,8 +2116,18 @@ int main(int argc, char **argv) {
     setbuf(stdout, NULL);
     setbuf(stderr, NULL);
 
+#ifndef _WIN32
+    // before any thread is started (outputs start theirs while the options are parsed):
+    // all threads inherit the mask, with -c only the reload thread takes SIGHUP
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hup, NULL);
+#endif
+
     demod = malloc(sizeof (struct dm_state));
     memset(demod, 0, sizeof (struct dm_state));
+    demod->protocols = calloc(1, sizeof(struct protocol_table));
 
     /* initialize tables */
     baseband_init();
@@ -1027,9 +2141,15 @@ int main(int argc, char **argv) {
     num_r_devices = sizeof(devices)/sizeof(*devices);
 
     demod->level_limit = DEFAULT_LEVEL_LIMIT;
-    demod->hop_time = DEFAULT_HOP_TIME;
-
-    while ((opt = getopt(argc, argv, "x:z:p:DtaAI:qm:r:l:d:f:H:g:s:b:n:SR:X:F:C:T:UWGy:E")) != -1) {
+    demod->hop_events = DEFAULT_HOP_EVENTS;
+    demod->hop_settle_ms = DEFAULT_HOP_SETTLE_MS;
+    demod->capture_buffers = DEFAULT_CAPTURE_BUFFERS;
+    demod->read_threads = IQZ_DEFAULT_THREADS;
+    demod->grab_pre_ms = DEFAULT_GRAB_PRE_MS;
+    demod->grab_post_ms = DEFAULT_GRAB_POST_MS;
+    demod->heartbeat = STATION_CACHE_HEARTBEAT_S;
+
+    while ((opt = getopt(argc, argv, "x:z:p:DtaAI:qm:r:l:d:f:H:g:s:b:n:SR:X:c:F:C:T:UWGy:EY:M:")) != -1) {
         switch (opt) {
             case 'd':
                 dev_query = optarg;
@@ -1039,7 +2159,8 @@ int main(int argc, char **argv) {
                 else fprintf(stderr, "Max number of frequencies reached %d\n", MAX_PROTOCOLS);
                 break;
             case 'H':
-                demod->hop_time = atoi_time(optarg, "-H: ");
+                if (demod->hop_times < MAX_PROTOCOLS) demod->hop_time[demod->hop_times++] = atoi_time(optarg, "-H: ");
+                else fprintf(stderr, "Max number of hop times reached %d\n", MAX_PROTOCOLS);
                 break;
             case 'g':
                 gain = (int) (atof(optarg) * 10); /* tenths of a dB */
@@ -1114,11 +2235,16 @@ int main(int argc, char **argv) {
                 break;
             case 'X':
                 flex_device = flex_create_device(optarg);
+                if (!flex_device)
+                    exit(1);
                 register_protocol(demod, flex_device);
                 if (flex_device->modulation >= FSK_DEMOD_MIN_VAL) {
                     demod->enable_FM_demod = 1;
                 }
                 break;
+            case 'c':
+                demod->config_file = optarg;
+                break;
             case 'q':
                 quiet_mode = 1;
                 break;
@@ -1129,8 +2255,18 @@ int main(int argc, char **argv) {
                     add_csv_output(arg_param(optarg), devices, num_r_devices, flex_device);
                 } else if (strncmp(optarg, "kv", 2) == 0) {
                     add_kv_output(arg_param(optarg));
+                } else if (strncmp(optarg, "cbor", 4) == 0) {
+                    add_cbor_output(arg_param(optarg));
                 } else if (strncmp(optarg, "syslog", 6) == 0) {
                     add_syslog_output(arg_param(optarg));
+                } else if (strncmp(optarg, "mqtt", 4) == 0) {
+                    add_mqtt_output(optarg);
+                } else if (strncmp(optarg, "influx", 6) == 0) {
+                    add_influx_output(optarg);
+                } else if (strncmp(optarg, "shm", 3) == 0) {
+                    add_shm_output(optarg);
+                } else if (strncmp(optarg, "tsdb", 4) == 0) {
+                    add_tsdb_output(optarg);
                 } else {
                     fprintf(stderr, "Invalid output format %s\n", optarg);
                     usage(devices);
@@ -1173,6 +2309,12 @@ int main(int argc, char **argv) {
             case 'E':
                 stop_after_successful_events_flag = 1;
                 break;
+            case 'Y':
+                parse_tuning_opts(demod, optarg);
+                break;
+            case 'M':
+                parse_metrics_opts(demod, optarg);
+                break;
             default:
                 usage(devices);
                 break;
@@ -1189,6 +2331,50 @@ int main(int argc, char **argv) {
         add_kv_output(NULL);
     }
 
+    // -Y may come after -F, batching is set up once all options are known
+    for (int n = 0; n < last_output_handler; ++n) {
+        data_output_syslog_set_latency(output_handler[n], demod->syslog_latency_ms);
+    }
+
+    if (demod->derived_weather) {
+        weather_metrics = weather_metrics_create(WEATHER_METRICS_MAX_STATIONS);
+        if (!weather_metrics) {
+            fprintf(stderr, "Failed to allocate the weather metrics\n");
+            exit(1);
+        }
+    }
+
+    if (demod->emit_mode != STATION_EMIT_FULL || demod->dedup_window > 0) {
+        station_cache = station_cache_create(demod->emit_mode, demod->heartbeat, demod->dedup_window, STATION_CACHE_MAX_STATIONS);
+        if (!station_cache) {
+            fprintf(stderr, "Failed to allocate the station cache\n");
+            exit(1);
+        }
+    }
+
+    if (demod->http_port) {
+        latest_output = data_output_latest_create(HTTP_LATEST_MAX);
+        http_server = http_server_start(demod->http_host, demod->http_port);
+        if (!latest_output || !http_server || pthread_create(&http_refresh_thread, NULL, http_refresh, NULL)) {
+            fprintf(stderr, "rtl_433: failed to start the HTTP server\n");
+            exit(1);
+        }
+        output_handler[last_output_handler++] = latest_output;
+        if (!quiet_mode)
+            fprintf(stderr, "Serving /metrics and /latest on %s port %s\n", demod->http_host, demod->http_port);
+    }
+    demod->decoder_stats = demod->profile_file || http_server;
+
+    // the HTTP metrics need the stage timings, reported through the outputs only with -M stats
+    if (demod->stats_interval || http_server) {
+        pipeline_stats = pipeline_stats_create(demod->stats_interval ? demod->stats_interval : DEFAULT_STATS_INTERVAL, last_output_handler);
+        if (!pipeline_stats) {
+            fprintf(stderr, "Failed to allocate pipeline stats\n");
+            exit(1);
+        }
+        pulse_demod_time_callbacks(&pipeline_stats->stage[STAGE_CALLBACK]);
+    }
+
     for (i = 0; i < num_r_devices; i++) {
         if (!devices[i].disabled || register_all) {
             register_protocol(demod, &devices[i]);
@@ -1200,7 +2386,32 @@ int main(int argc, char **argv) {
 
     if (!quiet_mode)
     fprintf(stderr,"Registered %d out of %d device decoding protocols\n",
-        demod->r_dev_num, num_r_devices);
+        demod->protocols->num, num_r_devices);
+
+    if (demod->decoder_stats)
+        protocol_table_enable_stats(demod->protocols);
+
+#ifndef _WIN32
+    pthread_t reload_thread;
+#endif
+    if (demod->config_file) {
+        demod->cfg_table = load_protocol_table(demod->config_file, demod->decoder_stats);
+        if (!demod->cfg_table)
+            exit(1);
+        if (demod->cfg_table->fsk)
+            demod->enable_FM_demod = 1;
+        if (!quiet_mode)
+            fprintf(stderr, "Loaded %u decoders from %s\n", demod->cfg_table->num, demod->config_file);
+#ifndef _WIN32
+        pthread_create(&reload_thread, NULL, reload_controller, demod);
+#endif
+    }
+#ifndef _WIN32
+    else {
+        // nothing to reload, SIGHUP ends rtl_433 as before (it is delivered to this thread)
+        pthread_sigmask(SIG_UNBLOCK, &hup, NULL);
+    }
+#endif
 
     if (out_block_size < MINIMAL_BUF_LENGTH ||
             out_block_size > MAXIMAL_BUF_LENGTH) {
@@ -1215,14 +2426,29 @@ int main(int argc, char **argv) {
 
     if (test_data) {
         r = 0;
-        for (i = 0; i < demod->r_dev_num; i++) {
+        for (i = 0; i < demod->protocols->num; i++) {
             if (!quiet_mode)
-                fprintf(stderr, "Verifying test data with device %s.\n", demod->r_devs[i]->name);
-            r += pulse_demod_string(test_data, demod->r_devs[i]);
+                fprintf(stderr, "Verifying test data with device %s.\n", demod->protocols->protocols[i].name);
+            r += pulse_demod_string(test_data, &demod->protocols->protocols[i]);
+        }
+        for (i = 0; demod->cfg_table && i < demod->cfg_table->num; i++) {
+            if (!quiet_mode)
+                fprintf(stderr, "Verifying test data with device %s.\n", demod->cfg_table->protocols[i].name);
+            r += pulse_demod_string(test_data, &demod->cfg_table->protocols[i]);
         }
         exit(!r);
     }
 
+#ifndef _WIN32
+    if (demod->profile_file) {
+        struct sigaction usr1 = {0};
+        usr1.sa_handler = sigusr1_callback;
+        sigemptyset(&usr1.sa_mask);
+        usr1.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &usr1, NULL);
+    }
+#endif
+
     if (!in_filename) {
     device_count = rtlsdr_get_device_count();
     if (!device_count) {
@@ -1339,17 +2565,41 @@ int main(int argc, char **argv) {
                 fprintf(stderr, "Failed to open %s\n", out_filename);
                 goto out;
             }
+            if (iqz_filename(out_filename)) {
+                if (demod->debug_mode == 1 || demod->debug_mode == 2) {
+                    fprintf(stderr, "Compressed output files hold I/Q samples only, use -m 0\n");
+                    exit(1);
+                }
+                iqz_meta_t meta = {
+                    .frequency = frequencies ? frequency[0] : DEFAULT_FREQUENCY,
+                    .sample_rate = samp_rate,
+                    .gain = gain,
+                    .timestamp = (uint64_t)time(NULL) * 1000000,
+                };
+                demod->out_iqz = iqz_writer_open(demod->out_file, &meta);
+                if (!demod->out_iqz) {
+                    fprintf(stderr, "Failed to setup compressed output\n");
+                    exit(1);
+                }
+            }
         }
     }
 
-    if (demod->signal_grabber)
-        demod->sg_buf = malloc(SIGNAL_GRABBER_BUFFER);
+    if (demod->signal_grabber) {
+        demod->grabber = signal_grabber_create(SIGNAL_GRABBER_BUFFER, samp_rate,
+                demod->grab_pre_ms, demod->grab_post_ms, overwrite_mode);
+        if (!demod->grabber) {
+            fprintf(stderr, "Failed to setup signal grabber\n");
+            exit(1);
+        }
+    }
 
     if (in_filename) {
         int i = 0;
         unsigned char *test_mode_buf = malloc(DEFAULT_BUF_LENGTH * sizeof(unsigned char));
-        float *test_mode_float_buf = malloc(DEFAULT_BUF_LENGTH * sizeof(float));
-        if (!test_mode_buf || !test_mode_float_buf)
+        void *test_mode_in_buf = malloc(DEFAULT_BUF_LENGTH * sizeof(float)); // fits all input formats
+        int16_t *test_mode_cs16_buf = malloc(DEFAULT_BUF_LENGTH * sizeof(int16_t));
+        if (!test_mode_buf || !test_mode_in_buf || !test_mode_cs16_buf)
         {
             fprintf(stderr, "Couldn't allocate read buffers!\n");
             exit(1);
@@ -1365,43 +2615,113 @@ int main(int argc, char **argv) {
             }
         }
         fprintf(stderr, "Test mode active. Reading samples from file: %s\n", in_filename);  // Essential information (not quiet)
-        if (!quiet_mode) {
-            fprintf(stderr, "Input format: %s\n", (demod->debug_mode == 3) ? "cf32" : "uint8");
+
+        iqz_reader_t *in_iqz = NULL;
+        if (iqz_filename(in_filename)) {
+            in_iqz = iqz_reader_open(in_file, demod->read_threads);
+            if (!in_iqz) {
+                fprintf(stderr, "Not a valid compressed I/Q file: %s\n", in_filename);
+                goto out;
+            }
+            iqz_meta_t const *meta = iqz_reader_meta(in_iqz);
+            if (!quiet_mode) {
+                time_t start = (time_t)(meta->timestamp / 1000000);
+                fprintf(stderr, "Input format: iqz, %s at %u Hz sample rate, gain %.1f dB, recorded %s",
+                        nice_freq(meta->frequency), meta->sample_rate, meta->gain / 10.0, ctime(&start));
+            }
+            if (meta->sample_rate != samp_rate)
+                fprintf(stderr, "WARNING: File was recorded at %u Hz sample rate, use -s %u\n", meta->sample_rate, meta->sample_rate);
+        }
+
+        sample_format_t in_format = demod->debug_mode == 3 ? SAMPLE_CF32 : sample_format_from_filename(in_filename);
+        // Only wider formats gain anything from the 16 bit path
+        int native_cs16 = !in_iqz && demod->native_cs16 && (in_format == SAMPLE_CS16 || in_format == SAMPLE_CF32);
+        if (!in_iqz && !quiet_mode) {
+            fprintf(stderr, "Input format: %s%s\n", sample_format_name(in_format), native_cs16 ? " (16 bit processing)" : "");
         }
+
         sample_file_pos = 0.0;
+        if (demod->in_offset > 0) {
+            uint64_t sample = (uint64_t)(demod->in_offset * samp_rate);
+            int seek_failed;
+            if (in_iqz)
+                seek_failed = iqz_seek(in_iqz, sample) < 0;
+            else
+                seek_failed = fseeko(in_file, (off_t)(sample * 2 * sample_format_size(in_format)), SEEK_SET) != 0;
+            if (seek_failed) {
+                fprintf(stderr, "Failed to seek to %.3f seconds in %s\n", demod->in_offset, in_filename);
+                goto out;
+            }
+            sample_file_pos = demod->in_offset;
+        }
 
-        int n_read, cf32_tmp;
+        int n_read;
+        uint64_t n_samples = 0;
+        uint64_t read_start = monotonic_ns();
         do {
-            if (demod->debug_mode == 3) {
-                n_read = fread(test_mode_float_buf, sizeof(float), DEFAULT_BUF_LENGTH, in_file);
-                for(int n = 0; n < n_read; n++) {
-                    cf32_tmp = test_mode_float_buf[n]*127 + 127;
-                    if (cf32_tmp < 0)
-                        cf32_tmp = 0;
-                    else if (cf32_tmp > 255)
-                        cf32_tmp = 255;
-                    test_mode_buf[n] = (uint8_t)cf32_tmp;
+            if (in_iqz) {
+                n_read = iqz_read(in_iqz, test_mode_buf, DEFAULT_BUF_LENGTH);
+                // the frequency of each block, hopping captures change it
+                uint32_t freq = iqz_reader_frequency(in_iqz);
+                if (freq && freq != center_frequency) {
+                    center_frequency = freq;
+                    if (!quiet_mode)
+                        fprintf(stderr, "Recorded at %u Hz.\n", freq);
                 }
-            } else {
+            } else if (in_format == SAMPLE_CU8) {
                 n_read = fread(test_mode_buf, 1, DEFAULT_BUF_LENGTH, in_file);
+            } else {
+                n_read = fread(test_mode_in_buf, sample_format_size(in_format), DEFAULT_BUF_LENGTH, in_file);
+                sample_convert_cu8(in_format, test_mode_in_buf, test_mode_buf, n_read);
+                if (native_cs16) {
+                    sample_convert_cs16(in_format, test_mode_in_buf, test_mode_cs16_buf, n_read);
+                    demod->iq16_buf = test_mode_cs16_buf;
+                }
             }
             if (n_read == 0) break;  // rtlsdr_callback() will Segmentation Fault with len=0
             rtlsdr_callback(test_mode_buf, n_read, demod);
             i++;
-            sample_file_pos = (float)i * n_read / samp_rate / 2;
+            n_samples += n_read / 2;
+            sample_file_pos = demod->in_offset + (float)i * n_read / samp_rate / 2;
         } while (n_read != 0);
+        double read_secs = (monotonic_ns() - read_start) / 1e9;
+
+        if (in_iqz) {
+            if (iqz_reader_error(in_iqz))
+                fprintf(stderr, "WARNING: Corrupt block in %s, stopped reading\n", in_filename);
+            iqz_reader_close(in_iqz);
+        }
 
         // Call a last time with cleared samples to ensure EOP detection
         memset(test_mode_buf, 128, DEFAULT_BUF_LENGTH);  // 128 is 0 in unsigned data
+        demod->iq16_buf = NULL;
         rtlsdr_callback(test_mode_buf, DEFAULT_BUF_LENGTH, demod);
 
         //Always classify a signal at the end of the file
         classify_signal();
         if (!quiet_mode) {
             fprintf(stderr, "Test mode file issued %d packets\n", i);
+            fprintf(stderr, "Processed %llu samples in %.3f s (%.2f MS/s)\n", (unsigned long long)n_samples,
+                    read_secs, read_secs > 0 ? n_samples / read_secs / 1e6 : 0.0);
         }
+        print_protocol_stats(demod, demod->cfg_table);
+        emit_pipeline_stats(demod);
         free(test_mode_buf);
-        free(test_mode_float_buf);
+        free(test_mode_in_buf);
+        free(test_mode_cs16_buf);
+        if (demod->grabber)
+            signal_grabber_free(demod->grabber, quiet_mode ? NULL : stderr);
+        if (demod->out_iqz && iqz_writer_close(demod->out_iqz, quiet_mode ? NULL : stderr) < 0)
+            fprintf(stderr, "Short write, samples lost, exiting!\n");
+        if (demod->out_file && (demod->out_file != stdout))
+            fclose(demod->out_file);
+        stop_http();
+        station_cache_free(station_cache);
+        weather_metrics_free(weather_metrics);
+        // flushes batched outputs
+        for (int n = 0; n < last_output_handler; ++n) {
+            data_output_free(output_handler[n]);
+        }
         exit(0);
     }
 
@@ -1415,9 +2735,19 @@ int main(int argc, char **argv) {
             fprintf(stderr, "Specify an output file for sync mode.\n");
             exit(0);
         }
+        if (demod->out_iqz) {
+            fprintf(stderr, "Compressed output files are not supported in sync mode.\n");
+            exit(1);
+        }
 
         fprintf(stderr, "Reading samples in sync mode...\n");
-        uint8_t *buffer = malloc(out_block_size * sizeof (uint8_t));
+        // stdout may be a pipe, never try direct I/O on it
+        capture_writer_t *writer = capture_writer_create(fileno(demod->out_file), out_block_size,
+                demod->capture_buffers, demod->capture_direct && demod->out_file != stdout);
+        if (!writer) {
+            fprintf(stderr, "Failed to setup capture writer.\n");
+            exit(1);
+        }
 
         if (duration > 0) {
             time(&stop_time);
@@ -1425,6 +2755,7 @@ int main(int argc, char **argv) {
         }
         time_t timestamp;
         while (!do_exit) {
+            uint8_t *buffer = capture_writer_buffer(writer);
             r = rtlsdr_read_sync(dev, buffer, out_block_size, &n_read);
             if (r < 0) {
                 fprintf(stderr, "WARNING: sync read failed.\n");
@@ -1436,10 +2767,9 @@ int main(int argc, char **argv) {
                 do_exit = 1;
             }
 
-            if (fwrite(buffer, 1, n_read, demod->out_file) != (size_t) n_read) {
-                fprintf(stderr, "Short write, samples lost, exiting!\n");
-                break;
-            }
+            capture_writer_commit(writer, n_read);
+            if (capture_writer_failed(writer))
+                break; // reported when closing the writer
 
             if ((uint32_t) n_read < out_block_size) {
                 fprintf(stderr, "Short read, samples lost, exiting!\n");
@@ -1458,14 +2788,23 @@ int main(int argc, char **argv) {
                 bytes_to_read -= n_read;
         }
 
-        free(buffer);
+        if (capture_writer_close(writer, quiet_mode ? NULL : stderr) < 0)
+            fprintf(stderr, "Short write, samples lost, exiting!\n");
     } else {
+        pthread_t hop_thread;
         if (frequencies == 0) {
             frequency[0] = DEFAULT_FREQUENCY;
             frequencies = 1;
-        } else {
-            time(&rawtime_old);
         }
+        if (demod->hop_times == 0) {
+            demod->hop_time[0] = DEFAULT_HOP_TIME;
+            demod->hop_times = 1;
+        }
+        hop_scheduler_init(&demod->hop, frequency, demod->hop_time, demod->hop_times, frequencies,
+                samp_rate, HOP_ASYNC_BUF_NUMBER, demod->hop_settle_ms, demod->hop_events);
+        // short blocks while hopping, the queued ones are discarded after each retune
+        if (frequencies > 1 && out_block_size > hop_scheduler_block_size(samp_rate))
+            out_block_size = hop_scheduler_block_size(samp_rate);
         if (!quiet_mode) {
             fprintf(stderr, "Reading samples in async mode...\n");
         }
@@ -1473,20 +2812,22 @@ int main(int argc, char **argv) {
             time(&stop_time);
             stop_time += duration;
         }
+        /* Set the frequency, hops are retuned by the controller without stopping the async reader */
+        center_frequency = hop_scheduler_frequency(&demod->hop);
+        r = rtlsdr_set_center_freq(dev, center_frequency);
+        if (r < 0)
+            fprintf(stderr, "WARNING: Failed to set center freq.\n");
+        else
+            fprintf(stderr, "Tuned to %u Hz.\n", rtlsdr_get_center_freq(dev));
+        if (frequencies > 1)
+            pthread_create(&hop_thread, NULL, hop_controller, demod);
         while (!do_exit) {
-            /* Set the frequency */
-            center_frequency = frequency[frequency_current];
-            r = rtlsdr_set_center_freq(dev, center_frequency);
-            if (r < 0)
-                fprintf(stderr, "WARNING: Failed to set center freq.\n");
-            else
-                fprintf(stderr, "Tuned to %u Hz.\n", rtlsdr_get_center_freq(dev));
 #ifndef _WIN32
             signal(SIGALRM, sighandler);
             alarm(3); // require callback to run every 3 second, abort otherwise
 #endif
             r = rtlsdr_read_async(dev, rtlsdr_callback, (void *) demod,
-                    DEFAULT_ASYNC_BUF_NUMBER, out_block_size);
+                    frequencies > 1 ? HOP_ASYNC_BUF_NUMBER : DEFAULT_ASYNC_BUF_NUMBER, out_block_size);
             if (r < 0) {
                 fprintf(stderr, "WARNING: async read failed (%i).\n", r);
                 break;
@@ -1495,21 +2836,60 @@ int main(int argc, char **argv) {
             alarm(0); // cancel the watchdog timer
 #endif
             do_exit_async = 0;
-            frequency_current = (frequency_current + 1) % frequencies;
         }
+        if (frequencies > 1) {
+            pthread_mutex_lock(&hop_mutex);
+            hop_stop = 1;
+            pthread_cond_signal(&hop_cond);
+            pthread_mutex_unlock(&hop_mutex);
+            pthread_join(hop_thread, NULL);
+            if (!quiet_mode)
+                hop_scheduler_print_stats(&demod->hop, stderr);
+        }
+        hop_scheduler_free(&demod->hop);
     }
 
     if (!do_exit)
         fprintf(stderr, "\nLibrary error %d, exiting...\n", r);
 
+    if (demod->out_iqz && iqz_writer_close(demod->out_iqz, quiet_mode ? NULL : stderr) < 0)
+        fprintf(stderr, "Short write, samples lost, exiting!\n");
     if (demod->out_file && (demod->out_file != stdout))
         fclose(demod->out_file);
 
-    for (i = 0; i < demod->r_dev_num; i++)
-        free(demod->r_devs[i]);
+    if (demod->config_file) {
+#ifndef _WIN32
+        pthread_mutex_lock(&reload_mutex);
+        reload_stop = 1;
+        pthread_cond_signal(&reload_cond);
+        pthread_mutex_unlock(&reload_mutex);
+        pthread_kill(reload_thread, SIGHUP);
+        pthread_join(reload_thread, NULL);
+#endif
+    }
+
+    print_protocol_stats(demod, demod->cfg_table);
+    emit_pipeline_stats(demod);
+    stop_http();
+    station_cache_free(station_cache);
+    station_cache = NULL;
+    weather_metrics_free(weather_metrics);
+    weather_metrics = NULL;
+    if (pipeline_stats) {
+        pulse_demod_time_callbacks(NULL);
+        pipeline_stats_free(pipeline_stats);
+        pipeline_stats = NULL;
+    }
+    if (demod->profile_file && demod->profile_file != stderr && demod->profile_file != stdout)
+        fclose(demod->profile_file);
+
+    protocol_table_free(demod->protocols);
+    free_config_table(demod->cfg_table);
+    free_config_table(demod->cfg_pending);
+    free_config_table(demod->cfg_retired);
 
-    if (demod->signal_grabber)
-        free(demod->sg_buf);
+    if (demod->grabber)
+        signal_grabber_free(demod->grabber, quiet_mode ? NULL : stderr);
 
     free(demod);
 
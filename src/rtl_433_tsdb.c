@@ -0,0 +1,409 @@
+/*
+ * rtl_433_tsdb, queries the columnar store written with -F tsdb
+ *
+ * Prints the rows of each matching series in a time range as CSV, or
+ * aggregates of each field over fixed intervals:
+ *
+ *     rtl_433 -F tsdb:weather &
+ *     rtl_433_tsdb -d weather -l
+ *     rtl_433_tsdb -d weather -s 'Fine Offset*' -f temperature_C,humidity -b -24h -i 3600 -a mean
+ *
+ * Only the block headers of a segment are read to find the rows in range,
+ * and of those only the columns asked for.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fnmatch.h>
+
+#include "tsdb.h"
+
+typedef enum {
+    AGG_NONE,
+    AGG_MEAN,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_SUM,
+    AGG_COUNT,
+    AGG_LAST,
+} agg_t;
+
+static char const *const agg_names[] = {"", "mean", "min", "max", "sum", "count", "last"};
+
+/// A series with one schema, a series whose fields changed has several
+typedef struct {
+    char series[TSDB_MAX_NAME];
+    uint64_t schema;
+    unsigned num_fields;
+    tsdb_field_desc_t fields[TSDB_MAX_FIELDS];
+    unsigned long rows;
+    int64_t first;
+    int64_t last;
+} series_t;
+
+typedef struct {
+    char const *pattern;        // glob of the series names, NULL for all
+    series_t *series;
+    unsigned num_series;
+    unsigned max_series;
+} list_t;
+
+typedef struct {
+    double sum;
+    double min;
+    double max;
+    double last;
+    unsigned long count;
+} acc_t;
+
+typedef struct {
+    series_t const *series;
+    unsigned num_columns;
+    unsigned columns[TSDB_MAX_FIELDS];  // field index of each output column
+    agg_t agg;
+    int64_t interval_ms;
+    int have_bucket;
+    int64_t bucket;
+    acc_t acc[TSDB_MAX_FIELDS];
+    unsigned long rows;
+} print_t;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "rtl_433_tsdb, queries the store written by rtl_433 -F tsdb\n\n"
+            "Usage:\trtl_433_tsdb [-d <dir>] [-l] [-s <series>] [-f <field>,...] [-b <time>] [-e <time>] [-i <seconds> [-a <agg>]] [-v]\n"
+            "\t-d <dir> The store directory (default: %s)\n"
+            "\t-l List the series with their fields, rows and time range instead of the rows\n"
+            "\t-s <series> Only series matching the glob, e.g. 'Acurite*' (series are model[/channel][/id])\n"
+            "\t-f <field>,... Only these fields, in this order\n"
+            "\t-b <time> Rows at or after, -e <time> rows before (default: all)\n"
+            "\t\t as seconds since the epoch, YYYY-MM-DD[THH:MM[:SS]] in UTC or -<n>s|m|h|d before now\n"
+            "\t-i <seconds> Aggregate the rows of each interval, -a <agg> with mean (default), min, max, sum, count or last\n"
+            "\t-v Print the rows read and the time taken to stderr\n",
+            TSDB_DEFAULT_DIR);
+    exit(1);
+}
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Parse a time argument to ms since the epoch, exits on error
+static int64_t parse_time(char const *arg)
+{
+    char *end;
+    if (*arg == '-') {
+        double n = strtod(arg + 1, &end);
+        double unit = *end == 's' ? 1 : *end == 'm' ? 60 : *end == 'h' ? 3600 : *end == 'd' ? 86400 : 0;
+        if (end == arg + 1 || !unit || end[1]) {
+            fprintf(stderr, "Invalid relative time \"%s\"\n", arg);
+            exit(1);
+        }
+        return now_ms() - (int64_t)(n * unit * 1000);
+    }
+
+    int y, mo, d, h = 0, mi = 0, s = 0;
+    int n = sscanf(arg, "%4d-%2d-%2d%*[T ]%2d:%2d:%2d", &y, &mo, &d, &h, &mi, &s);
+    if (n >= 3 && mo >= 1 && mo <= 12 && d >= 1 && d <= 31)
+        return ((days_from_civil(y, mo, d) * 24 + h) * 60 + mi) * 60000LL + s * 1000LL;
+
+    double sec = strtod(arg, &end);
+    if (end == arg || *end) {
+        fprintf(stderr, "Invalid time \"%s\"\n", arg);
+        exit(1);
+    }
+    return (int64_t)(sec * 1000);
+}
+
+static void print_time(int64_t time_ms)
+{
+    int64_t sec = time_ms / 1000;
+    int ms = (int)(time_ms % 1000);
+    if (ms < 0) {
+        sec -= 1;
+        ms += 1000;
+    }
+    time_t t = (time_t)sec;
+    struct tm tm;
+    char buf[32];
+    gmtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    printf("%s.%03dZ", buf, ms);
+}
+
+static double field_value(tsdb_rows_t const *rows, unsigned field, unsigned row)
+{
+    if (rows->fields[field].type == TSDB_INT)
+        return ((int32_t const *)rows->columns[field])[row];
+    return ((double const *)rows->columns[field])[row];
+}
+
+/* Listing the series */
+
+static int list_rows(tsdb_rows_t const *rows, void *ctx)
+{
+    list_t *list = ctx;
+    if (list->pattern && fnmatch(list->pattern, rows->series, 0))
+        return 0;
+
+    series_t *series = NULL;
+    for (unsigned i = 0; i < list->num_series && !series; ++i) {
+        if (list->series[i].schema == rows->schema && !strcmp(list->series[i].series, rows->series))
+            series = &list->series[i];
+    }
+    if (!series) {
+        if (list->num_series == list->max_series) {
+            unsigned max = list->max_series ? list->max_series * 2 : 64;
+            series_t *grown = realloc(list->series, max * sizeof(series_t));
+            if (!grown) {
+                fprintf(stderr, "realloc() failed");
+                return 1;
+            }
+            list->series = grown;
+            list->max_series = max;
+        }
+        series = &list->series[list->num_series++];
+        memset(series, 0, sizeof(series_t));
+        snprintf(series->series, sizeof(series->series), "%s", rows->series);
+        series->schema = rows->schema;
+        series->num_fields = rows->num_fields;
+        memcpy(series->fields, rows->fields, rows->num_fields * sizeof(tsdb_field_desc_t));
+        series->first = rows->time[0];
+        series->last = rows->time[rows->rows - 1];
+    }
+    series->rows += rows->rows;
+    if (rows->time[0] < series->first)
+        series->first = rows->time[0];
+    if (rows->time[rows->rows - 1] > series->last)
+        series->last = rows->time[rows->rows - 1];
+    return 0;
+}
+
+static int compare_series(void const *a, void const *b)
+{
+    series_t const *sa = a;
+    series_t const *sb = b;
+    int c = strcmp(sa->series, sb->series);
+    return c ? c : sa->first < sb->first ? -1 : sa->first > sb->first;
+}
+
+/* Printing the rows of a series */
+
+static void acc_add(acc_t *acc, double v)
+{
+    if (!acc->count || v < acc->min)
+        acc->min = v;
+    if (!acc->count || v > acc->max)
+        acc->max = v;
+    acc->sum += v;
+    acc->last = v;
+    acc->count++;
+}
+
+static void print_bucket(print_t *p)
+{
+    print_time(p->bucket * p->interval_ms);
+    for (unsigned i = 0; i < p->num_columns; ++i) {
+        acc_t const *acc = &p->acc[i];
+        if (p->agg == AGG_COUNT)
+            printf(",%lu", acc->count);
+        else if (!acc->count)
+            printf(",");
+        else if (p->agg == AGG_MEAN)
+            printf(",%g", acc->sum / acc->count);
+        else
+            printf(",%g", p->agg == AGG_MIN ? acc->min : p->agg == AGG_MAX ? acc->max : p->agg == AGG_SUM ? acc->sum : acc->last);
+    }
+    printf("\n");
+    memset(p->acc, 0, sizeof(p->acc));
+}
+
+static int print_rows(tsdb_rows_t const *rows, void *ctx)
+{
+    print_t *p = ctx;
+    if (rows->schema != p->series->schema || strcmp(rows->series, p->series->series))
+        return 0;
+    p->rows += rows->rows;
+
+    for (unsigned r = 0; r < rows->rows; ++r) {
+        if (p->agg == AGG_NONE) {
+            print_time(rows->time[r]);
+            for (unsigned i = 0; i < p->num_columns; ++i) {
+                unsigned f = p->columns[i];
+                if (rows->fields[f].type == TSDB_INT)
+                    printf(",%d", ((int32_t const *)rows->columns[f])[r]);
+                else
+                    printf(",%g", ((double const *)rows->columns[f])[r]);
+            }
+            printf("\n");
+            continue;
+        }
+        int64_t bucket = rows->time[r] / p->interval_ms;
+        if (rows->time[r] % p->interval_ms < 0)
+            bucket -= 1;
+        if (p->have_bucket && bucket != p->bucket)
+            print_bucket(p);
+        p->bucket = bucket;
+        p->have_bucket = 1;
+        for (unsigned i = 0; i < p->num_columns; ++i)
+            acc_add(&p->acc[i], field_value(rows, p->columns[i], r));
+    }
+    return 0;
+}
+
+// Select the output columns of a series, all fields or those named in the list in its order
+static unsigned select_columns(series_t const *series, char const *fields, unsigned *columns)
+{
+    unsigned num = 0;
+    if (!fields) {
+        for (unsigned i = 0; i < series->num_fields; ++i)
+            columns[num++] = i;
+        return num;
+    }
+    char const *p = fields;
+    while (*p && num < TSDB_MAX_FIELDS) {
+        size_t len = strcspn(p, ",");
+        for (unsigned i = 0; i < series->num_fields; ++i) {
+            if (strlen(series->fields[i].name) == len && !strncmp(series->fields[i].name, p, len)) {
+                columns[num++] = i;
+                break;
+            }
+        }
+        p += len;
+        if (*p)
+            ++p;
+    }
+    return num;
+}
+
+int main(int argc, char **argv)
+{
+    char const *dir = TSDB_DEFAULT_DIR;
+    char const *fields = NULL;
+    int list_only = 0;
+    int verbose = 0;
+    int64_t from_ms = INT64_MIN;
+    int64_t to_ms = INT64_MAX;
+    int64_t interval_ms = 0;
+    agg_t agg = AGG_MEAN;
+    list_t list = {0};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:ls:f:b:e:i:a:vh")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'l':
+            list_only = 1;
+            break;
+        case 's':
+            list.pattern = optarg;
+            break;
+        case 'f':
+            fields = optarg;
+            break;
+        case 'b':
+            from_ms = parse_time(optarg);
+            break;
+        case 'e':
+            to_ms = parse_time(optarg);
+            break;
+        case 'i':
+            interval_ms = (int64_t)(atof(optarg) * 1000);
+            if (interval_ms <= 0) {
+                fprintf(stderr, "Invalid interval \"%s\"\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'a':
+            for (agg = AGG_MEAN; agg <= AGG_LAST && strcmp(optarg, agg_names[agg]); ++agg)
+                ;
+            if (agg > AGG_LAST) {
+                fprintf(stderr, "Invalid aggregate \"%s\"\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind < argc)
+        usage();
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // a first pass over the block headers finds the series, then one per series prints it
+    if (tsdb_query(dir, from_ms, to_ms, list_rows, &list) < 0)
+        exit(1);
+    if (list.num_series)
+        qsort(list.series, list.num_series, sizeof(series_t), compare_series);
+
+    unsigned long total = 0;
+    for (unsigned s = 0; s < list.num_series; ++s) {
+        series_t const *series = &list.series[s];
+        if (list_only) {
+            printf("%s,%lu,", series->series, series->rows);
+            print_time(series->first);
+            printf(",");
+            print_time(series->last);
+            for (unsigned i = 0; i < series->num_fields; ++i)
+                printf(",%s", series->fields[i].name);
+            printf("\n");
+            total += series->rows;
+            continue;
+        }
+
+        print_t p = {0};
+        p.series = series;
+        p.num_columns = select_columns(series, fields, p.columns);
+        p.agg = interval_ms ? agg : AGG_NONE;
+        p.interval_ms = interval_ms;
+        if (!p.num_columns)
+            continue;
+
+        printf("# %s\ntime", series->series);
+        for (unsigned i = 0; i < p.num_columns; ++i)
+            printf(",%s", series->fields[p.columns[i]].name);
+        printf("\n");
+        tsdb_query(dir, from_ms, to_ms, print_rows, &p);
+        if (p.have_bucket)
+            print_bucket(&p);
+        total += p.rows;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if (verbose)
+        fprintf(stderr, "%u series, %lu rows in %.1f ms\n", list.num_series, total,
+                (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6);
+    free(list.series);
+    return 0;
+}
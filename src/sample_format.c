@@ -0,0 +1,135 @@
+/**
+ * I/Q sample formats
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "sample_format.h"
+#include <string.h>
+#include <strings.h>
+
+sample_format_t sample_format_from_filename(char const *filename)
+{
+    char const *ext = strrchr(filename, '.');
+    if (!ext)
+        return SAMPLE_CU8;
+    ext++;
+
+    if (!strcasecmp(ext, "cs8"))
+        return SAMPLE_CS8;
+    if (!strcasecmp(ext, "cs16") || !strcasecmp(ext, "complex16s"))
+        return SAMPLE_CS16;
+    if (!strcasecmp(ext, "cf32") || !strcasecmp(ext, "cfile"))
+        return SAMPLE_CF32;
+    return SAMPLE_CU8; // .cu8, .complex16u, .data, .raw, ...
+}
+
+char const *sample_format_name(sample_format_t format)
+{
+    switch (format) {
+    case SAMPLE_CS8:
+        return "cs8";
+    case SAMPLE_CS16:
+        return "cs16";
+    case SAMPLE_CF32:
+        return "cf32";
+    default:
+        return "cu8";
+    }
+}
+
+size_t sample_format_size(sample_format_t format)
+{
+    switch (format) {
+    case SAMPLE_CS16:
+        return sizeof(int16_t);
+    case SAMPLE_CF32:
+        return sizeof(float);
+    default:
+        return sizeof(uint8_t);
+    }
+}
+
+/* Conversion kernels, one loop per format pair so each one vectorizes */
+
+static void cs8_to_cu8(int8_t const *restrict in, uint8_t *restrict out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (uint8_t)(in[i] + 128);
+}
+
+static void cs16_to_cu8(int16_t const *restrict in, uint8_t *restrict out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (uint8_t)((in[i] + 32768) >> 8);
+}
+
+// Same scaling as the original cf32 reader: x * 127 + 127, truncated and clipped
+static void cf32_to_cu8(float const *restrict in, uint8_t *restrict out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        float v = in[i] * 127.0f + 127.0f;
+        v = v < 0.0f ? 0.0f : v;
+        v = v > 255.0f ? 255.0f : v;
+        out[i] = (uint8_t)v;
+    }
+}
+
+static void cu8_to_cs16(uint8_t const *restrict in, int16_t *restrict out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (int16_t)((in[i] - 128) * 256);
+}
+
+static void cs8_to_cs16(int8_t const *restrict in, int16_t *restrict out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (int16_t)(in[i] * 256);
+}
+
+static void cf32_to_cs16(float const *restrict in, int16_t *restrict out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        float v = in[i] * 32767.0f;
+        v = v < -32767.0f ? -32767.0f : v;
+        v = v > 32767.0f ? 32767.0f : v;
+        out[i] = (int16_t)v;
+    }
+}
+
+void sample_convert_cu8(sample_format_t format, void const *in, uint8_t *out, size_t num_values)
+{
+    switch (format) {
+    case SAMPLE_CS8:
+        cs8_to_cu8(in, out, num_values);
+        break;
+    case SAMPLE_CS16:
+        cs16_to_cu8(in, out, num_values);
+        break;
+    case SAMPLE_CF32:
+        cf32_to_cu8(in, out, num_values);
+        break;
+    default:
+        memmove(out, in, num_values);
+    }
+}
+
+void sample_convert_cs16(sample_format_t format, void const *in, int16_t *out, size_t num_values)
+{
+    switch (format) {
+    case SAMPLE_CS8:
+        cs8_to_cs16(in, out, num_values);
+        break;
+    case SAMPLE_CS16:
+        memmove(out, in, num_values * sizeof(int16_t));
+        break;
+    case SAMPLE_CF32:
+        cf32_to_cs16(in, out, num_values);
+        break;
+    default:
+        cu8_to_cs16(in, out, num_values);
+    }
+}
@@ -0,0 +1,304 @@
+/**
+ * Shared memory record ring, one writer and any number of local readers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "shm_ring.h"
+
+// Not available on Windows, data_output_shm_create() is a stub there
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_RING_DATA_OFFSET    4096        // the header gets a page of its own
+#define SHM_RING_MIN_SIZE       4096
+#define SHM_RING_MAX_SIZE       (1 << 30)
+#define SHM_RING_ALIGN          16
+
+// The writer and the readers are different processes, the header fields are
+// accessed with the compiler's atomic builtins to order them with the data.
+#define load_acquire(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define load_relaxed(p)         __atomic_load_n(p, __ATOMIC_RELAXED)
+#define store_release(p, v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+struct shm_ring {
+    char name[256];
+    shm_ring_header_t *header;
+    uint8_t *data;
+    size_t map_size;
+    uint64_t size;
+    uint64_t head;              // copies of the header positions, only the writer changes them
+    uint64_t tail;
+    uint64_t seq;
+    unsigned long dropped;
+};
+
+struct shm_ring_reader {
+    shm_ring_header_t const *header;
+    uint8_t const *data;
+    size_t map_size;
+    uint64_t size;
+    uint64_t pos;
+    uint64_t next_seq;          // the seq expected next, to count the records lost
+    int have_seq;
+    uint8_t *buf;               // the record copied out
+    size_t buf_size;
+};
+
+static void shm_ring_name(char const *name, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s%s", *name == '/' ? "" : "/", name);
+}
+
+static size_t slot_size(size_t len)
+{
+    return (sizeof(shm_ring_slot_t) + len + SHM_RING_ALIGN - 1) & ~(size_t)(SHM_RING_ALIGN - 1);
+}
+
+// Tell readers of a stale segment (e.g. of a writer that crashed) that it is done
+static void shm_ring_close_stale(char const *name)
+{
+    struct stat st;
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(shm_ring_header_t)) {
+        shm_ring_header_t *header = mmap(NULL, sizeof(shm_ring_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (header != MAP_FAILED) {
+            if (header->magic == SHM_RING_MAGIC)
+                store_release(&header->closed, 1);
+            munmap(header, sizeof(shm_ring_header_t));
+        }
+    }
+    close(fd);
+    shm_unlink(name);
+}
+
+shm_ring_t *shm_ring_create(char const *name, size_t size)
+{
+    shm_ring_t *ring = calloc(1, sizeof(shm_ring_t));
+    if (!ring) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+    shm_ring_name(name, ring->name, sizeof(ring->name));
+
+    ring->size = SHM_RING_MIN_SIZE;
+    while (ring->size < size && ring->size < SHM_RING_MAX_SIZE)
+        ring->size *= 2;
+    ring->map_size = SHM_RING_DATA_OFFSET + ring->size;
+
+    shm_ring_close_stale(ring->name);
+    int fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Shared memory: can't create %s: %s\n", ring->name, strerror(errno));
+        free(ring);
+        return NULL;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, ring->map_size) == 0)
+        map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Shared memory: can't map %s: %s\n", ring->name, strerror(errno));
+        shm_unlink(ring->name);
+        free(ring);
+        return NULL;
+    }
+
+    ring->header = map;
+    ring->data = (uint8_t *)map + SHM_RING_DATA_OFFSET;
+    ring->header->version = SHM_RING_VERSION;
+    ring->header->data_offset = SHM_RING_DATA_OFFSET;
+    ring->header->data_size = ring->size;
+    ring->header->writer_pid = (uint32_t)getpid();
+    store_release(&ring->header->magic, SHM_RING_MAGIC);
+    return ring;
+}
+
+int shm_ring_write(shm_ring_t *ring, void const *data, size_t len)
+{
+    size_t need = slot_size(len);
+    if (len >= SHM_RING_PAD || need > ring->size / 2) {
+        ring->dropped++;
+        return -1;
+    }
+
+    // a filler slot if the record does not fit before the end; need is at most
+    // half the ring, so filler and record together never exceed it
+    uint64_t offset = ring->head & (ring->size - 1);
+    uint64_t pad = offset + need > ring->size ? ring->size - offset : 0;
+    uint64_t end = ring->head + pad + need;
+
+    // move the tail past the slots about to be overwritten, before writing
+    uint64_t tail = ring->tail;
+    while (end - tail > ring->size) {
+        shm_ring_slot_t const *slot = (shm_ring_slot_t const *)(ring->data + (tail & (ring->size - 1)));
+        tail += slot->size;
+    }
+    if (tail != ring->tail) {
+        ring->tail = tail;
+        store_release(&ring->header->tail, tail);
+        // the new tail must be visible before any of the data written below
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    shm_ring_slot_t *slot = (shm_ring_slot_t *)(ring->data + offset);
+    if (pad) {
+        slot->size = (uint32_t)pad;
+        slot->len = SHM_RING_PAD;
+        slot->seq = 0;
+        slot = (shm_ring_slot_t *)ring->data;
+    }
+    slot->size = (uint32_t)need;
+    slot->len = (uint32_t)len;
+    slot->seq = ring->seq++;
+    memcpy(slot + 1, data, len);
+
+    ring->head = end;
+    store_release(&ring->header->seq, ring->seq);
+    store_release(&ring->header->head, end);
+    return 0;
+}
+
+void shm_ring_counters(shm_ring_t *ring, unsigned long *records, unsigned long *dropped)
+{
+    *records = (unsigned long)ring->seq;
+    *dropped = ring->dropped;
+}
+
+void shm_ring_free(shm_ring_t *ring)
+{
+    if (!ring)
+        return;
+    store_release(&ring->header->closed, 1);
+    munmap(ring->header, ring->map_size);
+    shm_unlink(ring->name);
+    free(ring);
+}
+
+shm_ring_reader_t *shm_ring_reader_open(char const *name, int from_oldest)
+{
+    char path[256];
+    struct stat st;
+
+    shm_ring_name(name, path, sizeof(path));
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > SHM_RING_DATA_OFFSET)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    shm_ring_header_t const *header = map;
+    uint64_t size = 0;
+    if (load_acquire(&header->magic) != SHM_RING_MAGIC
+            || header->version != SHM_RING_VERSION
+            || (size = header->data_size) < SHM_RING_MIN_SIZE || (size & (size - 1))
+            || header->data_offset + size != (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    shm_ring_reader_t *reader = calloc(1, sizeof(shm_ring_reader_t));
+    if (!reader) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    reader->header = header;
+    reader->data = (uint8_t const *)map + header->data_offset;
+    reader->map_size = st.st_size;
+    reader->size = size;
+    if (from_oldest) {
+        reader->pos = load_acquire(&header->tail);
+    } else {
+        reader->pos = load_acquire(&header->head);
+        reader->next_seq = load_acquire(&header->seq);
+        reader->have_seq = 1;
+    }
+    return reader;
+}
+
+int shm_ring_read(shm_ring_reader_t *reader, shm_ring_record_t *record)
+{
+    shm_ring_header_t const *header = reader->header;
+
+    for (;;) {
+        uint64_t head = load_acquire(&header->head);
+        if (reader->pos == head) {
+            if (!load_acquire(&header->closed))
+                return 0;
+            if (reader->pos == load_acquire(&header->head))
+                return SHM_RING_CLOSED;
+            continue; // the last records came with the close
+        }
+        uint64_t tail = load_acquire(&header->tail);
+        if ((int64_t)(reader->pos - tail) < 0 || (int64_t)(head - reader->pos) < 0) {
+            reader->pos = tail; // overrun, continue with the oldest record kept
+            continue;
+        }
+
+        // copy the slot out, it is only valid if the tail has not passed it by then
+        uint64_t offset = reader->pos & (reader->size - 1);
+        shm_ring_slot_t slot;
+        memcpy(&slot, reader->data + offset, sizeof(slot));
+        int valid = slot.size >= sizeof(slot) && slot.size % SHM_RING_ALIGN == 0
+                && slot.size <= reader->size - offset
+                && (slot.len == SHM_RING_PAD || slot.len <= slot.size - sizeof(slot));
+        if (valid && slot.len != SHM_RING_PAD) {
+            if (slot.len > reader->buf_size) {
+                uint8_t *buf = realloc(reader->buf, slot.len);
+                if (!buf)
+                    return SHM_RING_CORRUPT;
+                reader->buf = buf;
+                reader->buf_size = slot.len;
+            }
+            memcpy(reader->buf, reader->data + offset + sizeof(slot), slot.len);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        tail = load_relaxed(&header->tail);
+        if ((int64_t)(reader->pos - tail) < 0) {
+            reader->pos = tail; // overwritten while copying
+            continue;
+        }
+        if (!valid)
+            return SHM_RING_CORRUPT;
+
+        reader->pos += slot.size;
+        if (slot.len == SHM_RING_PAD)
+            continue;
+        record->data = reader->buf;
+        record->len = slot.len;
+        record->seq = slot.seq;
+        record->lost = reader->have_seq && slot.seq > reader->next_seq ? slot.seq - reader->next_seq : 0;
+        reader->next_seq = slot.seq + 1;
+        reader->have_seq = 1;
+        return 1;
+    }
+}
+
+void shm_ring_reader_close(shm_ring_reader_t *reader)
+{
+    if (!reader)
+        return;
+    munmap((void *)reader->header, reader->map_size);
+    free(reader->buf);
+    free(reader);
+}
+
+#endif /* _WIN32 */
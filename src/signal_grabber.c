@@ -0,0 +1,229 @@
+/**
+ * Signal grabber
+ *
+ * The ring is addressed by stream offset (samples since start). The writer
+ * thread copies snippets straight from the ring without holding the lock
+ * and checks afterwards that the receiver did not overwrite the samples
+ * while they were being written.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "signal_grabber.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint32_t frequency;
+} grab_job_t;
+
+struct signal_grabber {
+    uint8_t *ring;
+    uint64_t ring_samples;      // Ring size in samples
+    uint32_t samp_rate;
+    uint64_t pre_samples;
+    uint64_t post_samples;
+    int overwrite;
+
+    // shared, protected by mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint64_t write_pos;         // Stream offset of the next sample to append
+    grab_job_t jobs[SIGNAL_GRABBER_JOBS];
+    unsigned job_head;
+    unsigned job_count;
+    int stop;
+    unsigned merged;
+    unsigned dropped;
+
+    // writer side
+    pthread_t thread;
+    unsigned file_num;
+    unsigned saved;
+    unsigned truncated;
+};
+
+static void write_snippet(signal_grabber_t *grabber, grab_job_t *job)
+{
+    char name[256];
+    do {
+        snprintf(name, sizeof(name), "g%03u_%gM_%gk.cu8", ++grabber->file_num,
+                job->frequency / 1000000.0, grabber->samp_rate / 1000.0);
+    } while (!grabber->overwrite && access(name, F_OK) == 0);
+
+    FILE *file = fopen(name, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", name);
+        return;
+    }
+    fprintf(stderr, "*** Saving signal to file %s (%llu samples)\n", name,
+            (unsigned long long)(job->end - job->start));
+
+    uint64_t pos = job->start;
+    while (pos < job->end) {
+        uint64_t index = pos % grabber->ring_samples;
+        uint64_t n = job->end - pos;
+        if (n > grabber->ring_samples - index)
+            n = grabber->ring_samples - index;
+        if (fwrite(&grabber->ring[index * 2], 2, n, file) != n) {
+            fprintf(stderr, "Short write to %s\n", name);
+            break;
+        }
+        pos += n;
+    }
+    fclose(file);
+
+    // The receiver might have lapped us while writing
+    pthread_mutex_lock(&grabber->mutex);
+    uint64_t write_pos = grabber->write_pos;
+    pthread_mutex_unlock(&grabber->mutex);
+    if (write_pos > grabber->ring_samples && write_pos - grabber->ring_samples > job->start) {
+        fprintf(stderr, "Signal grabber overrun, start of %s is damaged\n", name);
+        grabber->truncated++;
+    }
+    grabber->saved++;
+}
+
+static void *signal_grabber_thread(void *arg)
+{
+    signal_grabber_t *grabber = arg;
+
+    pthread_mutex_lock(&grabber->mutex);
+    for (;;) {
+        // wait until the post margin of the oldest snippet was received
+        while (!grabber->stop
+                && (!grabber->job_count || grabber->write_pos < grabber->jobs[grabber->job_head].end))
+            pthread_cond_wait(&grabber->cond, &grabber->mutex);
+        if (!grabber->job_count)
+            break;
+        grab_job_t job = grabber->jobs[grabber->job_head];
+        grabber->job_head = (grabber->job_head + 1) % SIGNAL_GRABBER_JOBS;
+        grabber->job_count--;
+        uint64_t write_pos = grabber->write_pos;
+        pthread_mutex_unlock(&grabber->mutex);
+
+        if (job.end > write_pos)
+            job.end = write_pos; // stopping, save what we have
+        if (write_pos > grabber->ring_samples && write_pos - grabber->ring_samples > job.start) {
+            job.start = write_pos - grabber->ring_samples;
+            grabber->truncated++;
+        }
+        if (job.start < job.end)
+            write_snippet(grabber, &job);
+
+        pthread_mutex_lock(&grabber->mutex);
+    }
+    pthread_mutex_unlock(&grabber->mutex);
+    return NULL;
+}
+
+signal_grabber_t *signal_grabber_create(size_t ring_size, uint32_t samp_rate, unsigned pre_ms, unsigned post_ms, int overwrite)
+{
+    signal_grabber_t *grabber = calloc(1, sizeof(signal_grabber_t));
+    if (!grabber)
+        return NULL;
+    grabber->ring_samples = ring_size / 2;
+    grabber->ring = malloc(grabber->ring_samples * 2);
+    if (!grabber->ring) {
+        free(grabber);
+        return NULL;
+    }
+    grabber->samp_rate = samp_rate;
+    grabber->pre_samples = (uint64_t)samp_rate * pre_ms / 1000;
+    grabber->post_samples = (uint64_t)samp_rate * post_ms / 1000;
+    grabber->overwrite = overwrite;
+
+    pthread_mutex_init(&grabber->mutex, NULL);
+    pthread_cond_init(&grabber->cond, NULL);
+    if (pthread_create(&grabber->thread, NULL, signal_grabber_thread, grabber)) {
+        pthread_cond_destroy(&grabber->cond);
+        pthread_mutex_destroy(&grabber->mutex);
+        free(grabber->ring);
+        free(grabber);
+        return NULL;
+    }
+    return grabber;
+}
+
+void signal_grabber_write(signal_grabber_t *grabber, uint8_t const *iq_buf, uint32_t len)
+{
+    // Only this thread moves write_pos, reading it without the lock is fine
+    uint64_t pos = grabber->write_pos;
+    uint64_t samples = len / 2;
+    if (samples > grabber->ring_samples) {
+        iq_buf += (samples - grabber->ring_samples) * 2;
+        pos += samples - grabber->ring_samples;
+        samples = grabber->ring_samples;
+    }
+
+    uint64_t index = pos % grabber->ring_samples;
+    uint64_t n = grabber->ring_samples - index;
+    if (n > samples)
+        n = samples;
+    memcpy(&grabber->ring[index * 2], iq_buf, n * 2);
+    memcpy(grabber->ring, iq_buf + n * 2, (samples - n) * 2);
+
+    pthread_mutex_lock(&grabber->mutex);
+    grabber->write_pos = pos + samples;
+    if (grabber->job_count)
+        pthread_cond_signal(&grabber->cond);
+    pthread_mutex_unlock(&grabber->mutex);
+}
+
+void signal_grabber_trigger(signal_grabber_t *grabber, uint64_t start, uint64_t end, uint32_t frequency)
+{
+    start = start > grabber->pre_samples ? start - grabber->pre_samples : 0;
+    end += grabber->post_samples;
+
+    pthread_mutex_lock(&grabber->mutex);
+    grab_job_t *last = grabber->job_count
+            ? &grabber->jobs[(grabber->job_head + grabber->job_count - 1) % SIGNAL_GRABBER_JOBS] : NULL;
+    if (last && start <= last->end && frequency == last->frequency) {
+        if (end > last->end)
+            last->end = end;
+        grabber->merged++;
+    } else if (grabber->job_count == SIGNAL_GRABBER_JOBS) {
+        grabber->dropped++;
+    } else {
+        grab_job_t *job = &grabber->jobs[(grabber->job_head + grabber->job_count) % SIGNAL_GRABBER_JOBS];
+        job->start = start;
+        job->end = end;
+        job->frequency = frequency;
+        grabber->job_count++;
+        pthread_cond_signal(&grabber->cond);
+    }
+    pthread_mutex_unlock(&grabber->mutex);
+}
+
+unsigned signal_grabber_pending(signal_grabber_t *grabber)
+{
+    pthread_mutex_lock(&grabber->mutex);
+    unsigned pending = grabber->job_count;
+    pthread_mutex_unlock(&grabber->mutex);
+    return pending;
+}
+
+void signal_grabber_free(signal_grabber_t *grabber, FILE *stats_file)
+{
+    pthread_mutex_lock(&grabber->mutex);
+    grabber->stop = 1;
+    pthread_cond_signal(&grabber->cond);
+    pthread_mutex_unlock(&grabber->mutex);
+    pthread_join(grabber->thread, NULL);
+
+    if (stats_file)
+        fprintf(stats_file, "Signal grabber: %u files saved, %u signals merged, %u dropped, %u truncated\n",
+                grabber->saved, grabber->merged, grabber->dropped, grabber->truncated);
+
+    pthread_cond_destroy(&grabber->cond);
+    pthread_mutex_destroy(&grabber->mutex);
+    free(grabber->ring);
+    free(grabber);
+}
@@ -0,0 +1,193 @@
+/**
+ * Per station state cache to thin out repeated records
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "station_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+typedef struct {
+    uint64_t key;               // hash of model, id, channel and message type
+    uint64_t values;            // hash of the other fields of the last record emitted
+    double last_seen;
+    double last_emitted;
+} station_t;
+
+struct station_cache {
+    station_emit_t mode;
+    double heartbeat;
+    double dedup_window;
+    unsigned max_stations;
+    unsigned num_stations;
+    station_t *stations;
+    station_cache_counters_t counters;
+};
+
+static uint64_t hash_bytes(uint64_t hash, void const *buf, size_t len)
+{
+    unsigned char const *p = buf;
+    for (size_t i = 0; i < len; ++i)
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    return hash;
+}
+
+static uint64_t hash_string(uint64_t hash, char const *str)
+{
+    return hash_bytes(hash, str, strlen(str) + 1);
+}
+
+static uint64_t hash_data(uint64_t hash, data_t const *data, int top_level);
+
+static uint64_t hash_value(uint64_t hash, data_type_t type, void const *value)
+{
+    hash = hash_bytes(hash, &type, sizeof(type));
+    switch (type) {
+    case DATA_INT:
+        return hash_bytes(hash, value, sizeof(int));
+    case DATA_DOUBLE:
+        return hash_bytes(hash, value, sizeof(double));
+    case DATA_STRING:
+        return hash_string(hash, value);
+    case DATA_DATA:
+        return hash_data(hash, value, 0);
+    case DATA_ARRAY: {
+        data_array_t const *array = value;
+        hash = hash_bytes(hash, &array->num_values, sizeof(array->num_values));
+        for (int i = 0; i < array->num_values; ++i) {
+            if (array->type == DATA_INT)
+                hash = hash_value(hash, DATA_INT, (int const *)array->values + i);
+            else if (array->type == DATA_DOUBLE)
+                hash = hash_value(hash, DATA_DOUBLE, (double const *)array->values + i);
+            else
+                hash = hash_value(hash, array->type, ((void *const *)array->values)[i]);
+        }
+        return hash;
+    }
+    default:
+        return hash;
+    }
+}
+
+// The fields that identify a station, the time fields differ for every record
+static int is_key_field(char const *key)
+{
+    return !strcmp(key, "model") || !strcmp(key, "id") || !strcmp(key, "channel") || !strcmp(key, "msg_type");
+}
+
+static int is_time_field(char const *key)
+{
+    return !strcmp(key, "time") || !strcmp(key, "capture_time") || !strcmp(key, "latency_us");
+}
+
+// Hash of the values, at the top level without the key and time fields
+static uint64_t hash_data(uint64_t hash, data_t const *data, int top_level)
+{
+    for (; data; data = data->next) {
+        if (top_level && (is_key_field(data->key) || is_time_field(data->key)))
+            continue;
+        hash = hash_string(hash, data->key);
+        hash = hash_value(hash, data->type, data->value);
+    }
+    return hash;
+}
+
+int station_cache_key(data_t const *data, uint64_t *key)
+{
+    int have_model = 0;
+    uint64_t hash = FNV_OFFSET;
+    for (; data; data = data->next) {
+        if (!is_key_field(data->key))
+            continue;
+        if (!strcmp(data->key, "model"))
+            have_model = data->type == DATA_STRING;
+        hash = hash_string(hash, data->key);
+        hash = hash_value(hash, data->type, data->value);
+    }
+    *key = hash;
+    return have_model;
+}
+
+station_cache_t *station_cache_create(station_emit_t mode, double heartbeat, double dedup_window, unsigned max_stations)
+{
+    station_cache_t *cache = calloc(1, sizeof(station_cache_t));
+    if (!cache)
+        return NULL;
+    cache->mode = mode;
+    cache->heartbeat = heartbeat;
+    cache->dedup_window = dedup_window;
+    cache->max_stations = max_stations ? max_stations : 1;
+    cache->stations = calloc(cache->max_stations, sizeof(station_t));
+    if (!cache->stations) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+int station_cache_check(station_cache_t *cache, data_t const *data, double now)
+{
+    uint64_t key;
+    if (!station_cache_key(data, &key))
+        return 1;
+    uint64_t values = hash_data(FNV_OFFSET, data, 1);
+    cache->counters.records++;
+
+    station_t *station = NULL;
+    station_t *oldest = cache->stations;
+    for (unsigned i = 0; i < cache->num_stations; ++i) {
+        if (cache->stations[i].key == key) {
+            station = &cache->stations[i];
+            break;
+        }
+        if (cache->stations[i].last_seen < oldest->last_seen)
+            oldest = &cache->stations[i];
+    }
+    if (!station) {
+        station = cache->num_stations < cache->max_stations ? &cache->stations[cache->num_stations++] : oldest;
+        station->key = key;
+        station->values = values;
+        station->last_seen = station->last_emitted = now;
+        cache->counters.emitted++;
+        return 1;
+    }
+    station->last_seen = now;
+
+    int changed = values != station->values;
+    double since = now - station->last_emitted;
+    if (!changed && cache->dedup_window > 0 && since >= 0 && since < cache->dedup_window) {
+        cache->counters.duplicates++;
+        return 0;
+    }
+    if (!changed && (cache->mode == STATION_EMIT_CHANGE
+            || (cache->mode == STATION_EMIT_HEARTBEAT && since >= 0 && since < cache->heartbeat))) {
+        cache->counters.unchanged++;
+        return 0;
+    }
+    station->values = values;
+    station->last_emitted = now;
+    cache->counters.emitted++;
+    return 1;
+}
+
+void station_cache_counters(station_cache_t const *cache, station_cache_counters_t *counters)
+{
+    *counters = cache->counters;
+    counters->stations = cache->num_stations;
+}
+
+void station_cache_free(station_cache_t *cache)
+{
+    if (!cache)
+        return;
+    free(cache->stations);
+    free(cache);
+}
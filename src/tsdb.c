@@ -0,0 +1,523 @@
+/**
+ * Append-only columnar store for decoded readings
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "tsdb.h"
+
+// Not available on Windows, data_output_tsdb_create() is a stub there
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TSDB_OPEN_BLOCKS    4096        // series with an open block per segment, one is closed beyond
+#define TSDB_OPEN_SLOTS     (2 * TSDB_OPEN_BLOCKS)  // open addressing, at most half full
+#define TSDB_LAST_DAY       2932896     // 9999-12-31, the last day a segment name can hold
+#define MS_PER_DAY          86400000LL
+
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+// Queries may map a segment while it is written, the row counts and the
+// segment end are accessed with the compiler's atomic builtins to order them
+// with the data.
+#define load_acquire(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+typedef struct {
+    uint64_t schema;
+    uint64_t offset;
+} open_block_t;
+
+struct tsdb {
+    char *dir;
+    int fd;
+    uint8_t *map;               // TSDB_SEGMENT_MAX bytes, the file is grown as blocks are added
+    tsdb_segment_header_t *header;
+    int32_t day;
+    uint64_t end;               // copy of the header end, only the writer changes it
+    unsigned num_open;
+    open_block_t open[TSDB_OPEN_SLOTS];     // by schema, offset 0 for an empty slot
+    int full_logged;            // the segment is full and that was reported
+    unsigned long rows;
+    unsigned long dropped;
+};
+
+static uint64_t hash_bytes(uint64_t hash, void const *buf, size_t len)
+{
+    unsigned char const *p = buf;
+    for (size_t i = 0; i < len; ++i)
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    return hash;
+}
+
+static int64_t day_of(int64_t time_ms)
+{
+    int64_t day = time_ms / MS_PER_DAY;
+    return time_ms % MS_PER_DAY < 0 ? day - 1 : day;
+}
+
+static size_t pad8(size_t len)
+{
+    return (len + 7) & ~(size_t)7;
+}
+
+static size_t column_size(uint8_t type, unsigned capacity)
+{
+    return pad8(capacity * (type == TSDB_INT ? sizeof(int32_t) : sizeof(double)));
+}
+
+static size_t block_size(tsdb_field_desc_t const *fields, unsigned num_fields, unsigned capacity)
+{
+    size_t size = sizeof(tsdb_block_header_t) + num_fields * sizeof(tsdb_field_desc_t) + capacity * sizeof(int64_t);
+    for (unsigned i = 0; i < num_fields; ++i)
+        size += column_size(fields[i].type, capacity);
+    return size;
+}
+
+static tsdb_field_desc_t const *block_fields(tsdb_block_header_t const *block)
+{
+    return (tsdb_field_desc_t const *)(block + 1);
+}
+
+// Check a block header read from a file, avail is the space left in the segment
+static int block_valid(tsdb_block_header_t const *block, uint64_t avail)
+{
+    if (avail < sizeof(tsdb_block_header_t) || block->magic != TSDB_BLOCK_MAGIC
+            || block->num_fields > TSDB_MAX_FIELDS || block->capacity > TSDB_MAX_ROWS
+            || block->size > avail || block->size % 8
+            || block->columns_offset != sizeof(tsdb_block_header_t) + block->num_fields * sizeof(tsdb_field_desc_t)
+            || block->series[TSDB_MAX_NAME - 1] != '\0')
+        return 0;
+    tsdb_field_desc_t const *fields = block_fields(block);
+    for (unsigned i = 0; i < block->num_fields; ++i) {
+        if ((fields[i].type != TSDB_INT && fields[i].type != TSDB_DOUBLE)
+                || fields[i].name[TSDB_MAX_FIELD_NAME - 1] != '\0')
+            return 0;
+    }
+    return block->size == block_size(fields, block->num_fields, block->capacity);
+}
+
+static void segment_name(char const *dir, int64_t day, char *buf, size_t size)
+{
+    time_t t = (time_t)(day * 86400);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    snprintf(buf, size, "%s/%04d-%02d-%02d.tsd", dir, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+}
+
+/* Writer */
+
+// The slot of a series, or the empty slot to add it in
+static open_block_t *open_slot(tsdb_t *db, uint64_t schema)
+{
+    unsigned i = (unsigned)schema & (TSDB_OPEN_SLOTS - 1);
+    while (db->open[i].offset && db->open[i].schema != schema)
+        i = (i + 1) & (TSDB_OPEN_SLOTS - 1);
+    return &db->open[i];
+}
+
+static void remember_block(tsdb_t *db, uint64_t schema, uint64_t offset)
+{
+    open_block_t *entry = open_slot(db, schema);
+    if (!entry->offset) {
+        // beyond TSDB_OPEN_BLOCKS series the block in the first slot of the series is closed
+        if (db->num_open >= TSDB_OPEN_BLOCKS)
+            entry = &db->open[(unsigned)schema & (TSDB_OPEN_SLOTS - 1)];
+        else
+            db->num_open++;
+    }
+    entry->schema = schema;
+    entry->offset = offset;
+}
+
+static tsdb_block_header_t *find_block(tsdb_t *db, uint64_t schema)
+{
+    open_block_t *entry = open_slot(db, schema);
+    return entry->offset ? (tsdb_block_header_t *)(db->map + entry->offset) : NULL;
+}
+
+static void close_segment(tsdb_t *db)
+{
+    if (!db->map)
+        return;
+    munmap(db->map, TSDB_SEGMENT_MAX);
+    if (ftruncate(db->fd, (off_t)db->end) < 0)
+        fprintf(stderr, "tsdb: can't truncate segment: %s\n", strerror(errno));
+    close(db->fd);
+    db->map = NULL;
+    db->header = NULL;
+    db->fd = -1;
+}
+
+static int open_segment(tsdb_t *db, int64_t day)
+{
+    char path[1024];
+    struct stat st;
+
+    close_segment(db);
+    db->num_open = 0;
+    memset(db->open, 0, sizeof(db->open));
+    db->full_logged = 0;
+    if (day < 0 || day > TSDB_LAST_DAY)
+        return -1;
+    segment_name(db->dir, day, path, sizeof(path));
+
+    db->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (db->fd < 0) {
+        fprintf(stderr, "tsdb: can't open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(db->fd, &st) < 0
+            || (st.st_size < (off_t)sizeof(tsdb_segment_header_t) && ftruncate(db->fd, sizeof(tsdb_segment_header_t)) < 0)) {
+        fprintf(stderr, "tsdb: can't size %s: %s\n", path, strerror(errno));
+        close(db->fd);
+        return -1;
+    }
+    db->map = mmap(NULL, TSDB_SEGMENT_MAX, PROT_READ | PROT_WRITE, MAP_SHARED, db->fd, 0);
+    if (db->map == MAP_FAILED) {
+        fprintf(stderr, "tsdb: can't map %s: %s\n", path, strerror(errno));
+        db->map = NULL;
+        close(db->fd);
+        return -1;
+    }
+    db->header = (tsdb_segment_header_t *)db->map;
+    db->day = (int32_t)day;
+
+    if (st.st_size < (off_t)sizeof(tsdb_segment_header_t)) {
+        // a new segment
+        memset(db->header, 0, sizeof(tsdb_segment_header_t));
+        db->header->magic = TSDB_SEGMENT_MAGIC;
+        db->header->version = TSDB_VERSION;
+        db->header->day = db->day;
+        db->end = sizeof(tsdb_segment_header_t);
+        store_release(&db->header->end, db->end);
+        return 0;
+    }
+
+    if (db->header->magic != TSDB_SEGMENT_MAGIC || db->header->version != TSDB_VERSION || db->header->day != db->day) {
+        fprintf(stderr, "tsdb: %s is not a segment of this version\n", path);
+        munmap(db->map, TSDB_SEGMENT_MAX);
+        close(db->fd);
+        db->map = NULL;
+        db->header = NULL;
+        db->fd = -1;
+        return -1;
+    }
+    // continue the last block of each series, up to the first block that is not complete
+    uint64_t end = db->header->end;
+    if (end > (uint64_t)st.st_size)
+        end = (uint64_t)st.st_size;
+    uint64_t pos = sizeof(tsdb_segment_header_t);
+    while (pos < end) {
+        tsdb_block_header_t const *block = (tsdb_block_header_t const *)(db->map + pos);
+        if (!block_valid(block, end - pos) || block->rows > block->capacity)
+            break;
+        remember_block(db, block->schema, pos);
+        pos += block->size;
+    }
+    db->end = pos;
+    store_release(&db->header->end, db->end);
+    return 0;
+}
+
+static tsdb_block_header_t *new_block(tsdb_t *db, char const *series, uint64_t schema,
+        tsdb_field_desc_t const *fields, unsigned num_fields, unsigned capacity)
+{
+    size_t size = block_size(fields, num_fields, capacity);
+    if (db->end + size > TSDB_SEGMENT_MAX) {
+        if (!db->full_logged) {
+            char path[1024];
+            segment_name(db->dir, db->day, path, sizeof(path));
+            fprintf(stderr, "tsdb: segment %s full, dropping rows\n", path);
+            db->full_logged = 1;
+        }
+        return NULL;
+    }
+    if (ftruncate(db->fd, (off_t)(db->end + size)) < 0) {
+        fprintf(stderr, "tsdb: can't grow segment: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    tsdb_block_header_t *block = (tsdb_block_header_t *)(db->map + db->end);
+    memset(block, 0, sizeof(tsdb_block_header_t));
+    block->magic = TSDB_BLOCK_MAGIC;
+    block->size = (uint32_t)size;
+    block->capacity = capacity;
+    block->num_fields = (uint16_t)num_fields;
+    block->columns_offset = (uint16_t)(sizeof(tsdb_block_header_t) + num_fields * sizeof(tsdb_field_desc_t));
+    block->schema = schema;
+    memcpy(block->series, series, TSDB_MAX_NAME);
+    memcpy(block + 1, fields, num_fields * sizeof(tsdb_field_desc_t));
+
+    remember_block(db, schema, db->end);
+    db->end += size;
+    store_release(&db->header->end, db->end);
+    return block;
+}
+
+tsdb_t *tsdb_open(char const *dir)
+{
+    struct stat st;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "tsdb: can't create %s: %s\n", dir, strerror(errno));
+        return NULL;
+    }
+    if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "tsdb: %s is not a directory\n", dir);
+        return NULL;
+    }
+
+    tsdb_t *db = calloc(1, sizeof(tsdb_t));
+    if (!db) {
+        fprintf(stderr, "calloc() failed");
+        return NULL;
+    }
+    db->dir = strdup(dir);
+    if (!db->dir) {
+        fprintf(stderr, "strdup() failed");
+        free(db);
+        return NULL;
+    }
+    db->fd = -1;
+    return db;
+}
+
+int tsdb_append(tsdb_t *db, char const *series, int64_t time_ms, tsdb_field_t const *fields, unsigned num_fields)
+{
+    char name[TSDB_MAX_NAME] = {0};
+    tsdb_field_desc_t desc[TSDB_MAX_FIELDS];
+
+    if (num_fields > TSDB_MAX_FIELDS)
+        num_fields = TSDB_MAX_FIELDS;
+    // zero padded, the names are hashed and written whole
+    strncpy(name, series, TSDB_MAX_NAME - 1);
+    memset(desc, 0, num_fields * sizeof(tsdb_field_desc_t));
+    for (unsigned i = 0; i < num_fields; ++i) {
+        strncpy(desc[i].name, fields[i].name, TSDB_MAX_FIELD_NAME - 1);
+        desc[i].type = fields[i].type == TSDB_INT ? TSDB_INT : TSDB_DOUBLE;
+    }
+    uint64_t schema = hash_bytes(FNV_OFFSET, name, sizeof(name));
+    schema = hash_bytes(schema, desc, num_fields * sizeof(tsdb_field_desc_t));
+
+    int64_t day = day_of(time_ms);
+    if ((!db->map || db->day != day) && open_segment(db, day) < 0) {
+        db->dropped++;
+        return -1;
+    }
+
+    tsdb_block_header_t *block = find_block(db, schema);
+    if (!block || block->rows >= block->capacity || time_ms < block->time_max) {
+        // grow when full, going back in time continues in a block of the same size
+        unsigned capacity = !block ? TSDB_MIN_ROWS : block->rows >= block->capacity ? block->capacity * 2 : block->capacity;
+        if (capacity > TSDB_MAX_ROWS)
+            capacity = TSDB_MAX_ROWS;
+        block = new_block(db, name, schema, desc, num_fields, capacity);
+        if (!block) {
+            db->dropped++;
+            return -1;
+        }
+    }
+
+    uint32_t row = block->rows;
+    uint8_t *column = (uint8_t *)block + block->columns_offset;
+    ((int64_t *)column)[row] = time_ms;
+    column += block->capacity * sizeof(int64_t);
+    for (unsigned i = 0; i < num_fields; ++i) {
+        if (desc[i].type == TSDB_INT)
+            ((int32_t *)column)[row] = fields[i].value.i;
+        else
+            ((double *)column)[row] = fields[i].value.d;
+        column += column_size(desc[i].type, block->capacity);
+    }
+    if (row == 0)
+        block->time_min = time_ms;
+    block->time_max = time_ms;
+    store_release(&block->rows, row + 1);
+    db->rows++;
+    return 0;
+}
+
+void tsdb_counters(tsdb_t *db, unsigned long *rows, unsigned long *dropped)
+{
+    *rows = db->rows;
+    *dropped = db->dropped;
+}
+
+void tsdb_close(tsdb_t *db)
+{
+    if (!db)
+        return;
+    close_segment(db);
+    free(db->dir);
+    free(db);
+}
+
+/* Query */
+
+static int compare_names(void const *a, void const *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// First row in [lo, hi) at or after time_ms
+static unsigned lower_bound(int64_t const *time, unsigned lo, unsigned hi, int64_t time_ms)
+{
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (time[mid] < time_ms)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int query_segment(char const *path, int64_t from_ms, int64_t to_ms, tsdb_rows_cb cb, void *ctx)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "tsdb: can't open %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(tsdb_segment_header_t)) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    uint8_t const *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "tsdb: can't map %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    int ret = 0;
+    tsdb_segment_header_t const *header = (tsdb_segment_header_t const *)map;
+    if (header->magic != TSDB_SEGMENT_MAGIC || header->version != TSDB_VERSION) {
+        fprintf(stderr, "tsdb: %s is not a segment of this version\n", path);
+        munmap((void *)map, size);
+        return 0;
+    }
+    uint64_t end = load_acquire(&header->end);
+    if (end > size)
+        end = size;
+
+    uint64_t pos = sizeof(tsdb_segment_header_t);
+    while (pos < end && !ret) {
+        tsdb_block_header_t const *block = (tsdb_block_header_t const *)(map + pos);
+        if (!block_valid(block, end - pos))
+            break;
+        pos += block->size;
+
+        uint32_t rows = load_acquire(&block->rows);
+        if (rows > block->capacity)
+            rows = block->capacity;
+        // the block headers are the index, skip blocks out of range without touching their columns
+        if (rows == 0 || block->time_min >= to_ms || block->time_max < from_ms)
+            continue;
+
+        uint8_t const *column = (uint8_t const *)block + block->columns_offset;
+        int64_t const *time = (int64_t const *)column;
+        unsigned first = lower_bound(time, 0, rows, from_ms);
+        unsigned last = lower_bound(time, first, rows, to_ms);
+        if (first == last)
+            continue;
+
+        tsdb_rows_t result = {0};
+        result.series = block->series;
+        result.schema = block->schema;
+        result.num_fields = block->num_fields;
+        result.fields = block_fields(block);
+        result.rows = last - first;
+        result.time = time + first;
+        column += block->capacity * sizeof(int64_t);
+        for (unsigned i = 0; i < block->num_fields; ++i) {
+            if (result.fields[i].type == TSDB_INT)
+                result.columns[i] = (int32_t const *)column + first;
+            else
+                result.columns[i] = (double const *)column + first;
+            column += column_size(result.fields[i].type, block->capacity);
+        }
+        ret = cb(&result, ctx) ? 1 : 0;
+    }
+    munmap((void *)map, size);
+    return ret;
+}
+
+int tsdb_query(char const *dir, int64_t from_ms, int64_t to_ms, tsdb_rows_cb cb, void *ctx)
+{
+    if (to_ms <= from_ms)
+        return 0;
+    int64_t first_day = day_of(from_ms);
+    int64_t last_day = day_of(to_ms - 1);
+    if (last_day < 0 || first_day > TSDB_LAST_DAY)
+        return 0;
+    if (first_day < 0)
+        first_day = 0;
+    if (last_day > TSDB_LAST_DAY)
+        last_day = TSDB_LAST_DAY;
+
+    // segment names sort by day, select them by name
+    char first_name[1024];
+    char last_name[1024];
+    segment_name("", first_day, first_name, sizeof(first_name));
+    segment_name("", last_day, last_name, sizeof(last_name));
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "tsdb: can't open %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    char **names = NULL;
+    size_t num_names = 0;
+    size_t max_names = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        char name[1024];
+        snprintf(name, sizeof(name), "/%s", entry->d_name);
+        if (strlen(name) != strlen(first_name) || strcmp(name + strlen(name) - 4, ".tsd")
+                || strcmp(name, first_name) < 0 || strcmp(name, last_name) > 0)
+            continue;
+        if (num_names == max_names) {
+            max_names = max_names ? max_names * 2 : 64;
+            char **grown = realloc(names, max_names * sizeof(char *));
+            if (!grown)
+                break;
+            names = grown;
+        }
+        names[num_names] = strdup(entry->d_name);
+        if (names[num_names])
+            num_names++;
+    }
+    closedir(d);
+    if (num_names)
+        qsort(names, num_names, sizeof(char *), compare_names);
+
+    int ret = 0;
+    for (size_t i = 0; i < num_names; ++i) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        if (!ret)
+            ret = query_segment(path, from_ms, to_ms, cb, ctx);
+        free(names[i]);
+    }
+    free(names);
+    return ret;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,321 @@
+/**
+ * Derived weather metrics per station
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "weather_metrics.h"
+#include "station_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define WINDOW_MAX_BUCKETS  24
+#define WIND_BUCKETS        10      // of a minute each
+
+/// A sum over a sliding window, to the resolution of a bucket
+typedef struct {
+    double width;               // bucket width in seconds
+    unsigned num;               // buckets in the window
+    int started;
+    int64_t current;            // index of the newest bucket, counted from time 0
+    double total;
+    double bucket[WINDOW_MAX_BUCKETS];
+} sum_window_t;
+
+typedef struct {
+    double speed;               // sum of the average speeds
+    unsigned count;
+    double gust;                // highest gust
+    double x, y;                // sum of the directions as vectors of length speed
+} wind_bucket_t;
+
+typedef struct {
+    uint64_t key;
+    double last_seen;
+    int have_rain;
+    double last_rain;
+    double rain_wrap;           // counter modulus, 0 if unknown
+    sum_window_t rain_10m;
+    sum_window_t rain_1h;
+    sum_window_t rain_24h;
+    int wind_started;
+    int64_t wind_current;
+    wind_bucket_t wind[WIND_BUCKETS];
+} station_t;
+
+struct weather_metrics {
+    unsigned max_stations;
+    unsigned num_stations;
+    station_t *stations;
+};
+
+// Stations whose rain counter is known to wrap, at the total in mm it wraps at
+static struct {
+    char const *model;
+    double wrap;
+} const rain_counters[] = {
+    {"Fine Offset WH1080 Weather Station", 4096 * 0.3}, // 12 bit count of 0.3 mm
+};
+
+// The first of these fields found is used, in the units the decoders output
+static char const *const temperature_keys[] = {"temperature_C", NULL};
+static char const *const humidity_keys[] = {"humidity", NULL};
+static char const *const rain_keys[] = {"rain", "rain_mm", "rain_total", NULL};
+static char const *const wind_keys[] = {"speed", "wind_speed_kph", "wind_avg_km_h", NULL};
+static char const *const gust_keys[] = {"gust", "gust_kph", "wind_max_km_h", NULL};
+static char const *const direction_keys[] = {"direction_deg", "wind_dir_deg", NULL};
+
+static void sum_window_init(sum_window_t *w, unsigned num, double width)
+{
+    memset(w, 0, sizeof(*w));
+    w->num = num;
+    w->width = width;
+}
+
+// Move the window to now, clearing the buckets that fell out of it
+static void sum_window_advance(sum_window_t *w, double now)
+{
+    int64_t index = (int64_t)floor(now / w->width);
+    if (!w->started || index - w->current >= w->num) {
+        memset(w->bucket, 0, sizeof(w->bucket));
+        w->total = 0;
+        w->started = 1;
+        w->current = index;
+        return;
+    }
+    // time going back (e.g. the next input file) is counted in the newest bucket
+    for (; w->current < index; ++w->current) {
+        double *bucket = &w->bucket[(w->current + 1) % w->num];
+        w->total -= *bucket;
+        *bucket = 0;
+    }
+    if (w->total < 1e-9)
+        w->total = 0; // rounding left over by the subtractions
+}
+
+static void sum_window_add(sum_window_t *w, double now, double value)
+{
+    sum_window_advance(w, now);
+    w->bucket[w->current % w->num] += value;
+    w->total += value;
+}
+
+static void wind_advance(station_t *st, double now)
+{
+    int64_t index = (int64_t)floor(now / 60.0);
+    if (!st->wind_started || index - st->wind_current >= WIND_BUCKETS) {
+        memset(st->wind, 0, sizeof(st->wind));
+        st->wind_started = 1;
+        st->wind_current = index;
+        return;
+    }
+    for (; st->wind_current < index; ++st->wind_current)
+        memset(&st->wind[(st->wind_current + 1) % WIND_BUCKETS], 0, sizeof(wind_bucket_t));
+}
+
+static int find_value(data_t const *data, char const *const *keys, double *value)
+{
+    for (; *keys; ++keys) {
+        for (data_t const *d = data; d; d = d->next) {
+            if (strcmp(d->key, *keys))
+                continue;
+            if (d->type == DATA_DOUBLE)
+                *value = *(double *)d->value;
+            else if (d->type == DATA_INT)
+                *value = *(int *)d->value;
+            else if (d->type == DATA_STRING) {
+                char *end;
+                *value = strtod(d->value, &end);
+                if (end == (char *)d->value)
+                    return 0;
+            }
+            else
+                return 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static station_t *find_station(weather_metrics_t *metrics, data_t const *data)
+{
+    uint64_t key;
+    if (!station_cache_key(data, &key))
+        return NULL;
+
+    station_t *oldest = metrics->stations;
+    for (unsigned i = 0; i < metrics->num_stations; ++i) {
+        if (metrics->stations[i].key == key)
+            return &metrics->stations[i];
+        if (metrics->stations[i].last_seen < oldest->last_seen)
+            oldest = &metrics->stations[i];
+    }
+    station_t *st = metrics->num_stations < metrics->max_stations ? &metrics->stations[metrics->num_stations++] : oldest;
+    memset(st, 0, sizeof(*st));
+    st->key = key;
+    sum_window_init(&st->rain_10m, 10, 60);
+    sum_window_init(&st->rain_1h, 12, 300);
+    sum_window_init(&st->rain_24h, 24, 3600);
+
+    for (data_t const *d = data; d; d = d->next) {
+        if (strcmp(d->key, "model") == 0 && d->type == DATA_STRING) {
+            for (size_t i = 0; i < sizeof(rain_counters) / sizeof(*rain_counters); ++i) {
+                if (strcmp(d->value, rain_counters[i].model) == 0)
+                    st->rain_wrap = rain_counters[i].wrap;
+            }
+        }
+    }
+    return st;
+}
+
+// Rain since the previous record; a decrease is a wraparound if the counter is known to wrap
+// and it went down by more than half its range, otherwise a reset of which nothing is counted
+static double rain_delta(station_t *st, double rain)
+{
+    double delta = 0;
+    if (st->have_rain && rain >= st->last_rain)
+        delta = rain - st->last_rain;
+    else if (st->have_rain && st->rain_wrap > 0 && st->last_rain - rain > st->rain_wrap / 2)
+        delta = rain + st->rain_wrap - st->last_rain;
+    st->have_rain = 1;
+    st->last_rain = rain;
+    return delta;
+}
+
+// Magnus formula, good to 0.1 C from -45 C to 60 C
+static double dew_point(double temperature, double humidity)
+{
+    double gamma = log(humidity / 100.0) + 17.62 * temperature / (243.12 + temperature);
+    return 243.12 * gamma / (17.62 - gamma);
+}
+
+// North American and UK wind chill index, defined at or below 10 C and above 4.8 km/h
+static double wind_chill(double temperature, double wind_kph)
+{
+    double v = pow(wind_kph, 0.16);
+    return 13.12 + 0.6215 * temperature - 11.37 * v + 0.3965 * temperature * v;
+}
+
+static data_t *append(data_t *head, data_t *fields)
+{
+    if (!head)
+        return fields;
+    data_t *tail = head;
+    while (tail->next)
+        tail = tail->next;
+    tail->next = fields;
+    return head;
+}
+
+weather_metrics_t *weather_metrics_create(unsigned max_stations)
+{
+    weather_metrics_t *metrics = calloc(1, sizeof(weather_metrics_t));
+    if (!metrics)
+        return NULL;
+    metrics->max_stations = max_stations ? max_stations : 1;
+    metrics->stations = calloc(metrics->max_stations, sizeof(station_t));
+    if (!metrics->stations) {
+        free(metrics);
+        return NULL;
+    }
+    return metrics;
+}
+
+data_t *weather_metrics_update(weather_metrics_t *metrics, data_t const *data, double now)
+{
+    double temperature, humidity, rain, wind, gust, direction;
+    int have_temperature = find_value(data, temperature_keys, &temperature);
+    int have_humidity = find_value(data, humidity_keys, &humidity) && humidity > 0 && humidity <= 100;
+    int have_rain = find_value(data, rain_keys, &rain);
+    int have_wind = find_value(data, wind_keys, &wind);
+    int have_gust = find_value(data, gust_keys, &gust);
+    int have_direction = find_value(data, direction_keys, &direction);
+    if (!have_temperature && !have_rain && !have_wind && !have_gust)
+        return NULL;
+
+    station_t *st = find_station(metrics, data);
+    if (!st)
+        return NULL;
+    st->last_seen = now;
+    data_t *fields = NULL;
+
+    if (have_rain) {
+        int had_rain = st->have_rain;
+        double delta = rain_delta(st, rain);
+        sum_window_add(&st->rain_10m, now, delta);
+        sum_window_add(&st->rain_1h, now, delta);
+        sum_window_add(&st->rain_24h, now, delta);
+        if (had_rain) // the first record only sets the counter base
+            fields = append(fields, data_make(
+                    "rain_rate_mm_h", "Rain rate",   DATA_FORMAT, "%.1f mm/h", DATA_DOUBLE, st->rain_10m.total * 6,
+                    "rain_1h_mm",     "Rain 1h",     DATA_FORMAT, "%.1f mm",   DATA_DOUBLE, st->rain_1h.total,
+                    "rain_24h_mm",    "Rain 24h",    DATA_FORMAT, "%.1f mm",   DATA_DOUBLE, st->rain_24h.total,
+                    NULL));
+    }
+
+    if (have_wind || have_gust) {
+        wind_advance(st, now);
+        wind_bucket_t *bucket = &st->wind[st->wind_current % WIND_BUCKETS];
+        if (have_wind) {
+            bucket->speed += wind;
+            bucket->count++;
+            if (have_direction) {
+                bucket->x += wind * cos(direction * M_PI / 180);
+                bucket->y += wind * sin(direction * M_PI / 180);
+            }
+        }
+        if (have_gust && gust > bucket->gust)
+            bucket->gust = gust;
+
+        wind_bucket_t sum = {0};
+        for (int i = 0; i < WIND_BUCKETS; ++i) {
+            sum.speed += st->wind[i].speed;
+            sum.count += st->wind[i].count;
+            sum.x += st->wind[i].x;
+            sum.y += st->wind[i].y;
+            if (st->wind[i].gust > sum.gust)
+                sum.gust = st->wind[i].gust;
+        }
+        if (sum.count)
+            fields = append(fields, data_make(
+                    "wind_avg_10m_kph", "Wind avg 10m", DATA_FORMAT, "%.1f kph", DATA_DOUBLE, sum.speed / sum.count,
+                    NULL));
+        if (have_gust)
+            fields = append(fields, data_make(
+                    "gust_max_10m_kph", "Gust max 10m", DATA_FORMAT, "%.1f kph", DATA_DOUBLE, sum.gust,
+                    NULL));
+        if (sum.x != 0 || sum.y != 0) {
+            int deg = (int)lround(atan2(sum.y, sum.x) * 180 / M_PI);
+            fields = append(fields, data_make(
+                    "wind_dir_10m_deg", "Wind dir 10m", DATA_INT, (deg + 360) % 360,
+                    NULL));
+        }
+    }
+
+    if (have_temperature && have_humidity)
+        fields = append(fields, data_make(
+                "dew_point_C",  "Dew point",    DATA_FORMAT, "%.1f C", DATA_DOUBLE, dew_point(temperature, humidity),
+                NULL));
+    if (have_temperature && have_wind && temperature <= 10 && wind > 4.8)
+        fields = append(fields, data_make(
+                "wind_chill_C", "Wind chill",   DATA_FORMAT, "%.1f C", DATA_DOUBLE, wind_chill(temperature, wind),
+                NULL));
+    return fields;
+}
+
+void weather_metrics_free(weather_metrics_t *metrics)
+{
+    if (!metrics)
+        return;
+    free(metrics->stations);
+    free(metrics);
+}
@@ -0,0 +1,238 @@
+/*
+ * Round trip test for the CBOR output and reader
+ *
+ * Records with all value types (nested objects, arrays of every type,
+ * floats of each width) are written with data_output_cbor_create() and
+ * read back with data_cbor_read(), in one piece and byte by byte, and
+ * must equal the originals. Also compares size and speed with JSON.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "data.h"
+#include "test_check.h"
+
+static int equal_values(data_type_t type, void *a, void *b);
+
+static int equal_arrays(data_array_t *a, data_array_t *b)
+{
+    if (a->num_values != b->num_values)
+        return 0;
+    if (!a->num_values)
+        return 1; // the type of an empty array is not kept
+    if (a->type != b->type)
+        return 0;
+    for (int i = 0; i < a->num_values; ++i) {
+        switch (a->type) {
+        case DATA_INT:
+            if (((int *)a->values)[i] != ((int *)b->values)[i])
+                return 0;
+            break;
+        case DATA_DOUBLE:
+            if (memcmp(&((double *)a->values)[i], &((double *)b->values)[i], sizeof(double)))
+                return 0;
+            break;
+        default:
+            if (!equal_values(a->type, ((void **)a->values)[i], ((void **)b->values)[i]))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static int equal_data(data_t *a, data_t *b)
+{
+    for (; a && b; a = a->next, b = b->next) {
+        if (strcmp(a->key, b->key) || a->type != b->type || !equal_values(a->type, a->value, b->value))
+            return 0;
+    }
+    return !a && !b;
+}
+
+static int equal_values(data_type_t type, void *a, void *b)
+{
+    switch (type) {
+    case DATA_INT:    return *(int *)a == *(int *)b;
+    case DATA_DOUBLE: return memcmp(a, b, sizeof(double)) == 0; // also tells -0.0 from 0.0
+    case DATA_STRING: return strcmp(a, b) == 0;
+    case DATA_ARRAY:  return equal_arrays(a, b);
+    case DATA_DATA:   return equal_data(a, b);
+    default:          return 0;
+    }
+}
+
+static data_t **make_records(int *count)
+{
+    static char long_text[1000];
+    memset(long_text, 'x', sizeof(long_text) - 1);
+
+    data_t *records[] = {
+        data_make(
+                "time",          "",             DATA_STRING, "2018-01-01 12:00:00",
+                "model",         "",             DATA_STRING, "Bench Sensor",
+                "id",            "ID",           DATA_INT, 42,
+                "channel",       "Channel",      DATA_INT, 1,
+                "battery",       "Battery",      DATA_STRING, "OK",
+                "temperature_C", "Temperature",  DATA_FORMAT, "%.02f C", DATA_DOUBLE, 21.5,
+                "humidity",      "Humidity",     DATA_FORMAT, "%u %%", DATA_INT, 55,
+                "mic",           "Integrity",    DATA_STRING, "CRC",
+                NULL),
+        data_make(
+                "ints",          "", DATA_ARRAY, data_array(7, DATA_INT, (int[]){0, 23, 24, 255, 65536, -1, -2147483647 - 1}),
+                "max",           "", DATA_INT, 2147483647,
+                "half",          "", DATA_DOUBLE, -0.0,
+                "single",        "", DATA_DOUBLE, 0.1f,
+                "double",        "", DATA_DOUBLE, 0.1,
+                "tiny",          "", DATA_DOUBLE, 1e-300,
+                "huge",          "", DATA_DOUBLE, 65504.0,
+                "inf",           "", DATA_DOUBLE, -INFINITY,
+                "doubles",       "", DATA_ARRAY, data_array(3, DATA_DOUBLE, (double[]){1.5, 3.14159, 1e10}),
+                NULL),
+        data_make(
+                "empty",         "", DATA_STRING, "",
+                "utf8",          "", DATA_STRING, "\xc2\xb0" "C",
+                "long",          "", DATA_STRING, long_text,
+                "strings",       "", DATA_ARRAY, data_array(2, DATA_STRING, (char *[]){"hello", "world"}),
+                "none",          "", DATA_ARRAY, data_array(0, DATA_INT, NULL),
+                NULL),
+        data_make(
+                "model",         "", DATA_STRING, "Nested",
+                "stats",         "", DATA_DATA, data_make(
+                        "count",     "", DATA_INT, 7,
+                        "inner",     "", DATA_DATA, data_make("deep", "", DATA_DOUBLE, 2.5, NULL),
+                        NULL),
+                "rows",          "", DATA_ARRAY, data_array(2, DATA_DATA, (data_t *[]){
+                        data_make("a", "", DATA_INT, 1, NULL),
+                        data_make("b", "", DATA_STRING, "two", NULL)}),
+                "matrix",        "", DATA_ARRAY, data_array(2, DATA_ARRAY, (data_array_t *[]){
+                        data_array(2, DATA_INT, (int[]){1, 2}),
+                        data_array(1, DATA_INT, (int[]){3})}),
+                NULL),
+    };
+    *count = sizeof(records) / sizeof(records[0]);
+    data_t **copy = malloc(sizeof(records));
+    memcpy(copy, records, sizeof(records));
+    return copy;
+}
+
+// Write the records repeatedly, read them back in one piece or byte by byte
+static void test_round_trip(data_t **records, int count, int repeats, int byte_by_byte)
+{
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *file = open_memstream(&buf, &len);
+    struct data_output *output = data_output_cbor_create(file);
+    for (int r = 0; r < repeats; ++r) {
+        for (int i = 0; i < count; ++i)
+            data_output_print(output, records[i]);
+    }
+    data_output_free(output);
+    fclose(file);
+
+    data_cbor_reader_t *reader = data_cbor_reader_create();
+    size_t pos = 0;
+    size_t avail = byte_by_byte ? 0 : len;
+    int found = 0;
+    while (pos < len) {
+        data_t *data;
+        int n = data_cbor_read(reader, (uint8_t *)buf + pos, avail - pos, &data);
+        if (n < 0) {
+            fprintf(stderr, "malformed item at %zu\n", pos);
+            ++errors;
+            break;
+        }
+        if (n == 0) {
+            CHECK(avail < len);
+            avail++;
+            continue;
+        }
+        pos += n;
+        if (!data)
+            continue; // a key list
+        CHECK(equal_data(records[found % count], data));
+        data_free(data);
+        found++;
+    }
+    data_cbor_reader_free(reader);
+    CHECK(found == repeats * count);
+    free(buf);
+}
+
+// More key lists than the dictionary holds, it starts over
+static void test_many_schemas(void)
+{
+    enum { NUM = 600 };
+    data_t *records[NUM];
+    char key[16];
+    for (int i = 0; i < NUM; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        records[i] = data_make("model", "", DATA_STRING, "Many", key, "", DATA_INT, i, NULL);
+    }
+    test_round_trip(records, NUM, 2, 0);
+    for (int i = 0; i < NUM; ++i)
+        data_free(records[i]);
+}
+
+static void test_malformed(void)
+{
+    data_cbor_reader_t *reader = data_cbor_reader_create();
+    data_t *data;
+    uint8_t undefined[] = {0x83, 0x01, 0x05, 0x01}; // record with an undefined key list
+    uint8_t not_array[] = {0xa1, 0x61, 'a', 0x01};
+    uint8_t bad_float[] = {0x82, 0x00, 0x00};
+    CHECK(data_cbor_read(reader, undefined, sizeof(undefined), &data) == -1);
+    CHECK(data_cbor_read(reader, not_array, sizeof(not_array), &data) == -1);
+    CHECK(data_cbor_read(reader, bad_float, sizeof(bad_float), &data) == -1);
+    CHECK(data_cbor_read(reader, undefined, 0, &data) == 0);
+    data_cbor_reader_free(reader);
+}
+
+// Size and time per record of CBOR and JSON
+static void compare_json(data_t *record)
+{
+    enum { REPEATS = 100000 };
+    char const *names[2] = {"json", "cbor"};
+    size_t sizes[2];
+    for (int f = 0; f < 2; ++f) {
+        char *buf = NULL;
+        size_t len = 0;
+        FILE *file = open_memstream(&buf, &len);
+        struct data_output *output = f ? data_output_cbor_create(file) : data_output_json_create(file);
+        double start = now();
+        for (int i = 0; i < REPEATS; ++i)
+            data_output_print(output, record);
+        double secs = now() - start;
+        data_output_free(output);
+        fclose(file);
+        sizes[f] = len;
+        printf("%s: %.1f bytes/record, %.0f ns/record\n", names[f], (double)len / REPEATS, secs * 1e9 / REPEATS);
+        free(buf);
+    }
+    CHECK(sizes[1] < sizes[0] / 2);
+}
+
+int main(void)
+{
+    int count;
+    data_t **list = make_records(&count);
+
+    test_round_trip(list, count, 3, 0);
+    test_round_trip(list, count, 1, 1);
+    test_many_schemas();
+    test_malformed();
+    compare_json(list[0]);
+
+    for (int i = 0; i < count; ++i)
+        data_free(list[i]);
+    free(list);
+    return checks_result();
+}
@@ -0,0 +1,486 @@
+/*
+ * Check and benchmark the compiled flex decoder matchers
+ *
+ * Loads every spec from a decoders.cfg and runs it against a corpus of
+ * packages, both through the compiled flex decoder and through a plain
+ * reference interpreter of the spec, compares the decisions and the
+ * resulting rows and prints the throughput of each, once for the matchers
+ * alone and once including the output of the decoded rows.
+ *
+ * The corpus is generated from the specs (matches, near misses and noise),
+ * recorded packages can be replayed from a file with one bitbuffer code
+ * per line, e.g. "{25}ebeaaa8 {25}ebeaaa8".
+ *
+ * Usage: flex-test <decoders.cfg> [<corpus file>]
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "rtl_433.h"
+#include "optparse.h"
+#include "util.h"
+#include "test_check.h"
+
+#define MAX_SPECS 8
+#define GENERATED_PACKAGES 2000
+#define MAX_PACKAGES 10000
+#define ROUNDS 20
+
+r_device *flex_create_device(char *spec);
+struct flex_params *flex_device_params(r_device const *dev);
+int flex_match(struct flex_params *params, bitbuffer_t *bitbuffer, int *match_count);
+
+int debug_output = 0;
+float sample_file_pos = -1;
+
+static int last_count;
+static unsigned outputs;
+
+void data_acquired_handler(data_t *data)
+{
+    for (data_t *d = data; d; d = d->next) {
+        if (!strcmp(d->key, "count"))
+            last_count = *(int *)d->value;
+    }
+    outputs++;
+    data_free(data);
+}
+
+// The spec as interpreted by the reference
+struct ref_spec {
+    char name[64];
+    unsigned min_rows, max_rows;
+    unsigned min_bits, max_bits;
+    unsigned min_repeats, max_repeats;
+    unsigned invert;
+    unsigned match_len;
+    bitrow_t match_bits;
+    unsigned preamble_len;
+    bitrow_t preamble_bits;
+};
+
+static unsigned parse_bits(const char *code, bitrow_t bitrow)
+{
+    bitbuffer_t bits = {0};
+    bitbuffer_parse(&bits, code);
+    memcpy(bitrow, bits.bb[0], sizeof(bitrow_t));
+    return bits.bits_per_row[0];
+}
+
+static void ref_parse(struct ref_spec *spec, char const *line)
+{
+    memset(spec, 0, sizeof(*spec));
+    snprintf(spec->name, sizeof(spec->name), "%.*s", (int)strcspn(line, ":"), line);
+
+    char *copy = strdup(line);
+    char *c = strchr(copy, ',');
+    char *key, *val;
+    if (c) {
+        c++;
+        while (getkwargs(&c, &key, &val)) {
+            unsigned v = val ? atoi(val) : 0;
+            if (!strcasecmp(key, "bits>"))
+                spec->min_bits = v;
+            else if (!strcasecmp(key, "bits<"))
+                spec->max_bits = v;
+            else if (!strcasecmp(key, "bits"))
+                spec->min_bits = spec->max_bits = v;
+            else if (!strcasecmp(key, "rows>"))
+                spec->min_rows = v;
+            else if (!strcasecmp(key, "rows<"))
+                spec->max_rows = v;
+            else if (!strcasecmp(key, "rows"))
+                spec->min_rows = spec->max_rows = v;
+            else if (!strcasecmp(key, "repeats>"))
+                spec->min_repeats = v;
+            else if (!strcasecmp(key, "repeats<"))
+                spec->max_repeats = v;
+            else if (!strcasecmp(key, "repeats"))
+                spec->min_repeats = spec->max_repeats = v;
+            else if (!strcasecmp(key, "invert"))
+                spec->invert = val ? v : 1;
+            else if (!strcasecmp(key, "match"))
+                spec->match_len = parse_bits(val, spec->match_bits);
+            else if (!strcasecmp(key, "preamble"))
+                spec->preamble_len = parse_bits(val, spec->preamble_bits);
+        }
+    }
+    free(copy);
+
+    if (spec->min_bits < spec->match_len)
+        spec->min_bits = spec->match_len;
+    if (spec->min_bits > 0 && spec->min_repeats < 1)
+        spec->min_repeats = 1;
+}
+
+// The generic interpretation: each check in spec order on every package.
+// The preamble is only found here, the output aligns at it.
+static int ref_check(struct ref_spec *spec, bitbuffer_t *bitbuffer, int *count, unsigned *preamble_pos)
+{
+    int match_count = 0;
+    int i;
+
+    if ((bitbuffer->num_rows < spec->min_rows)
+            || (spec->max_rows && bitbuffer->num_rows > spec->max_rows))
+        return 0;
+
+    for (i = 0; i < bitbuffer->num_rows; i++) {
+        if ((bitbuffer->bits_per_row[i] >= spec->min_bits)
+                && (!spec->max_bits || bitbuffer->bits_per_row[i] <= spec->max_bits))
+            match_count++;
+    }
+    if (!match_count)
+        return 0;
+
+    int r = -1;
+    for (i = 0; i < bitbuffer->num_rows && r < 0; i++) {
+        unsigned repeats = count_repeats(bitbuffer, i);
+        if (bitbuffer->bits_per_row[i] >= spec->min_bits
+                && (!spec->max_bits || bitbuffer->bits_per_row[i] <= spec->max_bits)
+                && repeats >= spec->min_repeats
+                && (!spec->max_repeats || repeats <= spec->max_repeats))
+            r = i;
+    }
+    if (r < 0)
+        return 0;
+    if (spec->min_repeats || spec->max_repeats)
+        match_count = count_repeats(bitbuffer, r);
+
+    if (spec->invert)
+        bitbuffer_invert(bitbuffer);
+
+    if (spec->match_len) {
+        match_count = 0;
+        for (i = 0; i < bitbuffer->num_rows; i++) {
+            if (bitbuffer_search(bitbuffer, i, 0, spec->match_bits, spec->match_len) < bitbuffer->bits_per_row[i])
+                match_count++;
+        }
+        if (!match_count)
+            return 0;
+    }
+
+    if (spec->preamble_len) {
+        match_count = 0;
+        for (i = 0; i < bitbuffer->num_rows; i++) {
+            preamble_pos[i] = bitbuffer_search(bitbuffer, i, 0, spec->preamble_bits, spec->preamble_len);
+            if (preamble_pos[i] < bitbuffer->bits_per_row[i])
+                match_count++;
+        }
+        if (!match_count)
+            return 0;
+    }
+
+    *count = match_count;
+    return 1;
+}
+
+// The output as the flex decoder did before compiling, handed on like the compiled decoder does
+static void ref_output(struct ref_spec *spec, bitbuffer_t *bitbuffer, int match_count, unsigned const *preamble_pos)
+{
+    int i;
+    bitrow_t tmp;
+
+    if (spec->preamble_len) {
+        for (i = 0; i < bitbuffer->num_rows; i++) {
+            unsigned pos = preamble_pos[i];
+            if (pos < bitbuffer->bits_per_row[i]) {
+                pos += spec->preamble_len;
+                unsigned len = bitbuffer->bits_per_row[i] - pos;
+                bitbuffer_extract_bytes(bitbuffer, i, pos, tmp, len);
+                memcpy(bitbuffer->bb[i], tmp, (len + 7) / 8);
+                bitbuffer->bits_per_row[i] = len;
+            }
+        }
+    }
+
+    data_t *row_data[BITBUF_ROWS];
+    char *row_codes[BITBUF_ROWS];
+    char row_bytes[BITBUF_COLS * 2 + 1];
+    char time_str[LOCAL_TIME_BUFLEN];
+    local_time_str(0, time_str);
+    for (i = 0; i < bitbuffer->num_rows; i++) {
+        row_bytes[0] = '\0';
+        for (int col = 0; col < (bitbuffer->bits_per_row[i] + 7) / 8; ++col) {
+            sprintf(&row_bytes[2 * col], "%02x", bitbuffer->bb[i][col]);
+        }
+        row_bytes[2 * (bitbuffer->bits_per_row[i] + 3) / 8] = '\0';
+        row_data[i] = data_make(
+                "len", "", DATA_INT, bitbuffer->bits_per_row[i],
+                "data", "", DATA_STRING, row_bytes,
+                NULL);
+        row_codes[i] = malloc(5 + BITBUF_COLS * 2 + 1);
+        sprintf(row_codes[i], "{%d}%s", bitbuffer->bits_per_row[i], row_bytes);
+    }
+    data_t *data = data_make(
+            "time", "", DATA_STRING, time_str,
+            "model", "", DATA_STRING, spec->name,
+            "count", "", DATA_INT, match_count,
+            "num_rows", "", DATA_INT, bitbuffer->num_rows,
+            "rows", "", DATA_ARRAY, data_array(bitbuffer->num_rows, DATA_DATA, row_data),
+            "codes", "", DATA_ARRAY, data_array(bitbuffer->num_rows, DATA_STRING, row_codes),
+            NULL);
+    data_acquired_handler(data);
+    for (i = 0; i < bitbuffer->num_rows; i++) {
+        free(row_codes[i]);
+    }
+}
+
+static int ref_match(struct ref_spec *spec, bitbuffer_t *bitbuffer, int *count)
+{
+    unsigned preamble_pos[BITBUF_ROWS];
+    if (!ref_check(spec, bitbuffer, count, preamble_pos))
+        return 0;
+    ref_output(spec, bitbuffer, *count, preamble_pos);
+    return 1;
+}
+
+static void copy_bits(bitbuffer_t *dst, bitbuffer_t const *src)
+{
+    dst->num_rows = src->num_rows;
+    memcpy(dst->bits_per_row, src->bits_per_row, sizeof(src->bits_per_row));
+    memcpy(dst->bb, src->bb, src->num_rows * sizeof(bitrow_t));
+}
+
+static void put_bits(uint8_t *row, unsigned pos, uint8_t const *bits, unsigned len, int invert)
+{
+    for (unsigned i = 0; i < len; ++i) {
+        unsigned bit = (bits[i / 8] >> (7 - i % 8) & 1) ^ (invert ? 1 : 0);
+        uint8_t m = 0x80 >> ((pos + i) % 8);
+        row[(pos + i) / 8] = bit ? row[(pos + i) / 8] | m : row[(pos + i) / 8] & ~m;
+    }
+}
+
+static void random_row(bitbuffer_t *bits, unsigned row, unsigned len)
+{
+    memset(bits->bb[row], 0, sizeof(bitrow_t));
+    for (unsigned i = 0; i < (len + 7) / 8; ++i)
+        bits->bb[row][i] = rand() & 0xff;
+    if (len % 8)
+        bits->bb[row][len / 8] &= 0xff << (8 - len % 8);
+    bits->bits_per_row[row] = len;
+}
+
+// A package the spec should match, or nearly match
+static void generate_match(struct ref_spec *spec, bitbuffer_t *bits, int near_miss)
+{
+    unsigned rows = spec->min_rows;
+    if (rows < spec->min_repeats)
+        rows = spec->min_repeats;
+    if (rows < 1)
+        rows = 1;
+    unsigned len = spec->min_bits ? spec->min_bits : 24 + (unsigned)rand() % 40;
+    if (spec->preamble_len && !spec->min_bits)
+        len += spec->preamble_len;
+
+    memset(bits, 0, sizeof(*bits));
+    bits->num_rows = rows;
+    random_row(bits, 0, len);
+    if (spec->match_len)
+        put_bits(bits->bb[0], rand() % (len - spec->match_len + 1), spec->match_bits, spec->match_len, spec->invert);
+    if (spec->preamble_len && len >= spec->preamble_len)
+        put_bits(bits->bb[0], 0, spec->preamble_bits, spec->preamble_len, spec->invert);
+    for (unsigned r = 1; r < rows; ++r) {
+        memcpy(bits->bb[r], bits->bb[0], sizeof(bitrow_t));
+        bits->bits_per_row[r] = len;
+    }
+
+    if (near_miss) {
+        unsigned r = rand() % rows;
+        if (rand() % 2) {
+            bits->bb[r][rand() % ((len + 7) / 8)] ^= 0x80 >> (rand() % 8);
+        } else {
+            random_row(bits, r, len + 1);
+        }
+    }
+}
+
+static void generate_noise(bitbuffer_t *bits)
+{
+    memset(bits, 0, sizeof(*bits));
+    bits->num_rows = 1 + rand() % BITBUF_ROWS;
+    for (unsigned r = 0; r < bits->num_rows; ++r)
+        random_row(bits, r, 1 + rand() % 120);
+}
+
+int main(int argc, char **argv)
+{
+    struct ref_spec specs[MAX_SPECS];
+    r_device *devices[MAX_SPECS];
+    unsigned num_specs = 0;
+    char line[1024];
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <decoders.cfg> [<corpus file>]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), file) && num_specs < MAX_SPECS) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *spec = line + strspn(line, " \t");
+        if (!*spec || *spec == '#')
+            continue;
+        ref_parse(&specs[num_specs], spec);
+        devices[num_specs] = flex_create_device(spec);
+        num_specs++;
+    }
+    fclose(file);
+
+    bitbuffer_t *corpus = calloc(MAX_PACKAGES, sizeof(bitbuffer_t));
+    bitbuffer_t *work = malloc(sizeof(bitbuffer_t));
+    bitbuffer_t *expect = malloc(sizeof(bitbuffer_t));
+    if (!corpus || !work || !expect)
+        return 1;
+    unsigned num_packages = 0;
+
+    if (argc > 2) {
+        file = fopen(argv[2], "r");
+        if (!file) {
+            fprintf(stderr, "Failed to open %s\n", argv[2]);
+            return 1;
+        }
+        while (fgets(line, sizeof(line), file) && num_packages < MAX_PACKAGES) {
+            line[strcspn(line, "\r\n#")] = '\0';
+            if (line[strspn(line, " \t")])
+                bitbuffer_parse(&corpus[num_packages++], line);
+        }
+        fclose(file);
+    }
+
+    srand(1);
+    for (unsigned i = 0; i < GENERATED_PACKAGES && num_packages < MAX_PACKAGES && num_specs; ++i) {
+        struct ref_spec *spec = &specs[rand() % num_specs];
+        switch (i % 4) {
+        case 0:
+            generate_match(spec, &corpus[num_packages++], 0);
+            break;
+        case 1:
+            generate_match(spec, &corpus[num_packages++], 1);
+            break;
+        default:
+            generate_noise(&corpus[num_packages++]);
+        }
+    }
+
+    // Check the compiled matchers against the reference
+    for (unsigned s = 0; s < num_specs; ++s) {
+        unsigned matched = 0;
+        for (unsigned p = 0; p < num_packages; ++p) {
+            int count = 0;
+            copy_bits(expect, &corpus[p]);
+            int ref = ref_match(&specs[s], expect, &count);
+
+            unsigned before = outputs;
+            copy_bits(work, &corpus[p]);
+            devices[s]->json_callback(work);
+            int got = outputs != before;
+
+            if (ref != got || (ref && count != last_count)) {
+                fprintf(stderr, "%s: package %u: reference %d (count %d), compiled %d (count %d)\n",
+                        specs[s].name, p, ref, count, got, last_count);
+                errors++;
+            } else if (ref) {
+                matched++;
+                for (unsigned r = 0; r < expect->num_rows; ++r) {
+                    if (expect->bits_per_row[r] != work->bits_per_row[r]
+                            || memcmp(expect->bb[r], work->bb[r], (expect->bits_per_row[r] + 7) / 8)) {
+                        fprintf(stderr, "%s: package %u: row %u differs\n", specs[s].name, p, r);
+                        errors++;
+                        break;
+                    }
+                }
+            }
+        }
+        printf("%-20s matched %u of %u packages\n", specs[s].name, matched, num_packages);
+    }
+
+    // Throughput, every package through every spec: the matchers alone, then with the output
+    struct flex_params *params[MAX_SPECS];
+    for (unsigned s = 0; s < num_specs; ++s)
+        params[s] = flex_device_params(devices[s]);
+    double kpackages = (double)num_packages * num_specs * ROUNDS / 1e3;
+
+    double start = now();
+    unsigned ref_matches = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (unsigned p = 0; p < num_packages; ++p) {
+            for (unsigned s = 0; s < num_specs; ++s) {
+                int count;
+                unsigned preamble_pos[BITBUF_ROWS];
+                copy_bits(work, &corpus[p]);
+                ref_matches += ref_check(&specs[s], work, &count, preamble_pos);
+            }
+        }
+    }
+    double ref_secs = now() - start;
+
+    start = now();
+    unsigned matches = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (unsigned p = 0; p < num_packages; ++p) {
+            for (unsigned s = 0; s < num_specs; ++s) {
+                int count;
+                copy_bits(work, &corpus[p]);
+                matches += flex_match(params[s], work, &count);
+            }
+        }
+    }
+    double compiled_secs = now() - start;
+
+    if (matches != ref_matches) {
+        fprintf(stderr, "match count differs: reference %u, compiled %u\n", ref_matches, matches);
+        errors++;
+    }
+    printf("%u specs, %u packages, matcher only: reference %.0f k/s, compiled %.0f k/s\n",
+            num_specs, num_packages, kpackages / ref_secs, kpackages / compiled_secs);
+
+    start = now();
+    outputs = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (unsigned p = 0; p < num_packages; ++p) {
+            for (unsigned s = 0; s < num_specs; ++s) {
+                int count;
+                copy_bits(work, &corpus[p]);
+                ref_match(&specs[s], work, &count);
+            }
+        }
+    }
+    ref_secs = now() - start;
+    unsigned ref_outputs = outputs;
+
+    start = now();
+    outputs = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (unsigned p = 0; p < num_packages; ++p) {
+            for (unsigned s = 0; s < num_specs; ++s) {
+                copy_bits(work, &corpus[p]);
+                devices[s]->json_callback(work);
+            }
+        }
+    }
+    compiled_secs = now() - start;
+
+    if (outputs != ref_outputs || outputs != ref_matches) {
+        fprintf(stderr, "output count differs: reference %u, compiled %u\n", ref_outputs, outputs);
+        errors++;
+    }
+    printf("%u specs, %u packages, matcher and output: reference %.0f k/s, compiled %.0f k/s\n",
+            num_specs, num_packages, kpackages / ref_secs, kpackages / compiled_secs);
+
+    free(corpus);
+    free(work);
+    free(expect);
+    return checks_result();
+}
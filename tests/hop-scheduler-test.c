@@ -0,0 +1,72 @@
+/*
+ * Test for the frequency hop scheduler
+ *
+ * Feeds blocks of the size the async reader uses while hopping at the
+ * default sample rate through a few hops and checks the samples discarded
+ * after each retune: the blocks the reader had queued, then the settle time.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "rtl_433.h"
+#include "hop_scheduler.h"
+#include "test_check.h"
+
+float sample_file_pos = -1;
+
+int main(void)
+{
+    uint32_t const frequencies[] = {433920000, 868300000, 915000000};
+    int const dwell_secs[] = {1};
+    uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
+    hop_scheduler_t hop;
+
+    unsigned block_size = hop_scheduler_block_size(samp_rate);
+    CHECK(block_size % 512 == 0);
+    CHECK(block_size >= samp_rate * 2 * HOP_BLOCK_MS / 1000);
+    CHECK(block_size < samp_rate * 2 * HOP_BLOCK_MS / 1000 + 512);
+    CHECK(hop_scheduler_block_size(1) == 512);
+
+    hop_scheduler_init(&hop, frequencies, dwell_secs, 1, 3, samp_rate, HOP_ASYNC_BUF_NUMBER,
+            DEFAULT_HOP_SETTLE_MS, 0);
+    unsigned block = block_size / 2; // samples
+    uint64_t per_hop = (uint64_t)HOP_ASYNC_BUF_NUMBER * block + samp_rate * DEFAULT_HOP_SETTLE_MS / 1000;
+    // the old frequency held in the reader's buffers and the settle time, a few ms at most
+    CHECK(per_hop * 1000 / samp_rate <= HOP_ASYNC_BUF_NUMBER * (HOP_BLOCK_MS + 1) + DEFAULT_HOP_SETTLE_MS);
+
+    for (int hops = 0; hops < 3; ++hops) {
+        unsigned current = hop.current;
+        uint64_t discarded = 0;
+        unsigned blocks = 0;
+        // a dwell, the retune while the reader keeps delivering, and the next dwell until it is due
+        for (;;) {
+            unsigned discard = hop_scheduler_settle(&hop, block);
+            discarded += discard;
+            blocks++;
+            if (hop_scheduler_update(&hop, block - discard, 0))
+                break;
+        }
+        CHECK(hop.current == current);
+        if (hops == 0)
+            CHECK(discarded == 0);
+        else
+            CHECK(discarded == per_hop);
+        CHECK((uint64_t)blocks * block >= samp_rate);
+
+        CHECK(hop_scheduler_pending(&hop));
+        CHECK(hop_scheduler_retune(&hop) == frequencies[(current + 1) % 3]);
+        hop_scheduler_retuned(&hop);
+        CHECK(hop.current == (current + 1) % 3);
+    }
+    CHECK(hop.channels[1].samples_discarded == per_hop);
+    CHECK(hop.channels[2].samples_discarded == per_hop);
+    hop_scheduler_free(&hop);
+
+    return checks_result();
+}
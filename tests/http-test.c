@@ -0,0 +1,251 @@
+/*
+ * Test for the embedded HTTP server and the latest records output
+ *
+ * Fetches published documents over keep-alive and pipelined connections,
+ * checks HEAD and the error responses, a body larger than the socket
+ * buffers, that a republished document is served on the next request,
+ * and that the latest records output keeps one record per model and id.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "data.h"
+#include "http_server.h"
+#include "test_check.h"
+
+static char port[8];
+
+static int connect_server(void)
+{
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", port, &hints, &res))
+        return -1;
+    int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sock >= 0 && connect(sock, res->ai_addr, res->ai_addrlen) < 0) {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+static void send_all(int sock, char const *str)
+{
+    size_t len = strlen(str);
+    while (len) {
+        ssize_t n = send(sock, str, len, 0);
+        if (n <= 0)
+            return;
+        str += n;
+        len -= n;
+    }
+}
+
+typedef struct {
+    int status;
+    int close;                  // the server said it closes the connection
+    size_t len;
+    char body[256 * 1024];
+} response_t;
+
+static response_t response;
+
+// Read one response, returns -1 if the connection closed or it was malformed
+static int read_response(int sock, int head_only)
+{
+    static char buf[sizeof(response.body) + 1024];
+    size_t len = 0;
+    char *end = NULL;
+    while (!end) {
+        ssize_t n = recv(sock, buf + len, 1, 0); // byte by byte, so nothing of the next response is read
+        if (n <= 0)
+            return -1;
+        len += n;
+        buf[len] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+    }
+    char *length = strstr(buf, "Content-Length: ");
+    if (sscanf(buf, "HTTP/1.1 %d", &response.status) != 1 || !length)
+        return -1;
+    response.close = strstr(buf, "Connection: close") != NULL;
+    response.len = strtoul(length + 16, NULL, 10);
+    if (response.len >= sizeof(response.body))
+        return -1;
+    size_t body_len = head_only ? 0 : response.len;
+    for (size_t got = 0; got < body_len;) {
+        ssize_t n = recv(sock, response.body + got, body_len - got, 0);
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+    response.body[body_len] = '\0';
+    return 0;
+}
+
+static int body_is(char const *expected)
+{
+    return response.len == strlen(expected) && memcmp(response.body, expected, response.len) == 0;
+}
+
+static void test_requests(http_server_t *server)
+{
+    char const *metrics = "rtl_433_blocks_total 1\n";
+    CHECK(http_server_publish(server, "/metrics", "text/plain; version=0.0.4", metrics, strlen(metrics)) == 0);
+    CHECK(http_server_publish(server, "/latest", "application/json", "[\n]\n", 4) == 0);
+
+    // keep-alive, several requests on one connection
+    int sock = connect_server();
+    CHECK(sock >= 0);
+    send_all(sock, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    CHECK(read_response(sock, 0) == 0);
+    CHECK(response.status == 200 && !response.close);
+    CHECK(body_is(metrics));
+    send_all(sock, "GET /latest?pretty=1 HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    CHECK(read_response(sock, 0) == 0);
+    CHECK(response.status == 200);
+    CHECK(body_is("[\n]\n"));
+
+    // a republished document is served on the next request
+    metrics = "rtl_433_blocks_total 2\n";
+    CHECK(http_server_publish(server, "/metrics", "text/plain; version=0.0.4", metrics, strlen(metrics)) == 0);
+    send_all(sock, "HEAD /metrics HTTP/1.1\r\n\r\n");
+    CHECK(read_response(sock, 1) == 0);
+    CHECK(response.status == 200 && response.len == strlen(metrics));
+    send_all(sock, "GET /metrics HTTP/1.1\r\n\r\n");
+    CHECK(read_response(sock, 0) == 0);
+    CHECK(body_is(metrics));
+
+    // pipelined, answered in order
+    send_all(sock, "GET /nothing HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\nGET /metrics HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(read_response(sock, 0) == 0);
+    CHECK(response.status == 404);
+    CHECK(read_response(sock, 0) == 0);
+    CHECK(response.status == 200);
+    CHECK(strstr(response.body, "/metrics\n") && strstr(response.body, "/latest\n"));
+    CHECK(read_response(sock, 0) == 0);
+    CHECK(response.status == 200 && response.close);
+    CHECK(body_is(metrics));
+    CHECK(read_response(sock, 0) == -1);
+    close(sock);
+
+    // HTTP/1.0 closes unless asked to keep alive
+    sock = connect_server();
+    send_all(sock, "GET /metrics HTTP/1.0\r\n\r\n");
+    CHECK(read_response(sock, 0) == 0);
+    CHECK(response.status == 200 && response.close);
+    close(sock);
+
+    // only GET and HEAD
+    sock = connect_server();
+    send_all(sock, "POST /metrics HTTP/1.1\r\nContent-Length: 0\r\n\r\n");
+    CHECK(read_response(sock, 0) == 0);
+    CHECK(response.status == 405 && response.close);
+    close(sock);
+
+    sock = connect_server();
+    send_all(sock, "hello\r\n\r\n");
+    CHECK(read_response(sock, 0) == 0);
+    CHECK(response.status == 400);
+    close(sock);
+
+    CHECK(http_server_requests(server) == 9); // the bad request is not counted
+}
+
+// A body larger than the socket buffers is written as the client reads
+static void test_large_body(http_server_t *server)
+{
+    size_t len = sizeof(response.body) - 1;
+    char *body = malloc(len);
+    for (size_t i = 0; i < len; ++i)
+        body[i] = 'a' + i % 26;
+    CHECK(http_server_publish(server, "/large", "text/plain", body, len) == 0);
+
+    int sock = connect_server();
+    CHECK(sock >= 0);
+    for (int i = 0; i < 3; ++i) {
+        send_all(sock, "GET /large HTTP/1.1\r\n\r\n");
+        CHECK(read_response(sock, 0) == 0);
+        CHECK(response.status == 200 && response.len == len);
+        CHECK(memcmp(response.body, body, len) == 0);
+    }
+    close(sock);
+    free(body);
+}
+
+static void print_record(struct data_output *output, char const *model, int id, double temperature)
+{
+    data_t *data = data_make(
+            "model",         "", DATA_STRING, model,
+            "id",            "", DATA_INT, id,
+            "temperature_C", "", DATA_DOUBLE, temperature,
+            NULL);
+    data_output_print(output, data);
+    data_free(data);
+}
+
+static void test_latest(void)
+{
+    char const *doc;
+    size_t len;
+
+    struct data_output *output = data_output_latest_create(2);
+    CHECK(output);
+    CHECK(data_output_latest_render(output, &doc, &len) == 1);
+    CHECK(len == 4 && memcmp(doc, "[\n]\n", 4) == 0);
+    CHECK(data_output_latest_render(output, &doc, &len) == 0);
+
+    print_record(output, "Test-sensor", 1, 20.0);
+    print_record(output, "Test-sensor", 2, 10.0);
+    print_record(output, "Test-sensor", 1, 21.5);
+    data_t *stats = data_make("enabled", "", DATA_INT, 1, NULL);
+    data_output_print(output, stats); // no model, not kept
+    data_free(stats);
+    CHECK(data_output_latest_render(output, &doc, &len) == 1);
+    char const *expected = "[\n"
+            "{\"model\" : \"Test-sensor\", \"id\" : 1, \"temperature_C\" : 21.500},\n"
+            "{\"model\" : \"Test-sensor\", \"id\" : 2, \"temperature_C\" : 10.000}\n"
+            "]\n";
+    CHECK(len == strlen(expected) && memcmp(doc, expected, len) == 0);
+
+    // full, the one updated longest ago is replaced
+    print_record(output, "Other-sensor", 2, 5.0);
+    CHECK(data_output_latest_render(output, &doc, &len) == 1);
+    CHECK(strstr(doc, "\"id\" : 1, \"temperature_C\" : 21.500"));
+    CHECK(strstr(doc, "Other-sensor"));
+    CHECK(!strstr(doc, "10.000"));
+
+    struct data_output *json = data_output_json_create(stdout);
+    CHECK(data_output_latest_render(json, &doc, &len) == -1);
+    data_output_free(json);
+    data_output_free(output);
+}
+
+int main(void)
+{
+    http_server_t *server = NULL;
+    for (int i = 0; i < 100 && !server; ++i) {
+        snprintf(port, sizeof(port), "%d", 20000 + (getpid() + i * 97) % 40000);
+        server = http_server_start("127.0.0.1", port);
+    }
+    CHECK(server);
+    if (server) {
+        test_requests(server);
+        test_large_body(server);
+        http_server_free(server);
+    }
+    test_latest();
+
+    return checks_result();
+}
@@ -0,0 +1,217 @@
+/*
+ * Test for the InfluxDB line protocol output
+ *
+ * Checks the lines written for a few records over UDP (escaping, tags,
+ * nested objects, timestamps, datagram size) and the HTTP POSTs to a fake
+ * server thread (request, kept alive connection, many lines per POST).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "data.h"
+#include "test_check.h"
+
+static int listen_local(int type, char *port, size_t port_size)
+{
+    struct sockaddr_in addr = {0};
+    socklen_t addr_len = sizeof(addr);
+    struct timeval timeout = {2, 0};
+
+    int sock = socket(AF_INET, type, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock < 0
+            || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || (type == SOCK_STREAM && listen(sock, 4) < 0)
+            || getsockname(sock, (struct sockaddr *)&addr, &addr_len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    snprintf(port, port_size, "%d", ntohs(addr.sin_port));
+    return sock;
+}
+
+static void test_udp(void)
+{
+    char port[8];
+    char buf[2048];
+    int sock = listen_local(SOCK_DGRAM, port, sizeof(port));
+
+    influx_opts_t opts = {.host = "127.0.0.1", .port = port, .flush_size = 200, .flush_ms = 10};
+    struct data_output *output = data_output_influx_create(&opts);
+    CHECK(output);
+
+    data_t *data = data_make(
+            "time",          "", DATA_STRING, "2018-01-01 12:00:00",
+            "model",         "", DATA_STRING, "Some Sensor,v2",
+            "id",            "", DATA_INT, 42,
+            "temperature_C", "", DATA_FORMAT, "%.1f C", DATA_DOUBLE, -3.25,
+            "humidity",      "", DATA_INT, 55,
+            "battery",       "", DATA_STRING, "say \"OK\"",
+            "odd key=",      "", DATA_DOUBLE, 1e-7,
+            NULL);
+    CHECK(data_output_influx_set_time(output, 1514808000123456789ULL) == 0);
+    data_output_print(output, data);
+    data_free(data);
+    data = data_make(
+            "frames", "", DATA_DATA, data_make(
+                    "count",     "", DATA_INT, 7,
+                    "rate",      "", DATA_DOUBLE, 0.5,
+                    NULL),
+            NULL);
+    data_output_influx_set_time(output, 1514808001000000000ULL);
+    data_output_print(output, data);
+    data_free(data);
+    data = data_make("model", "", DATA_STRING, "No fields", NULL); // no point without fields
+    data_output_print(output, data);
+    data_free(data);
+
+    // both lines, together or in two datagrams
+    size_t got = 0;
+    ssize_t len;
+    while (got < sizeof(buf) - 1 && (len = recv(sock, buf + got, sizeof(buf) - 1 - got, 0)) > 0) {
+        got += len;
+        buf[got] = '\0';
+        if (strchr(buf, '\n') != strrchr(buf, '\n'))
+            break;
+    }
+    buf[got] = '\0';
+    char const *expected =
+            "rtl_433,model=Some\\ Sensor\\,v2,id=42 temperature_C=-3.25,humidity=55i,battery=\"say \\\"OK\\\"\",odd\\ key\\==1e-07 1514808000123456789\n"
+            "rtl_433 frames_count=7i,frames_rate=0.5 1514808001000000000\n";
+    CHECK(strcmp(buf, expected) == 0);
+    if (strcmp(buf, expected))
+        fprintf(stderr, "got:\n%sexpected:\n%s", buf, expected);
+
+    // many records: whole lines, at most flush_size per datagram
+    for (int i = 0; i < 20; ++i) {
+        data = data_make("model", "", DATA_STRING, "Batch", "id", "", DATA_INT, i, "value", "", DATA_INT, i, NULL);
+        data_output_print(output, data);
+        data_free(data);
+    }
+    data_output_free(output);
+    int lines = 0;
+    int datagrams = 0;
+    while ((len = recv(sock, buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+        datagrams++;
+        CHECK(len <= 200);
+        CHECK(buf[len - 1] == '\n');
+        for (ssize_t i = 0; i < len; ++i)
+            lines += buf[i] == '\n';
+    }
+    CHECK(lines == 20);
+    CHECK(datagrams > 1 && datagrams < 20);
+    printf("udp: 20 lines in %d datagrams\n", datagrams);
+    close(sock);
+}
+
+typedef struct {
+    int listen_sock;
+    int connections;
+    int posts;
+    int lines;
+    char path[128];
+    char auth[128];
+} http_server_t;
+
+static void *http_thread(void *arg)
+{
+    http_server_t *server = arg;
+    char buf[65536];
+
+    // the output keeps one connection open, a second one would fail the test
+    int sock = accept(server->listen_sock, NULL, NULL);
+    if (sock >= 0) {
+        server->connections++;
+        size_t len = 0;
+        for (;;) {
+            ssize_t r = recv(sock, buf + len, sizeof(buf) - 1 - len, 0);
+            if (r <= 0)
+                break;
+            len += r;
+            buf[len] = '\0';
+            char *end = strstr(buf, "\r\n\r\n");
+            char *cl = strstr(buf, "Content-Length: ");
+            if (!end || !cl)
+                continue;
+            size_t body_len = strtoul(cl + 16, NULL, 10);
+            size_t head_len = end + 4 - buf;
+            if (len < head_len + body_len)
+                continue;
+            sscanf(buf, "POST %127s", server->path);
+            char *auth = strstr(buf, "Authorization: ");
+            if (auth)
+                sscanf(auth, "Authorization: %127[^\r]", server->auth);
+            for (size_t i = head_len; i < head_len + body_len; ++i)
+                server->lines += buf[i] == '\n';
+            server->posts++;
+            char const *response = "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n";
+            send(sock, response, strlen(response), 0);
+            len -= head_len + body_len;
+            memmove(buf, buf + head_len + body_len, len);
+        }
+        close(sock);
+    }
+    return NULL;
+}
+
+static void test_http(void)
+{
+    char port[8];
+    http_server_t server = {0};
+    pthread_t thread;
+
+    server.listen_sock = listen_local(SOCK_STREAM, port, sizeof(port));
+    pthread_create(&thread, NULL, http_thread, &server);
+
+    influx_opts_t opts = {.host = "127.0.0.1", .port = port, .path = "/write?db=test", .token = "secret", .flush_size = 500, .flush_ms = 50};
+    struct data_output *output = data_output_influx_create(&opts);
+    CHECK(output);
+    // two bursts, each sent after flush_ms
+    for (int i = 0; i < 50; ++i) {
+        data_t *data = data_make("model", "", DATA_STRING, "Batch", "id", "", DATA_INT, i, "value", "", DATA_DOUBLE, i * 0.1, NULL);
+        data_output_print(output, data);
+        data_free(data);
+        if (i == 24)
+            sleep_ms(200);
+    }
+    sleep_ms(200);
+    unsigned long lines, sends, dropped;
+    CHECK(data_output_influx_counters(output, &lines, &sends, &dropped) == 0);
+    data_output_free(output);
+    pthread_join(thread, NULL);
+    close(server.listen_sock);
+
+    CHECK(server.lines == 50);
+    CHECK(lines == 50);
+    CHECK(dropped == 0);
+    CHECK(server.posts == (int)sends);
+    CHECK(server.posts > 1 && server.posts < 50);
+    CHECK(server.connections == 1);
+    CHECK(strcmp(server.path, "/write?db=test") == 0);
+    CHECK(strcmp(server.auth, "Token secret") == 0);
+    printf("http: %d lines in %d POSTs over %d connection\n", server.lines, server.posts, server.connections);
+}
+
+int main(void)
+{
+    test_udp();
+    test_http();
+
+    return checks_result();
+}
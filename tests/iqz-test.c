@@ -0,0 +1,155 @@
+/*
+ * Round trip test and benchmark for the compressed I/Q file format
+ *
+ * Without arguments a synthetic capture (receiver noise with OOK and FSK
+ * bursts) is used, otherwise each given cu8 file is benchmarked.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "iqz.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint8_t clip(double v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+static double noise(void)
+{
+    // roughly gaussian, sigma about 2 counts like an idle RTL-SDR
+    return (rand() % 256 + rand() % 256 + rand() % 256 - 382.5) / 36.0;
+}
+
+static size_t make_capture(uint8_t **buf)
+{
+    size_t len = 10 * IQZ_BLOCK_SIZE + 12345 * 2;
+    uint8_t *p = malloc(len);
+    if (!p)
+        exit(1);
+    double phase = 0;
+    for (size_t i = 0; i < len / 2; ++i) {
+        double amp = 0, freq = 0.05;
+        size_t burst = i % 300000;
+        if (burst < 40000) // OOK burst, 500 sample symbols
+            amp = (burst / 500) % 2 ? 60 : 0;
+        else if (burst > 100000 && burst < 140000) // FSK burst
+            amp = 60, freq = (burst / 250) % 2 ? 0.08 : 0.02;
+        phase += 2 * 3.14159265358979 * freq;
+        p[2 * i] = clip(127.5 + amp * cos(phase) + noise());
+        p[2 * i + 1] = clip(127.5 + amp * sin(phase) + noise());
+    }
+    *buf = p;
+    return len;
+}
+
+static int benchmark(char const *name, uint8_t const *buf, size_t len)
+{
+    iqz_meta_t meta = {433920000, 250000, 0, 1500000000000000ULL};
+    int errors = 0;
+
+    FILE *file = tmpfile();
+    if (!file) {
+        perror("tmpfile");
+        return 1;
+    }
+
+    double start = now();
+    iqz_writer_t *writer = iqz_writer_open(file, &meta);
+    // write in odd sized pieces to cross block boundaries
+    for (size_t pos = 0; pos < len; pos += 100002) {
+        size_t n = len - pos < 100002 ? len - pos : 100002;
+        if (pos == len / 2)
+            iqz_writer_set_frequency(writer, 868300000);
+        errors += iqz_write(writer, buf + pos, n) < 0;
+    }
+    errors += iqz_writer_close(writer, NULL) < 0;
+    double encode_time = now() - start;
+    long comp_len = ftell(file);
+
+    uint8_t *out = malloc(len + 1);
+    for (unsigned threads = 0; threads <= 4; threads += 2) {
+        rewind(file);
+        start = now();
+        iqz_reader_t *reader = iqz_reader_open(file, threads);
+        if (!reader) {
+            fprintf(stderr, "%s: failed to open\n", name);
+            return 1;
+        }
+        size_t n = iqz_read(reader, out, len + 1);
+        double decode_time = now() - start;
+        if (n != len || memcmp(out, buf, len) || iqz_reader_error(reader)) {
+            fprintf(stderr, "%s: round trip mismatch with %u threads (%zu of %zu bytes)\n", name, threads, n, len);
+            errors++;
+        }
+        if (iqz_reader_meta(reader)->sample_rate != meta.sample_rate)
+            errors++;
+
+        // seek into the middle of a block and compare
+        uint64_t sample = len / 2 / 3;
+        if (iqz_seek(reader, sample) < 0
+                || iqz_read(reader, out, 1000) != 1000
+                || memcmp(out, buf + sample * 2, 1000)) {
+            fprintf(stderr, "%s: seek failed with %u threads\n", name, threads);
+            errors++;
+        }
+        iqz_reader_close(reader);
+
+        printf("%s: decode %u threads %.1f MB/s\n", name, threads, len / decode_time / 1e6);
+    }
+
+    printf("%s: %zu -> %ld bytes (%.1f%%), encode %.1f MB/s\n",
+            name, len, comp_len, 100.0 * comp_len / len, len / encode_time / 1e6);
+
+    free(out);
+    fclose(file);
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    int errors = 0;
+
+    if (argc < 2) {
+        uint8_t *buf;
+        size_t len = make_capture(&buf);
+        errors += benchmark("synthetic", buf, len);
+        free(buf);
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        FILE *file = fopen(argv[i], "rb");
+        if (!file) {
+            fprintf(stderr, "Failed to open %s\n", argv[i]);
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        size_t len = ftell(file);
+        rewind(file);
+        uint8_t *buf = malloc(len);
+        if (!buf || fread(buf, 1, len, file) != len) {
+            fprintf(stderr, "Failed to read %s\n", argv[i]);
+            return 1;
+        }
+        fclose(file);
+        errors += benchmark(argv[i], buf, len & ~(size_t)1);
+        free(buf);
+    }
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,333 @@
+/*
+ * Test for the MQTT publisher and the MQTT data output
+ *
+ * A fake broker thread on a local port accepts connections, acknowledges
+ * CONNECT and QoS 1 PUBLISH packets and records what it received. It can
+ * drop a connection after a number of messages to test the reconnect.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "data.h"
+#include "mqtt_client.h"
+#include "test_check.h"
+
+#define MAX_MSGS 256
+
+typedef struct {
+    char topic[128];
+    char payload[512];
+    int flags;      // fixed header flags: DUP, QoS, RETAIN
+    unsigned id;
+    int connection;
+} broker_msg_t;
+
+typedef struct {
+    int listen_sock;
+    char port[8];
+    int connections;    // accept this many, then stop
+    int drop_after;     // close the first connection after this many publishes, none are acked, 0 = never
+    pthread_t thread;
+    broker_msg_t msgs[MAX_MSGS];
+    int num_msgs;
+    int connects;
+    int disconnects;
+    char client_id[64];
+} broker_t;
+
+static int read_full(int sock, uint8_t *buf, size_t len)
+{
+    while (len) {
+        ssize_t r = recv(sock, buf, len, 0);
+        if (r <= 0)
+            return -1;
+        buf += r;
+        len -= r;
+    }
+    return 0;
+}
+
+// Returns the packet type and fills the body, -1 on close
+static int read_packet(int sock, uint8_t *flags, uint8_t *body, size_t size, size_t *len)
+{
+    uint8_t b;
+    if (read_full(sock, &b, 1) < 0)
+        return -1;
+    *flags = b & 0x0f;
+    int type = b >> 4;
+    size_t remaining = 0;
+    int shift = 0;
+    do {
+        if (read_full(sock, &b, 1) < 0)
+            return -1;
+        remaining |= (size_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    if (remaining > size || read_full(sock, body, remaining) < 0)
+        return -1;
+    *len = remaining;
+    return type;
+}
+
+static void *broker_thread(void *arg)
+{
+    broker_t *broker = arg;
+    uint8_t body[4096];
+
+    for (int c = 0; c < broker->connections; ++c) {
+        int sock = accept(broker->listen_sock, NULL, NULL);
+        if (sock < 0)
+            return NULL;
+        int published = 0;
+        uint8_t flags;
+        size_t len;
+        int type;
+        while ((type = read_packet(sock, &flags, body, sizeof(body), &len)) >= 0) {
+            if (type == 1) { // CONNECT, client id follows the 10 byte variable header
+                size_t id_len = body[10] << 8 | body[11];
+                snprintf(broker->client_id, sizeof(broker->client_id), "%.*s", (int)id_len, (char *)body + 12);
+                uint8_t connack[4] = {0x20, 2, 0, 0};
+                send(sock, connack, sizeof(connack), 0);
+                broker->connects++;
+            } else if (type == 3 && broker->num_msgs < MAX_MSGS) { // PUBLISH
+                broker_msg_t *msg = &broker->msgs[broker->num_msgs++];
+                size_t topic_len = body[0] << 8 | body[1];
+                size_t n = 2 + topic_len;
+                snprintf(msg->topic, sizeof(msg->topic), "%.*s", (int)topic_len, (char *)body + 2);
+                msg->flags = flags;
+                msg->connection = c;
+                if (flags & 0x06) {
+                    msg->id = body[n] << 8 | body[n + 1];
+                    n += 2;
+                }
+                snprintf(msg->payload, sizeof(msg->payload), "%.*s", (int)(len - n), (char *)body + n);
+                if (c == 0 && broker->drop_after) {
+                    if (++published == broker->drop_after)
+                        break;
+                    continue;
+                }
+                if (flags & 0x06) {
+                    uint8_t puback[4] = {0x40, 2, (uint8_t)(msg->id >> 8), (uint8_t)msg->id};
+                    send(sock, puback, sizeof(puback), 0);
+                }
+            } else if (type == 12) { // PINGREQ
+                uint8_t pingresp[2] = {0xd0, 0};
+                send(sock, pingresp, sizeof(pingresp), 0);
+            } else if (type == 14) { // DISCONNECT
+                broker->disconnects++;
+                break;
+            }
+        }
+        close(sock);
+    }
+    return NULL;
+}
+
+static void broker_start(broker_t *broker, int connections, int drop_after)
+{
+    struct sockaddr_in addr = {0};
+    socklen_t addr_len = sizeof(addr);
+
+    memset(broker, 0, sizeof(*broker));
+    broker->connections = connections;
+    broker->drop_after = drop_after;
+    broker->listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (broker->listen_sock < 0
+            || bind(broker->listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(broker->listen_sock, 4) < 0
+            || getsockname(broker->listen_sock, (struct sockaddr *)&addr, &addr_len) < 0) {
+        perror("fake broker");
+        exit(1);
+    }
+    snprintf(broker->port, sizeof(broker->port), "%d", ntohs(addr.sin_port));
+    pthread_create(&broker->thread, NULL, broker_thread, broker);
+}
+
+static void broker_stop(broker_t *broker)
+{
+    pthread_join(broker->thread, NULL);
+    close(broker->listen_sock);
+}
+
+static mqtt_client_opts_t client_opts(broker_t *broker, int qos)
+{
+    mqtt_client_opts_t opts = {
+            .host       = "127.0.0.1",
+            .port       = broker->port,
+            .client_id  = "mqtt-test",
+            .keep_alive = MQTT_DEFAULT_KEEP_ALIVE,
+            .qos        = qos,
+            .backlog    = MQTT_DEFAULT_BACKLOG,
+    };
+    return opts;
+}
+
+// QoS 0: everything arrives in order, freeing flushes the queue and disconnects
+static void test_qos0(void)
+{
+    broker_t broker;
+    mqtt_client_counters_t counters;
+    char payload[32];
+
+    broker_start(&broker, 1, 0);
+    mqtt_client_opts_t opts = client_opts(&broker, 0);
+    mqtt_client_t *client = mqtt_client_create(&opts);
+    CHECK(client);
+    for (int i = 0; i < 100; ++i) {
+        snprintf(payload, sizeof(payload), "message %d", i);
+        mqtt_client_publish(client, "test/qos0", payload, strlen(payload));
+    }
+    sleep_ms(200);
+    mqtt_client_counters(client, &counters);
+    mqtt_client_free(client);
+    broker_stop(&broker);
+
+    CHECK(broker.connects == 1);
+    CHECK(broker.disconnects == 1);
+    CHECK(strcmp(broker.client_id, "mqtt-test") == 0);
+    CHECK(broker.num_msgs == 100);
+    for (int i = 0; i < broker.num_msgs; ++i) {
+        snprintf(payload, sizeof(payload), "message %d", i);
+        CHECK(strcmp(broker.msgs[i].topic, "test/qos0") == 0);
+        CHECK(strcmp(broker.msgs[i].payload, payload) == 0);
+        CHECK(broker.msgs[i].flags == 0);
+    }
+    CHECK(counters.published == 100);
+    CHECK(counters.writes >= 1 && counters.writes <= 100);
+    printf("qos 0: %d messages in %lu writes\n", broker.num_msgs, counters.writes);
+}
+
+// QoS 1: the broker drops the connection without acking, the client reconnects and sends again with DUP
+static void test_qos1_reconnect(void)
+{
+    broker_t broker;
+    mqtt_client_counters_t counters;
+    char payload[32];
+
+    broker_start(&broker, 2, 5);
+    mqtt_client_opts_t opts = client_opts(&broker, 1);
+    mqtt_client_t *client = mqtt_client_create(&opts);
+    CHECK(client);
+    for (int i = 0; i < 10; ++i) {
+        snprintf(payload, sizeof(payload), "%d", i);
+        mqtt_client_publish(client, "test/qos1", payload, strlen(payload));
+    }
+    for (int wait = 0; wait < 50; ++wait) {
+        mqtt_client_counters(client, &counters);
+        if (counters.published == 10)
+            break;
+        sleep_ms(100);
+    }
+    mqtt_client_free(client);
+    broker_stop(&broker);
+
+    CHECK(counters.published == 10);
+    CHECK(counters.connects == 2);
+    CHECK(counters.queued == 0);
+    CHECK(broker.connects == 2);
+    // all came again on the second connection, those written before as DUP
+    int acked[10] = {0};
+    int dups = 0;
+    for (int i = 0; i < broker.num_msgs; ++i) {
+        int n = atoi(broker.msgs[i].payload);
+        CHECK((broker.msgs[i].flags & 0x06) == 0x02);
+        if (broker.msgs[i].connection != 1)
+            continue;
+        if (n >= 0 && n < 10)
+            acked[n]++;
+        if (broker.msgs[i].flags & 0x08)
+            dups++;
+    }
+    for (int n = 0; n < 10; ++n)
+        CHECK(acked[n] == 1);
+    CHECK(dups >= 5);
+    printf("qos 1: %d messages, %d sent again after the reconnect\n", broker.num_msgs, dups);
+}
+
+// Without a broker the backlog keeps the newest messages
+static void test_backlog(void)
+{
+    broker_t broker;
+    mqtt_client_counters_t counters;
+
+    broker_start(&broker, 0, 0);
+    broker_stop(&broker); // the port is closed now
+    mqtt_client_opts_t opts = client_opts(&broker, 0);
+    opts.backlog = 5;
+    mqtt_client_t *client = mqtt_client_create(&opts);
+    CHECK(client);
+    for (int i = 0; i < 12; ++i)
+        mqtt_client_publish(client, "test/backlog", "x", 1);
+    mqtt_client_counters(client, &counters);
+    mqtt_client_free(client);
+
+    CHECK(counters.queued == 5);
+    CHECK(counters.dropped == 7);
+    CHECK(counters.published == 0);
+}
+
+// The data output: topics from the template, one JSON record per message
+static void test_data_output(void)
+{
+    broker_t broker;
+
+    broker_start(&broker, 1, 0);
+    mqtt_client_opts_t opts = client_opts(&broker, 0);
+    struct data_output *output = data_output_mqtt_create(&opts, "rtl_433[/model][/id]");
+    CHECK(output);
+
+    data_t *data = data_make(
+            "model",        "", DATA_STRING, "Test-sensor",
+            "id",           "", DATA_INT, 42,
+            "temperature_C", "", DATA_DOUBLE, 21.5,
+            NULL);
+    data_output_print(output, data);
+    data_free(data);
+    data = data_make(
+            "model",        "", DATA_STRING, "Odd/name #1",
+            NULL);
+    data_output_print(output, data);
+    data_free(data);
+    data = data_make(
+            "time",         "", DATA_STRING, "2018-01-01 00:00:00",
+            NULL);
+    data_output_print(output, data);
+    data_free(data);
+
+    data_output_free(output);
+    broker_stop(&broker);
+
+    CHECK(broker.num_msgs == 3);
+    CHECK(strcmp(broker.msgs[0].topic, "rtl_433/Test-sensor/42") == 0);
+    CHECK(strcmp(broker.msgs[0].payload, "{\"model\" : \"Test-sensor\", \"id\" : 42, \"temperature_C\" : 21.500}") == 0);
+    CHECK(strcmp(broker.msgs[1].topic, "rtl_433/Odd_name__1") == 0);
+    CHECK(strcmp(broker.msgs[2].topic, "rtl_433") == 0);
+    for (int i = 0; i < broker.num_msgs; ++i)
+        printf("%s %s\n", broker.msgs[i].topic, broker.msgs[i].payload);
+}
+
+int main(void)
+{
+    test_qos0();
+    test_qos1_reconnect();
+    test_backlog();
+    test_data_output();
+
+    return checks_result();
+}
@@ -4,6 +4,14 @@
 Example program for receiving and parsing sensor data from rtl_433 sent
 as MQTT network messages. Recommended way of sending rtl_433 data on network is:
 
+$ rtl_433 -U -F mqtt://localhost/home/rtl_433
+
+or with one topic per sensor (home/rtl_433/<model>/<id>, subscribe to home/rtl_433/#):
+
+$ rtl_433 -U -F "mqtt://localhost/home/rtl_433[/model][/id]"
+
+Piping through mosquitto_pub also works:
+
 $ rtl_433 -F json -U | mosquitto_pub -t home/rtl_433 -l
 
 An MQTT broker e.g. 'mosquitto' must be running on local computer
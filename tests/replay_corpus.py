@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+""" Replay a corpus of recorded captures and compare against golden records
+
+Every capture (.cu8, .cs16 or .cf32) in the corpus directory is read with
+'rtl_433 -r' and the JSON records emitted are compared with the golden
+records in the file of the same name with a .json extension, one record
+per line. Extra rtl_433 arguments for a capture (e.g. "-R 1") go in a file
+with an .args extension. A sample rate in the name ("_250k") is passed
+with -s.
+
+Reports per capture the records found, missed and extra, the CPU time of
+rtl_433 and the MS/s (mega samples per second of capture per CPU second).
+Fails if any capture is below the minimum decode rate, has extra records
+or the total throughput is below the minimum MS/s.
+
+$ replay_corpus.py --rtl_433 build/src/rtl_433 path/to/corpus
+$ replay_corpus.py --rtl_433 build/src/rtl_433 --update path/to/corpus
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+"""
+
+import argparse
+import json
+import os
+import re
+import shlex
+import subprocess
+import sys
+import time
+
+try:
+    import resource
+except ImportError:  # Windows, fall back to wall time
+    resource = None
+
+SAMPLE_SIZE = {".cu8": 2, ".cs16": 4, ".cf32": 8}  # bytes per I/Q sample
+IGNORE_FIELDS = ("time", "capture_time", "latency_us")  # differ by run or block size
+
+
+def cpu_time():
+    """ CPU time used by finished child processes """
+    if not resource:
+        return time.time()
+    usage = resource.getrusage(resource.RUSAGE_CHILDREN)
+    return usage.ru_utime + usage.ru_stime
+
+
+def normalize(record, ignore):
+    """ Comparable form of a record without the ignored fields """
+    return json.dumps({k: v for k, v in record.items() if k not in ignore}, sort_keys=True)
+
+
+def read_records(text):
+    records = []
+    for line in text.splitlines():
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            records.append(json.loads(line))
+        except ValueError:
+            records.append({"unparsable": line})
+    return records
+
+
+def replay(rtl_433, path, extra_args):
+    """ Run rtl_433 on a capture, returns records and CPU seconds """
+    cmd = [rtl_433, "-q", "-F", "json", "-r", path]
+    m = re.search(r"_(\d+)k", os.path.basename(path))
+    if m:
+        cmd += ["-s", str(int(m.group(1)) * 1000)]
+    cmd += extra_args
+    start = cpu_time()
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True)
+    secs = cpu_time() - start
+    if proc.returncode != 0:
+        raise RuntimeError("%s exited with status %d" % (" ".join(cmd), proc.returncode))
+    return read_records(proc.stdout), secs
+
+
+def compare(expected, found, ignore):
+    """ Returns matched, missed and extra record counts """
+    remaining = {}
+    for record in expected:
+        key = normalize(record, ignore)
+        remaining[key] = remaining.get(key, 0) + 1
+    matched = 0
+    extra = 0
+    for record in found:
+        key = normalize(record, ignore)
+        if remaining.get(key, 0) > 0:
+            remaining[key] -= 1
+            matched += 1
+        else:
+            extra += 1
+    return matched, len(expected) - matched, extra
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay captures and compare with golden records")
+    parser.add_argument("corpus", nargs="+", help="corpus directories or single captures")
+    parser.add_argument("--rtl_433", default="rtl_433", help="rtl_433 binary to test")
+    parser.add_argument("--min-rate", type=float, default=100.0,
+                        help="minimum percentage of golden records found per capture (default: 100)")
+    parser.add_argument("--min-msps", type=float, default=0.0,
+                        help="minimum total MS/s per CPU second (default: 0)")
+    parser.add_argument("--ignore", action="append", default=list(IGNORE_FIELDS),
+                        help="field to leave out of the comparison, may be repeated")
+    parser.add_argument("--update", action="store_true", help="write the current output as golden records")
+    parser.add_argument("--verbose", "-v", action="store_true", help="print missed and extra records")
+    args = parser.parse_args()
+
+    captures = []
+    for path in args.corpus:
+        if os.path.isdir(path):
+            captures += sorted(os.path.join(path, name) for name in os.listdir(path)
+                               if os.path.splitext(name)[1] in SAMPLE_SIZE)
+        else:
+            captures.append(path)
+    if not captures:
+        print("No captures found", file=sys.stderr)
+        return 1
+
+    failures = 0
+    total = {"expected": 0, "matched": 0, "missed": 0, "extra": 0, "samples": 0, "cpu": 0.0}
+    for capture in captures:
+        base, ext = os.path.splitext(capture)
+        extra_args = []
+        if os.path.exists(base + ".args"):
+            with open(base + ".args") as f:
+                extra_args = shlex.split(f.read())
+        samples = os.path.getsize(capture) // SAMPLE_SIZE.get(ext, 2)
+
+        try:
+            found, secs = replay(args.rtl_433, capture, extra_args)
+        except (OSError, RuntimeError) as err:
+            print("%s: %s" % (capture, err), file=sys.stderr)
+            failures += 1
+            continue
+
+        if args.update:
+            with open(base + ".json", "w") as f:
+                for record in found:
+                    f.write(json.dumps(record) + "\n")
+            print("%s: wrote %d golden records" % (capture, len(found)))
+            continue
+
+        try:
+            with open(base + ".json") as f:
+                expected = read_records(f.read())
+        except OSError:
+            print("%s: no golden records (%s.json), use --update" % (capture, base), file=sys.stderr)
+            failures += 1
+            continue
+
+        matched, missed, extra = compare(expected, found, args.ignore)
+        rate = 100.0 * matched / len(expected) if expected else 100.0
+        msps = samples / secs / 1e6 if secs > 0 else 0.0
+        print("%s: %d/%d found (%.1f %%), %d missed, %d extra, cpu %.3f s, %.2f MS/s"
+              % (capture, matched, len(expected), rate, missed, extra, secs, msps))
+        if args.verbose and (missed or extra):
+            found_keys = [normalize(r, args.ignore) for r in found]
+            expected_keys = [normalize(r, args.ignore) for r in expected]
+            for key in expected_keys:
+                if key not in found_keys:
+                    print("  missed: " + key)
+            for key in found_keys:
+                if key not in expected_keys:
+                    print("  extra:  " + key)
+        if rate < args.min_rate or extra:
+            failures += 1
+
+        total["expected"] += len(expected)
+        total["matched"] += matched
+        total["missed"] += missed
+        total["extra"] += extra
+        total["samples"] += samples
+        total["cpu"] += secs
+
+    if args.update:
+        return 1 if failures else 0
+
+    msps = total["samples"] / total["cpu"] / 1e6 if total["cpu"] > 0 else 0.0
+    rate = 100.0 * total["matched"] / total["expected"] if total["expected"] else 100.0
+    print("total: %d/%d found (%.1f %%), %d missed, %d extra, cpu %.3f s, %.2f MS/s"
+          % (total["matched"], total["expected"], rate, total["missed"], total["extra"], total["cpu"], msps))
+    if msps < args.min_msps:
+        print("throughput %.2f MS/s is below %.2f MS/s" % (msps, args.min_msps), file=sys.stderr)
+        failures += 1
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,624 @@
+/*
+ * Micro benchmarks for the DSP and decode stages
+ *
+ * Runs every stage on fixed synthetic inputs (the same on every run and
+ * every machine) and reports the best of several repetitions in ns per
+ * sample, per operation or per byte. Use -j to get JSON for comparing
+ * versions, e.g. "rtl_433_bench -j > before.json".
+ *
+ * Usage: rtl_433_bench [-j] [-s <scale>] [-f <name filter>]
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rtl_433.h"
+#include "baseband.h"
+#include "pulse_detect.h"
+#include "pulse_demod.h"
+#include "bitbuffer.h"
+#include "data.h"
+#include "util.h"
+
+#define SAMP_RATE 250000
+#define NUM_SAMPLES (1 << 18)
+#define REPEATS 5
+
+#ifdef GIT_VERSION
+#define STR_VALUE(arg) #arg
+#define STR_EXPAND(s) STR_VALUE(s)
+#define BENCH_VERSION STR_EXPAND(GIT_VERSION)
+#else
+#define BENCH_VERSION "unknown"
+#endif
+
+int debug_output = 0;
+float sample_file_pos = -1;
+
+void data_acquired_handler(data_t *data)
+{
+    data_free(data);
+}
+
+/* Fixed pseudo random numbers, rand() differs between C libraries */
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* Inputs, generated once */
+static uint8_t iq_buf[2 * NUM_SAMPLES];
+static uint16_t env_buf[NUM_SAMPLES];
+static int16_t am_buf[NUM_SAMPLES];
+static int16_t fm_buf[NUM_SAMPLES];
+
+enum { TRAIN_PWM, TRAIN_PPM, TRAIN_PCM, TRAIN_MANCHESTER, TRAIN_DMC, TRAIN_PIWM, TRAIN_OSV1, NUM_TRAINS };
+static pulse_data_t trains[NUM_TRAINS];
+
+static uint8_t message[64];
+static bitbuffer_t bitbuffer;
+static data_t *record;
+static unsigned callbacks;
+
+static int count_callback(bitbuffer_t *bits)
+{
+    callbacks += bits->num_rows;
+    return 1;
+}
+
+// OOK bursts (PWM, 250/500 us pulses) over noise, the carrier at +10 kHz so FM sees a tone
+static void make_iq(void)
+{
+    int carrier_i[25], carrier_q[25];
+    for (int i = 0; i < 25; ++i) {
+        carrier_i[i] = (int)lrint(100 * cos(2 * 3.14159265358979 * i / 25));
+        carrier_q[i] = (int)lrint(100 * sin(2 * 3.14159265358979 * i / 25));
+    }
+
+    unsigned pos = 0;
+    while (pos < NUM_SAMPLES) {
+        unsigned gap = SAMP_RATE / 20 + rng() % (SAMP_RATE / 20); // 50-100 ms of noise
+        for (unsigned i = 0; i < gap && pos < NUM_SAMPLES; ++i, ++pos) {
+            iq_buf[2 * pos] = 128 + rng() % 9 - 4;
+            iq_buf[2 * pos + 1] = 128 + rng() % 9 - 4;
+        }
+        for (unsigned bit = 0; bit < 64 && pos < NUM_SAMPLES; ++bit) {
+            unsigned high = (rng() & 1 ? 125 : 62) * SAMP_RATE / 250000; // 500 / 250 us
+            for (unsigned i = 0; i < 187 && pos < NUM_SAMPLES; ++i, ++pos) {
+                int on = i < high;
+                iq_buf[2 * pos] = 128 + (on ? carrier_i[pos % 25] : 0) + rng() % 9 - 4;
+                iq_buf[2 * pos + 1] = 128 + (on ? carrier_q[pos % 25] : 0) + rng() % 9 - 4;
+            }
+        }
+    }
+}
+
+/* Pulse trains for the demodulators, widths in samples, a message ends with a reset gap */
+
+static void add_pulse(pulse_data_t *p, int pulse, int gap)
+{
+    if (p->num_pulses < PD_MAX_PULSES) {
+        p->pulse[p->num_pulses] = pulse;
+        p->gap[p->num_pulses] = gap;
+        p->num_pulses++;
+    }
+}
+
+// alternating high and low runs, starting high
+static void add_runs(pulse_data_t *p, int const *runs, unsigned num_runs)
+{
+    for (unsigned i = 0; i + 1 < num_runs; i += 2)
+        add_pulse(p, runs[i], runs[i + 1]);
+    if (num_runs % 2)
+        add_pulse(p, runs[num_runs - 1], 1000);
+}
+
+static void end_train(pulse_data_t *p)
+{
+    p->gap[p->num_pulses - 1] = 1000; // beyond every reset_limit
+}
+
+static void make_trains(void)
+{
+    static int runs[PD_MAX_PULSES * 2];
+    unsigned n;
+
+    for (int row = 0; row < 4; ++row) {
+        for (int bit = 0; bit < 64; ++bit) {
+            int one = rng() & 1;
+            add_pulse(&trains[TRAIN_PWM], one ? 25 : 50, one ? 50 : 25);
+            add_pulse(&trains[TRAIN_PPM], 25, one ? 100 : 50);
+        }
+        trains[TRAIN_PWM].gap[trains[TRAIN_PWM].num_pulses - 1] = 300; // new row
+        trains[TRAIN_PPM].gap[trains[TRAIN_PPM].num_pulses - 1] = 300;
+    }
+    end_train(&trains[TRAIN_PWM]);
+    end_train(&trains[TRAIN_PPM]);
+
+    // PCM (RZ): a 25 sample pulse for each 1 in a 50 sample period
+    int gap = 0;
+    for (int bit = 0; bit < 256; ++bit) {
+        if (rng() & 1) {
+            if (trains[TRAIN_PCM].num_pulses)
+                trains[TRAIN_PCM].gap[trains[TRAIN_PCM].num_pulses - 1] += gap;
+            add_pulse(&trains[TRAIN_PCM], 25, 25);
+            gap = 0;
+        } else {
+            gap += 50;
+        }
+    }
+    end_train(&trains[TRAIN_PCM]);
+
+    // Manchester: half bits of 25 samples, merged into runs
+    n = 0;
+    int level = 1;
+    runs[n++] = 25; // leading zero bit
+    for (int bit = 0; bit < 256; ++bit) {
+        int first = rng() & 1;
+        int halves[2] = {first, !first};
+        for (int h = 0; h < 2; ++h) {
+            if (halves[h] == level)
+                runs[n - 1] += 25;
+            else
+                runs[n++] = 25;
+            level = halves[h];
+        }
+    }
+    add_runs(&trains[TRAIN_MANCHESTER], runs, n);
+    end_train(&trains[TRAIN_MANCHESTER]);
+
+    // Differential Manchester: a 1 is two 25 sample runs, a 0 one 50 sample run
+    n = 0;
+    for (int bit = 0; bit < 256; ++bit) {
+        if (rng() & 1) {
+            runs[n++] = 25;
+            runs[n++] = 25;
+        } else {
+            runs[n++] = 50;
+        }
+    }
+    add_runs(&trains[TRAIN_DMC], runs, n);
+    end_train(&trains[TRAIN_DMC]);
+
+    // PIWM: runs of one to four 25 sample bits
+    n = 0;
+    for (int i = 0; i < 256; ++i)
+        runs[n++] = 25 * (1 + rng() % 4);
+    add_runs(&trains[TRAIN_PIWM], runs, n);
+    end_train(&trains[TRAIN_PIWM]);
+
+    // Oregon Scientific v1: 12 preamble pulses, a sync and Manchester data (1 MHz widths)
+    for (int i = 0; i < 12; ++i)
+        add_pulse(&trains[TRAIN_OSV1], 400, i < 11 ? 250 : 450);
+    add_pulse(&trains[TRAIN_OSV1], 1200, 1200);
+    // a short pulse and gap add a 1, a long pulse and gap a 1 and a 0, the message has 32 bits
+    for (int bits = 0; bits < 31;) {
+        int longer = bits < 30 && rng() & 1;
+        add_pulse(&trains[TRAIN_OSV1], longer ? 800 : 350, longer ? 600 : 350);
+        bits += longer ? 2 : 1;
+    }
+    add_pulse(&trains[TRAIN_OSV1], 350, 350);
+    trains[TRAIN_OSV1].gap[trains[TRAIN_OSV1].num_pulses - 1] = 5000;
+}
+
+/* Benchmarks, each runs its stage iters times */
+
+static void bench_envelope(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        envelope_detect(iq_buf, env_buf, NUM_SAMPLES);
+}
+
+static void bench_low_pass(unsigned iters)
+{
+    FilterState state = {0};
+    for (unsigned i = 0; i < iters; ++i)
+        baseband_low_pass_filter(env_buf, am_buf, NUM_SAMPLES, &state);
+}
+
+static void bench_demod_fm(unsigned iters)
+{
+    DemodFM_State state = {0};
+    for (unsigned i = 0; i < iters; ++i)
+        baseband_demod_FM(iq_buf, fm_buf, NUM_SAMPLES, &state);
+}
+
+static void bench_pulse_detect(unsigned iters)
+{
+    static pulse_data_t pulses, fsk_pulses;
+    for (unsigned i = 0; i < iters; ++i) {
+        while (pulse_detect_package(am_buf, fm_buf, NUM_SAMPLES, 0, SAMP_RATE, &pulses, &fsk_pulses))
+            ;
+    }
+}
+
+struct demod_bench {
+    int (*demod)(const pulse_data_t *pulses, struct protocol_state *device);
+    int train;
+    struct protocol_state device;
+};
+
+static struct demod_bench demod_benches[] = {
+    {pulse_demod_pcm,               TRAIN_PCM,          {.short_limit = 25, .long_limit = 50, .reset_limit = 500}},
+    {pulse_demod_ppm,               TRAIN_PPM,          {.short_limit = 75, .long_limit = 200, .reset_limit = 500}},
+    {pulse_demod_pwm,               TRAIN_PWM,          {.short_limit = 37, .long_limit = 200, .reset_limit = 500}},
+    {pulse_demod_pwm_precise,       TRAIN_PWM,          {.short_limit = 25, .long_limit = 50, .gap_limit = 200, .reset_limit = 500, .tolerance = 8}},
+    {pulse_demod_manchester_zerobit, TRAIN_MANCHESTER,  {.short_limit = 25, .reset_limit = 500}},
+    {pulse_demod_dmc,               TRAIN_DMC,          {.short_limit = 25, .long_limit = 50, .reset_limit = 500, .tolerance = 8}},
+    {pulse_demod_piwm_raw,          TRAIN_PIWM,         {.short_limit = 25, .long_limit = 125, .reset_limit = 500, .tolerance = 8}},
+    {pulse_demod_piwm_dc,           TRAIN_PIWM,         {.short_limit = 25, .long_limit = 50, .reset_limit = 500, .tolerance = 8}},
+    {pulse_demod_osv1,              TRAIN_OSV1,         {.reset_limit = 2000}},
+};
+static struct demod_bench *current_demod;
+
+static void bench_pulse_demod(unsigned iters)
+{
+    struct demod_bench *b = current_demod;
+    b->device.callback = count_callback;
+    for (unsigned i = 0; i < iters; ++i)
+        b->demod(&trains[b->train], &b->device);
+}
+
+static void bench_bitbuffer_add_bit(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i) {
+        bitbuffer_clear(&bitbuffer);
+        for (unsigned row = 0; row < 8; ++row) {
+            for (unsigned bit = 0; bit < 128; ++bit)
+                bitbuffer_add_bit(&bitbuffer, message[bit / 8] >> (bit % 8) & 1);
+            bitbuffer_add_row(&bitbuffer);
+        }
+    }
+}
+
+static void fill_bitbuffer(void)
+{
+    bitbuffer_clear(&bitbuffer);
+    for (unsigned row = 0; row < 8; ++row) {
+        for (unsigned bit = 0; bit < 128; ++bit)
+            bitbuffer_add_bit(&bitbuffer, message[bit / 8] >> (bit % 8) & 1);
+        if (row < 7)
+            bitbuffer_add_row(&bitbuffer);
+    }
+}
+
+static void bench_bitbuffer_search(unsigned iters)
+{
+    uint8_t const pattern[] = {0xa5, 0x5a};
+    for (unsigned i = 0; i < iters; ++i)
+        bitbuffer_search(&bitbuffer, i % 8, 0, pattern, 16);
+}
+
+static void bench_bitbuffer_manchester(unsigned iters)
+{
+    static bitbuffer_t out;
+    for (unsigned i = 0; i < iters; ++i) {
+        bitbuffer_clear(&out);
+        bitbuffer_manchester_decode(&bitbuffer, i % 8, 0, &out, 64);
+    }
+}
+
+static void bench_bitbuffer_invert(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        bitbuffer_invert(&bitbuffer);
+}
+
+static void bench_bitbuffer_extract(unsigned iters)
+{
+    uint8_t bytes[16];
+    for (unsigned i = 0; i < iters; ++i)
+        bitbuffer_extract_bytes(&bitbuffer, i % 8, i % 7, bytes, 96);
+}
+
+static void bench_bitbuffer_find_repeated(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        bitbuffer_find_repeated_row(&bitbuffer, 3, 64);
+}
+
+static volatile unsigned crc_sink;
+
+static void bench_crc7(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        crc_sink += crc7(message, sizeof(message), 0x45, 0x00);
+}
+
+static void bench_crc8(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        crc_sink += crc8(message, sizeof(message), 0x31, 0x00);
+}
+
+static void bench_crc8le(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        crc_sink += crc8le(message, sizeof(message), 0x31, 0x00);
+}
+
+static void bench_crc16(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        crc_sink += crc16(message, sizeof(message), 0x8005, 0x0000);
+}
+
+static void bench_crc16_ccitt(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        crc_sink += crc16_ccitt(message, sizeof(message), 0x1021, 0xffff);
+}
+
+// a typical weather sensor record
+static data_t *make_record(void)
+{
+    return data_make(
+            "time",          "",             DATA_STRING, "2018-01-01 12:00:00",
+            "model",         "",             DATA_STRING, "Bench Sensor",
+            "id",            "ID",           DATA_INT, 42,
+            "channel",       "Channel",      DATA_INT, 1,
+            "battery",       "Battery",      DATA_STRING, "OK",
+            "temperature_C", "Temperature",  DATA_FORMAT, "%.02f C", DATA_DOUBLE, 21.5,
+            "humidity",      "Humidity",     DATA_FORMAT, "%u %%", DATA_INT, 55,
+            "mic",           "Integrity",    DATA_STRING, "CRC",
+            NULL);
+}
+
+static void bench_data_make(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        data_free(make_record());
+}
+
+static struct data_output *current_output;
+
+static void bench_output(unsigned iters)
+{
+    for (unsigned i = 0; i < iters; ++i)
+        data_output_print(current_output, record);
+}
+
+/* Harness */
+
+struct bench {
+    char const *name;
+    char const *unit;
+    void (*run)(unsigned iters);
+    unsigned iters;     // at scale 1
+    double units;       // samples, operations or bytes per iteration
+    struct demod_bench *demod;
+    int output;
+};
+
+enum { OUTPUT_NONE, OUTPUT_JSON, OUTPUT_KV, OUTPUT_CSV, OUTPUT_CBOR, OUTPUT_INFLUX };
+
+static struct bench benches[] = {
+    {"envelope_detect",             "ns/sample", bench_envelope,        40, NUM_SAMPLES, NULL, 0},
+    {"baseband_low_pass_filter",    "ns/sample", bench_low_pass,        40, NUM_SAMPLES, NULL, 0},
+    {"baseband_demod_FM",           "ns/sample", bench_demod_fm,        20, NUM_SAMPLES, NULL, 0},
+    {"pulse_detect_package",        "ns/sample", bench_pulse_detect,    20, NUM_SAMPLES, NULL, 0},
+    {"pulse_demod_pcm",             "ns/op", bench_pulse_demod, 20000, 1, &demod_benches[0], 0},
+    {"pulse_demod_ppm",             "ns/op", bench_pulse_demod, 20000, 1, &demod_benches[1], 0},
+    {"pulse_demod_pwm",             "ns/op", bench_pulse_demod, 20000, 1, &demod_benches[2], 0},
+    {"pulse_demod_pwm_precise",     "ns/op", bench_pulse_demod, 20000, 1, &demod_benches[3], 0},
+    {"pulse_demod_manchester_zerobit", "ns/op", bench_pulse_demod, 20000, 1, &demod_benches[4], 0},
+    {"pulse_demod_dmc",             "ns/op", bench_pulse_demod, 20000, 1, &demod_benches[5], 0},
+    {"pulse_demod_piwm_raw",        "ns/op", bench_pulse_demod, 20000, 1, &demod_benches[6], 0},
+    {"pulse_demod_piwm_dc",         "ns/op", bench_pulse_demod, 20000, 1, &demod_benches[7], 0},
+    {"pulse_demod_osv1",            "ns/op", bench_pulse_demod, 200000, 1, &demod_benches[8], 0},
+    {"bitbuffer_add_bit",           "ns/op", bench_bitbuffer_add_bit, 20000, 8 * 128, NULL, 0},
+    {"bitbuffer_search",            "ns/op", bench_bitbuffer_search, 200000, 1, NULL, 0},
+    {"bitbuffer_manchester_decode", "ns/op", bench_bitbuffer_manchester, 200000, 1, NULL, 0},
+    {"bitbuffer_invert",            "ns/op", bench_bitbuffer_invert, 200000, 1, NULL, 0},
+    {"bitbuffer_extract_bytes",     "ns/op", bench_bitbuffer_extract, 1000000, 1, NULL, 0},
+    {"bitbuffer_find_repeated_row", "ns/op", bench_bitbuffer_find_repeated, 200000, 1, NULL, 0},
+    {"crc7",                        "ns/byte", bench_crc7, 20000, sizeof(message), NULL, 0},
+    {"crc8",                        "ns/byte", bench_crc8, 20000, sizeof(message), NULL, 0},
+    {"crc8le",                      "ns/byte", bench_crc8le, 20000, sizeof(message), NULL, 0},
+    {"crc16",                       "ns/byte", bench_crc16, 20000, sizeof(message), NULL, 0},
+    {"crc16_ccitt",                 "ns/byte", bench_crc16_ccitt, 20000, sizeof(message), NULL, 0},
+    {"data_make",                   "ns/op", bench_data_make, 200000, 1, NULL, 0},
+    {"output_json",                 "ns/op", bench_output, 100000, 1, NULL, OUTPUT_JSON},
+    {"output_kv",                   "ns/op", bench_output, 100000, 1, NULL, OUTPUT_KV},
+    {"output_csv",                  "ns/op", bench_output, 100000, 1, NULL, OUTPUT_CSV},
+    {"output_cbor",                 "ns/op", bench_output, 100000, 1, NULL, OUTPUT_CBOR},
+    {"output_influx_udp",           "ns/op", bench_output, 100000, 1, NULL, OUTPUT_INFLUX},
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+// a local UDP port nobody reads, the InfluxDB output sends its datagrams there
+static int sink_sock = -1;
+static char sink_port[8];
+
+static int open_sink(void)
+{
+    struct sockaddr_in addr = {0};
+    socklen_t addr_len = sizeof(addr);
+
+    if (sink_sock >= 0)
+        return 0;
+    sink_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sink_sock < 0
+            || bind(sink_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || getsockname(sink_sock, (struct sockaddr *)&addr, &addr_len) < 0) {
+        perror("UDP sink");
+        return -1;
+    }
+    snprintf(sink_port, sizeof(sink_port), "%d", ntohs(addr.sin_port));
+    return 0;
+}
+
+static struct data_output *create_output(int output, FILE *file)
+{
+    influx_opts_t influx = {.host = "127.0.0.1", .port = sink_port, .flush_ms = INFLUX_DEFAULT_FLUSH_MS};
+
+    static char const *fields[] = {"time", "model", "id", "channel", "battery", "temperature_C", "humidity", "mic"};
+    switch (output) {
+    case OUTPUT_JSON:
+        return data_output_json_create(file);
+    case OUTPUT_KV:
+        return data_output_kv_create(file);
+    case OUTPUT_CSV:
+        return data_output_csv_create(file, fields, sizeof(fields) / sizeof(fields[0]));
+    case OUTPUT_CBOR:
+        return data_output_cbor_create(file);
+    case OUTPUT_INFLUX:
+        return open_sink() == 0 ? data_output_influx_create(&influx) : NULL;
+    default:
+        return NULL;
+    }
+}
+
+// best of REPEATS in ns per unit
+static double run_bench(struct bench *b, double scale, FILE *null_file)
+{
+    unsigned iters = (unsigned)(b->iters * scale);
+    if (iters < 1)
+        iters = 1;
+    current_demod = b->demod;
+    current_output = create_output(b->output, null_file);
+    if (b->output && !current_output) {
+        fprintf(stderr, "%s: failed to create the output\n", b->name);
+        exit(1);
+    }
+
+    b->run(iters > 10 ? iters / 10 : 1); // warm up
+    double best = 0;
+    for (int r = 0; r < REPEATS; ++r) {
+        uint64_t start = monotonic_ns();
+        b->run(iters);
+        double ns = (double)(monotonic_ns() - start) / iters / b->units;
+        if (!r || ns < best)
+            best = ns;
+    }
+
+    if (current_output)
+        data_output_free(current_output);
+    current_output = NULL;
+    return best;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: rtl_433_bench [-j] [-s <scale>] [-f <name filter>]\n"
+            "\t-j  print the results as JSON\n"
+            "\t-s  scale the number of iterations (default: 1.0)\n"
+            "\t-f  only run benchmarks with names containing the filter\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int json = 0;
+    double scale = 1.0;
+    char const *filter = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "js:f:")) != -1) {
+        switch (opt) {
+        case 'j':
+            json = 1;
+            break;
+        case 's':
+            scale = atof(optarg);
+            if (scale <= 0)
+                usage();
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    FILE *null_file = fopen("/dev/null", "w");
+    if (!null_file) {
+        fprintf(stderr, "Failed to open /dev/null\n");
+        return 1;
+    }
+
+    rng_state = 0x12345678;
+    baseband_init();
+    make_iq();
+    make_trains();
+    for (unsigned i = 0; i < sizeof(message); ++i)
+        message[i] = (uint8_t)rng();
+    fill_bitbuffer();
+    record = make_record();
+
+    // the filter and demodulation stages need their inputs
+    envelope_detect(iq_buf, env_buf, NUM_SAMPLES);
+    FilterState lp_state = {0};
+    baseband_low_pass_filter(env_buf, am_buf, NUM_SAMPLES, &lp_state);
+    DemodFM_State fm_state = {0};
+    baseband_demod_FM(iq_buf, fm_buf, NUM_SAMPLES, &fm_state);
+
+    data_t *results[NUM_BENCHES];
+    unsigned num_results = 0;
+    unsigned num_demods = 0;
+    for (unsigned i = 0; i < NUM_BENCHES; ++i) {
+        struct bench *b = &benches[i];
+        if (filter && !strstr(b->name, filter))
+            continue;
+        if (b->demod)
+            num_demods++;
+        double value = run_bench(b, scale, null_file);
+        if (!json)
+            printf("%-32s %10.2f %s\n", b->name, value, b->unit);
+        results[num_results++] = data_make(
+                "name",  "", DATA_STRING, b->name,
+                "unit",  "", DATA_STRING, b->unit,
+                "value", "", DATA_DOUBLE, value,
+                NULL);
+    }
+
+    if (!num_results) {
+        fprintf(stderr, "No benchmark matches \"%s\"\n", filter);
+        return 1;
+    }
+
+    if (json) {
+        data_t *data = data_make(
+                "version",  "", DATA_STRING, BENCH_VERSION,
+                "samples",  "", DATA_INT, NUM_SAMPLES,
+                "scale",    "", DATA_DOUBLE, scale,
+                "results",  "", DATA_ARRAY, data_array(num_results, DATA_DATA, results),
+                NULL);
+        struct data_output *output = data_output_json_create(stdout);
+        data_output_print(output, data);
+        data_output_free(output);
+        data_free(data);
+    } else {
+        for (unsigned i = 0; i < num_results; ++i)
+            data_free(results[i]);
+    }
+
+    data_free(record);
+    fclose(null_file);
+    if (num_demods && !callbacks) {
+        fprintf(stderr, "No demodulator decoded anything, the pulse trains are broken\n");
+        return 1;
+    }
+    return 0;
+}
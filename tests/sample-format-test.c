@@ -0,0 +1,163 @@
+/*
+ * Check and benchmark the I/Q sample format conversions
+ *
+ * Compares each conversion kernel with a plain reference and prints the
+ * throughput in MS/s (mega samples per second) per input format, for
+ * conversion alone and for conversion plus envelope and FM demodulation.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sample_format.h"
+#include "baseband.h"
+
+#define NUM_SAMPLES (1 << 20)
+#define ROUNDS 20
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint8_t ref_cu8(sample_format_t format, void const *in, size_t i)
+{
+    switch (format) {
+    case SAMPLE_CS8:
+        return (uint8_t)(((int8_t const *)in)[i] + 128);
+    case SAMPLE_CS16:
+        return (uint8_t)((((int16_t const *)in)[i] + 32768) / 256);
+    case SAMPLE_CF32: {
+        int v = ((float const *)in)[i] * 127 + 127; // the original reader
+        return v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+    default:
+        return ((uint8_t const *)in)[i];
+    }
+}
+
+static int16_t ref_cs16(sample_format_t format, void const *in, size_t i)
+{
+    switch (format) {
+    case SAMPLE_CS8:
+        return ((int8_t const *)in)[i] * 256;
+    case SAMPLE_CS16:
+        return ((int16_t const *)in)[i];
+    case SAMPLE_CF32: {
+        float v = ((float const *)in)[i] * 32767;
+        return v < -32767 ? -32767 : v > 32767 ? 32767 : (int16_t)v;
+    }
+    default:
+        return (((uint8_t const *)in)[i] - 128) * 256;
+    }
+}
+
+static void fill(sample_format_t format, void *in, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        int r = rand();
+        switch (format) {
+        case SAMPLE_CS8:
+            ((int8_t *)in)[i] = (int8_t)(r & 0xff);
+            break;
+        case SAMPLE_CS16:
+            ((int16_t *)in)[i] = (int16_t)(r & 0xffff);
+            break;
+        case SAMPLE_CF32:
+            ((float *)in)[i] = (r % 2400 - 1200) / 1000.0f; // include some clipping
+            break;
+        default:
+            ((uint8_t *)in)[i] = (uint8_t)(r & 0xff);
+        }
+    }
+}
+
+int main(void)
+{
+    size_t n = 2 * NUM_SAMPLES;
+    void *in = malloc(n * sizeof(float));
+    uint8_t *cu8 = malloc(n);
+    int16_t *cs16 = malloc(n * sizeof(int16_t));
+    uint16_t *env = malloc(NUM_SAMPLES * sizeof(uint16_t));
+    int16_t *fm = malloc(NUM_SAMPLES * sizeof(int16_t));
+    int errors = 0;
+
+    if (!in || !cu8 || !cs16 || !env || !fm)
+        return 1;
+    baseband_init();
+
+    for (sample_format_t format = SAMPLE_CU8; format <= SAMPLE_CF32; ++format) {
+        char const *name = sample_format_name(format);
+        fill(format, in, n);
+
+        sample_convert_cu8(format, in, cu8, n);
+        sample_convert_cs16(format, in, cs16, n);
+        for (size_t i = 0; i < n; ++i) {
+            if (cu8[i] != ref_cu8(format, in, i) || cs16[i] != ref_cs16(format, in, i)) {
+                fprintf(stderr, "%s: mismatch at %zu\n", name, i);
+                errors++;
+                break;
+            }
+        }
+
+        double start = now();
+        for (int r = 0; r < ROUNDS; ++r)
+            sample_convert_cu8(format, in, cu8, n);
+        double cu8_secs = now() - start;
+
+        start = now();
+        for (int r = 0; r < ROUNDS; ++r)
+            sample_convert_cs16(format, in, cs16, n);
+        double cs16_secs = now() - start;
+
+        DemodFM_State fm_state = {0};
+        start = now();
+        for (int r = 0; r < ROUNDS; ++r) {
+            sample_convert_cu8(format, in, cu8, n);
+            envelope_detect(cu8, env, NUM_SAMPLES);
+            baseband_demod_FM(cu8, fm, NUM_SAMPLES, &fm_state);
+        }
+        double demod_cu8_secs = now() - start;
+
+        fm_state = (DemodFM_State){0};
+        start = now();
+        for (int r = 0; r < ROUNDS; ++r) {
+            sample_convert_cs16(format, in, cs16, n);
+            envelope_detect_cs16(cs16, env, NUM_SAMPLES);
+            baseband_demod_FM_cs16(cs16, fm, NUM_SAMPLES, &fm_state);
+        }
+        double demod_cs16_secs = now() - start;
+
+        double msamples = (double)NUM_SAMPLES * ROUNDS / 1e6;
+        printf("%-5s to cu8 %7.1f MS/s, to cs16 %7.1f MS/s, demod cu8 %6.1f MS/s, demod cs16 %6.1f MS/s\n",
+                name, msamples / cu8_secs, msamples / cs16_secs,
+                msamples / demod_cu8_secs, msamples / demod_cs16_secs);
+    }
+
+    // The 16 bit envelope needs to match the 8 bit scale
+    uint8_t iq8[2] = {255, 128};
+    int16_t iq16[2] = {127 * 256, 0};
+    uint16_t e8, e16;
+    envelope_detect(iq8, &e8, 1);
+    envelope_detect_cs16(iq16, &e16, 1);
+    if (abs(e8 - e16) > e8 / 50) {
+        fprintf(stderr, "envelope scale mismatch: cu8 %u, cs16 %u\n", e8, e16);
+        errors++;
+    }
+
+    free(in);
+    free(cu8);
+    free(cs16);
+    free(env);
+    free(fm);
+    return errors ? 1 : 0;
+}
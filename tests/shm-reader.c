@@ -0,0 +1,80 @@
+/*
+ * Example reader of the shared memory output (-F shm)
+ *
+ * Prints each record as a line on stdout, notes records lost to overruns
+ * on stderr and follows rtl_433 across restarts. While records come in no
+ * syscalls are made, when idle it sleeps for a few milliseconds.
+ *
+ *     rtl_433 -F shm &
+ *     shm-reader [-o] [name]
+ *
+ * -o starts with the oldest records kept instead of the next one written.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shm_ring.h"
+
+#define IDLE_SLEEP_MS 10
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+int main(int argc, char **argv)
+{
+    char const *name = SHM_RING_DEFAULT_NAME;
+    int from_oldest = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0)
+            from_oldest = 1;
+        else if (argv[i][0] != '-')
+            name = argv[i];
+        else {
+            fprintf(stderr, "Usage: %s [-o] [name]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (;;) {
+        shm_ring_reader_t *reader = shm_ring_reader_open(name, from_oldest);
+        if (!reader) {
+            sleep_ms(1000); // no writer yet
+            continue;
+        }
+        fprintf(stderr, "Reading %s\n", name);
+
+        shm_ring_record_t record;
+        int r;
+        while ((r = shm_ring_read(reader, &record)) >= 0) {
+            if (r == 0) {
+                fflush(stdout);
+                sleep_ms(IDLE_SLEEP_MS);
+                continue;
+            }
+            if (record.lost)
+                fprintf(stderr, "%lu records lost\n", (unsigned long)record.lost);
+            fwrite(record.data, 1, record.len, stdout);
+            putchar('\n');
+        }
+        shm_ring_reader_close(reader);
+        fflush(stdout);
+        if (r == SHM_RING_CORRUPT) {
+            fprintf(stderr, "%s is not a valid ring\n", name);
+            return 1;
+        }
+        fprintf(stderr, "%s closed, waiting for the next writer\n", name);
+        from_oldest = 1; // everything the next writer wrote is new
+    }
+}
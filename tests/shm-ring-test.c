@@ -0,0 +1,215 @@
+/*
+ * Test for the shared memory record ring and the shared memory data output
+ *
+ * Reads back records written in the same thread, loses the oldest when the
+ * reader falls behind, and follows a writer thread concurrently, checking
+ * that every record read is complete (no torn copies) and that the records
+ * read plus the records reported lost add up to the records written.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "data.h"
+#include "shm_ring.h"
+#include "test_check.h"
+
+static char ring_name[64];
+
+// A record of 1 to 400 bytes, every byte derived from the seq
+static size_t make_record(uint64_t seq, uint8_t *buf)
+{
+    size_t len = 1 + (seq * 37) % 400;
+    for (size_t i = 0; i < len; ++i)
+        buf[i] = (uint8_t)(seq * 7 + i);
+    return len;
+}
+
+static int check_record(shm_ring_record_t const *record)
+{
+    uint8_t expected[400];
+    size_t len = make_record(record->seq, expected);
+    return record->len == len && memcmp(record->data, expected, len) == 0;
+}
+
+static void test_read_back(void)
+{
+    uint8_t buf[400];
+    shm_ring_record_t record;
+
+    shm_ring_t *ring = shm_ring_create(ring_name, 4096);
+    CHECK(ring);
+    shm_ring_reader_t *reader = shm_ring_reader_open(ring_name, 0);
+    CHECK(reader);
+    CHECK(shm_ring_read(reader, &record) == 0);
+
+    // more than the ring holds in total, read as they come
+    for (uint64_t seq = 0; seq < 100; ++seq) {
+        CHECK(shm_ring_write(ring, buf, make_record(seq, buf)) == 0);
+        CHECK(shm_ring_read(reader, &record) == 1);
+        CHECK(record.seq == seq);
+        CHECK(record.lost == 0);
+        CHECK(check_record(&record));
+    }
+    CHECK(shm_ring_read(reader, &record) == 0);
+    CHECK(shm_ring_write(ring, buf, 3000) == -1); // larger than half the ring
+
+    unsigned long records, dropped;
+    shm_ring_counters(ring, &records, &dropped);
+    CHECK(records == 100);
+    CHECK(dropped == 1);
+
+    // a second reader from the oldest kept
+    shm_ring_reader_t *late = shm_ring_reader_open(ring_name, 1);
+    CHECK(late);
+    int found = 0;
+    uint64_t next = 0;
+    while (shm_ring_read(late, &record) == 1) {
+        CHECK(!found || record.seq == next);
+        CHECK(check_record(&record));
+        next = record.seq + 1;
+        found++;
+    }
+    CHECK(next == 100);
+    CHECK(found > 5 && found < 100);
+
+    // after the writer is done the rest can be read
+    CHECK(shm_ring_write(ring, buf, make_record(100, buf)) == 0);
+    shm_ring_free(ring);
+    CHECK(shm_ring_read(reader, &record) == 1);
+    CHECK(record.seq == 100);
+    CHECK(shm_ring_read(reader, &record) == SHM_RING_CLOSED);
+    shm_ring_reader_close(reader);
+    shm_ring_reader_close(late);
+    CHECK(shm_ring_reader_open(ring_name, 0) == NULL);
+}
+
+// A reader behind by more than the ring size loses the oldest records
+static void test_overrun(void)
+{
+    uint8_t buf[400];
+    shm_ring_record_t record;
+
+    shm_ring_t *ring = shm_ring_create(ring_name, 4096);
+    shm_ring_reader_t *reader = shm_ring_reader_open(ring_name, 0);
+    CHECK(ring && reader);
+    for (uint64_t seq = 0; seq < 1000; ++seq)
+        shm_ring_write(ring, buf, make_record(seq, buf));
+
+    uint64_t read = 0, lost = 0;
+    while (shm_ring_read(reader, &record) == 1) {
+        CHECK(check_record(&record));
+        lost += record.lost;
+        read++;
+    }
+    CHECK(read > 5 && read < 100);
+    CHECK(read + lost == 1000);
+    CHECK(record.seq == 999);
+
+    // a writer replacing the segment closes it for the old readers
+    shm_ring_t *next_ring = shm_ring_create(ring_name, 4096);
+    CHECK(next_ring);
+    CHECK(shm_ring_read(reader, &record) == SHM_RING_CLOSED);
+    shm_ring_reader_close(reader);
+    shm_ring_free(ring);
+    shm_ring_free(next_ring);
+}
+
+typedef struct {
+    shm_ring_t *ring;
+    uint64_t count;
+} writer_arg_t;
+
+static void *writer_thread(void *arg)
+{
+    writer_arg_t *w = arg;
+    uint8_t buf[400];
+    for (uint64_t seq = 0; seq < w->count; ++seq)
+        shm_ring_write(w->ring, buf, make_record(seq, buf));
+    shm_ring_free(w->ring);
+    return NULL;
+}
+
+// The reader copies while the writer overwrites, no record may come out torn
+static void test_concurrent(void)
+{
+    enum { COUNT = 2000000 };
+    shm_ring_record_t record;
+    writer_arg_t w = {shm_ring_create(ring_name, 64 * 1024), COUNT};
+    shm_ring_reader_t *reader = shm_ring_reader_open(ring_name, 1);
+    CHECK(w.ring && reader);
+    pthread_t thread;
+    pthread_create(&thread, NULL, writer_thread, &w);
+
+    uint64_t read = 0, lost = 0, bad = 0, first = 0, last = 0;
+    int r;
+    while ((r = shm_ring_read(reader, &record)) >= 0) {
+        if (r == 0)
+            continue;
+        if (!read)
+            first = record.seq;
+        else if (record.seq <= last)
+            bad++;
+        if (!check_record(&record))
+            bad++;
+        last = record.seq;
+        lost += record.lost;
+        read++;
+    }
+    pthread_join(thread, NULL);
+    shm_ring_reader_close(reader);
+
+    CHECK(r == SHM_RING_CLOSED);
+    CHECK(bad == 0);
+    CHECK(first + read + lost == COUNT);
+    printf("concurrent: %lu records read, %lu lost to overruns\n", (unsigned long)read, (unsigned long)lost);
+}
+
+static void test_data_output(void)
+{
+    shm_ring_record_t record;
+    struct data_output *output = data_output_shm_create(ring_name, 0);
+    CHECK(output);
+    shm_ring_reader_t *reader = shm_ring_reader_open(ring_name, 0);
+    CHECK(reader);
+
+    data_t *data = data_make(
+            "model",         "", DATA_STRING, "Test-sensor",
+            "id",            "", DATA_INT, 42,
+            "temperature_C", "", DATA_DOUBLE, 21.5,
+            NULL);
+    data_output_print(output, data);
+    data_free(data);
+
+    CHECK(shm_ring_read(reader, &record) == 1);
+    char const *expected = "{\"model\" : \"Test-sensor\", \"id\" : 42, \"temperature_C\" : 21.500}";
+    CHECK(record.len == strlen(expected) && memcmp(record.data, expected, record.len) == 0);
+    unsigned long records, dropped;
+    CHECK(data_output_shm_counters(output, &records, &dropped) == 0);
+    CHECK(records == 1 && dropped == 0);
+
+    data_output_free(output);
+    CHECK(shm_ring_read(reader, &record) == SHM_RING_CLOSED);
+    shm_ring_reader_close(reader);
+}
+
+int main(void)
+{
+    snprintf(ring_name, sizeof(ring_name), "/rtl_433-test-%d", (int)getpid());
+
+    test_read_back();
+    test_overrun();
+    test_concurrent();
+    test_data_output();
+
+    return checks_result();
+}
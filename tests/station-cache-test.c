@@ -0,0 +1,132 @@
+/*
+ * Test for the per station state cache
+ *
+ * Feeds records of a few stations through the cache in each emit mode and
+ * checks which are passed on: changed values, repeated frames within the
+ * dedup window, heartbeats of unchanged stations, time fields ignored,
+ * records without a model passed through and the oldest station dropped
+ * when the cache is full.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data.h"
+#include "station_cache.h"
+#include "test_check.h"
+
+// Check a record of the weather station id with the given temperature and time string
+static int check(station_cache_t *cache, int id, double temperature, char const *time_str, double now)
+{
+    data_t *data = data_make(
+            "time",          "", DATA_STRING, time_str,
+            "model",         "", DATA_STRING, "Test-station",
+            "id",            "", DATA_INT, id,
+            "temperature_C", "", DATA_DOUBLE, temperature,
+            "wind",          "", DATA_ARRAY, data_array(2, DATA_DOUBLE, (double[]){1.5, 270.0}),
+            NULL);
+    int r = station_cache_check(cache, data, now);
+    data_free(data);
+    return r;
+}
+
+static void test_full(void)
+{
+    station_cache_t *cache = station_cache_create(STATION_EMIT_FULL, 0, 2.0, 16);
+    CHECK(cache);
+
+    CHECK(check(cache, 1, 20.0, "12:00:00", 0.0) == 1);
+    CHECK(check(cache, 1, 20.0, "12:00:00", 0.1) == 0); // repeats of the transmission
+    CHECK(check(cache, 1, 20.0, "12:00:01", 1.0) == 0); // the time field is ignored
+    CHECK(check(cache, 2, 20.0, "12:00:01", 1.0) == 1); // another station
+    CHECK(check(cache, 1, 20.5, "12:00:01", 1.5) == 1); // changed
+    CHECK(check(cache, 1, 20.5, "12:00:48", 48.0) == 1); // the next report, outside the window
+
+    data_t *stats = data_make("type", "", DATA_STRING, "stats", NULL);
+    CHECK(station_cache_check(cache, stats, 48.0) == 1);
+    CHECK(station_cache_check(cache, stats, 48.0) == 1);
+    data_free(stats);
+
+    station_cache_counters_t c;
+    station_cache_counters(cache, &c);
+    CHECK(c.records == 6);
+    CHECK(c.emitted == 4);
+    CHECK(c.duplicates == 2);
+    CHECK(c.unchanged == 0);
+    CHECK(c.stations == 2);
+    station_cache_free(cache);
+}
+
+static void test_change(void)
+{
+    station_cache_t *cache = station_cache_create(STATION_EMIT_CHANGE, 0, 0, 16);
+    CHECK(cache);
+
+    CHECK(check(cache, 1, 20.0, "12:00:00", 0.0) == 1);
+    for (int i = 1; i < 100; ++i)
+        CHECK(check(cache, 1, 20.0, "12:00:00", i * 48.0) == 0);
+    CHECK(check(cache, 1, 19.9, "13:20:00", 4800.0) == 1);
+    CHECK(check(cache, 1, 19.9, "13:20:48", 4848.0) == 0);
+    CHECK(check(cache, 1, 20.0, "13:21:36", 4896.0) == 1); // back to a previous value is a change too
+
+    station_cache_counters_t c;
+    station_cache_counters(cache, &c);
+    CHECK(c.emitted == 3);
+    CHECK(c.unchanged == 100);
+    station_cache_free(cache);
+}
+
+static void test_heartbeat(void)
+{
+    station_cache_t *cache = station_cache_create(STATION_EMIT_HEARTBEAT, 300.0, 2.0, 16);
+    CHECK(cache);
+
+    int emitted = 0;
+    for (int i = 0; i < 100; ++i) {
+        emitted += check(cache, 1, 20.0, "", i * 48.0);
+        emitted += check(cache, 1, 20.0, "", i * 48.0 + 0.5); // each report seen twice
+    }
+    // at 0, then at the first report at least 300 s after the one before
+    CHECK(emitted == 1 + (99 * 48) / 336);
+    station_cache_counters_t c;
+    station_cache_counters(cache, &c);
+    CHECK(c.duplicates == (unsigned long)emitted); // repeats of those passed on, the others are unchanged
+    CHECK(c.unchanged + c.emitted + c.duplicates == 200);
+    CHECK(check(cache, 1, 21.0, "", 4800.0) == 1);
+    station_cache_free(cache);
+}
+
+// Beyond the limit the station seen longest ago is forgotten, and is new when it comes back
+static void test_eviction(void)
+{
+    station_cache_t *cache = station_cache_create(STATION_EMIT_CHANGE, 0, 0, 2);
+    CHECK(cache);
+
+    CHECK(check(cache, 1, 20.0, "", 0.0) == 1);
+    CHECK(check(cache, 2, 20.0, "", 1.0) == 1);
+    CHECK(check(cache, 1, 20.0, "", 2.0) == 0);
+    CHECK(check(cache, 3, 20.0, "", 3.0) == 1); // replaces 2
+    CHECK(check(cache, 1, 20.0, "", 4.0) == 0);
+    CHECK(check(cache, 2, 20.0, "", 5.0) == 1);
+
+    station_cache_counters_t c;
+    station_cache_counters(cache, &c);
+    CHECK(c.stations == 2);
+    station_cache_free(cache);
+}
+
+int main(void)
+{
+    test_full();
+    test_change();
+    test_heartbeat();
+    test_eviction();
+
+    return checks_result();
+}
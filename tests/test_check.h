@@ -0,0 +1,47 @@
+/*
+ * Checks and timing helpers shared by the tests
+ *
+ * Each test is a plain program: failed checks are counted and reported,
+ * and the test fails if any check failed.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef TESTS_TEST_CHECK_H_
+#define TESTS_TEST_CHECK_H_
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+static int errors;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++errors; } } while (0)
+#define CHECK_NEAR(a, b, eps) do { double a_ = (a), b_ = (b); if (!(fabs(a_ - b_) <= (eps))) { fprintf(stderr, "%s:%d: check failed: %s = %f, expected %f\n", __FILE__, __LINE__, #a, a_, b_); ++errors; } } while (0)
+
+/// Exit status of the test, reports the number of failed checks.
+static inline int checks_result(void)
+{
+    if (errors)
+        fprintf(stderr, "%d checks failed\n", errors);
+    return errors ? 1 : 0;
+}
+
+static inline void sleep_ms(int ms)
+{
+    struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+/// Monotonic time in seconds.
+static inline double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif /* TESTS_TEST_CHECK_H_ */
@@ -0,0 +1,290 @@
+/*
+ * Test for the columnar store and the -F tsdb output
+ *
+ * Appends two series across a day boundary, reopens the store to continue
+ * the blocks, goes back in time, and checks range queries against the rows
+ * written. Then writes records through the data output, checks that many
+ * interleaved series and rows going back in time do not fragment a segment,
+ * and times a query of an hour out of a month of history.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "data.h"
+#include "tsdb.h"
+#include "test_check.h"
+
+#define DAY_MS      86400000LL
+#define T0          (20000 * DAY_MS)    // 2024-10-04
+
+// What a query saw of one series
+typedef struct {
+    char const *series;         // NULL for all
+    unsigned long rows;
+    unsigned long blocks;
+    int64_t first;
+    int64_t last;
+    int in_order;
+    double sum;                 // of the last field
+    int stop_after;             // blocks, 0 to read all
+} seen_t;
+
+static int count_rows(tsdb_rows_t const *rows, void *ctx)
+{
+    seen_t *seen = ctx;
+    if (seen->series && strcmp(rows->series, seen->series))
+        return 0;
+    for (unsigned r = 0; r < rows->rows; ++r) {
+        if (seen->rows && rows->time[r] < seen->last)
+            seen->in_order = 0;
+        if (!seen->rows)
+            seen->first = rows->time[r];
+        seen->last = rows->time[r];
+        seen->rows++;
+        unsigned f = rows->num_fields - 1;
+        if (rows->fields[f].type == TSDB_INT)
+            seen->sum += ((int32_t const *)rows->columns[f])[r];
+        else
+            seen->sum += ((double const *)rows->columns[f])[r];
+    }
+    seen->blocks++;
+    return seen->stop_after && seen->blocks >= (unsigned long)seen->stop_after;
+}
+
+static seen_t query(char const *dir, char const *series, int64_t from_ms, int64_t to_ms)
+{
+    seen_t seen = {0};
+    seen.series = series;
+    seen.in_order = 1;
+    CHECK(tsdb_query(dir, from_ms, to_ms, count_rows, &seen) == 0);
+    return seen;
+}
+
+static void append_reading(tsdb_t *db, char const *series, int64_t time_ms, int id, double temperature)
+{
+    tsdb_field_t fields[] = {
+            {"id", TSDB_INT, {.i = id}},
+            {"temperature_C", TSDB_DOUBLE, {.d = temperature}},
+    };
+    CHECK(tsdb_append(db, series, time_ms, fields, 2) == 0);
+}
+
+static void remove_dir(char const *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    char path[1024];
+    while (d && (entry = readdir(d))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    if (d)
+        closedir(d);
+    rmdir(dir);
+}
+
+static void test_store(char const *dir)
+{
+    tsdb_t *db = tsdb_open(dir);
+    CHECK(db);
+
+    // a reading every minute from 20:00 to 04:00 of the next day, the second series every other minute
+    int64_t start = T0 - 4 * 3600000LL;
+    for (int i = 0; i < 8 * 60; ++i) {
+        append_reading(db, "Acurite tower/A/1234", start + i * 60000LL, 1234, i);
+        if (i % 2 == 0)
+            append_reading(db, "Nexus-TH/2/17", start + i * 60000LL, 17, 1.0);
+    }
+
+    // readable while the writer has the store open
+    seen_t all = query(dir, NULL, INT64_MIN, INT64_MAX);
+    CHECK(all.rows == 8 * 60 + 4 * 60);
+    seen_t acurite = query(dir, "Acurite tower/A/1234", INT64_MIN, INT64_MAX);
+    CHECK(acurite.rows == 8 * 60);
+    CHECK(acurite.in_order);
+    CHECK(acurite.sum == (8 * 60 - 1) * 8 * 60 / 2);
+    unsigned long rows, dropped;
+    tsdb_counters(db, &rows, &dropped);
+    CHECK(rows == 8 * 60 + 4 * 60 && dropped == 0);
+    tsdb_close(db);
+
+    // one segment per day
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/2024-10-03.tsd", dir);
+    CHECK(access(path, R_OK) == 0);
+    snprintf(path, sizeof(path), "%s/2024-10-04.tsd", dir);
+    CHECK(access(path, R_OK) == 0);
+
+    // ranges: from inclusive, to exclusive, across the day boundary
+    seen_t hour = query(dir, "Acurite tower/A/1234", T0 - 1800000LL, T0 + 1800000LL);
+    CHECK(hour.rows == 60);
+    CHECK(hour.first == T0 - 1800000LL && hour.last == T0 + 1740000LL);
+    CHECK(query(dir, "Nexus-TH/2/17", T0, T0 + 60000LL).rows == 1);
+    CHECK(query(dir, "Nexus-TH/2/17", T0 + 60000LL, T0 + 120000LL).rows == 0);
+    CHECK(query(dir, NULL, T0 + 8 * 3600000LL, INT64_MAX).rows == 0);
+    CHECK(query(dir, NULL, T0, T0).rows == 0);
+
+    // a callback can stop the query
+    seen_t some = {0};
+    some.stop_after = 1;
+    CHECK(tsdb_query(dir, INT64_MIN, INT64_MAX, count_rows, &some) == 1);
+    CHECK(some.blocks == 1);
+
+    // reopened, the blocks of the day are continued, going back in time starts a new block
+    db = tsdb_open(dir);
+    CHECK(db);
+    for (int i = 8 * 60; i < 9 * 60; ++i)
+        append_reading(db, "Acurite tower/A/1234", start + i * 60000LL, 1234, 0);
+    append_reading(db, "Acurite tower/A/1234", T0 + 30000LL, 1234, 1000);
+    tsdb_close(db);
+
+    acurite = query(dir, "Acurite tower/A/1234", INT64_MIN, INT64_MAX);
+    CHECK(acurite.rows == 9 * 60 + 1);
+    CHECK(!acurite.in_order);
+    CHECK(acurite.sum == (8 * 60 - 1) * 8 * 60 / 2 + 1000);
+    CHECK(query(dir, "Acurite tower/A/1234", T0, T0 + 60000LL).rows == 2);
+
+    CHECK(tsdb_query("/nonexistent/tsdb", INT64_MIN, INT64_MAX, count_rows, &some) == -1);
+}
+
+static void test_output(char const *dir)
+{
+    struct data_output *output = data_output_tsdb_create(dir);
+    CHECK(output);
+
+    for (int i = 0; i < 10; ++i) {
+        data_t *data = data_make(
+                "time",          "", DATA_STRING, "2024-10-05 12:00:00",
+                "model",         "", DATA_STRING, "Fine Offset WH1080 Weather Station",
+                "id",            "", DATA_INT, 90,
+                "temperature_C", "", DATA_FORMAT, "%.1f C", DATA_DOUBLE, 10.0 + i,
+                "direction_str", "", DATA_STRING, "NW",
+                "direction_deg", "", DATA_STRING, "315",
+                NULL);
+        CHECK(data_output_tsdb_set_time(output, (uint64_t)(T0 + DAY_MS + i * 48000LL) * 1000000) == 0);
+        data_output_print(output, data);
+        data_free(data);
+    }
+    // stats records have no model and are not stored
+    data_t *stats = data_make("count", "", DATA_INT, 1, NULL);
+    data_output_print(output, stats);
+    data_free(stats);
+
+    unsigned long rows, dropped;
+    CHECK(data_output_tsdb_counters(output, &rows, &dropped) == 0);
+    CHECK(rows == 10 && dropped == 0);
+    data_output_free(output);
+
+    seen_t seen = query(dir, "Fine Offset WH1080 Weather Station/90", T0 + DAY_MS, T0 + 2 * DAY_MS);
+    CHECK(seen.rows == 10);
+    CHECK(seen.sum == 315 * 10); // the numeric string is the last column, the other string is left out
+}
+
+static void test_fragmentation(char const *dir)
+{
+    tsdb_t *db = tsdb_open(dir);
+    CHECK(db);
+
+    // more series than TSDB_OPEN_BLOCKS was, interleaved: each keeps growing its blocks
+    char series[1000][32];
+    for (int s = 0; s < 1000; ++s)
+        snprintf(series[s], sizeof(series[s]), "Station/%d", s);
+    for (int i = 0; i < 200; ++i) {
+        for (int s = 0; s < 1000; ++s)
+            append_reading(db, series[s], T0 + 3 * DAY_MS + i * 60000LL, s, 1.0);
+    }
+    // every other row goes back in time, the blocks for them do not grow
+    for (int i = 0; i < 100; ++i)
+        append_reading(db, "Back/1", T0 + 3 * DAY_MS + (i % 2 ? i - 2 : i) * 60000LL, 1, 1.0);
+    tsdb_close(db);
+
+    seen_t all = query(dir, NULL, T0 + 3 * DAY_MS - 120000LL, T0 + 4 * DAY_MS);
+    CHECK(all.rows == 1000 * 200 + 100);
+    seen_t one = query(dir, "Station/999", INT64_MIN, INT64_MAX);
+    CHECK(one.rows == 200 && one.in_order);
+    CHECK(one.blocks == 3); // 64 + 128 + 256 rows
+    seen_t back = query(dir, "Back/1", INT64_MIN, INT64_MAX);
+    CHECK(back.rows == 100);
+    CHECK(back.blocks == 51);
+
+    char path[1024];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/2024-10-07.tsd", dir);
+    CHECK(stat(path, &st) == 0 && st.st_size < 16 * 1024 * 1024);
+}
+
+static int sum_rows(tsdb_rows_t const *rows, void *ctx)
+{
+    *(unsigned long *)ctx += rows->rows;
+    return 0;
+}
+
+static void test_history(char const *dir)
+{
+    tsdb_t *db = tsdb_open(dir);
+    CHECK(db);
+
+    // 30 days of 20 stations reporting every minute
+    int64_t start = T0 + 10 * DAY_MS;
+    char series[20][32];
+    for (int s = 0; s < 20; ++s)
+        snprintf(series[s], sizeof(series[s]), "Station/%d", s);
+    for (int i = 0; i < 30 * 1440; ++i) {
+        for (int s = 0; s < 20; ++s)
+            append_reading(db, series[s], start + i * 60000LL + s * 1000, s, 20.0);
+    }
+    tsdb_close(db);
+
+    struct timespec t0, t1;
+    unsigned long rows = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    CHECK(tsdb_query(dir, start + 15 * DAY_MS, start + 15 * DAY_MS + 3600000LL, sum_rows, &rows) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    CHECK(rows == 20 * 60);
+    fprintf(stderr, "1 hour of %d rows: %lu rows in %.3f ms\n", 30 * 1440 * 20, rows,
+            (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+    rows = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    CHECK(tsdb_query(dir, INT64_MIN, INT64_MAX, sum_rows, &rows) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    CHECK(rows == 30 * 1440 * 20);
+    fprintf(stderr, "all: %lu rows in %.3f ms\n", rows,
+            (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/tsdb-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    test_store(dir);
+    test_output(dir);
+    test_fragmentation(dir);
+    remove_dir(dir);
+
+    if (!mkdtemp(strcpy(dir, "/tmp/tsdb-test-XXXXXX"))) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_history(dir);
+    remove_dir(dir);
+
+    return checks_result();
+}
@@ -0,0 +1,170 @@
+/*
+ * Test for the derived weather metrics
+ *
+ * Feeds a station reporting every 48 seconds through the metrics and
+ * checks the rain totals across a counter wraparound and a reset, the
+ * 10 minute wind average, gust and direction as old reports fall out of
+ * the window, and dew point and wind chill against reference values.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "data.h"
+#include "weather_metrics.h"
+#include "test_check.h"
+
+static char const *model = "Fine Offset WH1080 Weather Station";
+
+// A report as the WH1080 decoder outputs it
+static data_t *report(double temperature, int humidity, double speed, double gust, char const *direction, double rain)
+{
+    return data_make(
+            "time",          "", DATA_STRING, "",
+            "model",         "", DATA_STRING, model,
+            "msg_type",      "", DATA_INT, 0,
+            "id",            "", DATA_INT, 90,
+            "temperature_C", "", DATA_DOUBLE, temperature,
+            "humidity",      "", DATA_INT, humidity,
+            "direction_deg", "", DATA_STRING, direction,
+            "speed",         "", DATA_DOUBLE, speed,
+            "gust",          "", DATA_DOUBLE, gust,
+            "rain",          "", DATA_DOUBLE, rain,
+            NULL);
+}
+
+static data_t *fields;
+
+// Update with a report and keep the derived fields
+static void update(weather_metrics_t *metrics, double now, double temperature, int humidity, double speed, double gust, char const *direction, double rain)
+{
+    data_t *data = report(temperature, humidity, speed, gust, direction, rain);
+    data_free(fields);
+    fields = weather_metrics_update(metrics, data, now);
+    data_free(data);
+}
+
+static int has(char const *key)
+{
+    for (data_t *d = fields; d; d = d->next) {
+        if (!strcmp(d->key, key))
+            return 1;
+    }
+    return 0;
+}
+
+static double value(char const *key)
+{
+    for (data_t *d = fields; d; d = d->next) {
+        if (!strcmp(d->key, key))
+            return d->type == DATA_INT ? *(int *)d->value : *(double *)d->value;
+    }
+    fprintf(stderr, "no field %s\n", key);
+    ++errors;
+    return NAN;
+}
+
+static void test_rain(void)
+{
+    weather_metrics_t *metrics = weather_metrics_create(4);
+    CHECK(metrics);
+
+    update(metrics, 0, 20, 50, 0, 0, "0", 1220.0);
+    CHECK(!has("rain_1h_mm")); // nothing to compare with yet
+    // 0.3 mm every report for 30 minutes, across the wrap at 1228.8 mm
+    double rain = 1220.0;
+    for (int i = 1; i <= 37; ++i) {
+        rain = fmod(rain + 0.3, 4096 * 0.3);
+        update(metrics, i * 48.0, 20, 50, 0, 0, "0", rain);
+    }
+    CHECK(rain < 10);
+    CHECK_NEAR(value("rain_1h_mm"), 37 * 0.3, 1e-6);
+    CHECK_NEAR(value("rain_24h_mm"), 37 * 0.3, 1e-6);
+    // 0.3 mm every 48 s is 22.5 mm/h, measured over the last 9 to 10 minutes
+    CHECK(value("rain_rate_mm_h") > 19.5 && value("rain_rate_mm_h") < 24.0);
+
+    // dry for two hours, the hourly total is back to 0, the daily one is kept
+    for (int i = 38; i <= 190; ++i)
+        update(metrics, i * 48.0, 20, 50, 0, 0, "0", rain);
+    CHECK_NEAR(value("rain_rate_mm_h"), 0, 1e-9);
+    CHECK_NEAR(value("rain_1h_mm"), 0, 1e-9);
+    CHECK_NEAR(value("rain_24h_mm"), 37 * 0.3, 1e-6);
+
+    // a reset of the counter (e.g. new batteries) is not counted as rain
+    update(metrics, 191 * 48.0, 20, 50, 0, 0, "0", 0.0);
+    update(metrics, 192 * 48.0, 20, 50, 0, 0, "0", 0.6);
+    CHECK_NEAR(value("rain_1h_mm"), 0.6, 1e-6);
+    CHECK_NEAR(value("rain_24h_mm"), 37 * 0.3 + 0.6, 1e-6);
+
+    // a day later it is all gone
+    update(metrics, 192 * 48.0 + 86400, 20, 50, 0, 0, "0", 0.6);
+    CHECK_NEAR(value("rain_24h_mm"), 0, 1e-9);
+
+    weather_metrics_free(metrics);
+}
+
+static void test_wind(void)
+{
+    weather_metrics_t *metrics = weather_metrics_create(4);
+    CHECK(metrics);
+
+    // 10 minutes from the north-west at 10 km/h with one 40 km/h gust
+    for (int i = 0; i < 12; ++i)
+        update(metrics, i * 48.0, 20, 50, 10.0, i == 3 ? 40.0 : 15.0, i % 2 ? "270" : "0", 0);
+    CHECK_NEAR(value("wind_avg_10m_kph"), 10.0, 1e-9);
+    CHECK_NEAR(value("gust_max_10m_kph"), 40.0, 1e-9);
+    CHECK_NEAR(value("wind_dir_10m_deg"), 315, 0);
+
+    // then from the south-east at 20 km/h, the old reports fall out of the window
+    for (int i = 12; i < 30; ++i)
+        update(metrics, i * 48.0, 20, 50, 20.0, 25.0, "135", 0);
+    CHECK_NEAR(value("wind_avg_10m_kph"), 20.0, 1e-9);
+    CHECK_NEAR(value("gust_max_10m_kph"), 25.0, 1e-9);
+    CHECK_NEAR(value("wind_dir_10m_deg"), 135, 0);
+
+    // calm, no direction
+    for (int i = 30; i < 50; ++i)
+        update(metrics, i * 48.0, 20, 50, 0.0, 0.0, "135", 0);
+    CHECK_NEAR(value("wind_avg_10m_kph"), 0.0, 1e-9);
+    CHECK(!has("wind_dir_10m_deg"));
+
+    weather_metrics_free(metrics);
+}
+
+static void test_comfort(void)
+{
+    weather_metrics_t *metrics = weather_metrics_create(4);
+    CHECK(metrics);
+
+    update(metrics, 0, 20.0, 50, 3.0, 5.0, "0", 0);
+    CHECK_NEAR(value("dew_point_C"), 9.3, 0.1);
+    CHECK(!has("wind_chill_C")); // too warm, too calm
+
+    update(metrics, 48, -10.0, 80, 30.0, 40.0, "0", 0);
+    CHECK_NEAR(value("dew_point_C"), -12.8, 0.2);
+    CHECK_NEAR(value("wind_chill_C"), -19.5, 0.1);
+
+    // records without weather fields get nothing
+    data_t *data = data_make("model", "", DATA_STRING, model, "id", "", DATA_INT, 90, "hours", "", DATA_INT, 12, NULL);
+    CHECK(weather_metrics_update(metrics, data, 96) == NULL);
+    data_free(data);
+
+    weather_metrics_free(metrics);
+}
+
+int main(void)
+{
+    test_rain();
+    test_wind();
+    test_comfort();
+    data_free(fields);
+
+    return checks_result();
+}
@@ -0,0 +1,438 @@
+/*
+ * Synthetic Fine Offset WH1080/WH3080 I/Q signal generator
+ *
+ * Writes an OOK PWM signal with WH1080 weather, DCF77 time and WH3080
+ * UV/light packets, cycling through the 88/87 bit (weather, time) and
+ * 64/63 bit (UV/light) variants the decoder accepts. The carrier can be
+ * offset, the transmitter clock can drift (all pulse widths scaled) and
+ * white gaussian noise is added for the given SNR (carrier power over
+ * complex noise power). The output format follows the file name
+ * (.cu8, .cs16 or .cf32).
+ *
+ * With -T <rtl_433> it instead writes a cu8 and a cf32 file to a temporary
+ * directory, runs each through the complete rtl_433 pipeline and reports
+ * the decode rate per message type and the samples per second processed.
+ * It fails if less than the minimum rate (-P) decodes, or if anything
+ * decodes that was not sent.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "sample_format.h"
+#include "util.h"
+
+int debug_output = 0;
+float sample_file_pos = -1;
+
+#define SHORT_US 544    // 1 bit
+#define LONG_US 1524    // 0 bit
+#define GAP_US 1036     // fixed gap after each pulse
+#define MIN_SILENCE_US 20000 // packets closer than this would merge
+#define LEAD_IN_US 100000 // noise only, lets the level estimate settle
+#define BLOCK_SAMPLES 16384
+
+enum { MSG_WEATHER, MSG_TIME, MSG_UV, MSG_TYPES };
+static char const *msg_names[MSG_TYPES] = {"weather", "time", "uv"};
+
+typedef struct {
+    unsigned samp_rate;
+    unsigned packets;
+    double packet_rate;     // packets per second
+    double snr_db;
+    double freq_offset;     // Hz
+    double drift_ppm;       // transmitter clock error
+    char types[MSG_TYPES + 1]; // w, t, u in the order sent
+    unsigned station_id;
+    uint64_t seed;
+} gen_opts_t;
+
+typedef struct {
+    gen_opts_t const *opts;
+    sample_format_t format;
+    FILE *file;
+    float *iq;              // cf32 block
+    void *out;              // block in the output format
+    unsigned fill;          // samples in the block
+    double time;            // in samples, fractional
+    uint64_t written;       // samples
+    double phase;
+    double phase_inc;
+    double amplitude;
+    double sigma;           // noise per I and Q
+    uint64_t rng_state;
+    unsigned sent[MSG_TYPES];
+} gen_t;
+
+static uint64_t rng(gen_t *g)
+{
+    // xorshift64, the same signal for the same seed everywhere
+    g->rng_state ^= g->rng_state << 13;
+    g->rng_state ^= g->rng_state >> 7;
+    g->rng_state ^= g->rng_state << 17;
+    return g->rng_state;
+}
+
+static double gauss(gen_t *g)
+{
+    // Box-Muller, one of the pair is enough here
+    double u1 = ((rng(g) >> 11) + 1.0) / 9007199254740993.0;
+    double u2 = (rng(g) >> 11) / 9007199254740992.0;
+    return sqrt(-2.0 * log(u1)) * cos(2 * 3.14159265358979 * u2);
+}
+
+static int flush_block(gen_t *g)
+{
+    size_t n = 2 * g->fill;
+    void const *buf = g->iq;
+    if (g->format == SAMPLE_CU8) {
+        sample_convert_cu8(SAMPLE_CF32, g->iq, g->out, n);
+        buf = g->out;
+    } else if (g->format == SAMPLE_CS16) {
+        sample_convert_cs16(SAMPLE_CF32, g->iq, g->out, n);
+        buf = g->out;
+    }
+    if (fwrite(buf, sample_format_size(g->format), n, g->file) != n) {
+        fprintf(stderr, "Failed to write samples\n");
+        return -1;
+    }
+    g->written += g->fill;
+    g->fill = 0;
+    return 0;
+}
+
+// Append carrier (on) or silence for a duration in us, plus noise
+static int emit(gen_t *g, int on, double us)
+{
+    double end = g->time + us * g->opts->samp_rate / 1e6;
+    uint64_t n = (uint64_t)(end + 0.5) - (uint64_t)(g->time + 0.5);
+    g->time = end;
+
+    for (uint64_t i = 0; i < n; ++i) {
+        float *s = &g->iq[2 * g->fill];
+        s[0] = s[1] = 0;
+        if (on) {
+            s[0] = g->amplitude * cos(g->phase);
+            s[1] = g->amplitude * sin(g->phase);
+        }
+        if (g->sigma > 0) {
+            s[0] += g->sigma * gauss(g);
+            s[1] += g->sigma * gauss(g);
+        }
+        // keep the carrier phase continuous across pulses
+        g->phase += g->phase_inc;
+        if (g->phase > 2 * 3.14159265358979)
+            g->phase -= 2 * 3.14159265358979;
+        if (++g->fill == BLOCK_SAMPLES && flush_block(g) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static uint8_t bcd(unsigned v)
+{
+    return (uint8_t)((v / 10) << 4 | v % 10);
+}
+
+// Build packet number seq, returns the length in bytes including preamble and CRC
+static unsigned make_packet(gen_opts_t const *opts, int type, unsigned seq, uint8_t *b)
+{
+    unsigned id = opts->station_id & 0xff;
+    memset(b, 0, 11);
+    b[0] = 0xff;
+    if (type == MSG_UV) {
+        unsigned light = (seq * 2731) % 0x1000000;
+        b[1] = 0x70 | id >> 4;
+        b[2] = (uint8_t)((id & 0xf) << 4 | seq % 16); // UV index
+        b[3] = 85; // status OK
+        b[4] = (uint8_t)(light >> 16);
+        b[5] = (uint8_t)(light >> 8);
+        b[6] = (uint8_t)light;
+        b[7] = crc8(b, 7, 0x31, 0xff);
+        return 8;
+    }
+
+    if (type == MSG_WEATHER) {
+        unsigned temp = 0x190 + (seq * 7) % 500 - 100; // -10.0 C to 39.9 C
+        unsigned rain = (seq * 3) % 0x1000;
+        b[1] = 0xa0 | id >> 4;
+        b[2] = (uint8_t)((id & 0xf) << 4 | temp >> 8);
+        b[3] = (uint8_t)temp;
+        b[4] = 20 + seq % 80; // humidity
+        b[5] = seq % 40; // wind average
+        b[6] = seq % 40 + seq % 7; // gust
+        b[7] = (uint8_t)(rain >> 8);
+        b[8] = (uint8_t)rain;
+        b[9] = seq % 16; // battery OK, direction
+    } else {
+        unsigned secs = seq * 48;
+        b[1] = 0xb0 | id >> 4;
+        b[2] = (uint8_t)((id & 0xf) << 4 | 10); // DCF77
+        b[3] = bcd(secs / 3600 % 24);
+        b[4] = bcd(secs / 60 % 60);
+        b[5] = bcd(secs % 60);
+        b[6] = bcd(18);
+        b[7] = bcd(1 + seq / 28 % 12);
+        b[8] = bcd(1 + seq % 28);
+    }
+    b[10] = crc8(b, 10, 0x31, 0xff);
+    return 11;
+}
+
+static int send_packet(gen_t *g, int type, unsigned seq)
+{
+    uint8_t b[11];
+    unsigned len = make_packet(g->opts, type, seq, b);
+    // every other packet of a type has the 7 bit preamble (87 or 63 bits)
+    unsigned first_bit = (seq / strlen(g->opts->types)) % 2;
+    double scale = 1.0 + g->opts->drift_ppm * 1e-6;
+
+    g->phase = (rng(g) >> 11) / 9007199254740992.0 * 2 * 3.14159265358979;
+    for (unsigned i = first_bit; i < len * 8; ++i) {
+        int bit = (b[i / 8] >> (7 - i % 8)) & 1;
+        if (emit(g, 1, (bit ? SHORT_US : LONG_US) * scale) < 0
+                || (i < len * 8 - 1 && emit(g, 0, GAP_US * scale) < 0))
+            return -1;
+    }
+    g->sent[type]++;
+    return 0;
+}
+
+static int msg_type(char c)
+{
+    return c == 'w' ? MSG_WEATHER : c == 't' ? MSG_TIME : c == 'u' ? MSG_UV : -1;
+}
+
+/// Write the signal to file, returns the number of samples or 0 on error
+static uint64_t generate(gen_opts_t const *opts, char const *filename, unsigned sent[MSG_TYPES])
+{
+    gen_t g = {0};
+    g.opts = opts;
+    g.format = sample_format_from_filename(filename);
+    if (g.format == SAMPLE_CS8) {
+        fprintf(stderr, "Output format cs8 is not supported, use cu8, cs16 or cf32\n");
+        return 0;
+    }
+    g.file = fopen(filename, "wb");
+    g.iq = malloc(2 * BLOCK_SAMPLES * sizeof(float));
+    g.out = malloc(2 * BLOCK_SAMPLES * sizeof(int16_t));
+    if (!g.file || !g.iq || !g.out) {
+        fprintf(stderr, "Failed to create %s\n", filename);
+        free(g.iq);
+        free(g.out);
+        if (g.file)
+            fclose(g.file);
+        return 0;
+    }
+    g.amplitude = 0.5;
+    g.sigma = opts->snr_db >= 100 ? 0 : g.amplitude / sqrt(2 * pow(10, opts->snr_db / 10));
+    g.phase_inc = 2 * 3.14159265358979 * opts->freq_offset / opts->samp_rate;
+    g.rng_state = opts->seed ? opts->seed : 1;
+
+    int err = emit(&g, 0, LEAD_IN_US);
+    double period_us = 1e6 / opts->packet_rate;
+    unsigned num_types = strlen(opts->types);
+    for (unsigned i = 0; i < opts->packets && !err; ++i) {
+        double start = g.time;
+        err = send_packet(&g, msg_type(opts->types[i % num_types]), i);
+        double used_us = (g.time - start) * 1e6 / opts->samp_rate;
+        double silence_us = period_us - used_us;
+        if (!err)
+            err = emit(&g, 0, silence_us < MIN_SILENCE_US ? MIN_SILENCE_US : silence_us);
+    }
+    if (!err && g.fill)
+        err = flush_block(&g);
+
+    if (fclose(g.file) != 0 && !err) {
+        fprintf(stderr, "Failed to write %s\n", filename);
+        err = -1;
+    }
+    free(g.iq);
+    free(g.out);
+    memcpy(sent, g.sent, sizeof(g.sent));
+    return err ? 0 : g.written;
+}
+
+/// Count decoded records per message type from rtl_433 JSON output, returns the other lines
+static int count_decodes(FILE *in, unsigned station_id, unsigned decoded[MSG_TYPES])
+{
+    char line[1024];
+    int bad = 0;
+    while (fgets(line, sizeof(line), in)) {
+        char const *p = strstr(line, "\"msg_type\" : ");
+        char const *id = strstr(line, "id\" : "); // "id" and "uv_sensor_id"
+        int type = p ? atoi(p + 13) : -1;
+        if (type < 0 || type >= MSG_TYPES || !id || (unsigned)atoi(id + 6) != station_id) {
+            fprintf(stderr, "unexpected: %s", line);
+            bad++;
+            continue;
+        }
+        decoded[type]++;
+    }
+    return bad;
+}
+
+/// Generate cu8 and cf32 files, decode them with rtl_433, returns the number of failures
+static int pipeline_test(gen_opts_t const *opts, char const *rtl_433, double min_rate)
+{
+    static char const *formats[] = {"cu8", "cf32"};
+    char dir[] = "/tmp/wh1080-gen-XXXXXX";
+    char filename[64];
+    char cmd[1024];
+    int failures = 0;
+
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "Failed to create a temporary directory\n");
+        return 1;
+    }
+    for (unsigned f = 0; f < sizeof(formats) / sizeof(*formats); ++f) {
+        unsigned sent[MSG_TYPES], decoded[MSG_TYPES] = {0};
+        snprintf(filename, sizeof(filename), "%s/signal.%s", dir, formats[f]);
+        uint64_t samples = generate(opts, filename, sent);
+        if (!samples) {
+            failures++;
+            continue;
+        }
+
+        // only the WH1080 decoder, XC0400 shares the callback and would report everything twice
+        snprintf(cmd, sizeof(cmd), "'%s' -q -s %u -R 1 -F json -r '%s' 2>/dev/null", rtl_433, opts->samp_rate, filename);
+        uint64_t start = monotonic_ns();
+        FILE *p = popen(cmd, "r");
+        if (!p) {
+            fprintf(stderr, "Failed to run %s\n", rtl_433);
+            remove(filename);
+            failures++;
+            continue;
+        }
+        int bad = count_decodes(p, opts->station_id & 0xff, decoded);
+        int status = pclose(p);
+        double secs = (monotonic_ns() - start) / 1e9;
+        remove(filename);
+
+        unsigned total_sent = 0, total_decoded = 0;
+        printf("%-5s snr %.1f dB:", formats[f], opts->snr_db);
+        for (int t = 0; t < MSG_TYPES; ++t) {
+            if (!sent[t])
+                continue;
+            printf(" %s %u/%u", msg_names[t], decoded[t], sent[t]);
+            total_sent += sent[t];
+            total_decoded += decoded[t];
+            if (decoded[t] > sent[t])
+                bad++;
+        }
+        double rate = total_sent ? 100.0 * total_decoded / total_sent : 0;
+        printf(", decoded %.1f %%, %llu samples in %.3f s, %.2f MS/s\n",
+                rate, (unsigned long long)samples, secs, samples / secs / 1e6);
+
+        if (status != 0) {
+            fprintf(stderr, "%s exited with status %d\n", rtl_433, status);
+            failures++;
+        }
+        if (bad || rate < min_rate)
+            failures++;
+    }
+    rmdir(dir);
+    return failures;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: wh1080-gen [options] <file.cu8|file.cs16|file.cf32>\n"
+            "       wh1080-gen [options] -T <path to rtl_433>\n"
+            "\t-s  sample rate (default: 250000)\n"
+            "\t-n  number of packets (default: 60)\n"
+            "\t-p  packets per second (default: 4)\n"
+            "\t-S  SNR in dB, 100 or more for no noise (default: 20)\n"
+            "\t-f  carrier frequency offset in Hz (default: 10000)\n"
+            "\t-d  transmitter clock drift in ppm (default: 0)\n"
+            "\t-m  message types sent in turn, w=weather t=time u=UV/light (default: wtu)\n"
+            "\t-i  station id, 0-255 (default: 90)\n"
+            "\t-r  random seed (default: 1)\n"
+            "\t-T  decode the signal with rtl_433 and report decode rate and throughput\n"
+            "\t-P  with -T, minimum decode rate in percent (default: 95)\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    gen_opts_t opts = {
+        .samp_rate = 250000,
+        .packets = 60,
+        .packet_rate = 4,
+        .snr_db = 20,
+        .freq_offset = 10000,
+        .drift_ppm = 0,
+        .types = "wtu",
+        .station_id = 90,
+        .seed = 1,
+    };
+    char const *rtl_433 = NULL;
+    double min_rate = 95;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:p:S:f:d:m:i:r:T:P:")) != -1) {
+        switch (opt) {
+        case 's':
+            opts.samp_rate = atoi(optarg);
+            break;
+        case 'n':
+            opts.packets = atoi(optarg);
+            break;
+        case 'p':
+            opts.packet_rate = atof(optarg);
+            break;
+        case 'S':
+            opts.snr_db = atof(optarg);
+            break;
+        case 'f':
+            opts.freq_offset = atof(optarg);
+            break;
+        case 'd':
+            opts.drift_ppm = atof(optarg);
+            break;
+        case 'm':
+            if (!*optarg || strlen(optarg) > MSG_TYPES || strspn(optarg, "wtu") != strlen(optarg))
+                usage();
+            strcpy(opts.types, optarg);
+            break;
+        case 'i':
+            opts.station_id = atoi(optarg);
+            break;
+        case 'r':
+            opts.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'T':
+            rtl_433 = optarg;
+            break;
+        case 'P':
+            min_rate = atof(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (opts.samp_rate < 50000 || opts.packet_rate <= 0 || opts.station_id > 255
+            || opts.drift_ppm <= -1e6 || (!rtl_433 && optind != argc - 1))
+        usage();
+
+    if (rtl_433)
+        return pipeline_test(&opts, rtl_433, min_rate) ? 1 : 0;
+
+    unsigned sent[MSG_TYPES];
+    uint64_t samples = generate(&opts, argv[optind], sent);
+    if (!samples)
+        return 1;
+    fprintf(stderr, "%s: %u weather, %u time, %u UV/light packets, %llu samples (%.1f s)\n",
+            argv[optind], sent[MSG_WEATHER], sent[MSG_TIME], sent[MSG_UV],
+            (unsigned long long)samples, (double)samples / opts.samp_rate);
+    return 0;
+}